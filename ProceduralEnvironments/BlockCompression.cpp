@@ -0,0 +1,308 @@
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	/** Appends bit fields least significant bit first, the order every BC format uses */
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* data, size_t bytes) : data(data)
+		{
+			memset(data, 0, bytes);
+		}
+
+		void write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t i = 0; i < bits; i++, position++)
+			{
+				if (value & (1u << i))
+				{
+					data[position >> 3] |= static_cast<uint8_t>(1u << (position & 7));
+				}
+			}
+		}
+
+	private:
+		uint8_t* data;
+		uint32_t position = 0;
+	};
+
+	// BC7 interpolation weights for 4 bit indices, out of 64
+	constexpr std::array<int, 16> bc7Weights = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct Bc7Fit {
+		std::array<uint8_t, 4> endpoints[2]{}; // 7 bit per channel
+		uint32_t pbits[2]{};
+		std::array<uint8_t, 16> indices{};
+		uint64_t error = UINT64_MAX;
+	};
+
+	/** Quantize both endpoints for one p-bit combination and pick the closest palette entry per texel */
+	Bc7Fit fitBC7(const uint8_t texels[64], const float endpoints[2][4], uint32_t p0, uint32_t p1)
+	{
+		Bc7Fit fit;
+		fit.pbits[0] = p0;
+		fit.pbits[1] = p1;
+
+		int expanded[2][4];
+		for (int e = 0; e < 2; e++)
+		{
+			const uint32_t p = fit.pbits[e];
+			for (int c = 0; c < 4; c++)
+			{
+				int q = static_cast<int>(std::lround((endpoints[e][c] - p) * 0.5f));
+				q = std::clamp(q, 0, 127);
+				fit.endpoints[e][c] = static_cast<uint8_t>(q);
+				expanded[e][c] = (q << 1) | static_cast<int>(p);
+			}
+		}
+
+		int palette[16][4];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				palette[i][c] = ((64 - bc7Weights[i]) * expanded[0][c] + bc7Weights[i] * expanded[1][c] + 32) >> 6;
+			}
+		}
+
+		fit.error = 0;
+		for (int t = 0; t < 16; t++)
+		{
+			uint32_t bestError = UINT32_MAX;
+			for (int i = 0; i < 16; i++)
+			{
+				uint32_t error = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					int d = palette[i][c] - texels[t * 4 + c];
+					error += static_cast<uint32_t>(d * d);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					fit.indices[t] = static_cast<uint8_t>(i);
+				}
+			}
+			fit.error += bestError;
+		}
+		return fit;
+	}
+
+	Bc7Fit fitBC7AllPBits(const uint8_t texels[64], const float endpoints[2][4])
+	{
+		Bc7Fit best;
+		for (uint32_t p = 0; p < 4; p++)
+		{
+			Bc7Fit fit = fitBC7(texels, endpoints, p & 1, p >> 1);
+			if (fit.error < best.error)
+			{
+				best = fit;
+			}
+		}
+		return best;
+	}
+}
+
+void bc::encodeBC4Block(const uint8_t texels[64], uint32_t channel, uint8_t* block)
+{
+	uint8_t values[16];
+	uint8_t high = 0;
+	uint8_t low = 255;
+	for (int t = 0; t < 16; t++)
+	{
+		values[t] = texels[t * 4 + channel];
+		high = std::max(high, values[t]);
+		low = std::min(low, values[t]);
+	}
+
+	// high > low selects the 8 value mode, a flat block only ever uses index 0
+	int palette[8];
+	palette[0] = high;
+	palette[1] = low;
+	for (int i = 2; i < 8; i++)
+	{
+		palette[i] = ((8 - i) * high + (i - 1) * low + 3) / 7;
+	}
+
+	BitWriter writer(block, 8);
+	writer.write(high, 8);
+	writer.write(low, 8);
+	for (int t = 0; t < 16; t++)
+	{
+		uint32_t bestIndex = 0;
+		int bestError = INT32_MAX;
+		for (uint32_t i = 0; i < 8 && high != low; i++)
+		{
+			int error = std::abs(palette[i] - values[t]);
+			if (error < bestError)
+			{
+				bestError = error;
+				bestIndex = i;
+			}
+		}
+		writer.write(bestIndex, 3);
+	}
+}
+
+void bc::encodeBC5Block(const uint8_t texels[64], uint8_t* block)
+{
+	encodeBC4Block(texels, 0, block);
+	encodeBC4Block(texels, 1, block + 8);
+}
+
+void bc::encodeBC7Block(const uint8_t texels[64], uint8_t* block)
+{
+	float mean[4] = {};
+	for (int t = 0; t < 16; t++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			mean[c] += texels[t * 4 + c] / 16.0f;
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (int t = 0; t < 16; t++)
+	{
+		float d[4];
+		for (int c = 0; c < 4; c++)
+		{
+			d[c] = texels[t * 4 + c] - mean[c];
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				covariance[i][j] += d[i] * d[j];
+			}
+		}
+	}
+
+	// principal axis by power iteration, seeded with the per channel variance
+	float axis[4];
+	for (int c = 0; c < 4; c++)
+	{
+		axis[c] = covariance[c][c];
+	}
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				next[i] += covariance[i][j] * axis[j];
+			}
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (length < 1e-6f)
+		{
+			break;
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+	float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+	if (axisLength < 1e-6f)
+	{
+		axis[0] = axis[1] = axis[2] = axis[3] = 0.5f;
+	}
+	else
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			axis[c] /= axisLength;
+		}
+	}
+
+	float minProjection = FLT_MAX;
+	float maxProjection = -FLT_MAX;
+	for (int t = 0; t < 16; t++)
+	{
+		float projection = 0.0f;
+		for (int c = 0; c < 4; c++)
+		{
+			projection += (texels[t * 4 + c] - mean[c]) * axis[c];
+		}
+		minProjection = std::min(minProjection, projection);
+		maxProjection = std::max(maxProjection, projection);
+	}
+
+	float endpoints[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		endpoints[0][c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+		endpoints[1][c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+	}
+
+	Bc7Fit best = fitBC7AllPBits(texels, endpoints);
+
+	// least squares endpoints for the chosen indices, kept only when they lower the error
+	if (best.error > 0)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int t = 0; t < 16; t++)
+		{
+			float w = bc7Weights[best.indices[t]] / 64.0f;
+			aa += (1.0f - w) * (1.0f - w);
+			ab += (1.0f - w) * w;
+			bb += w * w;
+			for (int c = 0; c < 4; c++)
+			{
+				ax[c] += (1.0f - w) * texels[t * 4 + c];
+				bx[c] += w * texels[t * 4 + c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::abs(determinant) > 1e-6f)
+		{
+			float refined[2][4];
+			for (int c = 0; c < 4; c++)
+			{
+				refined[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+				refined[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+			}
+			Bc7Fit fit = fitBC7AllPBits(texels, refined);
+			if (fit.error < best.error)
+			{
+				best = fit;
+			}
+		}
+	}
+
+	// the anchor texel stores its index with the top bit implied as 0
+	if (best.indices[0] >= 8)
+	{
+		std::swap(best.endpoints[0], best.endpoints[1]);
+		std::swap(best.pbits[0], best.pbits[1]);
+		for (uint8_t& index : best.indices)
+		{
+			index = static_cast<uint8_t>(15 - index);
+		}
+	}
+
+	BitWriter writer(block, 16);
+	writer.write(1u << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		writer.write(best.endpoints[0][c], 7);
+		writer.write(best.endpoints[1][c], 7);
+	}
+	writer.write(best.pbits[0], 1);
+	writer.write(best.pbits[1], 1);
+	writer.write(best.indices[0], 3);
+	for (int t = 1; t < 16; t++)
+	{
+		writer.write(best.indices[t], 4);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+* CPU encoders for the block compressed formats written by the texture baker.
+* Every encoder takes one 4x4 block of RGBA8 texels, row by row, and writes one compressed block.
+*/
+namespace bc
+{
+	/** @brief 8 bytes, a single channel (0 = red .. 3 = alpha) with 8 interpolated values */
+	void encodeBC4Block(const uint8_t texels[64], uint32_t channel, uint8_t* block);
+
+	/** @brief 16 bytes, red and green as two BC4 blocks */
+	void encodeBC5Block(const uint8_t texels[64], uint8_t* block);
+
+	/**
+	* @brief 16 bytes, mode 6 only: one subset with RGBA endpoints and 16 interpolated colors.
+	* Endpoints are fitted along the principal axis of the block and refined once by least squares.
+	*/
+	void encodeBC7Block(const uint8_t texels[64], uint8_t* block);
+}
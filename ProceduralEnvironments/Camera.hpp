@@ -115,14 +115,36 @@ public:
 	}
 	glm::mat4 getProjectionMatrix() const
 	{
+		if (reverseZ)
+		{
+			// near maps to depth 1 and far to 0, which spreads the float precision evenly over the distance
+			return glm::perspective(glm::radians(fov), aspectRatio, far, near);
+		}
 		return glm::perspective(glm::radians(fov), aspectRatio, near, far);
 	}
 
+	void setReverseZ(bool reverseZ)
+	{
+		this->reverseZ = reverseZ;
+	}
+	bool isReverseZ() const
+	{
+		return reverseZ;
+	}
+
 	void setAspectRatio(float aspectRatio)
 	{
 		this->aspectRatio = aspectRatio;
 	}
 
+	void setView(glm::vec3 position, float yaw, float pitch)
+	{
+		this->position = position;
+		this->yaw = yaw;
+		this->pitch = pitch;
+		updateCameraVectors();
+	}
+
 private:
 	glm::vec3 position;
 	glm::vec3 front;
@@ -140,6 +162,7 @@ private:
 	float aspectRatio;
 	float near;
 	float far;
+	bool reverseZ = false;
 
 	void updateCameraVectors()
 	{
@@ -0,0 +1,82 @@
+#include "DeletionQueue.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+DeletionQueue::DeletionQueue(VkDevice device) :
+	device(device)
+{
+}
+
+DeletionQueue::~DeletionQueue()
+{
+	flush();
+}
+
+void DeletionQueue::retire(uint64_t frame, DestroyFn destroy)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.push_back({ VK_NULL_HANDLE, frame, std::move(destroy) });
+}
+
+void DeletionQueue::retire(VkSemaphore timeline, uint64_t value, DestroyFn destroy)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.push_back({ timeline, value, std::move(destroy) });
+}
+
+void DeletionQueue::collect(uint64_t completedFrameCount)
+{
+	std::vector<Entry> completed;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// frame slots are waited on out of order after the frame count changed, never step back
+		completedFrames = std::max(completedFrames, completedFrameCount);
+
+		// one query per semaphore, not per entry
+		std::unordered_map<VkSemaphore, uint64_t> timelineValues;
+		for (const Entry& entry : entries)
+		{
+			if (entry.timeline != VK_NULL_HANDLE && timelineValues.find(entry.timeline) == timelineValues.end())
+			{
+				uint64_t value = 0;
+				vkGetSemaphoreCounterValue(device, entry.timeline, &value);
+				timelineValues[entry.timeline] = value;
+			}
+		}
+
+		auto firstCompleted = std::stable_partition(entries.begin(), entries.end(), [&](const Entry& entry) {
+			return entry.timeline == VK_NULL_HANDLE ? entry.value >= completedFrames : entry.value > timelineValues[entry.timeline];
+		});
+		completed.assign(std::make_move_iterator(firstCompleted), std::make_move_iterator(entries.end()));
+		entries.erase(firstCompleted, entries.end());
+	}
+	// outside the lock, a callback may retire further objects
+	run(completed);
+}
+
+void DeletionQueue::flush()
+{
+	std::vector<Entry> all;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		all.swap(entries);
+	}
+	run(all);
+}
+
+size_t DeletionQueue::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+void DeletionQueue::run(std::vector<Entry>& completed)
+{
+	// in the order they were retired
+	for (Entry& entry : completed)
+	{
+		entry.destroy();
+	}
+	completed.clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+* Destroys Vulkan objects once the GPU work that may still use them has completed, so replacing a resource never
+* needs the device to go idle.
+* Entries are tagged either with the number of the last frame that may use them, which the owner of the frame loop
+* reports as completed through collect(), or with a timeline semaphore value, which collect() polls.
+* Callbacks run on the thread calling collect() or flush(), retiring is allowed from any thread.
+*/
+class DeletionQueue
+{
+public:
+	using DestroyFn = std::function<void()>;
+
+	explicit DeletionQueue(VkDevice device);
+	~DeletionQueue();
+
+	DeletionQueue(const DeletionQueue&) = delete;
+	DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+	/** @brief Run destroy once frame has completed. Pass the current frame number for objects it may still use */
+	void retire(uint64_t frame, DestroyFn destroy);
+
+	/** @brief Run destroy once timeline has reached value */
+	void retire(VkSemaphore timeline, uint64_t value, DestroyFn destroy);
+
+	/** @brief Run every callback whose work completed, frames below completedFrameCount have finished */
+	void collect(uint64_t completedFrameCount);
+
+	/** @brief Run every callback regardless of its tag, the device must be idle */
+	void flush();
+
+	size_t size() const;
+
+private:
+	struct Entry {
+		VkSemaphore timeline; // VK_NULL_HANDLE for frame tagged entries
+		uint64_t value;
+		DestroyFn destroy;
+	};
+
+	void run(std::vector<Entry>& completed);
+
+	VkDevice device;
+	mutable std::mutex mutex;
+	std::vector<Entry> entries;
+	uint64_t completedFrames = 0;
+};
@@ -0,0 +1,448 @@
+#include "DrainageAnalysis.h"
+
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+
+namespace
+{
+	// the donor count of a cell that no neighbour drains into, walks of the accumulation start there. Never
+	// decremented, so it stays apart from the cells whose donors all delivered
+	const uint8_t SOURCE = 0x80;
+
+	const float DIAGONAL_DISTANCE = 1.41421356f;
+
+	// row chunks per worker, the accumulation walks vary a lot in length between rows
+	const uint32_t CHUNKS_PER_THREAD = 8;
+
+	// synthetic terrain of the benchmark
+	const uint32_t BENCHMARK_OCTAVES = 6;
+	const float BENCHMARK_FREQUENCY = 8.0f; // lattice cells of the first octave per side
+	const uint32_t BENCHMARK_SEED = 1337;
+
+	float millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/** @brief Run body(firstRow, endRow) over chunks of rows on the pool and wait for all of them */
+	template<typename F>
+	void parallelRows(ThreadPool& threadPool, uint32_t rows, const F& body)
+	{
+		const uint32_t chunks = std::min(rows, threadPool.getThreadCount() * CHUNKS_PER_THREAD);
+		if (chunks <= 1)
+		{
+			body(0u, rows);
+			return;
+		}
+
+		std::vector<std::future<void>> futures;
+		futures.reserve(chunks);
+		for (uint32_t chunk = 0; chunk < chunks; chunk++)
+		{
+			const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(rows) * chunk / chunks);
+			const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(rows) * (chunk + 1) / chunks);
+			futures.push_back(threadPool.submit([&body, first, end]() { body(first, end); }));
+		}
+		// every chunk references body, so all of them finish before a failure is rethrown
+		for (std::future<void>& future : futures)
+		{
+			future.wait();
+		}
+		for (std::future<void>& future : futures)
+		{
+			future.get();
+		}
+	}
+
+	/**
+	* @brief Priority flood with an epsilon raise (Barnes et al. 2014): cells are flooded from the edge in order of
+	* height, a cell not above the one it was reached from is raised just above it and continues from a FIFO, so
+	* every flooded cell keeps a strictly lower path to the edge. Sequential, the flood order is global
+	*/
+	uint32_t fillDepressions(std::vector<float>& heights, uint32_t size)
+	{
+		using Entry = std::pair<float, uint32_t>;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+		std::queue<uint32_t> pit;
+		std::vector<uint8_t> closed(static_cast<size_t>(size) * size, 0);
+
+		auto close = [&](uint32_t x, uint32_t y) {
+			const uint32_t cell = y * size + x;
+			if (!closed[cell])
+			{
+				closed[cell] = 1;
+				open.emplace(heights[cell], cell);
+			}
+		};
+		for (uint32_t i = 0; i < size; i++)
+		{
+			close(i, 0);
+			close(i, size - 1);
+			close(0, i);
+			close(size - 1, i);
+		}
+
+		uint32_t filled = 0;
+		while (!open.empty() || !pit.empty())
+		{
+			uint32_t cell;
+			if (!pit.empty())
+			{
+				cell = pit.front();
+				pit.pop();
+			}
+			else
+			{
+				cell = open.top().second;
+				open.pop();
+			}
+
+			const int32_t x = static_cast<int32_t>(cell % size);
+			const int32_t y = static_cast<int32_t>(cell / size);
+			const float raised = std::nextafter(heights[cell], std::numeric_limits<float>::infinity());
+			for (uint32_t d = 0; d < 8; d++)
+			{
+				const int32_t nx = x + DrainageAnalysis::DIRECTION_X[d];
+				const int32_t ny = y + DrainageAnalysis::DIRECTION_Y[d];
+				if (nx < 0 || ny < 0 || nx >= static_cast<int32_t>(size) || ny >= static_cast<int32_t>(size))
+				{
+					continue;
+				}
+				const uint32_t neighbour = static_cast<uint32_t>(ny) * size + static_cast<uint32_t>(nx);
+				if (closed[neighbour])
+				{
+					continue;
+				}
+				closed[neighbour] = 1;
+				if (heights[neighbour] <= raised)
+				{
+					heights[neighbour] = raised;
+					pit.push(neighbour);
+					filled++;
+				}
+				else
+				{
+					open.emplace(heights[neighbour], neighbour);
+				}
+			}
+		}
+		return filled;
+	}
+
+	/** @brief Hash of a lattice point to [0, 1) */
+	float latticeValue(int32_t x, int32_t y, uint32_t seed)
+	{
+		uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u ^ seed * 0xcb1ab31fu;
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+		return static_cast<float>(h >> 8) * (1.0f / 16777216.0f);
+	}
+
+	float valueNoise(float x, float y, uint32_t seed)
+	{
+		const float fx = std::floor(x);
+		const float fy = std::floor(y);
+		const int32_t ix = static_cast<int32_t>(fx);
+		const int32_t iy = static_cast<int32_t>(fy);
+		const float tx = x - fx;
+		const float ty = y - fy;
+		const float sx = tx * tx * (3.0f - 2.0f * tx);
+		const float sy = ty * ty * (3.0f - 2.0f * ty);
+		const float top = latticeValue(ix, iy, seed) + (latticeValue(ix + 1, iy, seed) - latticeValue(ix, iy, seed)) * sx;
+		const float bottom = latticeValue(ix, iy + 1, seed) + (latticeValue(ix + 1, iy + 1, seed) - latticeValue(ix, iy + 1, seed)) * sx;
+		return top + (bottom - top) * sy;
+	}
+
+	/** @brief fBm of value noise over [0, 1] heights, the same terrain at every size */
+	std::vector<float> generateBenchmarkTerrain(uint32_t size, ThreadPool& threadPool)
+	{
+		std::vector<float> heights(static_cast<size_t>(size) * size);
+		const float toLattice = BENCHMARK_FREQUENCY / static_cast<float>(size);
+		parallelRows(threadPool, size, [&](uint32_t firstRow, uint32_t endRow) {
+			for (uint32_t y = firstRow; y < endRow; y++)
+			{
+				for (uint32_t x = 0; x < size; x++)
+				{
+					float height = 0.0f;
+					float amplitude = 0.5f;
+					float frequency = toLattice;
+					for (uint32_t octave = 0; octave < BENCHMARK_OCTAVES; octave++)
+					{
+						height += amplitude * valueNoise(static_cast<float>(x) * frequency, static_cast<float>(y) * frequency, BENCHMARK_SEED + octave);
+						amplitude *= 0.5f;
+						frequency *= 2.0f;
+					}
+					heights[static_cast<size_t>(y) * size + x] = height;
+				}
+			}
+		});
+		return heights;
+	}
+}
+
+DrainageAnalysis::DrainageAnalysis(VulkanDevice& device, const Terrain& terrain) :
+	device(device),
+	terrain(terrain),
+	size(terrain.getConfig().heightmapSize)
+{
+	if (terrain.getConfig().heightmapFormat != VK_FORMAT_R32_SFLOAT)
+	{
+		throw std::runtime_error("Drainage analysis reads the heightmap as 32 bit floats");
+	}
+
+	readback.create(device, sizeof(float) * size * size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VK_CHECK_RESULT(readback.map());
+}
+
+DrainageAnalysis::~DrainageAnalysis()
+{
+	// both reference this and wait on threadPool
+	if (analysis.valid())
+	{
+		analysis.wait();
+	}
+	if (benchmark.valid())
+	{
+		benchmark.wait();
+	}
+	readback.destroy();
+}
+
+void DrainageAnalysis::addReadbackPasses(RenderGraph& graph, RenderGraph::Resource heightmap, uint64_t frameNumber)
+{
+	if (!terrain.isInitialized() || terrain.getGenerationCount() == copiedGeneration || readbackFrame != UINT64_MAX)
+	{
+		return;
+	}
+	copiedGeneration = terrain.getGenerationCount();
+	readbackFrame = frameNumber;
+
+	// the host reads it after the frame fence, see collect()
+	const RenderGraph::Resource buffer = graph.importBuffer("drainage readback", readback.buffer, 0, readback.size, {});
+	graph.setFinalState(buffer, { VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT });
+
+	graph.addPass("drainage readback", [this](VkCommandBuffer cmd) {
+			VkBufferImageCopy region{};
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = { size, size, 1 };
+			vkCmdCopyImageToBuffer(cmd, terrain.getHeightmap().image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &region);
+		})
+		.read(heightmap, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL })
+		.write(buffer, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+}
+
+void DrainageAnalysis::collect(uint64_t completedFrameCount, const DrainageSettings& settings)
+{
+	if (analysis.valid() && analysis.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		result = analysis.get();
+	}
+	if (benchmark.valid() && benchmark.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		benchmarkResults = benchmark.get();
+	}
+
+	if (readbackFrame != UINT64_MAX && readbackFrame < completedFrameCount)
+	{
+		heights.resize(static_cast<size_t>(size) * size);
+		memcpy(heights.data(), readback.mapped, sizeof(float) * heights.size());
+		readbackFrame = UINT64_MAX;
+		pending = true;
+	}
+	if (!heights.empty() && (settings.fillDepressions != analyzedSettings.fillDepressions || settings.riverThreshold != analyzedSettings.riverThreshold))
+	{
+		pending = true;
+	}
+
+	if (pending && !analysis.valid())
+	{
+		pending = false;
+		analyzedSettings = settings;
+		// the parallel phases wait on the pool, so the analysis itself must not take one of its workers
+		analysis = std::async(std::launch::async, [this, copy = heights, settings]() mutable {
+			return analyze(std::move(copy), size, settings, threadPool);
+		});
+	}
+}
+
+void DrainageAnalysis::startBenchmark(const DrainageSettings& settings)
+{
+	if (benchmark.valid())
+	{
+		return;
+	}
+	benchmark = std::async(std::launch::async, [this, settings]() {
+		return runBenchmark({ 1024, 4096, 16384 }, settings, threadPool);
+	});
+}
+
+std::unique_ptr<DrainageAnalysis::Result> DrainageAnalysis::analyze(std::vector<float> heights, uint32_t size, const DrainageSettings& settings,
+	ThreadPool& threadPool)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const size_t cellCount = static_cast<size_t>(size) * size;
+	if (heights.size() != cellCount)
+	{
+		throw std::runtime_error("Drainage analysis needs size * size heights");
+	}
+
+	std::unique_ptr<Result> result = std::make_unique<Result>();
+	result->size = size;
+	result->stats.size = size;
+
+	if (settings.fillDepressions)
+	{
+		result->stats.filledCells = fillDepressions(heights, size);
+	}
+	result->stats.fillMs = millisecondsSince(start);
+
+	// D8: the steepest drop over the distance to the neighbour, edge cells drain off the map
+	const std::chrono::steady_clock::time_point directionStart = std::chrono::steady_clock::now();
+	result->directions.resize(cellCount);
+	std::atomic<uint32_t> sinkCells{ 0 };
+	parallelRows(threadPool, size, [&](uint32_t firstRow, uint32_t endRow) {
+		uint32_t sinks = 0;
+		for (uint32_t y = firstRow; y < endRow; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				const size_t cell = static_cast<size_t>(y) * size + x;
+				uint8_t direction = NO_DIRECTION;
+				if (x > 0 && y > 0 && x + 1 < size && y + 1 < size)
+				{
+					float steepest = 0.0f;
+					for (uint8_t d = 0; d < 8; d++)
+					{
+						const size_t neighbour = static_cast<size_t>(static_cast<int32_t>(y) + DIRECTION_Y[d]) * size + static_cast<uint32_t>(static_cast<int32_t>(x) + DIRECTION_X[d]);
+						const float drop = (heights[cell] - heights[neighbour]) / ((d & 1) ? DIAGONAL_DISTANCE : 1.0f);
+						if (drop > steepest)
+						{
+							steepest = drop;
+							direction = d;
+						}
+					}
+					sinks += direction == NO_DIRECTION ? 1 : 0;
+				}
+				result->directions[cell] = direction;
+			}
+		}
+		sinkCells += sinks;
+	});
+	result->stats.sinkCells = sinkCells;
+	result->stats.directionMs = millisecondsSince(directionStart);
+
+	// donors of every cell, gathered from the neighbours so there are no concurrent writes
+	const std::chrono::steady_clock::time_point accumulationStart = std::chrono::steady_clock::now();
+	std::vector<uint8_t> donors(cellCount);
+	result->accumulation.resize(cellCount);
+	const std::vector<uint8_t>& directions = result->directions;
+	parallelRows(threadPool, size, [&](uint32_t firstRow, uint32_t endRow) {
+		for (uint32_t y = firstRow; y < endRow; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				uint8_t count = 0;
+				for (uint8_t d = 0; d < 8; d++)
+				{
+					const int32_t nx = static_cast<int32_t>(x) + DIRECTION_X[d];
+					const int32_t ny = static_cast<int32_t>(y) + DIRECTION_Y[d];
+					if (nx < 0 || ny < 0 || nx >= static_cast<int32_t>(size) || ny >= static_cast<int32_t>(size))
+					{
+						continue;
+					}
+					// the neighbour drains here when it points back along d
+					count += directions[static_cast<size_t>(ny) * size + static_cast<uint32_t>(nx)] == ((d + 4) & 7) ? 1 : 0;
+				}
+				const size_t cell = static_cast<size_t>(y) * size + x;
+				donors[cell] = count > 0 ? count : SOURCE;
+				result->accumulation[cell] = 1;
+			}
+		}
+	});
+
+	// every source walks downstream adding its total. The walker taking the last donor of a cell has the complete
+	// total of it, released by the other walkers' decrements, and continues from there; the others stop
+	std::vector<uint32_t>& accumulation = result->accumulation;
+	parallelRows(threadPool, size, [&](uint32_t firstRow, uint32_t endRow) {
+		for (uint32_t y = firstRow; y < endRow; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				size_t cell = static_cast<size_t>(y) * size + x;
+				if (std::atomic_ref<uint8_t>(donors[cell]).load(std::memory_order_relaxed) != SOURCE)
+				{
+					continue;
+				}
+				uint32_t total = 1;
+				while (directions[cell] != NO_DIRECTION)
+				{
+					const uint8_t d = directions[cell];
+					const size_t next = static_cast<size_t>(static_cast<int32_t>(cell / size) + DIRECTION_Y[d]) * size +
+						static_cast<uint32_t>(static_cast<int32_t>(cell % size) + DIRECTION_X[d]);
+					std::atomic_ref<uint32_t>(accumulation[next]).fetch_add(total, std::memory_order_relaxed);
+					if (std::atomic_ref<uint8_t>(donors[next]).fetch_sub(1, std::memory_order_acq_rel) != 1)
+					{
+						break;
+					}
+					// all other donors added before their decrement, which the acquire above made visible
+					total = std::atomic_ref<uint32_t>(accumulation[next]).load(std::memory_order_relaxed);
+					cell = next;
+				}
+			}
+		}
+	});
+	donors = {};
+	result->stats.accumulationMs = millisecondsSince(accumulationStart);
+
+	const uint32_t riverThreshold = std::max(static_cast<uint32_t>(settings.riverThreshold * static_cast<float>(cellCount)), 1u);
+	result->riverMask.resize(cellCount);
+	std::mutex statsMutex;
+	parallelRows(threadPool, size, [&](uint32_t firstRow, uint32_t endRow) {
+		uint32_t rivers = 0;
+		uint32_t maxAccumulation = 0;
+		for (size_t cell = static_cast<size_t>(firstRow) * size; cell < static_cast<size_t>(endRow) * size; cell++)
+		{
+			const bool river = accumulation[cell] >= riverThreshold;
+			result->riverMask[cell] = river ? 1 : 0;
+			rivers += river ? 1 : 0;
+			maxAccumulation = std::max(maxAccumulation, accumulation[cell]);
+		}
+		std::lock_guard<std::mutex> lock(statsMutex);
+		result->stats.riverCells += rivers;
+		result->stats.maxAccumulation = std::max(result->stats.maxAccumulation, maxAccumulation);
+	});
+
+	result->heights = std::move(heights);
+	result->stats.totalMs = millisecondsSince(start);
+	return result;
+}
+
+std::vector<DrainageStats> DrainageAnalysis::runBenchmark(const std::vector<uint32_t>& sizes, const DrainageSettings& settings, ThreadPool& threadPool)
+{
+	std::vector<DrainageStats> results;
+	for (uint32_t size : sizes)
+	{
+		// each result is dropped before the next size is generated
+		const DrainageStats stats = analyze(generateBenchmarkTerrain(size, threadPool), size, settings, threadPool)->stats;
+		results.push_back(stats);
+		std::cout << "Drainage benchmark: " << size << "x" << size << " in " << stats.totalMs << " ms (fill " << stats.fillMs
+			<< " ms, D8 " << stats.directionMs << " ms, accumulation " << stats.accumulationMs << " ms) on "
+			<< std::max(threadPool.getThreadCount(), 1u) << " threads, " << stats.filledCells << " cells filled, "
+			<< stats.riverCells << " river cells" << "\n";
+	}
+	return results;
+}
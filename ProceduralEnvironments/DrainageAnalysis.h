@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanStructures.h"
+#include "ThreadPool.h"
+#include "RenderGraph.h"
+#include "Terrain.h"
+
+/**
+* Drainage of the terrain on the CPU, for river placement and gameplay queries:
+*  - depression filling (optional): priority flood with an epsilon raise, every cell then has a strictly lower
+*    neighbour or lies on the edge, so all water reaches the edge of the map
+*  - flow direction: D8, each cell drains to its steepest downhill neighbour, in parallel over rows
+*  - flow accumulation: the number of cells draining through each cell including itself. Every cell counts its
+*    donors, walks start at cells without any and carry their total downstream with atomic adds. The walker that
+*    delivers the last donor of a cell continues from it, so every cell is visited once and the work is O(n)
+*  - river mask: cells whose upstream area exceeds a fraction of the terrain
+* The heightmap is copied into a host visible buffer by a graph pass and analyzed on a separate thread once the
+* frame that copied it has completed. The parallel parts run on a pool of their own, long row chunks on the engine's
+* pool would queue ahead of the frame's command recording. A newer heightmap or changed settings
+* wait for the running analysis, only the latest of them is analyzed after it.
+*/
+class DrainageAnalysis
+{
+public:
+	static const uint8_t NO_DIRECTION = 0xFF; // edge outlets and, without filling, sinks
+	// D8 neighbour offsets, direction d drains to (x + DIRECTION_X[d], y + DIRECTION_Y[d])
+	static constexpr int32_t DIRECTION_X[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+	static constexpr int32_t DIRECTION_Y[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+	struct Result {
+		uint32_t size = 0;                  // cells per side, cell (x, y) is at y * size + x
+		std::vector<float> heights;         // after depression filling
+		std::vector<uint8_t> directions;    // D8 direction of every cell or NO_DIRECTION
+		std::vector<uint32_t> accumulation; // cells draining through every cell, itself included
+		std::vector<uint8_t> riverMask;     // 1 on rivers
+		DrainageStats stats{};
+	};
+
+	DrainageAnalysis(VulkanDevice& device, const Terrain& terrain);
+	~DrainageAnalysis();
+
+	DrainageAnalysis(const DrainageAnalysis&) = delete;
+	DrainageAnalysis& operator=(const DrainageAnalysis&) = delete;
+
+	/**
+	* @brief Add the copy of heightmap for an analysis, after the passes that wrote it. Skipped while a copy is in flight
+	* @param frameNumber Of the frame the graph is recorded for
+	*/
+	void addReadbackPasses(RenderGraph& graph, RenderGraph::Resource heightmap, uint64_t frameNumber);
+
+	/**
+	* @brief Pick up a finished analysis or benchmark and start the analysis of the copy once its frame completed, or
+	* of the last copy when settings changed. Once per frame
+	* @param completedFrameCount Frames below it have finished on the GPU, as reported to the deletion queue
+	*/
+	void collect(uint64_t completedFrameCount, const DrainageSettings& settings);
+
+	/** @brief Time analyze() at 1k, 4k and 16k cells per side in the background, ignored while a benchmark runs */
+	void startBenchmark(const DrainageSettings& settings);
+
+	/** @brief Latest finished analysis, nullptr before the first one. Replaced by collect() */
+	const Result* getResult() const { return result.get(); }
+	DrainageStats getStats() const { return result ? result->stats : DrainageStats{}; }
+	bool isRunning() const { return analysis.valid(); }
+	bool isBenchmarkRunning() const { return benchmark.valid(); }
+	/** @brief Stats of every size of the last finished benchmark */
+	const std::vector<DrainageStats>& getBenchmarkResults() const { return benchmarkResults; }
+
+	/**
+	* @brief Analyze a square heightmap. The parallel parts run on threadPool, so this must not be called from one of its workers
+	* @param heights size * size heights, filled in place when enabled
+	*/
+	static std::unique_ptr<Result> analyze(std::vector<float> heights, uint32_t size, const DrainageSettings& settings, ThreadPool& threadPool);
+
+	/**
+	* @brief Time analyze() on synthetic fBm terrain of every size, from the calling thread, which must not be a worker
+	* of threadPool. The results are printed as well. A size of 16k needs about 3 GB while it runs
+	*/
+	static std::vector<DrainageStats> runBenchmark(const std::vector<uint32_t>& sizes, const DrainageSettings& settings, ThreadPool& threadPool);
+
+private:
+	VulkanDevice& device;
+	const Terrain& terrain;
+	ThreadPool threadPool; // the parallel phases of the analyses and the benchmark
+	uint32_t size;
+
+	vks::Buffer readback; // size * size heights, persistently mapped
+	// frame number of the copy in flight, there is at most one. A number rather than a slot, the frames in flight may
+	// change before it completes
+	uint64_t readbackFrame = UINT64_MAX;
+
+	uint32_t copiedGeneration = UINT32_MAX; // terrain generation of the last copy
+
+	std::vector<float> heights; // of the last copy
+	bool pending = false;       // heights or settings changed since the analysis was started
+	DrainageSettings analyzedSettings{};
+	std::future<std::unique_ptr<Result>> analysis;
+	std::unique_ptr<Result> result;
+
+	std::future<std::vector<DrainageStats>> benchmark;
+	std::vector<DrainageStats> benchmarkResults;
+};
@@ -0,0 +1,316 @@
+#include "DynamicResolution.h"
+
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	/** Mirrors UpscaleParams in upscale.slang */
+	struct UpscaleParams {
+		uint32_t renderExtent[2];
+		uint32_t outputExtent[2];
+		float sharpness;
+		float _padding;
+	};
+
+	const uint32_t UPSCALE_GROUP_SIZE = 8;
+
+	// frames averaged before each decision, single frame times are too noisy to act on
+	const uint32_t AVERAGED_FRAMES = 8;
+	// largest change per decision and the granularity of the scale, every change re-records the scene commands
+	const float MAX_SCALE_STEP = 0.1f;
+	const float SCALE_QUANTUM = 1.0f / 40.0f;
+	// the scale only grows while the frame stays below this fraction of the target, so it does not oscillate around it
+	const float GROW_THRESHOLD = 0.85f;
+}
+
+DynamicResolution::DynamicResolution(VulkanDevice& device, ShaderCache& shaderCache, uint32_t latencyFrames, ThreadPool* threadPool) :
+	device(device),
+	shaderCache(shaderCache),
+	latencyFrames(latencyFrames),
+	threadPool(threadPool)
+{
+	// the rendered region is clamped in the shader, so edge clamping only matters for the outermost taps
+	VkSamplerCreateInfo samplerCI{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerCI.magFilter = VK_FILTER_LINEAR;
+	samplerCI.minFilter = VK_FILTER_LINEAR;
+	samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.maxAnisotropy = 1.0f;
+	samplerCI.minLod = 0.0f;
+	samplerCI.maxLod = 0.0f;
+	VK_CHECK_RESULT(vkCreateSampler(device.logicalDevice, &samplerCI, nullptr, &sampler));
+
+	createPass();
+}
+
+DynamicResolution::~DynamicResolution()
+{
+	// a build still in flight references the pass
+	if (pipelineBuild.valid())
+	{
+		pipelineBuild.wait();
+	}
+
+	destroyTarget(target);
+	upscalePass.reset();
+	vkDestroySampler(device.logicalDevice, sampler, nullptr);
+}
+
+void DynamicResolution::waitForPipelines()
+{
+	if (pipelineBuild.valid())
+	{
+		pipelineBuild.get();
+	}
+}
+
+void DynamicResolution::createPass()
+{
+	auto binding = [](uint32_t index, VkDescriptorType type) {
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = index;
+		layoutBinding.descriptorType = type;
+		layoutBinding.descriptorCount = 1;
+		layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		return layoutBinding;
+	};
+
+	VulkanComputePass::Config computeConfig{};
+	computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+	computeConfig.slangGlobalSession = nullptr;
+	computeConfig.shaderCache = &shaderCache;
+	computeConfig.shaderPath = "shaders/upscale.slang";
+	computeConfig.descriptorSetLayoutBindings = {
+		binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+		binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) };
+	computeConfig.pushConstantSize = sizeof(UpscaleParams);
+
+	upscalePass = std::make_unique<VulkanComputePass>(device);
+	upscalePass->createLayouts(computeConfig);
+
+	if (threadPool == nullptr)
+	{
+		upscalePass->createPipeline();
+		return;
+	}
+	VulkanComputePass* pass = upscalePass.get();
+	pipelineBuild = threadPool->submit([pass]() { pass->createPipeline(); });
+}
+
+void DynamicResolution::resize(VkExtent2D extent, uint64_t frameNumber)
+{
+	// frames in flight may still render into or upscale from the old images
+	if (target.descriptorPool != VK_NULL_HANDLE)
+	{
+		Target retired = target;
+		device.deletionQueue->retire(frameNumber, [this, retired]() mutable { destroyTarget(retired); });
+		target = Target{};
+	}
+
+	outputExtent = extent;
+	createTarget(extent);
+	setScale(scale);
+}
+
+void DynamicResolution::createTarget(VkExtent2D extent)
+{
+	VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = SCENE_COLOR_FORMAT;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = SCENE_COLOR_FORMAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	target.sceneColor.imageInfo = imageInfo;
+	target.sceneColor.imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	target.sceneColor.viewInfo = viewInfo;
+	target.sceneColor.createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+
+	target.output.imageInfo = imageInfo;
+	target.output.imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	target.output.viewInfo = viewInfo;
+	target.output.createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }
+	};
+	VkDescriptorPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCI.pPoolSizes = poolSizes.data();
+	poolCI.maxSets = 1;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device.logicalDevice, &poolCI, nullptr, &target.descriptorPool));
+
+	const VkDescriptorSetLayout setLayout = upscalePass->getDescriptorSetLayout();
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = target.descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &target.set));
+
+	VkDescriptorImageInfo sceneColorInfo{ sampler, target.sceneColor.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo outputInfo{ VK_NULL_HANDLE, target.output.imageView, VK_IMAGE_LAYOUT_GENERAL };
+
+	VkWriteDescriptorSet writes[2]{};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = target.set;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = &sceneColorInfo;
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].dstSet = target.set;
+	writes[1].dstBinding = 1;
+	writes[1].descriptorCount = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = &outputInfo;
+	vkUpdateDescriptorSets(device.logicalDevice, 2, writes, 0, nullptr);
+}
+
+void DynamicResolution::destroyTarget(Target& retired)
+{
+	if (retired.descriptorPool != VK_NULL_HANDLE)
+	{
+		// destroying the pool frees its set
+		vkDestroyDescriptorPool(device.logicalDevice, retired.descriptorPool, nullptr);
+		retired.descriptorPool = VK_NULL_HANDLE;
+	}
+	retired.sceneColor.destroy();
+	retired.output.destroy();
+}
+
+void DynamicResolution::setScale(float newScale)
+{
+	scale = newScale;
+	renderExtent.width = std::clamp(static_cast<uint32_t>(std::lround(outputExtent.width * scale)), 1u, outputExtent.width);
+	renderExtent.height = std::clamp(static_cast<uint32_t>(std::lround(outputExtent.height * scale)), 1u, outputExtent.height);
+}
+
+void DynamicResolution::update(const DynamicResolutionSettings& settings, float frameGpuMs)
+{
+	const float minScale = std::clamp(settings.minScale, DynamicResolutionSettings::MIN_SCALE, 1.0f);
+	const float maxScale = std::clamp(settings.maxScale, minScale, 1.0f);
+
+	if (!settings.enabled)
+	{
+		const float fixedScale = std::clamp(settings.fixedScale, DynamicResolutionSettings::MIN_SCALE, 1.0f);
+		if (scale != fixedScale)
+		{
+			setScale(fixedScale);
+		}
+		framesSinceChange = 0;
+		averagedFrames = 0;
+		gpuMsSum = 0.0f;
+		return;
+	}
+
+	// the UI may have moved the limits past the current scale
+	if (scale < minScale || scale > maxScale)
+	{
+		setScale(std::clamp(scale, minScale, maxScale));
+		framesSinceChange = 0;
+		averagedFrames = 0;
+		gpuMsSum = 0.0f;
+		return;
+	}
+
+	// 0 until the profiler resolved a frame or when timestamps are not supported
+	if (frameGpuMs <= 0.0f || settings.targetGpuMs <= 0.0f)
+	{
+		return;
+	}
+
+	// times of frames recorded before the last change are still coming in
+	if (framesSinceChange < latencyFrames)
+	{
+		framesSinceChange++;
+		return;
+	}
+
+	gpuMsSum += frameGpuMs;
+	if (++averagedFrames < AVERAGED_FRAMES)
+	{
+		return;
+	}
+	const float averageMs = gpuMsSum / static_cast<float>(averagedFrames);
+	averagedFrames = 0;
+	gpuMsSum = 0.0f;
+
+	// the fragment cost follows the pixel count, the square of the scale
+	float desired = scale * std::sqrt(settings.targetGpuMs / averageMs);
+	if (desired > scale && averageMs > settings.targetGpuMs * GROW_THRESHOLD)
+	{
+		return;
+	}
+	desired = std::clamp(desired, scale - MAX_SCALE_STEP, scale + MAX_SCALE_STEP);
+	desired = std::round(desired / SCALE_QUANTUM) * SCALE_QUANTUM;
+	desired = std::clamp(desired, minScale, maxScale);
+	if (desired != scale)
+	{
+		setScale(desired);
+		framesSinceChange = 0;
+	}
+}
+
+DynamicResolution::GraphResources DynamicResolution::importResources(RenderGraph& graph) const
+{
+	// the previous frame only read them, the writes of this frame wait for those reads and discard the contents
+	GraphResources resources{};
+	resources.sceneColor = graph.importImage("scene color", target.sceneColor.image, target.sceneColor.viewInfo.subresourceRange,
+		{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED });
+	resources.output = graph.importImage("upscale output", target.output.image, target.output.viewInfo.subresourceRange,
+		{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED });
+	return resources;
+}
+
+void DynamicResolution::addUpscalePasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource swapchainResource,
+	VkImage swapchainImage, float sharpness)
+{
+	waitForPipelines();
+
+	const UpscaleParams params{ { renderExtent.width, renderExtent.height }, { outputExtent.width, outputExtent.height }, std::max(sharpness, 0.0f), 0.0f };
+	const uint32_t groupsX = (outputExtent.width + UPSCALE_GROUP_SIZE - 1) / UPSCALE_GROUP_SIZE;
+	const uint32_t groupsY = (outputExtent.height + UPSCALE_GROUP_SIZE - 1) / UPSCALE_GROUP_SIZE;
+	graph.addPass("upscale", [this, params, groupsX, groupsY](VkCommandBuffer cmd) {
+			upscalePass->recordCommands(cmd, target.set, 0, nullptr, &params, groupsX, groupsY, 1);
+		})
+		.read(resources.sceneColor, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL })
+		.write(resources.output, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
+
+	// same size, the blit only converts to the swapchain format and encodes sRGB
+	VkImageBlit region{};
+	region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.srcOffsets[1] = { static_cast<int32_t>(outputExtent.width), static_cast<int32_t>(outputExtent.height), 1 };
+	region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.dstOffsets[1] = region.srcOffsets[1];
+	graph.addPass("upscale blit", [this, region, swapchainImage](VkCommandBuffer cmd) {
+			vkCmdBlitImage(cmd, target.output.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, &region, VK_FILTER_NEAREST);
+		})
+		.read(resources.output, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL })
+		.write(swapchainResource, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+}
+
+void DynamicResolution::registerShaderReloads(ShaderHotReloader& reloader)
+{
+	VulkanComputePass* pass = upscalePass.get();
+	reloader.registerPipeline(
+		pass->getShaderPath(),
+		{ pass->getShaderPath() },
+		[pass]() { return pass->buildPipeline(); },
+		[pass](VkPipeline pipeline) { return pass->swapPipeline(pipeline); }
+	);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanImage.h"
+#include "VulkanComputePass.h"
+#include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "RenderGraph.h"
+
+/**
+* Renders the scene below the swapchain resolution and scales it back up, to hold a GPU frame time on slower hardware.
+* The scene color and depth are allocated at the swapchain extent and the scene renders into the top left region
+* of them given by getRenderExtent(), so changing the scale only changes the viewport and never reallocates.
+* update() moves the scale towards the configured GPU time, with the fragment cost taken as proportional to the
+* pixel count. The upscale is a compute pass with a contrast limited sharpen into a native float image that is blitted
+* to the swapchain, an sRGB swapchain format can't be written as a storage image. The UI is drawn after that at
+* native resolution.
+*/
+class DynamicResolution
+{
+public:
+	// what the scene pipelines render into, storage and blit source support is mandatory for it
+	static constexpr VkFormat SCENE_COLOR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	struct GraphResources {
+		RenderGraph::Resource sceneColor;
+		RenderGraph::Resource output;
+	};
+
+	/**
+	* @param latencyFrames Frames until a GPU time reflects a change of the scale, the number of frames in flight
+	* @param threadPool When set, the compute pipeline is built on it, see waitForPipelines()
+	*/
+	DynamicResolution(VulkanDevice& device, ShaderCache& shaderCache, uint32_t latencyFrames, ThreadPool* threadPool = nullptr);
+	~DynamicResolution();
+
+	DynamicResolution(const DynamicResolution&) = delete;
+	DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+	/** @brief Block until the compute pipeline exists. Rethrows build failures */
+	void waitForPipelines();
+
+	/** @brief Create the scene color and upscale output for extent. The previous images are retired through the deletion queue */
+	void resize(VkExtent2D extent, uint64_t frameNumber);
+
+	/** @brief Pick the scale of the next frame from the last resolved GPU frame time, 0 while there is none. Once per frame */
+	void update(const DynamicResolutionSettings& settings, float frameGpuMs);
+
+	/** @brief Import the scene color and the upscale output, both are fully rewritten every frame */
+	GraphResources importResources(RenderGraph& graph) const;
+
+	/** @brief Add the upscale of the rendered region and its blit into swapchainImage, the handle of swapchainResource */
+	void addUpscalePasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource swapchainResource, VkImage swapchainImage,
+		float sharpness);
+
+	/** @brief Register the upscale pass with the hot reloader */
+	void registerShaderReloads(ShaderHotReloader& reloader);
+
+	float getScale() const { return scale; }
+	VkExtent2D getRenderExtent() const { return renderExtent; }
+	VkExtent2D getOutputExtent() const { return outputExtent; }
+	const vks::Image& getSceneColor() const { return target.sceneColor; }
+
+private:
+	// what the pass binds at one swapchain extent, replaced as a whole on resize
+	struct Target {
+		vks::Image sceneColor;
+		vks::Image output;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSet set = VK_NULL_HANDLE;
+	};
+
+	void createPass();
+	void createTarget(VkExtent2D extent);
+	void destroyTarget(Target& retired);
+	void setScale(float newScale);
+
+	VulkanDevice& device;
+	ShaderCache& shaderCache;
+	uint32_t latencyFrames;
+
+	ThreadPool* threadPool;
+	std::future<void> pipelineBuild;
+
+	std::unique_ptr<VulkanComputePass> upscalePass;
+	VkSampler sampler = VK_NULL_HANDLE;
+	Target target;
+
+	VkExtent2D outputExtent{};
+	VkExtent2D renderExtent{};
+	float scale = 1.0f;
+
+	// GPU times of the frames rendered at the current scale, averaged before every decision
+	uint32_t framesSinceChange = 0;
+	uint32_t averagedFrames = 0;
+	float gpuMsSum = 0.0f;
+};
@@ -1,5 +1,10 @@
 #include "Engine.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -32,14 +37,29 @@ void Engine::initGlfwWindow()
 
 void Engine::initVulkan()
 {
+    auto startupBegin = std::chrono::high_resolution_clock::now();
+
+    // startup work that does not touch the device runs on the pool from the very beginning
+    threadPool = std::make_unique<ThreadPool>();
+    // a cached cubemap is only read here, the equirect conversion runs when the source or format changed
+    std::future<Ktx2File> skyboxCubemap = threadPool->submit([this]() {
+        return TextureBaker::loadOrBakeCubemap(skyboxConfig.cachePath, skyboxConfig.sourcePath, skyboxConfig.faceSize, skyboxConfig.format);
+    });
 
     slang::createGlobalSession(&slangGlobalSession);
-    
+    shaderCache = std::make_unique<ShaderCache>(slangGlobalSession);
+
     device = std::make_unique<VulkanDevice>(window->getGlfwWindow());
+    uploadManager = std::make_unique<UploadManager>(*device);
     swapchain = std::make_unique<VulkanSwapchain>(device->instance, device->surface, device->logicalDevice, device->physicalDevice, window->getGlfwWindow());
-    swapchain->create(windowConfig.width, windowConfig.height);
+    framesInFlight = FRAME_MODE_FRAMES_IN_FLIGHT[frameSettings.mode];
+    appliedFrameSettings = frameSettings;
+    swapchain->create(windowConfig.width, windowConfig.height, FRAME_MODE_SWAPCHAIN_IMAGES[frameSettings.mode], frameSettings.vsync);
 
     frameCommandBuffers = VulkanDevice::createCommandBuffers(device->logicalDevice, VK_COMMAND_BUFFER_LEVEL_PRIMARY, device->graphicsCommandPool, MAX_CONCURRENT_FRAMES);
+    gpuProfiler = std::make_unique<GpuProfiler>(*device, MAX_CONCURRENT_FRAMES, GPU_SCOPE_COUNT);
+    frameConstants = std::make_unique<FrameConstantAllocator>(*device, MAX_CONCURRENT_FRAMES);
+    commandRecorder = std::make_unique<ParallelCommandRecorder>(*device, *threadPool, MAX_CONCURRENT_FRAMES);
 
     createDescriptorPools();
     
@@ -50,8 +70,9 @@ void Engine::initVulkan()
     terrainConfig.heightScale = 3.0f;
     terrainConfig.normalsStrength = 50.0f;
 
-    terrain = std::make_unique<Terrain>(*device, terrainConfig);
-    terrain->initialize(descriptorPool);
+    terrain = std::make_unique<Terrain>(*device, *shaderCache, terrainConfig);
+    terrain->initialize(descriptorPool, threadPool.get());
+    loadTerrainMaterials();
 
     heightMapConfig.seed = 12345;
     heightMapConfig.offset[0] = 0.0f;
@@ -66,14 +87,36 @@ void Engine::initVulkan()
     terrainGenParams.heightScale = terrainConfig.heightScale;
     terrainGenParams.normalsStrength = terrainConfig.normalsStrength;
     terrainGenParams.terrainSideLength = terrainConfig.terrainSideLength;
+    terrainGenParams.patchSize = terrainConfig.patchSize;
+
+    terrainMaterialParams.heightScale = terrainConfig.heightScale;
+    terrainMaterialParams.tiling = 16.0f;
+    terrainMaterialParams.sandHeight = 0.15f;
+    terrainMaterialParams.snowHeight = 0.7f;
+    terrainMaterialParams.rockSlope = 0.35f;
+    terrainMaterialParams.transitionWidth = 0.05f;
+    terrainMaterialParams.blendDepth = 0.2f;
+    terrainMaterialParams.horizonShadowing = 1.0f;
     
 
+    // pipelines build on the pool, each consumer below waits only for what it uses
     createGraphicsResources();
-
-    createSkyboxResources("assets/images/cloudy_sky.hdr");
     createSkyboxGraphicsPipeline();
 
+    createSkyboxResources(std::move(skyboxCubemap));
+    updateSkyboxDescriptors();
+    updateGraphicsDescriptors();
+
     createDepthResources();
+    occlusionCuller = std::make_unique<OcclusionCuller>(*device, *shaderCache, *frameConstants, *terrain, MAX_CONCURRENT_FRAMES, threadPool.get());
+    occlusionCuller->resize(depthBuffer, frameNumber);
+    dynamicResolution = std::make_unique<DynamicResolution>(*device, *shaderCache, MAX_CONCURRENT_FRAMES, threadPool.get());
+    dynamicResolution->resize(swapchain->extent, frameNumber);
+    propScatter = std::make_unique<PropScatter>(*device, *shaderCache, *frameConstants, *uploadManager, *terrain, *imageBasedLighting,
+        DynamicResolution::SCENE_COLOR_FORMAT, DEPTH_FORMAT, MAX_CONCURRENT_FRAMES, PropScatter::Config{}, threadPool.get());
+    propScatter->setPyramid(occlusionCuller->getPyramid(), frameNumber);
+    terrainErosion = std::make_unique<TerrainErosion>(*device, *shaderCache, *terrain, MAX_CONCURRENT_FRAMES, threadPool.get());
+    drainageAnalysis = std::make_unique<DrainageAnalysis>(*device, *terrain);
 
     createSyncPrimitives();
 
@@ -92,9 +135,16 @@ void Engine::initVulkan()
         500.0f
     );
 
-    uiOverlay = std::make_unique<UIOverlay>(*window, *device, *swapchain);
+    uiOverlay = std::make_unique<UIOverlay>(*window, *device, *swapchain, MAX_CONCURRENT_FRAMES);
+
+    waitForStartupPipelines();
+    uploadManager->wait(uploadManager->submit());
 
+    float startupMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startupBegin).count();
+    std::cout << "Startup: pipelines ready after " << startupMs << " ms on " << threadPool->getThreadCount() << " worker threads" << "\n";
+    device->allocator->printStats(std::cout);
 
+    createShaderHotReloader();
 }
 
 void Engine::mainLoop()
@@ -103,6 +153,19 @@ void Engine::mainLoop()
 
     while (window && !window->shouldClose())
     {
+        applyFrameSettings();
+
+        uint32_t imageIndex = 0;
+        if (!beginFrame(imageIndex))
+        {
+            continue;
+        }
+
+        // the frame can be recorded now, input is sampled as late as the measured cadence allows
+        frameGpuMs = gpuProfiler->getMilliseconds(GPU_SCOPE_FRAME);
+        framePacer.waitForInputSample(frameGpuMs);
+        dynamicResolution->update(resolutionSettings, frameGpuMs);
+
         auto currentTime = std::chrono::high_resolution_clock::now();
         float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastTime).count();
         lastTime = currentTime;
@@ -112,8 +175,13 @@ void Engine::mainLoop()
 
         window->pollEvents();
         processInput(deltaTime);
+        updateTextureBenchmark();
 
         glm::vec3 cameraDir = camera->getCameraDirection();
+        terrainGpuMs = gpuProfiler->getMilliseconds(GPU_SCOPE_TERRAIN);
+        float presentIntervalMs = framePacer.getPresentIntervalMilliseconds();
+        float presentJitterMs = framePacer.getPresentJitterMilliseconds();
+        float pacingSleepMs = framePacer.getSleepMilliseconds();
 
         UIPacket uiPacket{
             deltaTime,
@@ -122,206 +190,487 @@ void Engine::mainLoop()
             cameraDir,
             heightMapConfig,
             heightMapConfigChanged,
-            terrainGenParams
+            terrainGenParams,
+            terrainMaterialParams,
+            terrainGpuMs,
+            textureBenchmark.requested,
+            textureBenchmark.phase >= 0,
+            frameSettings.mode,
+            frameSettings.vsync,
+            frameSettings.pacing,
+            framesInFlight,
+            frameGpuMs,
+            presentIntervalMs,
+            presentJitterMs,
+            pacingSleepMs,
+            commandRecorder->getTimings(),
+            reuseSceneCommands,
+            sceneCommandsReused,
+            renderGraphDumpRequested,
+            renderGraphBarrierBatches,
+            depthSettings.reverseZ,
+            depthSettings.terrainPrePass,
+            depthSettings.terrainPrePass ? gpuProfiler->getMilliseconds(GPU_SCOPE_TERRAIN_DEPTH) : 0.0f,
+            gpuProfiler->getMilliseconds(GPU_SCOPE_SKYBOX),
+            gpuProfiler->isStatisticsSupported(),
+            gpuProfiler->getFragmentInvocations(GPU_SCOPE_TERRAIN),
+            gpuProfiler->getFragmentInvocations(GPU_SCOPE_SKYBOX),
+            occlusionCulling,
+            terrain->getPatchCount(),
+            occlusionStats,
+            resolutionSettings,
+            dynamicResolution->getScale(),
+            dynamicResolution->getRenderExtent(),
+            propSettings,
+            propStats,
+            propScatter->getCapacity(),
+            propSettings.enabled ? gpuProfiler->getMilliseconds(GPU_SCOPE_PROPS) : 0.0f,
+            erosionSettings,
+            erosionApplyRequested,
+            terrainErosion->getStats(),
+            erosionSettings.running ? gpuProfiler->getMilliseconds(GPU_SCOPE_EROSION) : 0.0f,
+            drainageSettings,
+            drainageAnalysis->getStats(),
+            drainageAnalysis->isRunning(),
+            drainageBenchmarkRequested,
+            drainageAnalysis->isBenchmarkRunning(),
+            drainageAnalysis->getBenchmarkResults()
         };
         uiOverlay->newFrame();
         uiOverlay->buildUI(uiPacket);
         
-        drawFrame();
+        drawFrame(imageIndex);
     }
 }
 
 void Engine::cleanUp()
 {
     vkDeviceWaitIdle(device->logicalDevice);
+    // retired objects may reference the swapchain and other members torn down below
+    device->deletionQueue->flush();
+
+    shaderHotReloader.reset();
 
     uiOverlay.reset();
 
+    dynamicResolution.reset();
+    propScatter.reset();
+    terrainErosion.reset();
+    drainageAnalysis.reset();
+    occlusionCuller.reset();
     terrain.reset();
+    terrainMaterials.reset();
 
+    imageBasedLighting.reset();
     skyboxCubemapImage.destroy();
 
     cleanUpSyncPrimitives();
 
-    depthStencil.destroy();
+    depthBuffer.destroy();
 
     cleanUpSkyboxResources();
 
     cleanUpGraphicsResources();
 
+    gpuProfiler.reset();
+    frameConstants.reset();
+    commandRecorder.reset();
+
     vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
 
     swapchain.reset();
+    uploadManager.reset();
     device.reset();
+    shaderCache.reset();
     camera.reset();
     window.reset();
 
 }
 
-void Engine::drawFrame()
+bool Engine::beginFrame(uint32_t& imageIndex)
 {
     vkWaitForFences(device->logicalDevice, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX);
 
-    VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &waitFences[currentFrame]));
+    // the fence above retired the last frame submitted on this slot and every frame before it
+    device->deletionQueue->collect(frameSlotSubmissions[currentFrame]);
+    shaderHotReloader->applyPendingReloads(frameNumber);
 
-    uint32_t imageIndex{ 0 };
     VkResult result = swapchain->acquireNextImage(presentCompleteSemaphores[currentFrame], imageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
         windowResize();
-        return;
+        return false;
     }
     else if ((result != VK_SUCCESS) && (result != VK_SUBOPTIMAL_KHR))
     {
-        throw "Could not acquire the next swapchain image";
+        throw std::runtime_error("Could not acquire the next swapchain image");
     }
 
+    // only reset once a submission is certain to follow, otherwise the next wait on this slot would never return
+    VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &waitFences[currentFrame]));
+    return true;
+}
+
+void Engine::drawFrame(uint32_t imageIndex)
+{
+    // the fence of this slot retired in beginFrame(), its constants can be overwritten
+    frameConstants->beginFrame(currentFrame);
+    commandRecorder->beginFrame(currentFrame);
+    occlusionStats = occlusionCuller->collectStats(currentFrame);
+    propStats = propScatter->collectStats(currentFrame);
+    // the fence of this slot retired every frame up to its last submission
+    drainageAnalysis->collect(frameSlotSubmissions[currentFrame], drainageSettings);
+    if (drainageBenchmarkRequested)
+    {
+        drainageAnalysis->startBenchmark(drainageSettings);
+        drainageBenchmarkRequested = false;
+    }
+
+    // written once and shared by the skybox and terrain sets. The model is identity and the view a rigid transform,
+    // only the projection needs a general inverse
     MVPMatrices mvpData{};
     mvpData.model = glm::mat4(1.0f);
+    camera->setReverseZ(depthSettings.reverseZ);
     mvpData.view = camera->calculateViewMatrix();
     mvpData.proj = camera->getProjectionMatrix();
-    mvpData.mvp = mvpData.proj * mvpData.view * mvpData.model;
-    mvpData.modelInverse = glm::inverse(mvpData.model);
-    mvpData.viewInverse = glm::inverse(mvpData.view);
+    mvpData.mvp = mvpData.proj * mvpData.view;
+    mvpData.modelInverse = glm::mat4(1.0f);
+    mvpData.viewInverse = glm::affineInverse(mvpData.view);
     mvpData.projInverse = glm::inverse(mvpData.proj);
-
-    graphicsUBO[currentFrame].copyTo(&mvpData, sizeof(MVPMatrices));
-    skyboxUBO[currentFrame].copyTo(&mvpData, sizeof(MVPMatrices));
+    const uint32_t cameraOffset = frameConstants->push(mvpData);
 
     vkResetCommandBuffer(frameCommandBuffers[currentFrame], 0);
     VkCommandBufferBeginInfo cmdBufInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     const VkCommandBuffer commandBuffer = frameCommandBuffers[currentFrame];
     VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-    /*if (!heightMapInitialized || heightMapConfigChanged)
+    gpuProfiler->beginFrame(commandBuffer, currentFrame);
+    gpuProfiler->beginScope(commandBuffer, currentFrame, GPU_SCOPE_FRAME);
+    // the profiler just collected the results of this slot, including the erosion it recorded last time
+    terrainErosion->update(erosionSettings, gpuProfiler->getMilliseconds(GPU_SCOPE_EROSION), currentFrame);
+
+    if (terrain->consumeRegenerateRequest())
     {
-        recordTerrainMeshGeneration(commandBuffer, heightMapConfig, terrainGenParams);
-    }*/
+        heightMapConfigChanged = true;
+    }
+
+    // passes declare what they access, the graph derives the barriers in between
+    RenderGraph graph;
+    const Terrain::GraphResources terrainResources = terrain->importResources(graph);
+
+    // the acquire semaphore is waited on at color attachment output, the layout transition is ordered after that wait
+    const RenderGraph::Resource swapchainImage = graph.importImage("swapchain", swapchain->images[imageIndex], { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED });
+    graph.setFinalState(swapchainImage, { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR });
+
+    // the scene renders into the top left renderExtent of the internal targets, which stay at the swapchain extent
+    const VkExtent2D renderExtent = dynamicResolution->getRenderExtent();
+    const DynamicResolution::GraphResources resolutionResources = dynamicResolution->importResources(graph);
+
+    // cleared every frame, only the depth writes of the previous frame have to finish first. The Hi-Z build of the
+    // previous frame read it as well, but the late phase wrote it after that
+    const RenderGraph::Resource depthImage = graph.importImage("depth", depthBuffer.image, { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 },
+        { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED });
 
     if (!terrain->isInitialized() || heightMapConfigChanged)
     {
-        terrain->recordGeneration(commandBuffer, heightMapConfig, terrainGenParams);
+        terrain->addGenerationPasses(graph, terrainResources, heightMapConfig, terrainGenParams);
+        terrainErosion->reset();
         heightMapConfigChanged = false;
     }
 
+    // a few erosion iterations on the heights of the generated terrain, the mesh follows only when asked to
+    const TerrainErosion::GraphResources erosionResources = terrainErosion->importResources(graph);
+    if (erosionSettings.running)
+    {
+        const uint32_t frame = currentFrame;
+        graph.addPass("erosion timer begin", [this, frame](VkCommandBuffer cmd) {
+                gpuProfiler->beginScope(cmd, frame, GPU_SCOPE_EROSION);
+            })
+            .sideEffect();
+        terrainErosion->addErosionPasses(graph, erosionResources, terrainResources.heightmap, erosionSettings, terrainGenParams, currentFrame);
+        graph.addPass("erosion timer end", [this, frame](VkCommandBuffer cmd) {
+                gpuProfiler->endScope(cmd, frame, GPU_SCOPE_EROSION);
+            })
+            .sideEffect();
+    }
+    if (erosionApplyRequested)
+    {
+        if (terrainErosion->addApplyPasses(graph, erosionResources, terrainResources.heightmap))
+        {
+            terrain->addMeshPasses(graph, terrainResources, terrainGenParams);
+        }
+        erosionApplyRequested = false;
+    }
 
-    vks::tools::insertImageMemoryBarrier(
-        commandBuffer,
-        swapchain->images[imageIndex],
-        0,
-        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-    );
+    // copies a new terrain's heights for the drainage analysis, after generation or an applied erosion
+    drainageAnalysis->addReadbackPasses(graph, terrainResources.heightmap, frameNumber);
 
-    vks::tools::insertImageMemoryBarrier(
-        commandBuffer,
-        depthStencil.image,
-        0,
-        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, 1 }
-    );
+    // places the props again after the terrain changed, reads the heightmap generated above
+    const PropScatter::GraphResources propResources = propScatter->importResources(graph, currentFrame);
+    propScatter->addScatterPasses(graph, propResources, terrainResources.heightmap, propSettings, terrainGenParams, terrainMaterialParams);
+
+    // early cull against the pyramid of the previous frame
+    const OcclusionCuller::GraphResources cullResources = occlusionCuller->importResources(graph, currentFrame);
+    occlusionCuller->addEarlyPasses(graph, cullResources, terrainResources.patchBounds, mvpData.mvp, depthSettings.reverseZ, occlusionCulling);
 
     VkRenderingAttachmentInfo colorAttachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-    colorAttachment.imageView = swapchain->imageViews[imageIndex];
+    colorAttachment.imageView = dynamicResolution->getSceneColor().imageView;
     colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.clearValue.color = { 0.02f, 0.02f, 0.02f, 0.0f };
 
-    VkRenderingAttachmentInfo depthStencilAttachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-    depthStencilAttachment.imageView = depthStencil.imageView;
-    depthStencilAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    depthStencilAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthStencilAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthStencilAttachment.clearValue.depthStencil = { 1.0f, 0 };
+    // with reverse-Z the far plane is at 0
+    const float farDepth = depthSettings.reverseZ ? 0.0f : 1.0f;
+
+    VkRenderingAttachmentInfo depthAttachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    depthAttachment.imageView = depthBuffer.imageView;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // kept for the Hi-Z build and the late phase
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.clearValue.depthStencil = { farDepth, 0 };
 
     VkRenderingInfo renderingInfo{ VK_STRUCTURE_TYPE_RENDERING_INFO_KHR };
-    renderingInfo.renderArea = { 0, 0, windowConfig.width, windowConfig.height };
+    renderingInfo.renderArea = { 0, 0, renderExtent.width, renderExtent.height };
     renderingInfo.layerCount = 1;
     renderingInfo.colorAttachmentCount = 1;
     renderingInfo.pColorAttachments = &colorAttachment;
-    renderingInfo.pDepthAttachment = &depthStencilAttachment;
-    renderingInfo.pStencilAttachment = &depthStencilAttachment;
-
-    vkCmdBeginRendering(commandBuffer, &renderingInfo);
-
-    //VkViewport viewport{ 0.0f, 0.0f, (float)windowConfig.width, (float)windowConfig.height, 0.0f, 1.0f };
+    renderingInfo.pDepthAttachment = &depthAttachment;
+
+    // the scene passes are recorded into secondary buffers in parallel, see ParallelCommandRecorder
+    renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+
+    // the late phase continues on what the early one left
+    VkRenderingAttachmentInfo lateColorAttachment = colorAttachment;
+    lateColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    VkRenderingAttachmentInfo lateDepthAttachment = depthAttachment;
+    lateDepthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    lateDepthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    VkRenderingInfo lateRenderingInfo = renderingInfo;
+    lateRenderingInfo.flags = 0;
+    lateRenderingInfo.pColorAttachments = &lateColorAttachment;
+    lateRenderingInfo.pDepthAttachment = &lateDepthAttachment;
+
+    //VkViewport viewport{ 0.0f, 0.0f, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
     VkViewport viewport{};
     viewport.x = 0.0f;
-    viewport.y = (float)windowConfig.height;
-    viewport.width = (float)windowConfig.width;
-    viewport.height = -(float)windowConfig.height;
+    viewport.y = (float)renderExtent.height;
+    viewport.width = (float)renderExtent.width;
+    viewport.height = -(float)renderExtent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-    VkRect2D scissor{ 0, 0, windowConfig.width, windowConfig.height };
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    // ============================================
-    // RENDER SKYBOX
-    // ============================================
-    
-    vkCmdBindDescriptorSets(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        skyboxPipelineLayout,
-        0, 1,
-        &skyboxDescriptors[currentFrame],
-        0, nullptr
-    );
-
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline);
-
-    VkDeviceSize skyboxOffsets[1]{ 0 };
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &skyboxVertexBuffer.buffer, skyboxOffsets);
-    vkCmdDraw(commandBuffer, 36, 1, 0, 0);
+    VkRect2D scissor{ 0, 0, renderExtent.width, renderExtent.height };
+
+    terrainMaterialParams.heightScale = terrainGenParams.heightScale;
+
+    const VkFormat colorFormat = DynamicResolution::SCENE_COLOR_FORMAT;
+    VkCommandBufferInheritanceRenderingInfo inheritanceRenderingInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+    inheritanceRenderingInfo.colorAttachmentCount = 1;
+    inheritanceRenderingInfo.pColorAttachmentFormats = &colorFormat;
+    inheritanceRenderingInfo.depthAttachmentFormat = depthBuffer.imageInfo.format;
+    inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // the terrain lays down depth first, either in its own pre-pass or while shading, and the skybox is drawn last so
+    // early depth testing rejects the sky behind the terrain. With the pre-pass the shading pass only runs for the
+    // visible fragment of each pixel, both passes use the same vertex shader so their depths match exactly
+    const bool reverseZ = depthSettings.reverseZ;
+    const bool terrainPrePass = depthSettings.terrainPrePass;
+    const VkCompareOp closerOp = reverseZ ? VK_COMPARE_OP_GREATER : VK_COMPARE_OP_LESS;
+    const VkCompareOp closerOrEqualOp = reverseZ ? VK_COMPARE_OP_GREATER_OR_EQUAL : VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    // the skybox vertex shader puts the sky at depth 1, the viewport depth range moves it onto the far plane
+    VkViewport skyboxViewport = viewport;
+    skyboxViewport.minDepth = farDepth;
+    skyboxViewport.maxDepth = farDepth;
+
+    // the terrain is drawn in two phases, the patches the early and late cull passes of OcclusionCuller let through
+    const uint32_t patchCount = terrain->getPatchCount();
+    auto drawTerrain = [this, patchCount](VkCommandBuffer cmd, bool late) {
+        terrain->recordDrawIndirect(
+            cmd,
+            late ? occlusionCuller->getLateDraws().buffer : occlusionCuller->getEarlyDraws().buffer,
+            occlusionCuller->getCounters().buffer,
+            late ? OcclusionCuller::LATE_COUNT_OFFSET : OcclusionCuller::EARLY_COUNT_OFFSET,
+            patchCount
+        );
+    };
+    auto recordTerrainDepth = [this, viewport, scissor, cameraOffset, closerOp, drawTerrain](VkCommandBuffer cmd, bool late) {
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            graphicsPipelineLayout,
+            0, 1,
+            &graphicsDescriptorSet,
+            1, &cameraOffset
+        );
 
-    // ============================================
-    // RENDER MAIN GRAPHICS
-    // ============================================
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, terrainDepthPipeline);
+        vkCmdSetDepthWriteEnable(cmd, VK_TRUE);
+        vkCmdSetDepthCompareOp(cmd, closerOp);
+        drawTerrain(cmd, late);
+    };
+    auto recordTerrain = [this, viewport, scissor, cameraOffset, terrainPrePass, closerOp, closerOrEqualOp, drawTerrain](VkCommandBuffer cmd, bool late) {
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            graphicsPipelineLayout,
+            0, 1,
+            &graphicsDescriptorSet,
+            1, &cameraOffset
+        );
 
-    vkCmdBindDescriptorSets(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        graphicsPipelineLayout,
-        0, 1,
-        &graphicsDescriptors[currentFrame],
-        0, nullptr
-    );
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        vkCmdPushConstants(cmd, graphicsPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TerrainMaterialParams), &terrainMaterialParams);
+        vkCmdSetDepthWriteEnable(cmd, terrainPrePass ? VK_FALSE : VK_TRUE);
+        vkCmdSetDepthCompareOp(cmd, terrainPrePass ? closerOrEqualOp : closerOp);
+        drawTerrain(cmd, late);
+    };
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    // the early phase is recorded into secondaries in parallel, the passes only read engine state, everything they
+    // share was written above. Executed in this order
+    const uint32_t frame = currentFrame;
+    std::vector<ParallelCommandRecorder::Pass> scenePasses;
+    if (terrainPrePass)
+    {
+        scenePasses.push_back({ "terrain depth", [this, frame, recordTerrainDepth](VkCommandBuffer cmd) {
+            gpuProfiler->beginScope(cmd, frame, GPU_SCOPE_TERRAIN_DEPTH);
+            recordTerrainDepth(cmd, false);
+            gpuProfiler->endScope(cmd, frame, GPU_SCOPE_TERRAIN_DEPTH);
+        } });
+    }
+    scenePasses.push_back({ "terrain", [this, frame, recordTerrain](VkCommandBuffer cmd) {
+        gpuProfiler->beginScope(cmd, frame, GPU_SCOPE_TERRAIN);
+        gpuProfiler->beginStatistics(cmd, frame, GPU_SCOPE_TERRAIN);
+        recordTerrain(cmd, false);
+        gpuProfiler->endStatistics(cmd, frame, GPU_SCOPE_TERRAIN);
+        gpuProfiler->endScope(cmd, frame, GPU_SCOPE_TERRAIN);
+    } });
+
+    const RenderGraph::Access indirectRead{ VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT };
+    // the terrain shading samples the horizon map, written by the generation passes above
+    const RenderGraph::Access horizonRead{ VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    const RenderGraph::Access depthAttachmentAccess{ VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL };
+
+    graph.addPass("scene", [&](VkCommandBuffer cmd) {
+        vkCmdBeginRendering(cmd, &renderingInfo);
+        const uint64_t stateHash = reuseSceneCommands ? sceneStateHash(viewport, scissor, cameraOffset) : 0;
+        sceneCommandsReused = commandRecorder->recordRenderingPasses(cmd, inheritanceRenderingInfo, scenePasses, stateHash);
+        if (sceneCommandsReused)
+        {
+            // the replayed passes still write their timestamps and statistics into this frame's queries
+            if (terrainPrePass)
+            {
+                gpuProfiler->markScopeWritten(currentFrame, GPU_SCOPE_TERRAIN_DEPTH);
+            }
+            gpuProfiler->markScopeWritten(currentFrame, GPU_SCOPE_TERRAIN, true);
+        }
+        vkCmdEndRendering(cmd);
+    })
+        .read(terrainResources.vertices, { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT })
+        .read(terrainResources.indices, { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT })
+        .read(terrainResources.horizonMap, horizonRead)
+        .read(cullResources.earlyDraws, indirectRead)
+        .read(cullResources.counters, indirectRead)
+        .write(resolutionResources.sceneColor, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL })
+        .write(depthImage, depthAttachmentAccess);
+
+    // rebuilds the pyramid from the early depth and culls the candidates again
+    occlusionCuller->addLatePasses(graph, cullResources, terrainResources.patchBounds, depthImage, renderExtent, currentFrame);
+
+    // the props are culled against the pyramid the late phase just built, so whatever a prop hides behind is already in it
+    const glm::vec3 cameraPosition = glm::vec3(mvpData.viewInverse[3]);
+    propScatter->addCullPasses(graph, propResources, cullResources.pyramid, mvpData.mvp, cameraPosition, depthSettings.reverseZ,
+        occlusionCuller->isPyramidBuilt(), propSettings, currentFrame);
+    const bool drawProps = propSettings.enabled;
+
+    // the late draws are few and the skybox has to follow all terrain, all are recorded inline. The props come after
+    // the terrain, they are not part of the pyramid and cover little of the screen
+    RenderGraph::PassBuilder scenePass = graph.addPass("scene late", [&](VkCommandBuffer cmd) {
+        vkCmdBeginRendering(cmd, &lateRenderingInfo);
+        if (terrainPrePass)
+        {
+            recordTerrainDepth(cmd, true);
+        }
+        recordTerrain(cmd, true);
+
+        if (drawProps)
+        {
+            gpuProfiler->beginScope(cmd, currentFrame, GPU_SCOPE_PROPS);
+            propScatter->recordDraw(cmd, mvpData.mvp, closerOp);
+            gpuProfiler->endScope(cmd, currentFrame, GPU_SCOPE_PROPS);
+        }
+
+        vkCmdSetViewport(cmd, 0, 1, &skyboxViewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            skyboxPipelineLayout,
+            0, 1,
+            &skyboxDescriptorSet,
+            1, &cameraOffset
+        );
 
-    // render terrain
-    terrain->recordDraw(commandBuffer);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline);
+        // only passes where no terrain was drawn, the depth buffer still holds the clear value there
+        vkCmdSetDepthCompareOp(cmd, closerOrEqualOp);
+
+        VkDeviceSize skyboxOffsets[1]{ 0 };
+        vkCmdBindVertexBuffers(cmd, 0, 1, &skyboxVertexBuffer.buffer, skyboxOffsets);
+        gpuProfiler->beginScope(cmd, currentFrame, GPU_SCOPE_SKYBOX);
+        gpuProfiler->beginStatistics(cmd, currentFrame, GPU_SCOPE_SKYBOX);
+        vkCmdDraw(cmd, 36, 1, 0, 0);
+        gpuProfiler->endStatistics(cmd, currentFrame, GPU_SCOPE_SKYBOX);
+        gpuProfiler->endScope(cmd, currentFrame, GPU_SCOPE_SKYBOX);
+        vkCmdEndRendering(cmd);
+    })
+        .read(terrainResources.vertices, { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT })
+        .read(terrainResources.indices, { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT })
+        .read(terrainResources.horizonMap, horizonRead)
+        .read(cullResources.lateDraws, indirectRead)
+        .read(cullResources.counters, indirectRead)
+        .read(resolutionResources.sceneColor, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL })
+        .write(resolutionResources.sceneColor, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL })
+        .read(depthImage, depthAttachmentAccess)
+        .write(depthImage, depthAttachmentAccess);
+    if (drawProps)
+    {
+        scenePass
+            .read(propResources.draws, indirectRead)
+            .read(propResources.visible, { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT })
+            .read(propResources.instances, { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT });
+    }
 
-    vkCmdEndRendering(commandBuffer);
+    // scales the rendered region up to the swapchain extent and writes it into the swapchain image
+    dynamicResolution->addUpscalePasses(graph, resolutionResources, swapchainImage, swapchain->images[imageIndex], resolutionSettings.sharpness);
 
-    // ============================================
-    // RENDER UI
-    // ============================================
+    // loads the upscaled scene and draws on top at native resolution
+    graph.addPass("ui", [&](VkCommandBuffer cmd) {
+        uiOverlay->render(cmd, imageIndex, windowConfig.width, windowConfig.height);
+    })
+        .read(swapchainImage, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL })
+        .write(swapchainImage, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
 
-    uiOverlay->render(commandBuffer, imageIndex, windowConfig.width, windowConfig.height);
+    graph.execute(commandBuffer);
+    renderGraphBarrierBatches = graph.getBarrierBatchCount();
+    if (renderGraphDumpRequested)
+    {
+        graph.dump(std::cout);
+        renderGraphDumpRequested = false;
+    }
 
-    vks::tools::insertImageMemoryBarrier(
-        commandBuffer,
-        swapchain->images[imageIndex],
-        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        0,
-        VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-    );
+    gpuProfiler->endScope(commandBuffer, currentFrame, GPU_SCOPE_FRAME);
 
     VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 
@@ -337,8 +686,10 @@ void Engine::drawFrame()
     submitInfo.signalSemaphoreCount = 1;
 
     VK_CHECK_RESULT(vkQueueSubmit(device->graphicsQueue, 1, &submitInfo, waitFences[currentFrame]));
+    frameSlotSubmissions[currentFrame] = frameNumber + 1;
 
-    result = swapchain->queuePresent(device->presentQueue, imageIndex, renderCompleteSemaphores[imageIndex]);
+    VkResult result = swapchain->queuePresent(device->presentQueue, imageIndex, renderCompleteSemaphores[imageIndex]);
+    framePacer.markPresented();
 
     if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR))
     {
@@ -349,7 +700,37 @@ void Engine::drawFrame()
         throw std::runtime_error("Could not present the image to the swap chain");
     }
 
-    currentFrame = (currentFrame + 1) % MAX_CONCURRENT_FRAMES;
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    frameNumber++;
+}
+
+uint64_t Engine::sceneStateHash(const VkViewport& viewport, const VkRect2D& scissor, uint32_t cameraOffset) const
+{
+    // everything the scene passes bake into their commands. The camera itself is read from the constant buffer
+    const VkBuffer terrainVertexBuffer = terrain->getVertexBuffer().buffer;
+    const VkBuffer terrainIndexBuffer = terrain->getIndexBuffer().buffer;
+    const uint32_t terrainPatchCount = terrain->getPatchCount();
+    const VkBuffer earlyDrawBuffer = occlusionCuller->getEarlyDraws().buffer;
+    const VkBuffer drawCountBuffer = occlusionCuller->getCounters().buffer;
+
+    uint64_t hash = vks::tools::fnv1a64(&sceneCommandGeneration, sizeof(sceneCommandGeneration));
+    hash = vks::tools::fnv1a64(&currentFrame, sizeof(currentFrame), hash);
+    hash = vks::tools::fnv1a64(&viewport, sizeof(viewport), hash);
+    hash = vks::tools::fnv1a64(&scissor, sizeof(scissor), hash);
+    hash = vks::tools::fnv1a64(&cameraOffset, sizeof(cameraOffset), hash);
+    hash = vks::tools::fnv1a64(&graphicsPipeline, sizeof(graphicsPipeline), hash);
+    hash = vks::tools::fnv1a64(&terrainDepthPipeline, sizeof(terrainDepthPipeline), hash);
+    hash = vks::tools::fnv1a64(&depthSettings.reverseZ, sizeof(depthSettings.reverseZ), hash);
+    hash = vks::tools::fnv1a64(&depthSettings.terrainPrePass, sizeof(depthSettings.terrainPrePass), hash);
+    hash = vks::tools::fnv1a64(&graphicsDescriptorSet, sizeof(graphicsDescriptorSet), hash);
+    hash = vks::tools::fnv1a64(&terrainVertexBuffer, sizeof(terrainVertexBuffer), hash);
+    hash = vks::tools::fnv1a64(&terrainIndexBuffer, sizeof(terrainIndexBuffer), hash);
+    hash = vks::tools::fnv1a64(&terrainPatchCount, sizeof(terrainPatchCount), hash);
+    hash = vks::tools::fnv1a64(&earlyDrawBuffer, sizeof(earlyDrawBuffer), hash);
+    hash = vks::tools::fnv1a64(&drawCountBuffer, sizeof(drawCountBuffer), hash);
+    hash = vks::tools::fnv1a64(&terrainMaterialParams, sizeof(terrainMaterialParams), hash);
+    // 0 asks the recorder for a one time recording
+    return hash != 0 ? hash : 1;
 }
 
 void Engine::windowResize()
@@ -362,24 +743,59 @@ void Engine::windowResize()
         window->getFramebufferSize(newWidth, newHeight);
         // todo: implement window->waitEvents() wait if window is minimized
     }
-    vkDeviceWaitIdle(device->logicalDevice);
     this->windowConfig.width = newWidth;
     this->windowConfig.height = newHeight;
 
-    // depthResource cleanup
-    depthStencil.destroy();
+    // frames in flight keep rendering to and presenting the old images, so instead of waiting for the device the old
+    // swapchain, its depth image, the Hi-Z pyramid, the scene color and its per image semaphores are retired and destroyed once those frames finished.
+    // The frame fences and everything indexed by frame slot stay as they are, the UI overlay reads the new images
+    // through the same VulkanSwapchain
+    VulkanSwapchain::Retired retiredSwapchain;
+    swapchain->create(this->windowConfig.width, this->windowConfig.height, FRAME_MODE_SWAPCHAIN_IMAGES[appliedFrameSettings.mode], appliedFrameSettings.vsync,
+        false, &retiredSwapchain);
 
-    swapchain.reset();
-    uiOverlay.reset();
+    vks::Image retiredDepthBuffer = depthBuffer;
+    depthBuffer = vks::Image{};
+    createDepthResources();
+    occlusionCuller->resize(depthBuffer, frameNumber);
+    propScatter->setPyramid(occlusionCuller->getPyramid(), frameNumber);
+    dynamicResolution->resize(swapchain->extent, frameNumber);
+
+    std::vector<VkSemaphore> retiredSemaphores = std::move(renderCompleteSemaphores);
+    createRenderCompleteSemaphores();
+
+    // the current frame may already have used them
+    device->deletionQueue->retire(frameNumber, [this, retiredSwapchain, retiredDepthBuffer, retiredSemaphores]() mutable {
+        swapchain->destroyRetired(retiredSwapchain);
+        retiredDepthBuffer.destroy();
+        for (VkSemaphore semaphore : retiredSemaphores)
+        {
+            vkDestroySemaphore(device->logicalDevice, semaphore, nullptr);
+        }
+    });
+
+    framePacer.reset();
+    camera->setAspectRatio((float)windowConfig.width / (float)windowConfig.height);
+}
 
-    swapchain = std::make_unique<VulkanSwapchain>(device->instance, device->surface, device->logicalDevice, device->physicalDevice, window->getGlfwWindow());
-    swapchain->create(this->windowConfig.width, this->windowConfig.height);
 
+void Engine::applyFrameSettings()
+{
+    framePacer.setEnabled(frameSettings.pacing);
 
-    // depthResource recreate
-    createDepthResources();
-    uiOverlay = std::make_unique<UIOverlay>(*window, *device, *swapchain);
-    camera->setAspectRatio((float)windowConfig.width / (float)windowConfig.height);
+    if (frameSettings.mode == appliedFrameSettings.mode && frameSettings.vsync == appliedFrameSettings.vsync)
+    {
+        return;
+    }
+
+    appliedFrameSettings = frameSettings;
+    framesInFlight = FRAME_MODE_FRAMES_IN_FLIGHT[frameSettings.mode];
+    std::cout << "Frame mode: " << framesInFlight << " frames in flight, " << FRAME_MODE_SWAPCHAIN_IMAGES[frameSettings.mode]
+        << " swapchain images requested, vsync " << (frameSettings.vsync ? "on" : "off") << "\n";
+
+    // same path as a resize. Frame slots beyond the new count keep their fences, they are waited on before any reuse
+    windowResize();
+    std::cout << "Frame mode: swapchain has " << swapchain->imageCount << " images" << "\n";
 }
 
 void Engine::processInput(float deltaTime)
@@ -414,6 +830,12 @@ void Engine::createSyncPrimitives()
         VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCI, nullptr, &semaphore));
     }
 
+    createRenderCompleteSemaphores();
+}
+
+void Engine::createRenderCompleteSemaphores()
+{
+    // one per swapchain image, presentation of an image waits on its own
     renderCompleteSemaphores.resize(swapchain->images.size());
     for (auto& semaphore : renderCompleteSemaphores)
     {
@@ -433,10 +855,14 @@ void Engine::cleanUpSyncPrimitives()
 void Engine::createDescriptorPools()
 {
     std::vector<VkDescriptorPoolSize> poolSizes = {
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, MAX_CONCURRENT_FRAMES + 1 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_CONCURRENT_FRAMES * 2 + 1 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}
+        // camera constants of the terrain and skybox sets, one set each serves every frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 },
+        // image based lighting generation takes 8 storage images and 2 samplers, freed again after startup
+        // the terrain horizon map pass takes a storage image and the heightmap, the terrain set samples the horizon map
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3 + 1 + 8 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6 + 1 + 1 + 2 + 2 },
+        // terrain vertices, indices and patch bounds
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3}
     };
 
     VkDescriptorPoolCreateInfo poolCI{};
@@ -444,35 +870,43 @@ void Engine::createDescriptorPools()
     poolCI.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
     poolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolCI.pPoolSizes = poolSizes.data();
-    poolCI.maxSets = MAX_CONCURRENT_FRAMES + 7;
+    poolCI.maxSets = 2 + 7 + 3 + 1;
 
     VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &poolCI, nullptr, &descriptorPool));
 }
 
 void Engine::createGraphicsResources()
 {
-    // initialize graphics ubo
-    graphicsUBO.resize(MAX_CONCURRENT_FRAMES);
-
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++)
-    {
-        graphicsUBO[i].create(
-            device->logicalDevice,
-            device->physicalDevice,
-            sizeof(MVPMatrices),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-        graphicsUBO[i].map();
-    }
+    // same filtering as the material sampler without the mip chain, only used by the texture benchmark
+    VkSamplerCreateInfo baseLevelSamplerCI{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    baseLevelSamplerCI.magFilter = VK_FILTER_LINEAR;
+    baseLevelSamplerCI.minFilter = VK_FILTER_LINEAR;
+    baseLevelSamplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    baseLevelSamplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    baseLevelSamplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    baseLevelSamplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    baseLevelSamplerCI.anisotropyEnable = VK_FALSE;
+    baseLevelSamplerCI.maxAnisotropy = 1.0f;
+    baseLevelSamplerCI.minLod = 0.0f;
+    baseLevelSamplerCI.maxLod = 0.0f;
+    VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &baseLevelSamplerCI, nullptr, &terrainBaseLevelSampler));
 
     // descriptor set layout
-    std::array<VkDescriptorSetLayoutBinding, 1> bindings{};
-    // mvp ubo
+    std::array<VkDescriptorSetLayoutBinding, 8> bindings{};
+    // camera constants at a dynamic offset, the fragment stage reads the camera position from viewInverse
     bindings[0].binding = 0;
     bindings[0].descriptorCount = 1;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    // material color, normal and surface arrays, one layer per material, then irradiance, prefiltered and brdf lut,
+    // then the terrain horizon map
+    for (uint32_t i = 1; i < 8; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
 
     VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
     descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -487,12 +921,41 @@ void Engine::createGraphicsResources()
     pipelineLayoutCI.setLayoutCount = 1;
     pipelineLayoutCI.pSetLayouts = &graphicsDescriptorSetLayout;
 
+    VkPushConstantRange materialPushConstant{};
+    materialPushConstant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    materialPushConstant.offset = 0;
+    materialPushConstant.size = sizeof(TerrainMaterialParams);
+    pipelineLayoutCI.pushConstantRangeCount = 1;
+    pipelineLayoutCI.pPushConstantRanges = &materialPushConstant;
+
     VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &graphicsPipelineLayout));
 
-    //VkShaderModule vertShaderModule = vks::tools::loadSlangShader(device->logicalDevice, slangGlobalSession, "shaders/shader.slang", "vertexMain");
-    //VkShaderModule fragShaderModule = vks::tools::loadSlangShader(device->logicalDevice, slangGlobalSession, "shaders/shader.slang", "fragmentMain");
-    VkShaderModule vertShaderModule = vks::tools::loadShader("shaders/vert.spirv", device->logicalDevice);
-    VkShaderModule fragShaderModule = vks::tools::loadShader("shaders/frag.spirv", device->logicalDevice);
+    // picked up in waitForStartupPipelines()
+    VkFormat colorFormat = DynamicResolution::SCENE_COLOR_FORMAT;
+    graphicsPipelineBuild = threadPool->submit([this, colorFormat]() { return buildGraphicsPipeline(colorFormat, DEPTH_FORMAT); });
+    terrainDepthPipelineBuild = threadPool->submit([this, colorFormat]() { return buildGraphicsPipeline(colorFormat, DEPTH_FORMAT, true); });
+
+    // one set for all frames in flight, the camera constants move with the dynamic offset
+    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &graphicsDescriptorSetLayout;
+
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &graphicsDescriptorSet));
+
+    // written by initVulkan once the image based lighting exists
+}
+
+VkPipeline Engine::buildGraphicsPipeline(VkFormat colorFormat, VkFormat depthFormat, bool depthOnly)
+{
+    VkShaderModule vertShaderModule = shaderCache->loadShader(device->logicalDevice, "shaders/shader.slang", "vertexMain");
+    VkShaderModule fragShaderModule = depthOnly ? VK_NULL_HANDLE : shaderCache->loadShader(device->logicalDevice, "shaders/shader.slang", "fragmentMain");
+    if (vertShaderModule == VK_NULL_HANDLE || (!depthOnly && fragShaderModule == VK_NULL_HANDLE))
+    {
+        if (vertShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device->logicalDevice, vertShaderModule, nullptr);
+        if (fragShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device->logicalDevice, fragShaderModule, nullptr);
+        return VK_NULL_HANDLE;
+    }
 
     VkPipelineShaderStageCreateInfo vertShaderStageCI{};
     vertShaderStageCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -506,10 +969,12 @@ void Engine::createGraphicsResources()
     fragShaderStageCI.module = fragShaderModule;
     fragShaderStageCI.pName = "main";
 
-    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
-        vertShaderStageCI,
-        fragShaderStageCI
-    };
+    // the depth pre-pass has no fragment stage, it only writes depth
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { vertShaderStageCI };
+    if (!depthOnly)
+    {
+        shaderStages.push_back(fragShaderStageCI);
+    }
 
     auto bindingDescription = Vertex::getBindingDescription();
     auto attribDescription = Vertex::getAttributeDescriptions();
@@ -554,7 +1019,7 @@ void Engine::createGraphicsResources()
     multisamplingStateCI.alphaToOneEnable = VK_FALSE;
 
     VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.colorWriteMask = depthOnly ? 0 : VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     colorBlendAttachment.blendEnable = VK_FALSE;
     colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
     colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
@@ -576,6 +1041,7 @@ void Engine::createGraphicsResources()
 
     VkPipelineDepthStencilStateCreateInfo depthStencilStateCI{};
     depthStencilStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    // compare op and depth writes are set when drawing, they depend on reverse-Z and the pre-pass
     depthStencilStateCI.depthTestEnable = VK_TRUE;
     depthStencilStateCI.depthWriteEnable = VK_TRUE;
     depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS;
@@ -590,22 +1056,20 @@ void Engine::createGraphicsResources()
 
     std::vector<VkDynamicState> dynamicStates = {
         VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
+        VK_DYNAMIC_STATE_SCISSOR,
+        VK_DYNAMIC_STATE_DEPTH_COMPARE_OP,
+        VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE
     };
     VkPipelineDynamicStateCreateInfo dynamicState{};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
     dynamicState.pDynamicStates = dynamicStates.data();
 
-    VkFormat depthStencilFormat{};
-    vks::tools::getSupportedDepthStencilFormat(device->physicalDevice, &depthStencilFormat);
-
     // dynamic rendering info
     VkPipelineRenderingCreateInfoKHR pipelineRenderingCI{ VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
     pipelineRenderingCI.colorAttachmentCount = 1;
-    pipelineRenderingCI.pColorAttachmentFormats = &swapchain->colorFormat;
-    pipelineRenderingCI.depthAttachmentFormat = depthStencilFormat;
-    pipelineRenderingCI.stencilAttachmentFormat = depthStencilFormat;
+    pipelineRenderingCI.pColorAttachmentFormats = &colorFormat;
+    pipelineRenderingCI.depthAttachmentFormat = depthFormat;
 
     VkGraphicsPipelineCreateInfo pipelineCI{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
     pipelineCI.layout = graphicsPipelineLayout;
@@ -621,47 +1085,89 @@ void Engine::createGraphicsResources()
     pipelineCI.pDynamicState = &dynamicState;
     pipelineCI.pNext = &pipelineRenderingCI;
 
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(device->logicalDevice, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &graphicsPipeline));
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(device->logicalDevice, device->pipelineCache, 1, &pipelineCI, nullptr, &pipeline);
 
     vkDestroyShaderModule(device->logicalDevice, vertShaderModule, nullptr);
-    vkDestroyShaderModule(device->logicalDevice, fragShaderModule, nullptr);
+    if (fragShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device->logicalDevice, fragShaderModule, nullptr);
 
-    // allocate descriptor sets
-    graphicsDescriptors.resize(MAX_CONCURRENT_FRAMES);
-    std::vector<VkDescriptorSetLayout> layouts(MAX_CONCURRENT_FRAMES, graphicsDescriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = MAX_CONCURRENT_FRAMES;
-    allocInfo.pSetLayouts = layouts.data();
-
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, graphicsDescriptors.data()));
-
-    updateGraphicsDescriptors();
+    if (result != VK_SUCCESS)
+    {
+        std::cerr << "vkCreateGraphicsPipelines failed with \"" << vks::tools::errorString(result) << "\"" << "\n";
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
 }
 
 void Engine::updateGraphicsDescriptors()
 {
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++)
-    {
-        VkDescriptorBufferInfo uboInfo{};
-        uboInfo.buffer = graphicsUBO[i].buffer;
-        uboInfo.offset = 0;
-        uboInfo.range = sizeof(MVPMatrices);
-
-
-        std::array<VkWriteDescriptorSet, 1> descriptorWrites{};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = graphicsDescriptors[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &uboInfo;
+    sceneCommandGeneration++;
 
+    const VkSampler materialSampler = textureBenchmark.phase == 0 ? terrainBaseLevelSampler : terrainMaterials->getSampler();
 
+    std::array<VkDescriptorImageInfo, 3> materialInfos{};
+    materialInfos[0].imageView = terrainMaterials->getColor().imageView;
+    materialInfos[1].imageView = terrainMaterials->getNormal().imageView;
+    materialInfos[2].imageView = terrainMaterials->getSurface().imageView;
+    for (VkDescriptorImageInfo& info : materialInfos)
+    {
+        info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        info.sampler = materialSampler;
+    }
 
-        vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    std::array<VkDescriptorImageInfo, 3> lightingInfos{};
+    lightingInfos[0].imageView = imageBasedLighting->getIrradiance().imageView;
+    lightingInfos[1].imageView = imageBasedLighting->getPrefiltered().imageView;
+    lightingInfos[2].imageView = imageBasedLighting->getBrdfLut().imageView;
+    for (VkDescriptorImageInfo& info : lightingInfos)
+    {
+        info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        info.sampler = imageBasedLighting->getSampler();
     }
+
+    VkDescriptorImageInfo horizonInfo{};
+    horizonInfo.imageView = terrain->getHorizonMap().imageView;
+    horizonInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    horizonInfo.sampler = terrain->getHorizonMap().sampler;
+
+    VkDescriptorBufferInfo uboInfo = frameConstants->getDescriptorInfo(sizeof(MVPMatrices));
+
+    std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = graphicsDescriptorSet;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pBufferInfo = &uboInfo;
+
+    // bindings 1 to 3 are consecutive, one write covers all of them
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = graphicsDescriptorSet;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[1].descriptorCount = static_cast<uint32_t>(materialInfos.size());
+    descriptorWrites[1].pImageInfo = materialInfos.data();
+
+    // bindings 4 to 6, the image based lighting maps
+    descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[2].dstSet = graphicsDescriptorSet;
+    descriptorWrites[2].dstBinding = 4;
+    descriptorWrites[2].dstArrayElement = 0;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[2].descriptorCount = static_cast<uint32_t>(lightingInfos.size());
+    descriptorWrites[2].pImageInfo = lightingInfos.data();
+
+    descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[3].dstSet = graphicsDescriptorSet;
+    descriptorWrites[3].dstBinding = 7;
+    descriptorWrites[3].dstArrayElement = 0;
+    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[3].descriptorCount = 1;
+    descriptorWrites[3].pImageInfo = &horizonInfo;
+
+    vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void Engine::cleanUpGraphicsResources()
@@ -671,6 +1177,11 @@ void Engine::cleanUpGraphicsResources()
         vkDestroyPipeline(device->logicalDevice, graphicsPipeline, nullptr);
         graphicsPipeline = VK_NULL_HANDLE;
     }
+    if (terrainDepthPipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(device->logicalDevice, terrainDepthPipeline, nullptr);
+        terrainDepthPipeline = VK_NULL_HANDLE;
+    }
     if (graphicsPipelineLayout != VK_NULL_HANDLE)
     {
         vkDestroyPipelineLayout(device->logicalDevice, graphicsPipelineLayout, nullptr);
@@ -681,13 +1192,136 @@ void Engine::cleanUpGraphicsResources()
         vkDestroyDescriptorSetLayout(device->logicalDevice, graphicsDescriptorSetLayout, nullptr);
         graphicsDescriptorSetLayout = VK_NULL_HANDLE;
     }
-    for (auto buffer : graphicsUBO) buffer.destroy();
+    if (terrainBaseLevelSampler != VK_NULL_HANDLE)
+    {
+        vkDestroySampler(device->logicalDevice, terrainBaseLevelSampler, nullptr);
+        terrainBaseLevelSampler = VK_NULL_HANDLE;
+    }
+}
+
+/**
+* Each phase renders the same view for a fixed number of frames and averages the terrain GPU time.
+* Results lag framesInFlight behind, the warm-up frames absorb that and the sampler swap.
+*/
+void Engine::updateTextureBenchmark()
+{
+    const uint32_t warmupFrames = 16;
+    const uint32_t measuredFrames = 240;
+
+    if (textureBenchmark.phase < 0)
+    {
+        if (!textureBenchmark.requested)
+        {
+            return;
+        }
+        textureBenchmark.requested = false;
+        textureBenchmark.savedCamera = *camera;
+        textureBenchmark.gpuMs[0] = textureBenchmark.gpuMs[1] = 0.0;
+        textureBenchmark.frame = 0;
+        textureBenchmark.phase = 0;
+
+        vkDeviceWaitIdle(device->logicalDevice);
+        updateGraphicsDescriptors();
+    }
+
+    // high above one edge, looking across the whole terrain at a grazing angle
+    camera->setView(glm::vec3(0.0f, 6.0f, terrainGenParams.terrainSideLength * 0.75f), -90.0f, -12.0f);
+
+    if (textureBenchmark.frame >= warmupFrames)
+    {
+        textureBenchmark.gpuMs[textureBenchmark.phase] += gpuProfiler->getMilliseconds(GPU_SCOPE_TERRAIN);
+    }
+
+    if (++textureBenchmark.frame < warmupFrames + measuredFrames)
+    {
+        return;
+    }
+
+    textureBenchmark.gpuMs[textureBenchmark.phase] /= measuredFrames;
+    textureBenchmark.frame = 0;
+    textureBenchmark.phase++;
+
+    if (textureBenchmark.phase > 1)
+    {
+        std::cout << "Texture benchmark: terrain " << textureBenchmark.gpuMs[0] << " ms base level only, "
+            << textureBenchmark.gpuMs[1] << " ms with mip chain and " << vks::Image::getMaxAnisotropy(*device) << "x anisotropy"
+            << " (" << measuredFrames << " frames each)" << "\n";
+        textureBenchmark.phase = -1;
+        *camera = textureBenchmark.savedCamera;
+    }
+
+    vkDeviceWaitIdle(device->logicalDevice);
+    updateGraphicsDescriptors();
+}
+
+void Engine::waitForStartupPipelines()
+{
+    graphicsPipeline = graphicsPipelineBuild.get();
+    terrainDepthPipeline = terrainDepthPipelineBuild.get();
+    skyboxPipeline = skyboxPipelineBuild.get();
+    terrain->waitForPipelines();
+    occlusionCuller->waitForPipelines();
+    dynamicResolution->waitForPipelines();
+    propScatter->waitForPipelines();
+    terrainErosion->waitForPipelines();
+
+    if (graphicsPipeline == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Failed to create the terrain graphics pipeline");
+    }
+    if (terrainDepthPipeline == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Failed to create the terrain depth pipeline");
+    }
+    if (skyboxPipeline == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Failed to create the skybox graphics pipeline");
+    }
+}
+
+void Engine::createShaderHotReloader()
+{
+    shaderHotReloader = std::make_unique<ShaderHotReloader>(device->logicalDevice, *shaderCache, *device->deletionQueue);
+
+    terrain->registerShaderReloads(*shaderHotReloader);
+    occlusionCuller->registerShaderReloads(*shaderHotReloader);
+    dynamicResolution->registerShaderReloads(*shaderHotReloader);
+    propScatter->registerShaderReloads(*shaderHotReloader);
+    terrainErosion->registerShaderReloads(*shaderHotReloader);
+
+    // attachment formats are captured by value, the scene renders into the internal target of DynamicResolution
+    VkFormat colorFormat = DynamicResolution::SCENE_COLOR_FORMAT;
+    shaderHotReloader->registerPipeline(
+        "terrain graphics",
+        { "shaders/shader.slang" },
+        [this, colorFormat]() { return buildGraphicsPipeline(colorFormat, DEPTH_FORMAT); },
+        [this](VkPipeline pipeline) { sceneCommandGeneration++; return std::exchange(graphicsPipeline, pipeline); }
+    );
+    shaderHotReloader->registerPipeline(
+        "terrain depth",
+        { "shaders/shader.slang" },
+        [this, colorFormat]() { return buildGraphicsPipeline(colorFormat, DEPTH_FORMAT, true); },
+        [this](VkPipeline pipeline) { sceneCommandGeneration++; return std::exchange(terrainDepthPipeline, pipeline); }
+    );
+    shaderHotReloader->registerPipeline(
+        "skybox graphics",
+        { "shaders/skybox.slang" },
+        [this, colorFormat]() { return buildSkyboxPipeline(colorFormat, DEPTH_FORMAT); },
+        [this](VkPipeline pipeline) { sceneCommandGeneration++; return std::exchange(skyboxPipeline, pipeline); }
+    );
+
+    shaderHotReloader->start();
 }
 
 void Engine::createDepthResources()
 {
-    VkFormat depthStencilFormat{};
-    vks::tools::getSupportedDepthStencilFormat(device->physicalDevice, &depthStencilFormat);
+    // every implementation supports one of D32_SFLOAT and X8_D24, reverse-Z only pays off with the float format
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(device->physicalDevice, DEPTH_FORMAT, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT))
+    {
+        throw std::runtime_error("VK_FORMAT_D32_SFLOAT is not supported as a depth attachment");
+    }
 
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -697,10 +1331,11 @@ void Engine::createDepthResources()
     imageInfo.extent.depth = 1;
     imageInfo.mipLevels = 1;
     imageInfo.arrayLayers = 1;
-    imageInfo.format = depthStencilFormat;
+    imageInfo.format = DEPTH_FORMAT;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    // sampled by the Hi-Z build of OcclusionCuller
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.flags = 0;
@@ -708,7 +1343,7 @@ void Engine::createDepthResources()
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = depthStencilFormat;
+    viewInfo.format = DEPTH_FORMAT;
 
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
@@ -716,169 +1351,131 @@ void Engine::createDepthResources()
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
-    depthStencil.imageInfo = imageInfo;
-    depthStencil.viewInfo = viewInfo;
+    depthBuffer.imageInfo = imageInfo;
+    depthBuffer.viewInfo = viewInfo;
 
-    depthStencil.createImage(device->logicalDevice, device->physicalDevice, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    depthBuffer.createImage(*device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 }
 
-void Engine::createSkyboxResources(std::string hdrPath)
+// array layer order, matches the LAYER_ constants in shader.slang
+static const std::pair<const char*, const char*> terrainMaterialSets[] = {
+    { "assets/pbr_textures/ground", "Ground068" },
+    { "assets/pbr_textures/rocks", "Rocks007" },
+    { "assets/pbr_textures/sand", "Ground054" },
+    { "assets/pbr_textures/snow", "Snow010A" },
+};
+
+void Engine::loadTerrainMaterials()
 {
-    int width, height, channels;
+    auto loadBegin = std::chrono::high_resolution_clock::now();
 
-    float* data = stbi_loadf(hdrPath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    std::vector<MaterialArray::SourcePaths> materials;
+    for (const auto& [directory, name] : terrainMaterialSets)
+    {
+        materials.push_back(MaterialArray::ambientCGPaths(directory, name));
+    }
 
-    if (!data)
+    // stale or missing bakes are rebuilt here, so the first start after a source change is slower
+    TextureBaker baker(TextureBaker::supportsBlockCompression(*device));
+
+    // the upload is waited on with the rest of startup before the first frame
+    terrainMaterials = std::make_unique<MaterialArray>();
+    terrainMaterials->load(*device, *uploadManager, *threadPool, baker, materials);
+
+    float loadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - loadBegin).count();
+    std::cout << "Startup: loaded " << materials.size() << " terrain materials in " << loadMs << " ms" << "\n";
+}
+
+void Engine::bakeTerrainMaterials()
+{
+    auto bakeBegin = std::chrono::high_resolution_clock::now();
+
+    std::vector<MaterialArray::SourcePaths> sets;
+    for (const auto& [directory, name] : terrainMaterialSets)
     {
-        throw std::runtime_error("Failed to load HDR image: " + hdrPath);
+        sets.push_back(MaterialArray::ambientCGPaths(directory, name));
     }
 
-    vks::Image hdrSourceImage;
-    VkImageCreateInfo hdrImageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-    hdrImageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    hdrImageInfo.imageType = VK_IMAGE_TYPE_2D;
-    hdrImageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    hdrImageInfo.extent.width = static_cast<uint32_t>(width);
-    hdrImageInfo.extent.height = static_cast<uint32_t>(height);
-    hdrImageInfo.extent.depth = 1;
-    hdrImageInfo.mipLevels = 1;
-    hdrImageInfo.arrayLayers = 1;
-    hdrImageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    hdrImageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    hdrImageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-
-    VkImageViewCreateInfo hdrViewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-    hdrViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    hdrViewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    hdrViewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-
-    hdrSourceImage.imageInfo = hdrImageInfo;
-    hdrSourceImage.viewInfo = hdrViewInfo;
-    hdrSourceImage.createImage(device->logicalDevice, device->physicalDevice, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    // transfer hdr data to gpu
-    vks::Image::transferHdrDataToImage(*device, data, hdrSourceImage.image, width, height, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-    stbi_image_free(data);
+    ThreadPool pool;
+    MaterialArray::bakeConcurrently(pool, TextureBaker(true), sets);
+
+    float bakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - bakeBegin).count();
+    std::cout << "Baked " << sets.size() * 3 << " material textures in " << bakeMs << " ms" << "\n";
+}
+
+void Engine::createSkyboxResources(std::future<Ktx2File> cubemapFile)
+{
+    Ktx2File cubemap = cubemapFile.get();
+    const uint32_t levelCount = static_cast<uint32_t>(cubemap.levels.size());
 
     VkImageCreateInfo skyboxImageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-    skyboxImageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    skyboxImageInfo.format = cubemap.format;
     skyboxImageInfo.imageType = VK_IMAGE_TYPE_2D;
     skyboxImageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    skyboxImageInfo.extent.width = 512;
-    skyboxImageInfo.extent.height = 512;
+    skyboxImageInfo.extent.width = cubemap.width;
+    skyboxImageInfo.extent.height = cubemap.height;
     skyboxImageInfo.extent.depth = 1;
-    skyboxImageInfo.mipLevels = 1; // more than 1 when I generate mipmaps later
+    skyboxImageInfo.mipLevels = levelCount;
     skyboxImageInfo.arrayLayers = 6;
     skyboxImageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     skyboxImageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    skyboxImageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    skyboxImageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     skyboxImageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
     VkImageViewCreateInfo skyboxImageViewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
     skyboxImageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-    skyboxImageViewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    skyboxImageViewInfo.format = cubemap.format;
     VkImageSubresourceRange subrsc{};
     subrsc.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subrsc.baseMipLevel = 0;
-    subrsc.levelCount = 1;
+    subrsc.levelCount = levelCount;
     subrsc.baseArrayLayer = 0;
     subrsc.layerCount = 6;
     skyboxImageViewInfo.subresourceRange = subrsc;
 
     skyboxCubemapImage.imageInfo = skyboxImageInfo;
     skyboxCubemapImage.viewInfo = skyboxImageViewInfo;
-    skyboxCubemapImage.createImage(device->logicalDevice, device->physicalDevice, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    // temporary 2D array view for comp shader
-    VkImageViewCreateInfo computeViewInfo = skyboxCubemapImage.viewInfo;
-    computeViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
-    VkImageView computeCubeView;
-    VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &computeViewInfo, nullptr, &computeCubeView));
+    skyboxCubemapImage.createImage(*device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+    // a level holds its six faces back to back, which is also how one copy region over six layers reads them
+    VkDeviceSize stagingSize = 0;
+    for (const std::vector<uint8_t>& level : cubemap.levels)
+    {
+        stagingSize += (static_cast<VkDeviceSize>(level.size()) + 15) & ~VkDeviceSize(15);
+    }
+    UploadManager::Staging staging = uploadManager->reserve(stagingSize);
 
-    std::vector<VkDescriptorSetLayoutBinding> bindings(2);
-    // source hdr texture
-    bindings[0].binding = 0;
-    bindings[0].descriptorCount = 1;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    bindings[1].binding = 1;
-    bindings[1].descriptorCount = 1;
-    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    VulkanComputePass skyboxComputePass(*device);
-    VulkanComputePass::Config computeConfig{};
-    computeConfig.descriptorSetLayoutBindings = bindings;
-    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SPIRV;
-    computeConfig.shaderPath = "shaders/hdrToCube.spirv";
-    computeConfig.slangGlobalSession = nullptr;
-    computeConfig.pushConstantSize = 0;
-
-    skyboxComputePass.create(computeConfig, descriptorPool);
-
-    VkDescriptorImageInfo hdrDescriptorImageInfo{};
-    hdrDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    hdrDescriptorImageInfo.imageView = hdrSourceImage.imageView;
-    hdrDescriptorImageInfo.sampler = hdrSourceImage.sampler;
-
-    VkDescriptorImageInfo cubeMapDescriptorImageInfo{};
-    cubeMapDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-    //cubeMapDescriptorImageInfo.imageView = skyboxCubemapImage.imageView;
-    cubeMapDescriptorImageInfo.imageView = computeCubeView; // 2D array view
-    
-    std::vector<VkWriteDescriptorSet> writeDescriptors(2);
-    writeDescriptors[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptors[0].dstBinding = 0;
-    writeDescriptors[0].descriptorCount = 1;
-    writeDescriptors[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    writeDescriptors[0].pImageInfo = &hdrDescriptorImageInfo;
-
-    writeDescriptors[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptors[1].dstBinding = 1;
-    writeDescriptors[1].descriptorCount = 1;
-    writeDescriptors[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    writeDescriptors[1].pImageInfo = &cubeMapDescriptorImageInfo;
-
-    skyboxComputePass.updateDescriptors(writeDescriptors);
-
-    VkCommandBuffer cmd = vks::tools::beginSingleTimeCommands(device->logicalDevice, device->graphicsCommandPool);
+    std::vector<VkBufferImageCopy> regions;
+    VkDeviceSize stagingOffset = 0;
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        memcpy(static_cast<char*>(staging.mapped) + stagingOffset, cubemap.levels[level].data(), cubemap.levels[level].size());
 
-    vks::tools::insertImageMemoryBarrier(
-        cmd,
-        skyboxCubemapImage.image,
-        0,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6 }
-    );
+        VkBufferImageCopy region{};
+        region.bufferOffset = stagingOffset;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 6 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { std::max(cubemap.width >> level, 1u), std::max(cubemap.height >> level, 1u), 1 };
+        regions.push_back(region);
 
-    uint32_t gx = 512 / 16;
-    uint32_t gy = 512 / 16;
-    uint32_t gz = 6;
-    skyboxComputePass.recordCommands(cmd, nullptr, gx, gy, gz);
+        stagingOffset += (static_cast<VkDeviceSize>(cubemap.levels[level].size()) + 15) & ~VkDeviceSize(15);
+    }
 
-    vks::tools::insertImageMemoryBarrier(
-        cmd,
+    // initVulkan waits for it once before the first frame, like the vertex buffer below
+    UploadManager::Token cubemapUpload = uploadManager->uploadImage(
         skyboxCubemapImage.image,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        VK_ACCESS_SHADER_READ_BIT,
-        VK_IMAGE_LAYOUT_GENERAL,
+        staging,
+        regions,
+        subrsc,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6 }
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
     );
 
-    vks::tools::endSingleTimeCommands(cmd, device->logicalDevice, device->graphicsQueue, device->graphicsCommandPool);
-
-    // skyboxComputePass destroyed
-    vkDestroyImageView(device->logicalDevice, computeCubeView, nullptr);
-    hdrSourceImage.destroy();
+    // derived from the cubemap, a cache hit only queues uploads, a miss waits for the cubemap and generates them
+    imageBasedLighting = std::make_unique<ImageBasedLighting>(*device, *shaderCache);
+    imageBasedLighting->initialize(*uploadManager, descriptorPool, skyboxCubemapImage, cubemapUpload,
+        TextureBaker::getSourceHash(cubemap), skyboxConfig.lightingCachePrefix);
 
     std::vector<glm::vec3> skyboxVertices = {
         // Front face
@@ -903,56 +1500,33 @@ void Engine::createSkyboxResources(std::string hdrPath)
 
     VkDeviceSize bufferSize = sizeof(glm::vec3) * skyboxVertices.size();
 
-    vks::Buffer stagingBuffer;
-    stagingBuffer.create(
-        device->logicalDevice,
-        device->physicalDevice,
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
-
-    stagingBuffer.map();
-    stagingBuffer.copyTo(skyboxVertices.data(), bufferSize);
-    stagingBuffer.unmap();
-
     skyboxVertexBuffer.create(
-        device->logicalDevice,
-        device->physicalDevice,
+        *device,
         bufferSize,
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
     );
 
-    VkCommandBuffer copyCmd = vks::tools::beginSingleTimeCommands(device->logicalDevice, device->graphicsCommandPool);
-    VkBufferCopy copyRegion{ 0, 0, bufferSize };
-    vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, skyboxVertexBuffer.buffer, 1, &copyRegion);
-    vks::tools::endSingleTimeCommands(copyCmd, device->logicalDevice, device->graphicsQueue, device->graphicsCommandPool);
-
-    stagingBuffer.destroy();
+    // initVulkan waits for it once before the first frame, startup carries on meanwhile
+    uploadManager->uploadBuffer(
+        skyboxVertexBuffer.buffer,
+        skyboxVertices.data(),
+        bufferSize,
+        0,
+        VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT,
+        VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT
+    );
+    uploadManager->submit();
 
 }
 
 void Engine::createSkyboxGraphicsPipeline()
 {
-    skyboxUBO.resize(MAX_CONCURRENT_FRAMES);
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++)
-    {
-        skyboxUBO[i].create(
-            device->logicalDevice,
-            device->physicalDevice,
-            sizeof(MVPMatrices),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-        skyboxUBO[i].map();
-    }
-
     std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
-    // MVP matrices
+    // MVP matrices, the camera constants shared with the terrain
     bindings[0].binding = 0;
     bindings[0].descriptorCount = 1;
-    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     // Cubemap sampler
     bindings[1].binding = 1;
@@ -970,9 +1544,30 @@ void Engine::createSkyboxGraphicsPipeline()
     pipelineLayoutCI.pSetLayouts = &skyboxDescriptorSetLayout;
     VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &skyboxPipelineLayout));
 
-    //VkShaderModule vertShaderModule = vks::tools::loadShader("shaders/skybox_vert.spirv", device->logicalDevice);
+    // picked up in waitForStartupPipelines()
+    VkFormat colorFormat = DynamicResolution::SCENE_COLOR_FORMAT;
+    skyboxPipelineBuild = threadPool->submit([this, colorFormat]() { return buildSkyboxPipeline(colorFormat, DEPTH_FORMAT); });
+
+    // Allocate the descriptor set, shared by every frame in flight
+    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &skyboxDescriptorSetLayout;
+
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &skyboxDescriptorSet));
+}
+
+VkPipeline Engine::buildSkyboxPipeline(VkFormat colorFormat, VkFormat depthFormat)
+{
+    // vertex stage stays on the glsl version, see skybox_glsl.vert
     VkShaderModule vertShaderModule = vks::tools::loadShader("shaders/skybox_glsl_vert.spirv", device->logicalDevice);
-    VkShaderModule fragShaderModule = vks::tools::loadShader("shaders/skybox_frag.spirv", device->logicalDevice);
+    VkShaderModule fragShaderModule = shaderCache->loadShader(device->logicalDevice, "shaders/skybox.slang", "fragmentMain");
+    if (vertShaderModule == VK_NULL_HANDLE || fragShaderModule == VK_NULL_HANDLE)
+    {
+        if (vertShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device->logicalDevice, vertShaderModule, nullptr);
+        if (fragShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device->logicalDevice, fragShaderModule, nullptr);
+        return VK_NULL_HANDLE;
+    }
 
     VkPipelineShaderStageCreateInfo vertShaderStageCI{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
     vertShaderStageCI.stage = VK_SHADER_STAGE_VERTEX_BIT;
@@ -1034,7 +1629,7 @@ void Engine::createSkyboxGraphicsPipeline()
     colorBlendingStateCI.attachmentCount = 1;
     colorBlendingStateCI.pAttachments = &colorBlendAttachment;
 
-    // Depth state - test but don't write, draw at max depth
+    // Depth state - test but don't write, drawn on the far plane. The compare op depends on reverse-Z
     VkPipelineDepthStencilStateCreateInfo depthStencilStateCI{ VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
     depthStencilStateCI.depthTestEnable = VK_TRUE;
     depthStencilStateCI.depthWriteEnable = VK_FALSE; // Don't write to depth buffer
@@ -1042,20 +1637,16 @@ void Engine::createSkyboxGraphicsPipeline()
     depthStencilStateCI.depthBoundsTestEnable = VK_FALSE;
     depthStencilStateCI.stencilTestEnable = VK_FALSE;
 
-    std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP };
     VkPipelineDynamicStateCreateInfo dynamicState{};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
     dynamicState.pDynamicStates = dynamicStates.data();
 
-    VkFormat depthStencilFormat{};
-    vks::tools::getSupportedDepthStencilFormat(device->physicalDevice, &depthStencilFormat);
-
     VkPipelineRenderingCreateInfoKHR pipelineRenderingCI{ VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
     pipelineRenderingCI.colorAttachmentCount = 1;
-    pipelineRenderingCI.pColorAttachmentFormats = &swapchain->colorFormat;
-    pipelineRenderingCI.depthAttachmentFormat = depthStencilFormat;
-    pipelineRenderingCI.stencilAttachmentFormat = depthStencilFormat;
+    pipelineRenderingCI.pColorAttachmentFormats = &colorFormat;
+    pipelineRenderingCI.depthAttachmentFormat = depthFormat;
 
     VkGraphicsPipelineCreateInfo pipelineCI{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
     pipelineCI.layout = skyboxPipelineLayout;
@@ -1071,57 +1662,49 @@ void Engine::createSkyboxGraphicsPipeline()
     pipelineCI.pDynamicState = &dynamicState;
     pipelineCI.pNext = &pipelineRenderingCI;
 
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(device->logicalDevice, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &skyboxPipeline));
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(device->logicalDevice, device->pipelineCache, 1, &pipelineCI, nullptr, &pipeline);
 
     vkDestroyShaderModule(device->logicalDevice, vertShaderModule, nullptr);
     vkDestroyShaderModule(device->logicalDevice, fragShaderModule, nullptr);
 
-    // Allocate descriptor sets
-    skyboxDescriptors.resize(MAX_CONCURRENT_FRAMES);
-    std::vector<VkDescriptorSetLayout> layouts(MAX_CONCURRENT_FRAMES, skyboxDescriptorSetLayout);
-    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = MAX_CONCURRENT_FRAMES;
-    allocInfo.pSetLayouts = layouts.data();
-
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, skyboxDescriptors.data()));
-
-    updateSkyboxDescriptors();
+    if (result != VK_SUCCESS)
+    {
+        std::cerr << "vkCreateGraphicsPipelines failed with \"" << vks::tools::errorString(result) << "\"" << "\n";
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
 }
 
 void Engine::updateSkyboxDescriptors()
 {
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; i++)
-    {
-        VkDescriptorBufferInfo uboInfo{};
-        uboInfo.buffer = skyboxUBO[i].buffer;
-        uboInfo.offset = 0;
-        uboInfo.range = sizeof(MVPMatrices);
-
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = skyboxCubemapImage.imageView;
-        imageInfo.sampler = skyboxCubemapImage.sampler;
-
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = skyboxDescriptors[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &uboInfo;
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = skyboxDescriptors[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-
-        vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-    }
+    sceneCommandGeneration++;
+
+    VkDescriptorBufferInfo uboInfo = frameConstants->getDescriptorInfo(sizeof(MVPMatrices));
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = skyboxCubemapImage.imageView;
+    imageInfo.sampler = skyboxCubemapImage.sampler;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = skyboxDescriptorSet;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pBufferInfo = &uboInfo;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = skyboxDescriptorSet;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void Engine::cleanUpSkyboxResources()
@@ -1144,5 +1727,4 @@ void Engine::cleanUpSkyboxResources()
         vkDestroyDescriptorSetLayout(device->logicalDevice, skyboxDescriptorSetLayout, nullptr);
         skyboxDescriptorSetLayout = VK_NULL_HANDLE;
     }
-    for (auto& buffer : skyboxUBO) buffer.destroy();
 }
\ No newline at end of file
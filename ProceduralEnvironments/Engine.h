@@ -2,7 +2,9 @@
 
 #include <memory>
 #include <chrono>
+#include <future>
 #include <vector>
+#include <utility>
 
 #include <vulkan/vulkan.h>
 #include <slang/slang.h>
@@ -15,11 +17,27 @@
 #include "VulkanImage.h"
 #include "VulkanComputePass.h"
 #include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "UploadManager.h"
+#include "MaterialArray.h"
+#include "ImageBasedLighting.h"
+#include "GpuProfiler.h"
+#include "FramePacer.h"
+#include "FrameConstants.h"
+#include "ParallelCommandRecorder.h"
+#include "RenderGraph.h"
 
 #include "Window.h"
 #include "Camera.hpp"
 #include "UIOverlay.h"
 #include "Terrain.h"
+#include "OcclusionCuller.h"
+#include "DynamicResolution.h"
+#include "PropScatter.h"
+#include "TerrainErosion.h"
+#include "DrainageAnalysis.h"
 
 //#include "GpuCrashTracker.h"
 
@@ -28,6 +46,9 @@ class Engine
 public:
 	void run();
 
+	/** @brief Offline bake step: refresh the block compressed cache of every terrain material and return */
+	static void bakeTerrainMaterials();
+
 private:
 
 	struct {
@@ -41,33 +62,75 @@ private:
 	std::unique_ptr<UIOverlay> uiOverlay;
 
 	uint32_t currentFrame = 0;
-	static const uint32_t MAX_CONCURRENT_FRAMES = 2;
+	uint64_t frameNumber = 0;
+	// capacity of every per frame resource, framesInFlight picks how many of them are cycled through
+	static const uint32_t MAX_CONCURRENT_FRAMES = 3;
+	uint32_t framesInFlight = 2;
 	float totalElapsedTime = 0.0f;
 	std::vector<float> frame_history;
 
 	slang::IGlobalSession* slangGlobalSession;
+	std::unique_ptr<ShaderCache> shaderCache;
+	std::unique_ptr<ShaderHotReloader> shaderHotReloader;
 
 	std::unique_ptr<Window> window;
 	std::unique_ptr<Camera> camera;
 	std::unique_ptr<VulkanDevice> device;
+	std::unique_ptr<UploadManager> uploadManager;
 	std::unique_ptr<VulkanSwapchain> swapchain;
 
 	std::vector<VkCommandBuffer> frameCommandBuffers;
+	// camera and other per frame constants, bound through dynamic offsets by every pipeline
+	std::unique_ptr<FrameConstantAllocator> frameConstants;
+	// secondary command buffers of the scene passes, recorded on the thread pool
+	std::unique_ptr<ParallelCommandRecorder> commandRecorder;
+	// the scene secondaries of a frame slot are replayed while sceneStateHash() stays the same
+	bool reuseSceneCommands = true;
+	bool sceneCommandsReused = false;
+	// bumped whenever a pipeline or descriptor set bound by the scene passes is replaced or written, both invalidate
+	// command buffers that recorded them
+	uint64_t sceneCommandGeneration = 1;
+	uint64_t sceneStateHash(const VkViewport& viewport, const VkRect2D& scissor, uint32_t cameraOffset) const;
+	// drawFrame builds a RenderGraph every frame, printed to stdout once when requested from the UI
+	bool renderGraphDumpRequested = false;
+	uint32_t renderGraphBarrierBatches = 0;
 
 	void initGlfwWindow();
 	void initVulkan();
 	void mainLoop();
 	void cleanUp();
 
-	void drawFrame();
+	/** @brief Wait for the frame slot and acquire a swapchain image, false when the swapchain had to be recreated instead */
+	bool beginFrame(uint32_t& imageIndex);
+	void drawFrame(uint32_t imageIndex);
+	/** @brief Recreate the swapchain and the render targets for the current window size without waiting for the device */
 	void windowResize();
 	void processInput(float deltaTime);
 
+	// ----- Frame Pacing -----
+	// frames in flight and swapchain images per FrameMode, the image count is clamped to the surface limits
+	enum FrameMode : int { FRAME_MODE_LATENCY, FRAME_MODE_BALANCED, FRAME_MODE_THROUGHPUT, FRAME_MODE_COUNT };
+	static constexpr uint32_t FRAME_MODE_FRAMES_IN_FLIGHT[FRAME_MODE_COUNT] = { 1, 2, 3 };
+	static constexpr uint32_t FRAME_MODE_SWAPCHAIN_IMAGES[FRAME_MODE_COUNT] = { 2, 3, 3 };
+	struct FrameSettings {
+		int mode = FRAME_MODE_BALANCED;
+		bool vsync = false;
+		bool pacing = true;
+	};
+	FrameSettings frameSettings;
+	FrameSettings appliedFrameSettings; // what the swapchain was created with
+	/** @brief Recreate the swapchain when the UI changed the frame settings */
+	void applyFrameSettings();
+	FramePacer framePacer;
+
 	// ----- Sync Objects -----
 	void createSyncPrimitives();
+	void createRenderCompleteSemaphores();
 	std::vector<VkSemaphore> presentCompleteSemaphores{};
 	std::vector<VkSemaphore> renderCompleteSemaphores{};
 	std::array<VkFence, MAX_CONCURRENT_FRAMES> waitFences{};
+	// frameNumber + 1 of the last submission on each slot, reported to the deletion queue once its fence was waited on
+	std::array<uint64_t, MAX_CONCURRENT_FRAMES> frameSlotSubmissions{};
 	void cleanUpSyncPrimitives();
 
 	// ----- Descriptor Pool -----
@@ -76,40 +139,123 @@ private:
 
 	// ----- Graphics Pipeline -----
 	void createGraphicsResources();
+	/** @brief depthOnly builds the terrain depth pre-pass: same vertex shader, no fragment stage and no color writes */
+	VkPipeline buildGraphicsPipeline(VkFormat colorFormat, VkFormat depthFormat, bool depthOnly = false);
 	VkDescriptorSetLayout graphicsDescriptorSetLayout;
 	VkPipelineLayout graphicsPipelineLayout;
 	VkPipeline graphicsPipeline;
+	VkPipeline terrainDepthPipeline = VK_NULL_HANDLE;
 	void updateGraphicsDescriptors();
-	std::vector<VkDescriptorSet> graphicsDescriptors;
-	std::vector<vks::Buffer> graphicsUBO;
+	VkDescriptorSet graphicsDescriptorSet = VK_NULL_HANDLE;
 	VertexShaderPushConstant vertPushConstant;
 	void cleanUpGraphicsResources();
 
-	// ----- Depth/Stencil Resources -----
+	// ----- Startup -----
+	std::future<VkPipeline> graphicsPipelineBuild;
+	std::future<VkPipeline> terrainDepthPipelineBuild;
+	std::future<VkPipeline> skyboxPipelineBuild;
+	void waitForStartupPipelines();
+
+	// ----- Shader Hot Reload -----
+	void createShaderHotReloader();
+
+	// ----- Depth Resources -----
+	// no stencil is used, a pure float format keeps the full 32 bits for depth
+	static constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
 	void createDepthResources();
-	vks::Image depthStencil;
+	vks::Image depthBuffer;
+	struct {
+		// near at 1 and far at 0 with a float buffer, the precision is roughly uniform over the view distance
+		bool reverseZ = true;
+		// terrain depth first, so the shading pass runs once per pixel
+		bool terrainPrePass = true;
+	} depthSettings;
 
 	// ----- TERRAIN -----
 	std::unique_ptr<Terrain> terrain;
 	HeightMapParams heightMapConfig;
 	TerrainParams terrainGenParams;
 	bool heightMapConfigChanged = true;
+	void loadTerrainMaterials();
+	std::unique_ptr<MaterialArray> terrainMaterials;
+	TerrainMaterialParams terrainMaterialParams;
+
+	// ----- Occlusion Culling -----
+	// terrain patches are culled against a Hi-Z pyramid and drawn indirectly in two phases, see OcclusionCuller
+	std::unique_ptr<OcclusionCuller> occlusionCuller;
+	bool occlusionCulling = true;
+	OcclusionStats occlusionStats{}; // of the last frame that finished on the current slot
+
+	// ----- Dynamic Resolution -----
+	// the scene renders into a region of an internal target sized to hold the GPU frame time, then is upscaled into
+	// the swapchain image before the UI, see DynamicResolution
+	std::unique_ptr<DynamicResolution> dynamicResolution;
+	DynamicResolutionSettings resolutionSettings;
 
+	// ----- Props -----
+	// trees and rocks scattered on the GPU, culled against this frame's Hi-Z pyramid and drawn indirectly, see PropScatter
+	std::unique_ptr<PropScatter> propScatter;
+	PropSettings propSettings;
+	PropStats propStats{}; // of the last frame that finished on the current slot
+
+	// ----- Erosion -----
+	// hydraulic and thermal erosion of the heightmap within a GPU time budget per frame, see TerrainErosion. The
+	// mesh only picks the eroded heights up when the UI asks for it
+	std::unique_ptr<TerrainErosion> terrainErosion;
+	ErosionSettings erosionSettings;
+	bool erosionApplyRequested = false;
+
+	// ----- Drainage -----
+	// flow directions, flow accumulation and rivers of every new terrain, analyzed on the CPU, see DrainageAnalysis
+	std::unique_ptr<DrainageAnalysis> drainageAnalysis;
+	DrainageSettings drainageSettings;
+	bool drainageBenchmarkRequested = false;
+
+	// ----- GPU Profiling -----
+	enum GpuScope : uint32_t { GPU_SCOPE_FRAME, GPU_SCOPE_TERRAIN_DEPTH, GPU_SCOPE_TERRAIN, GPU_SCOPE_SKYBOX, GPU_SCOPE_PROPS, GPU_SCOPE_EROSION, GPU_SCOPE_COUNT };
+	std::unique_ptr<GpuProfiler> gpuProfiler;
+	float frameGpuMs = 0.0f;
+	float terrainGpuMs = 0.0f;
+
+	// ----- Texture Sampling Benchmark -----
+	// a fixed, strongly minified terrain view sampled from the base level only, then through the full mip chain
+	void updateTextureBenchmark();
+	VkSampler terrainBaseLevelSampler = VK_NULL_HANDLE;
+	struct {
+		bool requested = false;
+		int phase = -1; // -1 idle, 0 base level only, 1 full mip chain
+		uint32_t frame = 0;
+		double gpuMs[2] = {};
+		Camera savedCamera;
+	} textureBenchmark;
 
 
 	// ----- Skybox Resources-----
-	void createSkyboxResources(std::string hdrPath);
+	struct {
+		std::string sourcePath = "assets/images/cloudy_sky.hdr";
+		std::string cachePath = "assets/images/baked/cloudy_sky.ktx2";
+		uint32_t faceSize = 512;
+		// R16G16B16A16_SFLOAT takes half the memory of RGBA32F, B10G11R11_UFLOAT_PACK32 a quarter but drops alpha and negative values
+		VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		std::string lightingCachePrefix = "assets/images/baked/cloudy_sky";
+	} skyboxConfig;
+	void createSkyboxResources(std::future<Ktx2File> cubemapFile);
 	void createSkyboxGraphicsPipeline();
+	VkPipeline buildSkyboxPipeline(VkFormat colorFormat, VkFormat depthFormat);
 	void updateSkyboxDescriptors();
 	void cleanUpSkyboxResources();
 
 	vks::Image skyboxCubemapImage;
 	vks::Buffer skyboxVertexBuffer;
+	// irradiance, prefiltered specular and brdf lut of the skybox, sampled by the terrain
+	std::unique_ptr<ImageBasedLighting> imageBasedLighting;
 
 	VkDescriptorSetLayout skyboxDescriptorSetLayout = VK_NULL_HANDLE;
 	VkPipelineLayout skyboxPipelineLayout = VK_NULL_HANDLE;
 	VkPipeline skyboxPipeline = VK_NULL_HANDLE;
-	std::vector<VkDescriptorSet> skyboxDescriptors;
-	std::vector<vks::Buffer> skyboxUBO;
+	VkDescriptorSet skyboxDescriptorSet = VK_NULL_HANDLE;
+
+	// declared last so it is destroyed first, joining any task that still references the members above
+	std::unique_ptr<ThreadPool> threadPool;
 };
 
@@ -0,0 +1,49 @@
+#include "FrameConstants.h"
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+FrameConstantAllocator::FrameConstantAllocator(VulkanDevice& device, uint32_t frameCount, VkDeviceSize bytesPerFrame) :
+	alignment(std::max<VkDeviceSize>(device.properties.limits.minUniformBufferOffsetAlignment, 16)),
+	frameCount(frameCount)
+{
+	segmentSize = vks::tools::alignUp(bytesPerFrame, alignment);
+	if (segmentSize * frameCount > UINT32_MAX)
+	{
+		throw std::runtime_error("Frame constant segments exceed the range of a dynamic offset");
+	}
+
+	buffer.create(
+		device,
+		segmentSize * frameCount,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+	);
+	VK_CHECK_RESULT(buffer.map());
+}
+
+FrameConstantAllocator::~FrameConstantAllocator()
+{
+	buffer.destroy();
+}
+
+void FrameConstantAllocator::beginFrame(uint32_t frame)
+{
+	segmentBegin = segmentSize * (frame % frameCount);
+	head = segmentBegin;
+}
+
+uint32_t FrameConstantAllocator::allocate(VkDeviceSize size, void*& mapped)
+{
+	const VkDeviceSize offset = head;
+	if (offset + size > segmentBegin + segmentSize)
+	{
+		throw std::runtime_error("Frame constants exceed the " + std::to_string(segmentSize) + " bytes of a frame");
+	}
+	head = vks::tools::alignUp(offset + size, alignment);
+
+	mapped = static_cast<char*>(buffer.mapped) + offset;
+	return static_cast<uint32_t>(offset);
+}
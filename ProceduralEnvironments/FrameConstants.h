@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+
+/**
+* Per frame constant data in one persistently mapped uniform buffer, split into a segment per frame in flight.
+* Each frame bump allocates from its own segment and binds the results through UNIFORM_BUFFER_DYNAMIC descriptors,
+* so a single descriptor set per layout serves every frame and every draw, only the dynamic offset changes.
+* A segment is reused only after beginFrame() for the same frame index, which the caller does once its fence retired.
+*/
+class FrameConstantAllocator
+{
+public:
+	FrameConstantAllocator(VulkanDevice& device, uint32_t frameCount, VkDeviceSize bytesPerFrame = 64 * 1024);
+	~FrameConstantAllocator();
+
+	FrameConstantAllocator(const FrameConstantAllocator&) = delete;
+	FrameConstantAllocator& operator=(const FrameConstantAllocator&) = delete;
+
+	/** @brief Rewind the segment of frame, everything allocated from it by its previous submission must have retired */
+	void beginFrame(uint32_t frame);
+
+	/** @brief Reserve size bytes in the current segment, returns the dynamic offset and the mapped memory to write */
+	uint32_t allocate(VkDeviceSize size, void*& mapped);
+
+	/** @brief Copy data into the current segment, returns its dynamic offset */
+	template<typename T>
+	uint32_t push(const T& data)
+	{
+		void* mapped = nullptr;
+		uint32_t offset = allocate(sizeof(T), mapped);
+		memcpy(mapped, &data, sizeof(T));
+		return offset;
+	}
+
+	/** @brief Buffer info for a UNIFORM_BUFFER_DYNAMIC descriptor that reads range bytes at the dynamic offset */
+	VkDescriptorBufferInfo getDescriptorInfo(VkDeviceSize range) const { return { buffer.buffer, 0, range }; }
+
+	VkDeviceSize getUsedBytes() const { return head - segmentBegin; }
+
+private:
+	vks::Buffer buffer;
+	VkDeviceSize alignment;
+	VkDeviceSize segmentSize;
+	VkDeviceSize segmentBegin = 0;
+	VkDeviceSize head = 0;
+	uint32_t frameCount;
+};
@@ -0,0 +1,121 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+	const float SMOOTHING = 0.1f;
+	// slack left before the predicted deadline, the larger of an absolute and a relative amount
+	const float MIN_MARGIN_MS = 1.0f;
+	const float MARGIN_FRACTION = 0.15f;
+	// the OS sleep is only trusted up to this close to the target, the rest is spent yielding
+	const auto SPIN_THRESHOLD = std::chrono::milliseconds(2);
+
+	float toMilliseconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+
+	float smooth(float average, float sample)
+	{
+		return average == 0.0f ? sample : average + (sample - average) * SMOOTHING;
+	}
+}
+
+FramePacer::FramePacer(uint32_t historySize) :
+	presentIntervals(std::max(historySize, 2u), 0.0f)
+{
+}
+
+void FramePacer::reset()
+{
+	hasFrameStart = false;
+	hasInputSample = false;
+	hasPresent = false;
+	frameIntervalMs = 0.0f;
+	cpuWorkMs = 0.0f;
+	sleepMs = 0.0f;
+	presentIntervalCount = 0;
+	presentIntervalNext = 0;
+	presentIntervalMs = 0.0f;
+	presentJitterMs = 0.0f;
+}
+
+void FramePacer::waitForInputSample(float gpuFrameMs)
+{
+	const Clock::time_point frameStart = Clock::now();
+	if (hasFrameStart)
+	{
+		frameIntervalMs = smooth(frameIntervalMs, toMilliseconds(frameStart - lastFrameStart));
+	}
+	lastFrameStart = frameStart;
+	hasFrameStart = true;
+
+	sleepMs = 0.0f;
+	if (enabled && frameIntervalMs > 0.0f && cpuWorkMs > 0.0f)
+	{
+		const float margin = std::max(MIN_MARGIN_MS, MARGIN_FRACTION * frameIntervalMs);
+		sleepMs = std::clamp(frameIntervalMs - cpuWorkMs - gpuFrameMs - margin, 0.0f, frameIntervalMs);
+		if (sleepMs > 0.0f)
+		{
+			sleepUntil(frameStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(sleepMs)));
+		}
+	}
+
+	inputSample = Clock::now();
+	hasInputSample = true;
+}
+
+void FramePacer::markPresented()
+{
+	const Clock::time_point present = Clock::now();
+	if (hasInputSample)
+	{
+		cpuWorkMs = smooth(cpuWorkMs, toMilliseconds(present - inputSample));
+		hasInputSample = false;
+	}
+
+	if (hasPresent)
+	{
+		presentIntervals[presentIntervalNext] = toMilliseconds(present - lastPresent);
+		presentIntervalNext = (presentIntervalNext + 1) % static_cast<uint32_t>(presentIntervals.size());
+		presentIntervalCount = std::min(presentIntervalCount + 1, static_cast<uint32_t>(presentIntervals.size()));
+		updatePresentStatistics();
+	}
+	lastPresent = present;
+	hasPresent = true;
+}
+
+void FramePacer::updatePresentStatistics()
+{
+	double sum = 0.0;
+	for (uint32_t i = 0; i < presentIntervalCount; i++)
+	{
+		sum += presentIntervals[i];
+	}
+	const double mean = sum / presentIntervalCount;
+
+	double squaredDeviations = 0.0;
+	for (uint32_t i = 0; i < presentIntervalCount; i++)
+	{
+		squaredDeviations += (presentIntervals[i] - mean) * (presentIntervals[i] - mean);
+	}
+
+	presentIntervalMs = static_cast<float>(mean);
+	presentJitterMs = static_cast<float>(std::sqrt(squaredDeviations / presentIntervalCount));
+}
+
+void FramePacer::sleepUntil(Clock::time_point target)
+{
+	// sleep granularity is about a millisecond at best, often worse on Windows
+	if (target - Clock::now() > SPIN_THRESHOLD)
+	{
+		std::this_thread::sleep_until(target - SPIN_THRESHOLD);
+	}
+	while (Clock::now() < target)
+	{
+		std::this_thread::yield();
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+* Delays input sampling until just before the frame has to be recorded, so the presented image is as fresh as possible.
+* The frame cadence is measured from the moment the frame slot and swapchain image become available, which is when
+* the blocking waits release the CPU. The pacer sleeps through the part of that interval the frame doesn't need:
+* interval - CPU work - GPU work - margin. When nothing throttles the loop the interval shrinks to the work itself
+* and the pacer stops sleeping, so it is only active while presentation (vsync) or the GPU is the bottleneck.
+* Present-to-present intervals are kept for the jitter statistics. They are CPU timestamps taken when queuePresent
+* returns, not display times.
+*/
+class FramePacer
+{
+public:
+	explicit FramePacer(uint32_t historySize = 120);
+
+	void setEnabled(bool enabled) { this->enabled = enabled; }
+	bool isEnabled() const { return enabled; }
+
+	/** @brief Forget every estimate, after the swapchain or the number of frames in flight changed */
+	void reset();
+
+	/**
+	* @brief Call once the frame can be recorded, after the fence and image acquire waits.
+	* Sleeps until input should be sampled. gpuFrameMs is the latest GPU duration of a frame
+	*/
+	void waitForInputSample(float gpuFrameMs);
+
+	/** @brief Call right after queuePresent returned */
+	void markPresented();
+
+	float getSleepMilliseconds() const { return sleepMs; }
+	float getCpuWorkMilliseconds() const { return cpuWorkMs; }
+	/** @brief Mean present-to-present interval over the history */
+	float getPresentIntervalMilliseconds() const { return presentIntervalMs; }
+	/** @brief Standard deviation of present-to-present intervals over the history */
+	float getPresentJitterMilliseconds() const { return presentJitterMs; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static void sleepUntil(Clock::time_point target);
+	void updatePresentStatistics();
+
+	bool enabled = true;
+
+	Clock::time_point lastFrameStart{};
+	Clock::time_point inputSample{};
+	Clock::time_point lastPresent{};
+	bool hasFrameStart = false;
+	bool hasInputSample = false;
+	bool hasPresent = false;
+
+	// exponential moving averages
+	float frameIntervalMs = 0.0f;
+	float cpuWorkMs = 0.0f;
+	float sleepMs = 0.0f;
+
+	std::vector<float> presentIntervals; // ring of the last historySize intervals
+	uint32_t presentIntervalCount = 0;
+	uint32_t presentIntervalNext = 0;
+	float presentIntervalMs = 0.0f;
+	float presentJitterMs = 0.0f;
+};
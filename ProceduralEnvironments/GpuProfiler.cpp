@@ -0,0 +1,155 @@
+#include "GpuProfiler.h"
+#include "VulkanTools.h"
+
+#include <array>
+
+GpuProfiler::GpuProfiler(VulkanDevice& vulkanDevice, uint32_t framesInFlight, uint32_t scopeCount) :
+	device(vulkanDevice.logicalDevice),
+	scopeCount(scopeCount),
+	timestampPeriod(vulkanDevice.properties.limits.timestampPeriod),
+	timestampMask(0),
+	written(framesInFlight * scopeCount, false),
+	statisticsWritten(framesInFlight * scopeCount, false),
+	milliseconds(scopeCount, 0.0f),
+	fragmentInvocations(scopeCount, 0)
+{
+	if (vulkanDevice.enabledFeatures.pipelineStatisticsQuery)
+	{
+		VkQueryPoolCreateInfo statisticsPoolCI{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		statisticsPoolCI.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		statisticsPoolCI.queryCount = framesInFlight * scopeCount;
+		statisticsPoolCI.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &statisticsPoolCI, nullptr, &statisticsPool));
+	}
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(vulkanDevice.physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(vulkanDevice.physicalDevice, &familyCount, families.data());
+
+	// without valid bits on the graphics queue every scope just reads 0
+	uint32_t validBits = families[vulkanDevice.familyIndices.graphicsFamily.value()].timestampValidBits;
+	if (validBits == 0)
+	{
+		return;
+	}
+	timestampMask = validBits >= 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
+
+	VkQueryPoolCreateInfo queryPoolCI{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCI.queryCount = framesInFlight * scopeCount * 2;
+	VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &queryPool));
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	if (statisticsPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, statisticsPool, nullptr);
+	}
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+	}
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, uint32_t frame)
+{
+	if (statisticsPool != VK_NULL_HANDLE)
+	{
+		for (uint32_t scope = 0; scope < scopeCount; scope++)
+		{
+			if (!statisticsWritten[frame * scopeCount + scope])
+			{
+				continue;
+			}
+
+			// invocation count followed by its availability
+			std::array<uint64_t, 2> results{};
+			VkResult result = vkGetQueryPoolResults(device, statisticsPool, frame * scopeCount + scope, 1, sizeof(results), results.data(),
+				sizeof(results), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if (result == VK_SUCCESS && results[1] != 0)
+			{
+				fragmentInvocations[scope] = results[0];
+			}
+			statisticsWritten[frame * scopeCount + scope] = false;
+		}
+		vkCmdResetQueryPool(cmd, statisticsPool, frame * scopeCount, scopeCount);
+	}
+
+	if (queryPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (uint32_t scope = 0; scope < scopeCount; scope++)
+	{
+		if (!written[frame * scopeCount + scope])
+		{
+			continue;
+		}
+
+		// begin/end ticks, each followed by its availability
+		std::array<uint64_t, 4> results{};
+		VkResult result = vkGetQueryPoolResults(device, queryPool, firstQuery(frame, scope), 2, sizeof(results), results.data(),
+			2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if (result == VK_SUCCESS && results[1] != 0 && results[3] != 0)
+		{
+			uint64_t ticks = (results[2] - results[0]) & timestampMask;
+			milliseconds[scope] = static_cast<float>(static_cast<double>(ticks) * timestampPeriod / 1.0e6);
+		}
+		written[frame * scopeCount + scope] = false;
+	}
+
+	vkCmdResetQueryPool(cmd, queryPool, firstQuery(frame, 0), scopeCount * 2);
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer cmd, uint32_t frame, uint32_t scope)
+{
+	if (queryPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, queryPool, firstQuery(frame, scope));
+}
+
+void GpuProfiler::endScope(VkCommandBuffer cmd, uint32_t frame, uint32_t scope)
+{
+	if (queryPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, queryPool, firstQuery(frame, scope) + 1);
+	written[frame * scopeCount + scope] = true;
+}
+
+void GpuProfiler::beginStatistics(VkCommandBuffer cmd, uint32_t frame, uint32_t scope)
+{
+	if (statisticsPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	vkCmdBeginQuery(cmd, statisticsPool, frame * scopeCount + scope, 0);
+}
+
+void GpuProfiler::endStatistics(VkCommandBuffer cmd, uint32_t frame, uint32_t scope)
+{
+	if (statisticsPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	vkCmdEndQuery(cmd, statisticsPool, frame * scopeCount + scope);
+	statisticsWritten[frame * scopeCount + scope] = true;
+}
+
+void GpuProfiler::markScopeWritten(uint32_t frame, uint32_t scope, bool statistics)
+{
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		written[frame * scopeCount + scope] = true;
+	}
+	if (statistics && statisticsPool != VK_NULL_HANDLE)
+	{
+		statisticsWritten[frame * scopeCount + scope] = true;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "VulkanDevice.h"
+
+/**
+* Timestamp pairs around command ranges on the graphics queue, one query slot per frame in flight.
+* A slot is read back when its frame comes around again, after the frame fence has been waited on,
+* so results lag by the number of frames in flight and never stall the CPU.
+* Scopes may be recorded into secondary command buffers on worker threads, one thread per scope.
+* Where pipelineStatisticsQuery is enabled, a scope can also count its fragment shader invocations. Statistics
+* queries of one command buffer must not overlap, so they are recorded separately from the timestamps.
+*/
+class GpuProfiler
+{
+public:
+	GpuProfiler(VulkanDevice& device, uint32_t framesInFlight, uint32_t scopeCount);
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	/** @brief Collect the previous results of frame's slot and reset it. Record outside of rendering */
+	void beginFrame(VkCommandBuffer cmd, uint32_t frame);
+
+	void beginScope(VkCommandBuffer cmd, uint32_t frame, uint32_t scope);
+	void endScope(VkCommandBuffer cmd, uint32_t frame, uint32_t scope);
+
+	/** @brief Count the fragment shader invocations between the two calls, both in the same command buffer */
+	void beginStatistics(VkCommandBuffer cmd, uint32_t frame, uint32_t scope);
+	void endStatistics(VkCommandBuffer cmd, uint32_t frame, uint32_t scope);
+
+	/** @brief Flag scope as recorded for frame without recording it, for command buffers that are replayed */
+	void markScopeWritten(uint32_t frame, uint32_t scope, bool statistics = false);
+
+	/** @brief Latest resolved duration of scope, 0 until a result is available */
+	float getMilliseconds(uint32_t scope) const { return milliseconds[scope]; }
+
+	/** @brief Latest resolved fragment shader invocation count of scope, 0 until a result is available */
+	uint64_t getFragmentInvocations(uint32_t scope) const { return fragmentInvocations[scope]; }
+
+	bool isSupported() const { return queryPool != VK_NULL_HANDLE; }
+	bool isStatisticsSupported() const { return statisticsPool != VK_NULL_HANDLE; }
+
+private:
+	uint32_t firstQuery(uint32_t frame, uint32_t scope) const { return (frame * scopeCount + scope) * 2; }
+
+	VkDevice device;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	VkQueryPool statisticsPool = VK_NULL_HANDLE; // one query per frame and scope
+	uint32_t scopeCount;
+	float timestampPeriod; // nanoseconds per tick
+	uint64_t timestampMask;
+
+	// per frame and scope, reading never written queries would not return. Bytes rather than vector<bool>, scopes
+	// of one frame may be recorded on different threads
+	std::vector<uint8_t> written;
+	std::vector<uint8_t> statisticsWritten;
+	std::vector<float> milliseconds;
+	std::vector<uint64_t> fragmentInvocations;
+};
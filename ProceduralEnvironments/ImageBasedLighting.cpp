@@ -0,0 +1,454 @@
+#include "ImageBasedLighting.h"
+
+#include "VulkanBuffer.h"
+#include "VulkanComputePass.h"
+#include "VulkanTools.h"
+#include "TextureBaker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	// bump whenever the generated maps change, so every cached set is generated again
+	const uint32_t IBL_VERSION = 1;
+
+	const uint32_t PREFILTER_SAMPLES = 512;
+	const uint32_t BRDF_SAMPLES = 512;
+	const uint32_t IRRADIANCE_PHI_STEPS = 128;
+	const uint32_t IRRADIANCE_THETA_STEPS = 32;
+
+	struct IrradianceParams {
+		float sourceLod;
+		uint32_t phiSteps;
+		uint32_t thetaSteps;
+		float _padding;
+	};
+
+	struct PrefilterParams {
+		uint32_t level;
+		float roughness;
+		uint32_t sampleCount;
+		float environmentSize;
+	};
+
+	struct BrdfParams {
+		uint32_t sampleCount;
+		float _padding[3];
+	};
+
+	VkDeviceSize alignStaging(VkDeviceSize size)
+	{
+		return (size + 15) & ~VkDeviceSize(15);
+	}
+}
+
+ImageBasedLighting::ImageBasedLighting(VulkanDevice& device, ShaderCache& shaderCache) :
+	device(device),
+	shaderCache(shaderCache)
+{
+}
+
+ImageBasedLighting::~ImageBasedLighting()
+{
+	irradiance.destroy();
+	prefiltered.destroy();
+	brdfLut.destroy();
+	if (sampler != VK_NULL_HANDLE)
+	{
+		vkDestroySampler(device.logicalDevice, sampler, nullptr);
+	}
+}
+
+void ImageBasedLighting::initialize(UploadManager& uploads, VkDescriptorPool descriptorPool, const vks::Image& environment, UploadManager::Token environmentUpload,
+	const std::string& sourceHash, const std::string& cachePrefix)
+{
+	createImages();
+	createSampler();
+
+	const std::vector<uint32_t> settings = { IBL_VERSION, IRRADIANCE_SIZE, PREFILTERED_SIZE, PREFILTERED_LEVELS, BRDF_LUT_SIZE,
+		static_cast<uint32_t>(FORMAT), PREFILTER_SAMPLES, BRDF_SAMPLES, IRRADIANCE_PHI_STEPS, IRRADIANCE_THETA_STEPS };
+
+	Ktx2File files[MAP_COUNT];
+	bool cached = true;
+	for (uint32_t map = 0; map < MAP_COUNT && cached; map++)
+	{
+		cached = TextureBaker::readDerived(getCachePath(cachePrefix, static_cast<Map>(map)), FORMAT, sourceHash, settings, files[map]);
+	}
+	if (cached)
+	{
+		upload(uploads, files);
+		return;
+	}
+
+	auto generateBegin = std::chrono::high_resolution_clock::now();
+
+	uploads.wait(environmentUpload);
+	generate(descriptorPool, environment, files);
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		TextureBaker::writeDerived(getCachePath(cachePrefix, static_cast<Map>(map)), files[map], sourceHash, settings);
+	}
+
+	float generateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - generateBegin).count();
+	std::cout << "Startup: generated image based lighting in " << generateMs << " ms" << "\n";
+}
+
+void ImageBasedLighting::createImages()
+{
+	const struct {
+		vks::Image* image;
+		uint32_t size;
+		uint32_t levels;
+		bool cube;
+	} maps[MAP_COUNT] = {
+		{ &irradiance, IRRADIANCE_SIZE, 1, true },
+		{ &prefiltered, PREFILTERED_SIZE, PREFILTERED_LEVELS, true },
+		{ &brdfLut, BRDF_LUT_SIZE, 1, false },
+	};
+
+	for (const auto& map : maps)
+	{
+		const uint32_t layers = map.cube ? 6 : 1;
+
+		VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+		imageInfo.format = FORMAT;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.extent = { map.size, map.size, 1 };
+		imageInfo.mipLevels = map.levels;
+		imageInfo.arrayLayers = layers;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		// written by compute and read back on a cache miss, uploaded on a hit
+		imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		imageInfo.flags = map.cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+
+		VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+		viewInfo.viewType = map.cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = FORMAT;
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, map.levels, 0, layers };
+
+		map.image->imageInfo = imageInfo;
+		map.image->viewInfo = viewInfo;
+		map.image->createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	}
+}
+
+void ImageBasedLighting::createSampler()
+{
+	VkSamplerCreateInfo samplerCI{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerCI.magFilter = VK_FILTER_LINEAR;
+	samplerCI.minFilter = VK_FILTER_LINEAR;
+	samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCI.anisotropyEnable = VK_FALSE;
+	samplerCI.maxAnisotropy = 1.0f;
+	samplerCI.minLod = 0.0f;
+	samplerCI.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK_RESULT(vkCreateSampler(device.logicalDevice, &samplerCI, nullptr, &sampler));
+}
+
+void ImageBasedLighting::upload(UploadManager& uploads, const Ktx2File files[MAP_COUNT])
+{
+	VkDeviceSize stagingSize = 0;
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		for (const std::vector<uint8_t>& level : files[map].levels)
+		{
+			stagingSize += alignStaging(level.size());
+		}
+	}
+	UploadManager::Staging staging = uploads.reserve(stagingSize);
+
+	VkDeviceSize stagingOffset = 0;
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		const Ktx2File& file = files[map];
+		vks::Image& image = getImage(static_cast<Map>(map));
+		if (file.width != image.imageInfo.extent.width || file.faceCount != image.imageInfo.arrayLayers || file.levels.size() != image.imageInfo.mipLevels)
+		{
+			throw std::runtime_error("Cached image based lighting does not match its settings");
+		}
+
+		// faces of a level are back to back, one region per level covers all of them
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t level = 0; level < file.levels.size(); level++)
+		{
+			memcpy(static_cast<char*>(staging.mapped) + stagingOffset, file.levels[level].data(), file.levels[level].size());
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = stagingOffset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, file.faceCount };
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { std::max(file.width >> level, 1u), std::max(file.height >> level, 1u), 1 };
+			regions.push_back(region);
+
+			stagingOffset += alignStaging(file.levels[level].size());
+		}
+
+		uploads.uploadImage(
+			image.image,
+			staging,
+			regions,
+			image.viewInfo.subresourceRange,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
+		);
+	}
+}
+
+void ImageBasedLighting::generate(VkDescriptorPool descriptorPool, const vks::Image& environment, Ktx2File files[MAP_COUNT])
+{
+	VkDescriptorSetLayoutBinding environmentBinding{};
+	environmentBinding.binding = 0;
+	environmentBinding.descriptorCount = 1;
+	environmentBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	environmentBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutBinding outputBinding{};
+	outputBinding.binding = 1;
+	outputBinding.descriptorCount = 1;
+	outputBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	outputBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VulkanComputePass::Config computeConfig{};
+	computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+	computeConfig.slangGlobalSession = nullptr;
+	computeConfig.shaderCache = &shaderCache;
+
+	VulkanComputePass irradiancePass(device);
+	computeConfig.shaderPath = "shaders/ibl_irradiance.slang";
+	computeConfig.descriptorSetLayoutBindings = { environmentBinding, outputBinding };
+	computeConfig.pushConstantSize = sizeof(IrradianceParams);
+	irradiancePass.create(computeConfig, descriptorPool);
+
+	// every level is a separate storage image, the shader picks one by push constant
+	VulkanComputePass prefilterPass(device);
+	computeConfig.shaderPath = "shaders/ibl_prefilter.slang";
+	outputBinding.descriptorCount = PREFILTERED_LEVELS;
+	computeConfig.descriptorSetLayoutBindings = { environmentBinding, outputBinding };
+	computeConfig.pushConstantSize = sizeof(PrefilterParams);
+	prefilterPass.create(computeConfig, descriptorPool);
+
+	VulkanComputePass brdfPass(device);
+	computeConfig.shaderPath = "shaders/ibl_brdf.slang";
+	outputBinding.binding = 0;
+	outputBinding.descriptorCount = 1;
+	computeConfig.descriptorSetLayoutBindings = { outputBinding };
+	computeConfig.pushConstantSize = sizeof(BrdfParams);
+	brdfPass.create(computeConfig, descriptorPool);
+
+	// the cubes are written through 2D array views, one per prefiltered level
+	std::vector<VkImageView> storageViews;
+	auto createStorageView = [&](const vks::Image& image, uint32_t level) {
+		VkImageViewCreateInfo viewInfo = image.viewInfo;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+		VkImageView view;
+		VK_CHECK_RESULT(vkCreateImageView(device.logicalDevice, &viewInfo, nullptr, &view));
+		storageViews.push_back(view);
+		return view;
+	};
+
+	VkDescriptorImageInfo environmentInfo{ environment.sampler, environment.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+	VkDescriptorImageInfo irradianceInfo{ VK_NULL_HANDLE, createStorageView(irradiance, 0), VK_IMAGE_LAYOUT_GENERAL };
+	std::vector<VkDescriptorImageInfo> prefilteredInfos(PREFILTERED_LEVELS);
+	for (uint32_t level = 0; level < PREFILTERED_LEVELS; level++)
+	{
+		prefilteredInfos[level] = { VK_NULL_HANDLE, createStorageView(prefiltered, level), VK_IMAGE_LAYOUT_GENERAL };
+	}
+	VkDescriptorImageInfo brdfLutInfo{ VK_NULL_HANDLE, brdfLut.imageView, VK_IMAGE_LAYOUT_GENERAL };
+
+	auto write = [](uint32_t binding, VkDescriptorType type, const VkDescriptorImageInfo* infos, uint32_t count) {
+		VkWriteDescriptorSet descriptorWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.descriptorCount = count;
+		descriptorWrite.descriptorType = type;
+		descriptorWrite.pImageInfo = infos;
+		return descriptorWrite;
+	};
+	irradiancePass.updateDescriptors({
+		write(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &environmentInfo, 1),
+		write(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &irradianceInfo, 1) });
+	prefilterPass.updateDescriptors({
+		write(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &environmentInfo, 1),
+		write(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, prefilteredInfos.data(), PREFILTERED_LEVELS) });
+	brdfPass.updateDescriptors({
+		write(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &brdfLutInfo, 1) });
+
+	// readback buffer, every level of every map in the order the KTX2 files store them
+	VkDeviceSize readbackSize = 0;
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		const vks::Image& image = getImage(static_cast<Map>(map));
+		for (uint32_t level = 0; level < image.imageInfo.mipLevels; level++)
+		{
+			const uint32_t size = std::max(image.imageInfo.extent.width >> level, 1u);
+			readbackSize += alignStaging(Ktx2File::getLevelSize(FORMAT, size, size) * image.imageInfo.arrayLayers);
+		}
+	}
+	vks::Buffer readback;
+	readback.create(device, readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	readback.map();
+
+	VkCommandBuffer cmd = vks::tools::beginSingleTimeCommands(device.logicalDevice, device.graphicsCommandPool);
+
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		const vks::Image& image = getImage(static_cast<Map>(map));
+		vks::tools::insertImageMemoryBarrier(
+			cmd,
+			image.image,
+			0,
+			VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			image.viewInfo.subresourceRange
+		);
+	}
+
+	const uint32_t environmentSize = environment.imageInfo.extent.width;
+	const uint32_t environmentLevels = environment.imageInfo.mipLevels;
+
+	// sample spacing of the irradiance integral is about the texel size of a 32 wide face
+	IrradianceParams irradianceParams{};
+	irradianceParams.sourceLod = std::clamp(std::log2(environmentSize / 32.0f), 0.0f, static_cast<float>(environmentLevels - 1));
+	irradianceParams.phiSteps = IRRADIANCE_PHI_STEPS;
+	irradianceParams.thetaSteps = IRRADIANCE_THETA_STEPS;
+	irradiancePass.recordCommands(cmd, &irradianceParams, (IRRADIANCE_SIZE + 7) / 8, (IRRADIANCE_SIZE + 7) / 8, 6);
+
+	for (uint32_t level = 0; level < PREFILTERED_LEVELS; level++)
+	{
+		const uint32_t size = std::max(PREFILTERED_SIZE >> level, 1u);
+		PrefilterParams prefilterParams{};
+		prefilterParams.level = level;
+		prefilterParams.roughness = static_cast<float>(level) / (PREFILTERED_LEVELS - 1);
+		prefilterParams.sampleCount = PREFILTER_SAMPLES;
+		prefilterParams.environmentSize = static_cast<float>(environmentSize);
+		prefilterPass.recordCommands(cmd, &prefilterParams, (size + 7) / 8, (size + 7) / 8, 6);
+	}
+
+	BrdfParams brdfParams{};
+	brdfParams.sampleCount = BRDF_SAMPLES;
+	brdfPass.recordCommands(cmd, &brdfParams, (BRDF_LUT_SIZE + 7) / 8, (BRDF_LUT_SIZE + 7) / 8, 1);
+
+	VkDeviceSize readbackOffset = 0;
+	std::vector<VkDeviceSize> levelOffsets;
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		const vks::Image& image = getImage(static_cast<Map>(map));
+		vks::tools::insertImageMemoryBarrier(
+			cmd,
+			image.image,
+			VK_ACCESS_SHADER_WRITE_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_GENERAL,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			image.viewInfo.subresourceRange
+		);
+
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t level = 0; level < image.imageInfo.mipLevels; level++)
+		{
+			const uint32_t size = std::max(image.imageInfo.extent.width >> level, 1u);
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = readbackOffset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, image.imageInfo.arrayLayers };
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { size, size, 1 };
+			regions.push_back(region);
+
+			levelOffsets.push_back(readbackOffset);
+			readbackOffset += alignStaging(Ktx2File::getLevelSize(FORMAT, size, size) * image.imageInfo.arrayLayers);
+		}
+		vkCmdCopyImageToBuffer(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+		vks::tools::insertImageMemoryBarrier(
+			cmd,
+			image.image,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			image.viewInfo.subresourceRange
+		);
+	}
+
+	vks::tools::insertBufferMemoryBarrier(
+		cmd,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_ACCESS_HOST_READ_BIT,
+		readback.buffer,
+		0,
+		VK_WHOLE_SIZE,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT
+	);
+
+	vks::tools::endSingleTimeCommands(cmd, device.logicalDevice, device.graphicsQueue, device.graphicsCommandPool);
+
+	size_t levelIndex = 0;
+	for (uint32_t map = 0; map < MAP_COUNT; map++)
+	{
+		const vks::Image& image = getImage(static_cast<Map>(map));
+		Ktx2File& file = files[map];
+		file.format = FORMAT;
+		file.width = image.imageInfo.extent.width;
+		file.height = image.imageInfo.extent.height;
+		file.faceCount = image.imageInfo.arrayLayers;
+		file.levels.clear();
+		for (uint32_t level = 0; level < image.imageInfo.mipLevels; level++, levelIndex++)
+		{
+			const uint32_t size = std::max(file.width >> level, 1u);
+			const char* data = static_cast<const char*>(readback.mapped) + levelOffsets[levelIndex];
+			file.levels.emplace_back(data, data + Ktx2File::getLevelSize(FORMAT, size, size) * file.faceCount);
+		}
+	}
+
+	readback.destroy();
+	for (VkImageView view : storageViews)
+	{
+		vkDestroyImageView(device.logicalDevice, view, nullptr);
+	}
+	// the passes are only needed on a cache miss, their sets go back to the pool
+	const VkDescriptorSet sets[] = { irradiancePass.getDescriptorSet(), prefilterPass.getDescriptorSet(), brdfPass.getDescriptorSet() };
+	vkFreeDescriptorSets(device.logicalDevice, descriptorPool, 3, sets);
+}
+
+vks::Image& ImageBasedLighting::getImage(Map map)
+{
+	switch (map)
+	{
+	case MAP_IRRADIANCE:
+		return irradiance;
+	case MAP_PREFILTERED:
+		return prefiltered;
+	case MAP_BRDF_LUT:
+	default:
+		return brdfLut;
+	}
+}
+
+std::string ImageBasedLighting::getCachePath(const std::string& cachePrefix, Map map)
+{
+	static const char* suffixes[MAP_COUNT] = { "_Irradiance.ktx2", "_Prefiltered.ktx2", "_BrdfLut.ktx2" };
+	return cachePrefix + suffixes[map];
+}
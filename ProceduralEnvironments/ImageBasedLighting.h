@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+#include "VulkanDevice.h"
+#include "VulkanImage.h"
+#include "ShaderCache.h"
+#include "UploadManager.h"
+#include "Ktx2File.h"
+
+/**
+* Split sum image based lighting derived from the skybox cubemap:
+*  - irradiance: small cube of the cosine convolved environment, for diffuse
+*  - prefiltered: GGX convolved environment, roughness 0 to 1 spread over the mip levels, for specular
+*  - brdf lut: scale and bias to F0 by n.v and roughness
+* The three are computed once with compute passes, read back and cached next to the skybox. The cache
+* is keyed by the skybox source hash, so later runs only upload it.
+*/
+class ImageBasedLighting
+{
+public:
+	static const uint32_t IRRADIANCE_SIZE = 32;
+	static const uint32_t PREFILTERED_SIZE = 128;
+	static const uint32_t PREFILTERED_LEVELS = 6; // matches ibl_prefilter.slang and shader.slang
+	static const uint32_t BRDF_LUT_SIZE = 128;
+	static const VkFormat FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	ImageBasedLighting(VulkanDevice& device, ShaderCache& shaderCache);
+	~ImageBasedLighting();
+
+	ImageBasedLighting(const ImageBasedLighting&) = delete;
+	ImageBasedLighting& operator=(const ImageBasedLighting&) = delete;
+
+	/**
+	* @brief Upload the cached maps when they match sourceHash, otherwise wait for environmentUpload, generate them
+	* from environment on the graphics queue and write the cache. cachePrefix gets _Irradiance.ktx2 and so on appended.
+	* A cache hit returns before the upload completes, like any other UploadManager upload.
+	*/
+	void initialize(UploadManager& uploads, VkDescriptorPool descriptorPool, const vks::Image& environment, UploadManager::Token environmentUpload,
+		const std::string& sourceHash, const std::string& cachePrefix);
+
+	const vks::Image& getIrradiance() const { return irradiance; }
+	const vks::Image& getPrefiltered() const { return prefiltered; }
+	const vks::Image& getBrdfLut() const { return brdfLut; }
+	VkSampler getSampler() const { return sampler; }
+
+private:
+	enum Map : uint32_t { MAP_IRRADIANCE, MAP_PREFILTERED, MAP_BRDF_LUT, MAP_COUNT };
+
+	void createImages();
+	void createSampler();
+	void upload(UploadManager& uploads, const Ktx2File files[MAP_COUNT]);
+	/** @brief Run the compute passes and read every level of the results back into files */
+	void generate(VkDescriptorPool descriptorPool, const vks::Image& environment, Ktx2File files[MAP_COUNT]);
+
+	vks::Image& getImage(Map map);
+	static std::string getCachePath(const std::string& cachePrefix, Map map);
+
+	VulkanDevice& device;
+	ShaderCache& shaderCache;
+
+	vks::Image irradiance;
+	vks::Image prefiltered;
+	vks::Image brdfLut;
+	VkSampler sampler = VK_NULL_HANDLE;
+};
@@ -0,0 +1,359 @@
+#include "Ktx2File.h"
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+	const uint8_t ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+#pragma pack(push, 1)
+	struct Header {
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+#pragma pack(pop)
+	static_assert(sizeof(Header) == 68, "KTX2 header must be tightly packed");
+
+	struct LevelIndex {
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// Khronos data format descriptor values
+	const uint32_t KHR_DF_MODEL_RGBSDA = 1;
+	const uint32_t KHR_DF_MODEL_BC4 = 131;
+	const uint32_t KHR_DF_MODEL_BC5 = 132;
+	const uint32_t KHR_DF_MODEL_BC7 = 134;
+	const uint32_t KHR_DF_PRIMARIES_BT709 = 1;
+	const uint32_t KHR_DF_TRANSFER_LINEAR = 1;
+	const uint32_t KHR_DF_TRANSFER_SRGB = 2;
+	const uint32_t KHR_DF_SAMPLE_DATATYPE_LINEAR = 0x10;
+	const uint32_t KHR_DF_SAMPLE_DATATYPE_SIGNED = 0x40;
+	const uint32_t KHR_DF_SAMPLE_DATATYPE_FLOAT = 0x80;
+	const uint32_t FLOAT_ONE_BITS = 0x3F800000;
+	const uint32_t FLOAT_MINUS_ONE_BITS = 0xBF800000;
+
+	bool isSrgb(VkFormat format)
+	{
+		return format == VK_FORMAT_BC7_SRGB_BLOCK || format == VK_FORMAT_R8G8B8A8_SRGB;
+	}
+
+	bool isBlockCompressed(VkFormat format)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** Size of the data type for endianness conversion, the header's typeSize */
+	uint32_t getTypeSize(VkFormat format)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+			return 2;
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+			return 4;
+		default:
+			return 1;
+		}
+	}
+
+	/** Basic descriptor block with one sample per channel, as the KTX2 spec requires for every file */
+	std::vector<uint32_t> buildDataFormatDescriptor(VkFormat format)
+	{
+		struct Sample {
+			uint32_t bitOffset;
+			uint32_t bitLength;
+			uint32_t channel;
+			uint32_t upper;
+			uint32_t lower = 0;
+		};
+
+		uint32_t model;
+		std::vector<Sample> samples;
+		switch (format)
+		{
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			model = KHR_DF_MODEL_BC4;
+			samples = { { 0, 64, 0, UINT32_MAX } };
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			model = KHR_DF_MODEL_BC5;
+			samples = { { 0, 64, 0, UINT32_MAX }, { 64, 64, 1, UINT32_MAX } };
+			break;
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			model = KHR_DF_MODEL_BC7;
+			samples = { { 0, 128, 0, UINT32_MAX } };
+			break;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			model = KHR_DF_MODEL_RGBSDA;
+			samples = { { 0, 8, 0, 255 }, { 8, 8, 1, 255 }, { 16, 8, 2, 255 },
+				{ 24, 8, 15u | (isSrgb(format) ? KHR_DF_SAMPLE_DATATYPE_LINEAR : 0u), 255 } };
+			break;
+		case VK_FORMAT_R16G16B16A16_SFLOAT:
+		{
+			model = KHR_DF_MODEL_RGBSDA;
+			const uint32_t qualifiers = KHR_DF_SAMPLE_DATATYPE_FLOAT | KHR_DF_SAMPLE_DATATYPE_SIGNED;
+			samples = { { 0, 16, 0 | qualifiers, FLOAT_ONE_BITS, FLOAT_MINUS_ONE_BITS }, { 16, 16, 1 | qualifiers, FLOAT_ONE_BITS, FLOAT_MINUS_ONE_BITS },
+				{ 32, 16, 2 | qualifiers, FLOAT_ONE_BITS, FLOAT_MINUS_ONE_BITS }, { 48, 16, 15 | qualifiers, FLOAT_ONE_BITS, FLOAT_MINUS_ONE_BITS } };
+			break;
+		}
+		case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+			model = KHR_DF_MODEL_RGBSDA;
+			samples = { { 0, 11, 0 | KHR_DF_SAMPLE_DATATYPE_FLOAT, FLOAT_ONE_BITS }, { 11, 11, 1 | KHR_DF_SAMPLE_DATATYPE_FLOAT, FLOAT_ONE_BITS },
+				{ 22, 10, 2 | KHR_DF_SAMPLE_DATATYPE_FLOAT, FLOAT_ONE_BITS } };
+			break;
+		default:
+			throw std::runtime_error("No data format descriptor for format " + std::to_string(format));
+		}
+
+		const uint32_t blockDimension = Ktx2File::getBlockDimension(format) - 1;
+		const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+
+		std::vector<uint32_t> dfd;
+		dfd.push_back(4 + blockSize); // dfdTotalSize
+		dfd.push_back(0); // vendor Khronos, basic descriptor block
+		dfd.push_back(2 | (blockSize << 16)); // version 1.3
+		dfd.push_back(model | (KHR_DF_PRIMARIES_BT709 << 8) | ((isSrgb(format) ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+		dfd.push_back(blockDimension | (blockDimension << 8));
+		dfd.push_back(Ktx2File::getBlockBytes(format));
+		dfd.push_back(0);
+		for (const Sample& sample : samples)
+		{
+			dfd.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+			dfd.push_back(0);
+			dfd.push_back(sample.lower);
+			dfd.push_back(sample.upper);
+		}
+		return dfd;
+	}
+}
+
+uint32_t Ktx2File::getBlockBytes(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		return 4;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return 8;
+	default:
+		throw std::runtime_error("Unsupported KTX2 format " + std::to_string(format));
+	}
+}
+
+uint32_t Ktx2File::getBlockDimension(VkFormat format)
+{
+	return isBlockCompressed(format) ? 4 : 1;
+}
+
+size_t Ktx2File::getLevelSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	const uint32_t dimension = getBlockDimension(format);
+	return static_cast<size_t>((width + dimension - 1) / dimension) * ((height + dimension - 1) / dimension) * getBlockBytes(format);
+}
+
+bool Ktx2File::read(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), data.size());
+	if (!file)
+	{
+		return false;
+	}
+
+	Header header;
+	if (data.size() < sizeof(ktx2Identifier) + sizeof(Header) || memcmp(data.data(), ktx2Identifier, sizeof(ktx2Identifier)) != 0)
+	{
+		return false;
+	}
+	memcpy(&header, data.data() + sizeof(ktx2Identifier), sizeof(Header));
+
+	format = static_cast<VkFormat>(header.vkFormat);
+	switch (format)
+	{
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		break;
+	default:
+		return false;
+	}
+	if (header.pixelDepth != 0 || header.layerCount != 0 || header.levelCount == 0 || header.levelCount > 32 || header.supercompressionScheme != 0)
+	{
+		return false;
+	}
+	// cubemap faces are square
+	if (header.faceCount != 1 && (header.faceCount != 6 || header.pixelWidth != header.pixelHeight))
+	{
+		return false;
+	}
+	width = header.pixelWidth;
+	height = header.pixelHeight;
+	faceCount = header.faceCount;
+
+	const size_t levelIndexOffset = sizeof(ktx2Identifier) + sizeof(Header);
+	if (data.size() < levelIndexOffset + header.levelCount * sizeof(LevelIndex))
+	{
+		return false;
+	}
+
+	levels.assign(header.levelCount, {});
+	for (uint32_t level = 0; level < header.levelCount; level++)
+	{
+		LevelIndex index;
+		memcpy(&index, data.data() + levelIndexOffset + level * sizeof(LevelIndex), sizeof(LevelIndex));
+
+		const size_t expected = getLevelSize(format, std::max(width >> level, 1u), std::max(height >> level, 1u)) * faceCount;
+		if (index.byteLength != expected || index.byteOffset > data.size() || data.size() - index.byteOffset < index.byteLength)
+		{
+			return false;
+		}
+		levels[level].assign(data.begin() + index.byteOffset, data.begin() + index.byteOffset + index.byteLength);
+	}
+
+	keyValues.clear();
+	if (header.kvdByteOffset > data.size() || data.size() - header.kvdByteOffset < header.kvdByteLength)
+	{
+		return false;
+	}
+	size_t offset = header.kvdByteOffset;
+	const size_t kvdEnd = static_cast<size_t>(header.kvdByteOffset) + header.kvdByteLength;
+	while (offset + sizeof(uint32_t) <= kvdEnd)
+	{
+		uint32_t length;
+		memcpy(&length, data.data() + offset, sizeof(length));
+		offset += sizeof(length);
+		if (length > kvdEnd - offset)
+		{
+			return false;
+		}
+
+		// key and value are both NUL terminated
+		const char* entry = reinterpret_cast<const char*>(data.data() + offset);
+		const size_t keyLength = strnlen(entry, length);
+		if (keyLength < length)
+		{
+			std::string value(entry + keyLength + 1, length - keyLength - 1);
+			if (!value.empty() && value.back() == '\0')
+			{
+				value.pop_back();
+			}
+			keyValues[std::string(entry, keyLength)] = value;
+		}
+		offset = static_cast<size_t>(vks::tools::alignUp(offset + length, 4));
+	}
+
+	return true;
+}
+
+void Ktx2File::write(const std::string& path) const
+{
+	const std::vector<uint32_t> dfd = buildDataFormatDescriptor(format);
+
+	// std::map keeps the keys sorted, as the spec requires
+	std::vector<uint8_t> kvd;
+	for (const auto& [key, value] : keyValues)
+	{
+		const uint32_t length = static_cast<uint32_t>(key.size() + 1 + value.size() + 1);
+		const size_t start = kvd.size();
+		kvd.resize(static_cast<size_t>(vks::tools::alignUp(start + sizeof(length) + length, 4)), 0);
+		memcpy(kvd.data() + start, &length, sizeof(length));
+		memcpy(kvd.data() + start + sizeof(length), key.c_str(), key.size() + 1);
+		memcpy(kvd.data() + start + sizeof(length) + key.size() + 1, value.c_str(), value.size() + 1);
+	}
+
+	Header header{};
+	header.vkFormat = static_cast<uint32_t>(format);
+	header.typeSize = getTypeSize(format);
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = faceCount;
+	header.levelCount = static_cast<uint32_t>(levels.size());
+
+	const size_t levelIndexOffset = sizeof(ktx2Identifier) + sizeof(Header);
+	header.dfdByteOffset = static_cast<uint32_t>(levelIndexOffset + levels.size() * sizeof(LevelIndex));
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	header.kvdByteOffset = kvd.empty() ? 0 : header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+	// levels are stored smallest first, each aligned to the texel block size
+	const size_t levelAlignment = std::lcm<size_t>(getBlockBytes(format), 4);
+	std::vector<LevelIndex> levelIndices(levels.size());
+	size_t offset = static_cast<size_t>(header.dfdByteOffset) + header.dfdByteLength + header.kvdByteLength;
+	for (size_t level = levels.size(); level-- > 0;)
+	{
+		offset = static_cast<size_t>(vks::tools::alignUp(offset, levelAlignment));
+		levelIndices[level] = { offset, levels[level].size(), levels[level].size() };
+		offset += levels[level].size();
+	}
+
+	std::vector<uint8_t> data(offset, 0);
+	memcpy(data.data(), ktx2Identifier, sizeof(ktx2Identifier));
+	memcpy(data.data() + sizeof(ktx2Identifier), &header, sizeof(header));
+	memcpy(data.data() + levelIndexOffset, levelIndices.data(), levelIndices.size() * sizeof(LevelIndex));
+	memcpy(data.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+	if (!kvd.empty())
+	{
+		memcpy(data.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+	}
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		memcpy(data.data() + levelIndices[level].byteOffset, levels[level].data(), levels[level].size());
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	if (!file)
+	{
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
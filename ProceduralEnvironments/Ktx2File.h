@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+* Minimal KTX2 container: one 2D image or cubemap with a mip chain, no layers or supercompression.
+* Only the formats produced by the texture baker are understood, anything else fails to read.
+*/
+struct Ktx2File
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t faceCount = 1; // 6 for a cubemap
+	std::vector<std::vector<uint8_t>> levels; // level 0 first, the faces of a cubemap back to back in +X -X +Y -Y +Z -Z order
+	std::map<std::string, std::string> keyValues;
+
+	/** @brief Returns false when the file is missing, malformed or uses an unsupported layout */
+	bool read(const std::string& path);
+
+	/** @brief Throws when the file can't be written */
+	void write(const std::string& path) const;
+
+	/** @brief Bytes of one texel block and its dimension in texels, throws for unsupported formats */
+	static uint32_t getBlockBytes(VkFormat format);
+	static uint32_t getBlockDimension(VkFormat format);
+
+	/** @brief Tightly packed size of one level of one face */
+	static size_t getLevelSize(VkFormat format, uint32_t width, uint32_t height);
+};
@@ -0,0 +1,193 @@
+#include "MaterialArray.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <stdexcept>
+
+MaterialArray::MaterialArray() :
+	sampler(VK_NULL_HANDLE)
+{
+}
+
+MaterialArray::~MaterialArray()
+{
+	color.destroy();
+	normal.destroy();
+	surface.destroy();
+	if (sampler != VK_NULL_HANDLE)
+	{
+		vkDestroySampler(device, sampler, nullptr);
+	}
+}
+
+MaterialArray::SourcePaths MaterialArray::ambientCGPaths(const std::string& directory, const std::string& name)
+{
+	const std::string prefix = directory + "/" + name + "_1K-PNG_";
+
+	SourcePaths paths;
+	paths.color = prefix + "Color.png";
+	paths.ambientOcclusion = prefix + "AmbientOcclusion.png";
+	paths.normal = directory + "/" + name + ".png";
+	paths.roughness = prefix + "Roughness.png";
+	paths.displacement = prefix + "Displacement.png";
+	paths.bakedPrefix = directory + "/baked/" + name;
+	return paths;
+}
+
+UploadManager::Token MaterialArray::load(VulkanDevice& device, UploadManager& uploads, ThreadPool& threadPool, const TextureBaker& baker,
+	const std::vector<SourcePaths>& materials)
+{
+	if (materials.empty())
+	{
+		throw std::runtime_error("MaterialArray needs at least one material");
+	}
+
+	std::vector<BakeJob> jobs;
+	for (const SourcePaths& paths : materials)
+	{
+		appendBakeJobs(paths, jobs);
+	}
+
+	layerCount = static_cast<uint32_t>(materials.size());
+	uploadLayers(device, uploads, runBakeJobs(threadPool, baker, jobs));
+	createSampler(device);
+
+	return uploads.submit();
+}
+
+void MaterialArray::bakeConcurrently(ThreadPool& threadPool, const TextureBaker& baker, const std::vector<SourcePaths>& materials)
+{
+	std::vector<BakeJob> jobs;
+	for (const SourcePaths& paths : materials)
+	{
+		appendBakeJobs(paths, jobs);
+	}
+	runBakeJobs(threadPool, baker, jobs);
+}
+
+void MaterialArray::appendBakeJobs(const SourcePaths& paths, std::vector<BakeJob>& jobs)
+{
+	jobs.push_back({ paths.bakedPrefix + "_Color.ktx2", TextureBaker::Layout::Color, { paths.color } });
+	jobs.push_back({ paths.bakedPrefix + "_Normal.ktx2", TextureBaker::Layout::Normal, { paths.normal } });
+	jobs.push_back({ paths.bakedPrefix + "_Surface.ktx2", TextureBaker::Layout::Surface,
+		{ paths.ambientOcclusion, paths.roughness, paths.displacement } });
+}
+
+std::vector<Ktx2File> MaterialArray::runBakeJobs(ThreadPool& threadPool, const TextureBaker& baker, const std::vector<BakeJob>& jobs)
+{
+	std::vector<std::future<Ktx2File>> loads;
+	loads.reserve(jobs.size());
+	for (const BakeJob& job : jobs)
+	{
+		loads.push_back(threadPool.submit([&baker, &job]() { return baker.loadOrBake(job.cachePath, job.layout, job.sources); }));
+	}
+
+	// every task has to finish before leaving, they reference jobs and the baker
+	std::vector<Ktx2File> files;
+	files.reserve(jobs.size());
+	std::exception_ptr failure;
+	for (std::future<Ktx2File>& load : loads)
+	{
+		try
+		{
+			files.push_back(load.get());
+		}
+		catch (...)
+		{
+			if (!failure)
+			{
+				failure = std::current_exception();
+			}
+		}
+	}
+	if (failure)
+	{
+		std::rethrow_exception(failure);
+	}
+	return files;
+}
+
+/**
+* files holds the color, normal and surface file of each material in turn.
+* Each array gets its layers copied level by level from one shared staging reservation.
+*/
+void MaterialArray::uploadLayers(VulkanDevice& device, UploadManager& uploads, const std::vector<Ktx2File>& files)
+{
+	// one reservation for every level of every layer, each level on a block and copy offset boundary
+	VkDeviceSize stagingSize = 0;
+	for (const Ktx2File& file : files)
+	{
+		for (const std::vector<uint8_t>& level : file.levels)
+		{
+			stagingSize += (static_cast<VkDeviceSize>(level.size()) + 15) & ~VkDeviceSize(15);
+		}
+	}
+	UploadManager::Staging staging = uploads.reserve(stagingSize);
+
+	vks::Image* arrays[TEXTURES_PER_MATERIAL] = { &color, &normal, &surface };
+
+	VkDeviceSize stagingOffset = 0;
+	for (uint32_t texture = 0; texture < TEXTURES_PER_MATERIAL; texture++)
+	{
+		const Ktx2File& first = files[texture];
+		const uint32_t levelCount = static_cast<uint32_t>(first.levels.size());
+
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t layer = 0; layer < layerCount; layer++)
+		{
+			const Ktx2File& file = files[layer * TEXTURES_PER_MATERIAL + texture];
+			if (file.width != first.width || file.height != first.height || file.format != first.format || file.levels.size() != levelCount)
+			{
+				throw std::runtime_error("Terrain materials differ in size or format, every material needs the same resolution");
+			}
+
+			for (uint32_t level = 0; level < levelCount; level++)
+			{
+				memcpy(static_cast<char*>(staging.mapped) + stagingOffset, file.levels[level].data(), file.levels[level].size());
+
+				VkBufferImageCopy region{};
+				region.bufferOffset = stagingOffset;
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.mipLevel = level;
+				region.imageSubresource.baseArrayLayer = layer;
+				region.imageSubresource.layerCount = 1;
+				region.imageOffset = { 0, 0, 0 };
+				region.imageExtent = { std::max(file.width >> level, 1u), std::max(file.height >> level, 1u), 1 };
+				regions.push_back(region);
+
+				stagingOffset += (static_cast<VkDeviceSize>(file.levels[level].size()) + 15) & ~VkDeviceSize(15);
+			}
+		}
+
+		arrays[texture]->createTexture2DArray(device, first.width, first.height, layerCount, first.format, levelCount, false);
+
+		uploads.uploadImage(
+			arrays[texture]->image,
+			staging,
+			regions,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, layerCount },
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
+		);
+	}
+}
+
+void MaterialArray::createSampler(VulkanDevice& device)
+{
+	this->device = device.logicalDevice;
+
+	VkSamplerCreateInfo samplerCI{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerCI.magFilter = VK_FILTER_LINEAR;
+	samplerCI.minFilter = VK_FILTER_LINEAR;
+	samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCI.maxAnisotropy = vks::Image::getMaxAnisotropy(device);
+	samplerCI.anisotropyEnable = VK_TRUE;
+	samplerCI.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK_RESULT(vkCreateSampler(device.logicalDevice, &samplerCI, nullptr, &sampler));
+}
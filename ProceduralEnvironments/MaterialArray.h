@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "VulkanImage.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+#include "UploadManager.h"
+#include "ThreadPool.h"
+#include "TextureBaker.h"
+#include <string>
+#include <vector>
+
+/**
+* Every terrain material in three 2D array images, one layer per material, so a single descriptor set
+* covers all of them and the fragment shader picks layers by index.
+* The five source maps of a material are packed by the TextureBaker: color, normal (XY) and
+* surface (R = ambient occlusion, G = roughness, B = displacement).
+* All materials must share one resolution, the baked files then share their format and level count.
+*/
+class MaterialArray
+{
+public:
+	MaterialArray();
+	~MaterialArray();
+
+	MaterialArray(const MaterialArray&) = delete;
+	MaterialArray& operator=(const MaterialArray&) = delete;
+
+	struct SourcePaths {
+		std::string color;
+		std::string ambientOcclusion;
+		std::string normal;
+		std::string roughness;
+		std::string displacement;
+		std::string bakedPrefix; // baked files are <bakedPrefix>_Color.ktx2 and so on
+	};
+
+	/** @brief Files of an ambientCG 1K PNG set, the normal map is stored under the bare set name */
+	static SourcePaths ambientCGPaths(const std::string& directory, const std::string& name);
+
+	/**
+	* @brief Load materials into the layers of the arrays, in order.
+	* Every texture of every material is read, or baked when stale, concurrently on the pool, then all
+	* copies are recorded into a single upload batch. Returns the token of that batch.
+	*/
+	UploadManager::Token load(VulkanDevice& device, UploadManager& uploads, ThreadPool& threadPool, const TextureBaker& baker,
+		const std::vector<SourcePaths>& materials);
+
+	/** @brief Refresh the bake cache of every material without loading anything, for the offline bake step */
+	static void bakeConcurrently(ThreadPool& threadPool, const TextureBaker& baker, const std::vector<SourcePaths>& materials);
+
+	const vks::Image& getColor() const { return color; }
+	const vks::Image& getNormal() const { return normal; }
+	const vks::Image& getSurface() const { return surface; }
+	VkSampler getSampler() const { return sampler; }
+	uint32_t getLayerCount() const { return layerCount; }
+
+private:
+	struct BakeJob {
+		std::string cachePath;
+		TextureBaker::Layout layout;
+		std::vector<std::string> sources;
+	};
+
+	static void appendBakeJobs(const SourcePaths& paths, std::vector<BakeJob>& jobs);
+	static std::vector<Ktx2File> runBakeJobs(ThreadPool& threadPool, const TextureBaker& baker, const std::vector<BakeJob>& jobs);
+	void uploadLayers(VulkanDevice& device, UploadManager& uploads, const std::vector<Ktx2File>& files);
+
+	void createSampler(VulkanDevice& device);
+
+	VkDevice device = VK_NULL_HANDLE;
+
+	// color, normal and surface, in TextureBaker::Layout order
+	static const uint32_t TEXTURES_PER_MATERIAL = 3;
+
+	vks::Image color;
+	vks::Image normal;
+	vks::Image surface;
+	uint32_t layerCount = 0;
+
+	VkSampler sampler;
+};
@@ -0,0 +1,463 @@
+#include "OcclusionCuller.h"
+
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+	/** Mirrors CullConstants in occlusion_cull.slang */
+	struct CullConstants {
+		glm::mat4 viewProj;
+		glm::mat4 pyramidViewProj;
+		glm::vec4 frustumPlanes[6];
+		glm::vec2 pyramidSize;
+		uint32_t pyramidLevels;
+		uint32_t patchCount;
+		uint32_t patchIndexCount;
+		uint32_t earlyOcclusion;
+		uint32_t reverseZ;
+		uint32_t _padding;
+	};
+
+	struct BuildParams {
+		uint32_t level;
+		uint32_t reverseZ;
+		uint32_t depthExtent[2];
+	};
+
+	struct CullParams {
+		uint32_t phase;
+	};
+
+	const uint32_t CULL_GROUP_SIZE = 64;
+	const uint32_t BUILD_GROUP_SIZE = 8;
+
+	uint32_t floorPowerOfTwo(uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result * 2 <= value)
+		{
+			result *= 2;
+		}
+		return result;
+	}
+}
+
+OcclusionCuller::OcclusionCuller(VulkanDevice& device, ShaderCache& shaderCache, FrameConstantAllocator& frameConstants, const Terrain& terrain,
+	uint32_t frameCount, ThreadPool* threadPool) :
+	device(device),
+	shaderCache(shaderCache),
+	frameConstants(frameConstants),
+	terrain(terrain),
+	frameCount(frameCount),
+	threadPool(threadPool)
+{
+	createBuffers();
+	createPasses();
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	// builds still in flight reference the passes
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.wait();
+	}
+	pipelineBuilds.clear();
+
+	destroyTarget(target);
+	buildPass.reset();
+	cullPass.reset();
+
+	counters.destroy();
+	earlyDraws.destroy();
+	lateDraws.destroy();
+	candidates.destroy();
+	readback.destroy();
+}
+
+void OcclusionCuller::extractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6])
+{
+	// rows of the clip transform combined so that inside the frustum every plane is >= 0. Holds for 0 to 1 clip depth
+	// in either direction, reverse-Z only swaps the near and far plane
+	auto row = [&](int i) { return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+	planes[0] = row(3) + row(0);
+	planes[1] = row(3) - row(0);
+	planes[2] = row(3) + row(1);
+	planes[3] = row(3) - row(1);
+	planes[4] = row(2);
+	planes[5] = row(3) - row(2);
+}
+
+void OcclusionCuller::waitForPipelines()
+{
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.get();
+	}
+	pipelineBuilds.clear();
+}
+
+void OcclusionCuller::createBuffers()
+{
+	const VkDeviceSize patchCount = terrain.getPatchCount();
+
+	counters.create(device, sizeof(OcclusionStats),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	earlyDraws.create(device, sizeof(VkDrawIndexedIndirectCommand) * patchCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	lateDraws.create(device, sizeof(VkDrawIndexedIndirectCommand) * patchCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	candidates.create(device, sizeof(uint32_t) * patchCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	readback.create(device, sizeof(OcclusionStats) * frameCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VK_CHECK_RESULT(readback.map());
+	// slots that were never written read as nothing culled
+	memset(readback.mapped, 0, sizeof(OcclusionStats) * frameCount);
+}
+
+void OcclusionCuller::createPasses()
+{
+	auto binding = [](uint32_t index, VkDescriptorType type, uint32_t count = 1) {
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = index;
+		layoutBinding.descriptorType = type;
+		layoutBinding.descriptorCount = count;
+		layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		return layoutBinding;
+	};
+
+	VulkanComputePass::Config computeConfig{};
+	computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+	computeConfig.slangGlobalSession = nullptr;
+	computeConfig.shaderCache = &shaderCache;
+
+	// depth and every level of the pyramid as a separate storage image, the shader picks one by push constant
+	buildPass = std::make_unique<VulkanComputePass>(device);
+	computeConfig.shaderPath = "shaders/hiz_build.slang";
+	computeConfig.descriptorSetLayoutBindings = {
+		binding(0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE),
+		binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS) };
+	computeConfig.pushConstantSize = sizeof(BuildParams);
+	buildPass->createLayouts(computeConfig);
+
+	// constants, patch bounds, pyramid, early draws, late draws, candidates, counters
+	cullPass = std::make_unique<VulkanComputePass>(device);
+	computeConfig.shaderPath = "shaders/occlusion_cull.slang";
+	computeConfig.descriptorSetLayoutBindings = {
+		binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+		binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(2, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE),
+		binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) };
+	computeConfig.pushConstantSize = sizeof(CullParams);
+	cullPass->createLayouts(computeConfig);
+
+	for (VulkanComputePass* pass : { buildPass.get(), cullPass.get() })
+	{
+		if (threadPool == nullptr)
+		{
+			pass->createPipeline();
+			continue;
+		}
+		pipelineBuilds.push_back(threadPool->submit([pass]() { pass->createPipeline(); }));
+	}
+}
+
+void OcclusionCuller::resize(const vks::Image& depth, uint64_t frameNumber)
+{
+	// frames in flight may still build or read the old pyramid
+	if (target.descriptorPool != VK_NULL_HANDLE)
+	{
+		Target retired = target;
+		device.deletionQueue->retire(frameNumber, [this, retired]() mutable { destroyTarget(retired); });
+		target = Target{};
+	}
+
+	const uint32_t width = floorPowerOfTwo(depth.imageInfo.extent.width);
+	const uint32_t height = floorPowerOfTwo(depth.imageInfo.extent.height);
+	uint32_t levels = 1;
+	while ((std::max(width, height) >> levels) > 0)
+	{
+		levels++;
+	}
+	levels = std::min(levels, MAX_LEVELS);
+
+	VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = levels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1 };
+
+	target.pyramid.imageInfo = imageInfo;
+	target.pyramid.viewInfo = viewInfo;
+	target.pyramid.createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		VkImageViewCreateInfo levelViewInfo = viewInfo;
+		levelViewInfo.subresourceRange.baseMipLevel = level;
+		levelViewInfo.subresourceRange.levelCount = 1;
+		VkImageView view;
+		VK_CHECK_RESULT(vkCreateImageView(device.logicalDevice, &levelViewInfo, nullptr, &view));
+		target.levelViews.push_back(view);
+	}
+
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 2 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5 }
+	};
+	VkDescriptorPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCI.pPoolSizes = poolSizes.data();
+	poolCI.maxSets = 2;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device.logicalDevice, &poolCI, nullptr, &target.descriptorPool));
+
+	const VkDescriptorSetLayout setLayouts[2] = { buildPass->getDescriptorSetLayout(), cullPass->getDescriptorSetLayout() };
+	VkDescriptorSet sets[2];
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = target.descriptorPool;
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = setLayouts;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, sets));
+	target.buildSet = sets[0];
+	target.cullSet = sets[1];
+
+	writeDescriptors(depth);
+	pyramidValid = false;
+}
+
+void OcclusionCuller::writeDescriptors(const vks::Image& depth)
+{
+	VkDescriptorImageInfo depthInfo{ VK_NULL_HANDLE, depth.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	std::vector<VkDescriptorImageInfo> levelInfos(MAX_LEVELS);
+	for (uint32_t level = 0; level < MAX_LEVELS; level++)
+	{
+		const uint32_t viewLevel = std::min<uint32_t>(level, static_cast<uint32_t>(target.levelViews.size()) - 1);
+		levelInfos[level] = { VK_NULL_HANDLE, target.levelViews[viewLevel], VK_IMAGE_LAYOUT_GENERAL };
+	}
+	VkDescriptorImageInfo pyramidInfo{ VK_NULL_HANDLE, target.pyramid.imageView, VK_IMAGE_LAYOUT_GENERAL };
+
+	VkDescriptorBufferInfo constantsInfo = frameConstants.getDescriptorInfo(sizeof(CullConstants));
+	VkDescriptorBufferInfo boundsInfo{ terrain.getPatchBounds().buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo earlyDrawsInfo{ earlyDraws.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo lateDrawsInfo{ lateDraws.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo candidatesInfo{ candidates.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo countersInfo{ counters.buffer, 0, VK_WHOLE_SIZE };
+
+	auto write = [](VkDescriptorSet set, uint32_t binding, VkDescriptorType type, uint32_t count = 1) {
+		VkWriteDescriptorSet descriptorWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.descriptorCount = count;
+		descriptorWrite.descriptorType = type;
+		return descriptorWrite;
+	};
+
+	std::vector<VkWriteDescriptorSet> writes = {
+		write(target.buildSet, 0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE),
+		write(target.buildSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS),
+		write(target.cullSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+		write(target.cullSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(target.cullSet, 2, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE),
+		write(target.cullSet, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(target.cullSet, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(target.cullSet, 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(target.cullSet, 6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+	};
+	writes[0].pImageInfo = &depthInfo;
+	writes[1].pImageInfo = levelInfos.data();
+	writes[2].pBufferInfo = &constantsInfo;
+	writes[3].pBufferInfo = &boundsInfo;
+	writes[4].pImageInfo = &pyramidInfo;
+	writes[5].pBufferInfo = &earlyDrawsInfo;
+	writes[6].pBufferInfo = &lateDrawsInfo;
+	writes[7].pBufferInfo = &candidatesInfo;
+	writes[8].pBufferInfo = &countersInfo;
+	vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void OcclusionCuller::destroyTarget(Target& retired)
+{
+	for (VkImageView view : retired.levelViews)
+	{
+		vkDestroyImageView(device.logicalDevice, view, nullptr);
+	}
+	retired.levelViews.clear();
+	if (retired.descriptorPool != VK_NULL_HANDLE)
+	{
+		// destroying the pool frees its sets
+		vkDestroyDescriptorPool(device.logicalDevice, retired.descriptorPool, nullptr);
+		retired.descriptorPool = VK_NULL_HANDLE;
+	}
+	retired.pyramid.destroy();
+}
+
+OcclusionStats OcclusionCuller::collectStats(uint32_t frame) const
+{
+	OcclusionStats stats{};
+	memcpy(&stats, static_cast<const char*>(readback.mapped) + sizeof(OcclusionStats) * frame, sizeof(OcclusionStats));
+	return stats;
+}
+
+OcclusionCuller::GraphResources OcclusionCuller::importResources(RenderGraph& graph, uint32_t frame) const
+{
+	// which passes touched the buffers last frame depends on the settings, so they are imported as if every stage that
+	// may use them had written them. The pyramid is imported as written by its build: the next early cull only reads
+	// it and would otherwise not wait for the previous frame
+	const RenderGraph::Access previousFrame{
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+		VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT };
+	const RenderGraph::Access pyramidBuilt{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+
+	GraphResources resources{};
+	resources.pyramid = graph.importImage("hi-z pyramid", target.pyramid.image, target.pyramid.viewInfo.subresourceRange,
+		pyramidValid ? pyramidBuilt : RenderGraph::Access{});
+	resources.counters = graph.importBuffer("occlusion counters", counters.buffer, 0, counters.size, previousFrame);
+	resources.earlyDraws = graph.importBuffer("early draws", earlyDraws.buffer, 0, earlyDraws.size, previousFrame);
+	resources.lateDraws = graph.importBuffer("late draws", lateDraws.buffer, 0, lateDraws.size, previousFrame);
+	resources.candidates = graph.importBuffer("occlusion candidates", candidates.buffer, 0, candidates.size, previousFrame);
+
+	// the host reads the slot after the frame fence
+	resources.readback = graph.importBuffer("occlusion readback", readback.buffer, sizeof(OcclusionStats) * frame, sizeof(OcclusionStats), {});
+	graph.setFinalState(resources.readback, { VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT });
+	return resources;
+}
+
+void OcclusionCuller::addEarlyPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource patchBounds, const glm::mat4& viewProj,
+	bool reverseZ, bool occlusion)
+{
+	waitForPipelines();
+
+	frameOcclusion = occlusion;
+	frameReverseZ = reverseZ;
+	frameViewProj = viewProj;
+
+	CullConstants constants{};
+	constants.viewProj = viewProj;
+	constants.pyramidViewProj = pyramidViewProj;
+	extractFrustumPlanes(viewProj, constants.frustumPlanes);
+	constants.pyramidSize = glm::vec2(target.pyramid.imageInfo.extent.width, target.pyramid.imageInfo.extent.height);
+	constants.pyramidLevels = target.pyramid.imageInfo.mipLevels;
+	constants.patchCount = terrain.getPatchCount();
+	constants.patchIndexCount = terrain.getPatchIndexCount();
+	// a pyramid of the other depth direction would cull everything
+	constants.earlyOcclusion = occlusion && pyramidValid && pyramidReverseZ == reverseZ ? 1 : 0;
+	constants.reverseZ = reverseZ ? 1 : 0;
+	constantsOffset = frameConstants.push(constants);
+
+	graph.addPass("occlusion reset", [this](VkCommandBuffer cmd) {
+			vkCmdFillBuffer(cmd, counters.buffer, 0, VK_WHOLE_SIZE, 0);
+		})
+		.write(resources.counters, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+
+	const RenderGraph::Access storageRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT };
+	const RenderGraph::Access storageWrite{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT };
+	const RenderGraph::Access pyramidRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+
+	const uint32_t groups = (terrain.getPatchCount() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+	graph.addPass("occlusion early cull", [this, groups, offset = constantsOffset](VkCommandBuffer cmd) {
+			const CullParams params{ 0 };
+			cullPass->recordCommands(cmd, target.cullSet, 1, &offset, &params, groups, 1, 1);
+		})
+		.read(patchBounds, storageRead)
+		.read(resources.pyramid, pyramidRead)
+		.read(resources.counters, storageRead)
+		.write(resources.counters, storageWrite)
+		.write(resources.earlyDraws, storageWrite)
+		.write(resources.candidates, storageWrite);
+}
+
+void OcclusionCuller::addLatePasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource patchBounds, RenderGraph::Resource depth,
+	VkExtent2D depthExtent, uint32_t frame)
+{
+	const RenderGraph::Access storageRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT };
+	const RenderGraph::Access storageWrite{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT };
+
+	if (frameOcclusion)
+	{
+		const uint32_t levels = target.pyramid.imageInfo.mipLevels;
+		const uint32_t width = target.pyramid.imageInfo.extent.width;
+		const uint32_t height = target.pyramid.imageInfo.extent.height;
+		const uint32_t reverse = frameReverseZ ? 1 : 0;
+		graph.addPass("hi-z build", [this, levels, width, height, reverse, depthExtent](VkCommandBuffer cmd) {
+				for (uint32_t level = 0; level < levels; level++)
+				{
+					if (level > 0)
+					{
+						// every level reduces the one before it
+						vks::tools::insertMemoryBarrier2(cmd, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+							VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+					}
+					const BuildParams params{ level, reverse, { depthExtent.width, depthExtent.height } };
+					const uint32_t groupsX = (std::max(width >> level, 1u) + BUILD_GROUP_SIZE - 1) / BUILD_GROUP_SIZE;
+					const uint32_t groupsY = (std::max(height >> level, 1u) + BUILD_GROUP_SIZE - 1) / BUILD_GROUP_SIZE;
+					buildPass->recordCommands(cmd, target.buildSet, 0, nullptr, &params, groupsX, groupsY, 1);
+				}
+			})
+			.read(depth, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL })
+			.write(resources.pyramid, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_IMAGE_LAYOUT_GENERAL });
+
+		const uint32_t groups = (terrain.getPatchCount() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+		graph.addPass("occlusion late cull", [this, groups, offset = constantsOffset](VkCommandBuffer cmd) {
+				const CullParams params{ 1 };
+				cullPass->recordCommands(cmd, target.cullSet, 1, &offset, &params, groups, 1, 1);
+			})
+			.read(patchBounds, storageRead)
+			.read(resources.pyramid, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL })
+			.read(resources.candidates, storageRead)
+			.read(resources.counters, storageRead)
+			.write(resources.counters, storageWrite)
+			.write(resources.lateDraws, storageWrite);
+	}
+
+	// the early draws ran before the build, so the next frame tests against what this frame drew first
+	pyramidValid = frameOcclusion;
+	pyramidReverseZ = frameReverseZ;
+	pyramidViewProj = frameViewProj;
+
+	const VkBufferCopy region{ 0, sizeof(OcclusionStats) * frame, sizeof(OcclusionStats) };
+	graph.addPass("occlusion readback", [this, region](VkCommandBuffer cmd) {
+			vkCmdCopyBuffer(cmd, counters.buffer, readback.buffer, 1, &region);
+		})
+		.read(resources.counters, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT })
+		.write(resources.readback, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+}
+
+void OcclusionCuller::registerShaderReloads(ShaderHotReloader& reloader)
+{
+	// the cull pass includes the Hi-Z test it shares with PropScatter
+	const std::pair<VulkanComputePass*, std::vector<std::string>> passes[] = {
+		{ buildPass.get(), { buildPass->getShaderPath() } },
+		{ cullPass.get(), { cullPass->getShaderPath(), HIZ_COMMON_SHADER } }
+	};
+	for (const auto& [pass, shaderPaths] : passes)
+	{
+		reloader.registerPipeline(
+			pass->getShaderPath(),
+			shaderPaths,
+			[pass]() { return pass->buildPipeline(); },
+			[pass](VkPipeline pipeline) { return pass->swapPipeline(pipeline); }
+		);
+	}
+}
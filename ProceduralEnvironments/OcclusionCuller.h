@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanImage.h"
+#include "VulkanComputePass.h"
+#include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "FrameConstants.h"
+#include "RenderGraph.h"
+#include "Terrain.h"
+
+/**
+* Two phase occlusion culling of the terrain patches against a hierarchical depth pyramid (Hi-Z):
+*  - early: patches in the frustum that were visible in the previous frame's pyramid are drawn, the others become candidates
+*  - the pyramid is rebuilt from the depth the early draws left
+*  - late: the candidates are tested again against the new pyramid and the visible ones are drawn on top
+* Whatever came into view is drawn by the late phase of the same frame, so nothing pops in a frame late.
+* The pyramid is the largest power of two that fits the depth image and covers the rendered region of it, every texel
+* holds the farthest depth of its footprint. It is kept with the view projection it was built with for the early phase of the next frame.
+* Draws are written as VkDrawIndexedIndirectCommand, their counts live in a small counter buffer that is copied to a
+* host visible slot per frame in flight for the overlay.
+*/
+class OcclusionCuller
+{
+public:
+	static const uint32_t MAX_LEVELS = 13; // matches HIZ_MAX_LEVELS in hiz_build.slang and hiz_common.slang
+	// offsets of the draw counts in getCounters(), in the order of OcclusionStats
+	static const VkDeviceSize EARLY_COUNT_OFFSET = 0;
+	static const VkDeviceSize LATE_COUNT_OFFSET = 2 * sizeof(uint32_t);
+	// the pyramid test, included by every shader that culls against the pyramid
+	static constexpr const char* HIZ_COMMON_SHADER = "shaders/hiz_common.slang";
+
+	struct GraphResources {
+		RenderGraph::Resource pyramid;
+		RenderGraph::Resource counters;
+		RenderGraph::Resource earlyDraws;
+		RenderGraph::Resource lateDraws;
+		RenderGraph::Resource candidates;
+		RenderGraph::Resource readback;
+	};
+
+	/**
+	* @param threadPool When set, the compute pipelines are built on it, see waitForPipelines()
+	*/
+	OcclusionCuller(VulkanDevice& device, ShaderCache& shaderCache, FrameConstantAllocator& frameConstants, const Terrain& terrain,
+		uint32_t frameCount, ThreadPool* threadPool = nullptr);
+	~OcclusionCuller();
+
+	OcclusionCuller(const OcclusionCuller&) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+	/** @brief Block until the compute pipelines exist. Rethrows build failures */
+	void waitForPipelines();
+
+	/**
+	* @brief Create the pyramid and descriptor sets for depth, which has to be sampleable. A previous pyramid is retired
+	* through the deletion queue, the first frame afterwards only frustum culls
+	*/
+	void resize(const vks::Image& depth, uint64_t frameNumber);
+
+	/** @brief Counters of the last submission of frame's slot, call once its fence was waited on */
+	OcclusionStats collectStats(uint32_t frame) const;
+
+	/** @brief Import the pyramid, the draw and counter buffers and frame's readback slot */
+	GraphResources importResources(RenderGraph& graph, uint32_t frame) const;
+
+	/**
+	* @brief Add the counter reset and the early cull, the early draws can be recorded after them
+	* @param occlusion Test against the pyramid at all, without it the patches are only frustum culled
+	*/
+	void addEarlyPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource patchBounds, const glm::mat4& viewProj,
+		bool reverseZ, bool occlusion);
+
+	/**
+	* @brief Add the pyramid build from depth and the late cull when occlusion is on, then the counter readback.
+	* depth has to hold the early draws, the late draws can be recorded after these passes
+	* @param depthExtent The region of depth the frame renders into, the pyramid covers only that
+	*/
+	void addLatePasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource patchBounds, RenderGraph::Resource depth,
+		VkExtent2D depthExtent, uint32_t frame);
+
+	/** @brief Register the build and cull passes with the hot reloader */
+	void registerShaderReloads(ShaderHotReloader& reloader);
+
+	/** @brief World space frustum planes of viewProj, inside where dot(plane.xyz, p) + plane.w >= 0 */
+	static void extractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]);
+
+	const vks::Buffer& getEarlyDraws() const { return earlyDraws; }
+	const vks::Buffer& getLateDraws() const { return lateDraws; }
+	const vks::Buffer& getCounters() const { return counters; }
+	const vks::Image& getPyramid() const { return target.pyramid; }
+	/** @brief Whether addLatePasses() of the current frame builds the pyramid, it then holds this frame's depth afterwards */
+	bool isPyramidBuilt() const { return frameOcclusion; }
+
+private:
+	// what the passes of a pyramid size bind, replaced as a whole on resize
+	struct Target {
+		vks::Image pyramid;
+		std::vector<VkImageView> levelViews;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSet buildSet = VK_NULL_HANDLE;
+		VkDescriptorSet cullSet = VK_NULL_HANDLE;
+	};
+
+	void createBuffers();
+	void createPasses();
+	void writeDescriptors(const vks::Image& depth);
+	void destroyTarget(Target& retired);
+
+	VulkanDevice& device;
+	ShaderCache& shaderCache;
+	FrameConstantAllocator& frameConstants;
+	const Terrain& terrain;
+	uint32_t frameCount;
+
+	ThreadPool* threadPool;
+	std::vector<std::future<void>> pipelineBuilds;
+
+	std::unique_ptr<VulkanComputePass> buildPass;
+	std::unique_ptr<VulkanComputePass> cullPass;
+	Target target;
+
+	vks::Buffer counters;
+	vks::Buffer earlyDraws;
+	vks::Buffer lateDraws;
+	vks::Buffer candidates;
+	vks::Buffer readback; // one OcclusionStats per frame slot, persistently mapped
+
+	// state of the current frame between addEarlyPasses() and addLatePasses()
+	bool frameOcclusion = false;
+	bool frameReverseZ = false;
+	glm::mat4 frameViewProj{ 1.0f };
+	uint32_t constantsOffset = 0;
+
+	// what the pyramid holds for the next frame
+	bool pyramidValid = false;
+	bool pyramidReverseZ = false;
+	glm::mat4 pyramidViewProj{ 1.0f };
+};
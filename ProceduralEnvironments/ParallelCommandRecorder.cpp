@@ -0,0 +1,171 @@
+#include "ParallelCommandRecorder.h"
+#include "VulkanTools.h"
+
+#include <chrono>
+#include <exception>
+#include <future>
+
+ParallelCommandRecorder::ParallelCommandRecorder(VulkanDevice& vulkanDevice, ThreadPool& threadPool, uint32_t frameCount) :
+	device(vulkanDevice.logicalDevice),
+	threadPool(threadPool),
+	frameCount(frameCount),
+	threadSlots(threadPool.getThreadCount() + 1),
+	commands(frameCount * (threadPool.getThreadCount() + 1)),
+	frameCaches(frameCount)
+{
+	VkCommandPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	poolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolCI.queueFamilyIndex = vulkanDevice.familyIndices.graphicsFamily.value();
+	for (ThreadCommands& threadCommands : commands)
+	{
+		VK_CHECK_RESULT(vkCreateCommandPool(device, &poolCI, nullptr, &threadCommands.pool));
+	}
+}
+
+ParallelCommandRecorder::~ParallelCommandRecorder()
+{
+	// destroying a pool frees its command buffers
+	for (ThreadCommands& threadCommands : commands)
+	{
+		vkDestroyCommandPool(device, threadCommands.pool, nullptr);
+	}
+}
+
+void ParallelCommandRecorder::beginFrame(uint32_t frame)
+{
+	// the pools are only reset when this frame records again, until then they may hold cached buffers
+	currentFrame = frame % frameCount;
+}
+
+void ParallelCommandRecorder::resetFramePools()
+{
+	for (uint32_t slot = 0; slot < threadSlots; slot++)
+	{
+		ThreadCommands& threadCommands = commands[currentFrame * threadSlots + slot];
+		if (threadCommands.used > 0)
+		{
+			VK_CHECK_RESULT(vkResetCommandPool(device, threadCommands.pool, 0));
+			threadCommands.used = 0;
+		}
+	}
+}
+
+bool ParallelCommandRecorder::recordRenderingPasses(VkCommandBuffer primary, const VkCommandBufferInheritanceRenderingInfo& renderingInfo,
+	const std::vector<Pass>& passes, uint64_t stateHash)
+{
+	timings.assign(passes.size(), PassRecordTiming{});
+	for (size_t i = 0; i < passes.size(); i++)
+	{
+		timings[i].name = passes[i].name;
+	}
+	if (passes.empty())
+	{
+		return false;
+	}
+
+	FrameCache& cache = frameCaches[currentFrame];
+	if (stateHash != 0 && cache.stateHash == stateHash && cache.secondaries.size() == passes.size())
+	{
+		vkCmdExecuteCommands(primary, static_cast<uint32_t>(cache.secondaries.size()), cache.secondaries.data());
+		return true;
+	}
+
+	// the previous buffers of this slot retired with its fence, whether they were cached or not
+	resetFramePools();
+	cache.stateHash = 0;
+	cache.secondaries.clear();
+
+	// reusable buffers may be submitted any number of times, just never by two frames at once, which the per slot pools ensure
+	const VkCommandBufferUsageFlags usage = stateHash != 0 ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VkCommandBufferInheritanceInfo inheritance{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+	inheritance.pNext = &renderingInfo;
+
+	std::vector<VkCommandBuffer> secondaries(passes.size(), VK_NULL_HANDLE);
+
+	// the caller records the first pass itself instead of idling on the futures
+	std::vector<std::future<PassRecordTiming>> recordings;
+	recordings.reserve(passes.size() - 1);
+	for (size_t i = 1; i < passes.size(); i++)
+	{
+		recordings.push_back(threadPool.submit([this, &passes, &inheritance, usage, &secondaries, i]() {
+			return recordPass(passes[i], inheritance, usage, secondaries[i]);
+		}));
+	}
+
+	// every task has to finish before the locals it references go out of scope, even when one of them failed
+	std::exception_ptr failure;
+	try
+	{
+		timings[0] = recordPass(passes[0], inheritance, usage, secondaries[0]);
+	}
+	catch (...)
+	{
+		failure = std::current_exception();
+	}
+	for (size_t i = 1; i < passes.size(); i++)
+	{
+		try
+		{
+			timings[i] = recordings[i - 1].get();
+		}
+		catch (...)
+		{
+			if (!failure)
+			{
+				failure = std::current_exception();
+			}
+		}
+	}
+	if (failure)
+	{
+		std::rethrow_exception(failure);
+	}
+
+	vkCmdExecuteCommands(primary, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+
+	cache.stateHash = stateHash;
+	cache.secondaries = std::move(secondaries);
+	return false;
+}
+
+PassRecordTiming ParallelCommandRecorder::recordPass(const Pass& pass, const VkCommandBufferInheritanceInfo& inheritance, VkCommandBufferUsageFlags usage,
+	VkCommandBuffer& commandBuffer)
+{
+	auto recordBegin = std::chrono::high_resolution_clock::now();
+
+	commandBuffer = acquireCommandBuffer();
+
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = usage | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+	pass.record(commandBuffer);
+	VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+	float recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - recordBegin).count();
+	return { pass.name, recordMs };
+}
+
+VkCommandBuffer ParallelCommandRecorder::acquireCommandBuffer()
+{
+	// pool workers map to their own slot, any other thread to the last one
+	uint32_t slot = ThreadPool::getWorkerIndex();
+	if (slot >= threadSlots - 1)
+	{
+		slot = threadSlots - 1;
+	}
+
+	ThreadCommands& threadCommands = commands[currentFrame * threadSlots + slot];
+	if (threadCommands.used == threadCommands.buffers.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		allocInfo.commandPool = threadCommands.pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+		VkCommandBuffer commandBuffer;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
+		threadCommands.buffers.push_back(commandBuffer);
+	}
+	return threadCommands.buffers[threadCommands.used++];
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanStructures.h"
+#include "ThreadPool.h"
+
+/**
+* Records the passes of a dynamic rendering instance into secondary command buffers in parallel and executes them
+* from the primary in the order they were given, so the result doesn't depend on which thread finished first.
+* Every frame in flight owns one transient command pool per pool worker plus one for the calling thread. A task only
+* touches the pool of the thread it runs on, so no pool is ever used by two threads at once.
+* Secondary buffers inherit nothing but the attachment formats: each pass sets its own viewport, scissor, pipeline
+* and descriptors.
+* Given a state hash, the buffers of a frame slot are kept and replayed for as long as the hash of that slot matches.
+* The hash has to cover everything the passes bake into their commands: handles, dynamic offsets, push constant data,
+* viewport and a generation of every descriptor set they bind. Data read through buffers, like camera matrices, may change.
+*/
+class ParallelCommandRecorder
+{
+public:
+	struct Pass {
+		const char* name;
+		std::function<void(VkCommandBuffer)> record;
+	};
+
+	ParallelCommandRecorder(VulkanDevice& device, ThreadPool& threadPool, uint32_t frameCount);
+	~ParallelCommandRecorder();
+
+	ParallelCommandRecorder(const ParallelCommandRecorder&) = delete;
+	ParallelCommandRecorder& operator=(const ParallelCommandRecorder&) = delete;
+
+	/** @brief Select the pools of frame, its previous submission must have retired */
+	void beginFrame(uint32_t frame);
+
+	/**
+	* @brief Record passes concurrently and execute them into primary, which must be inside a vkCmdBeginRendering
+	* started with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT and matching renderingInfo.
+	* The first pass is recorded on the calling thread. Exceptions of any pass are rethrown after all of them finished.
+	* With a stateHash other than 0 that matches the last recording of this frame slot nothing is recorded and the
+	* previous buffers are executed again, in that case it returns true.
+	*/
+	bool recordRenderingPasses(VkCommandBuffer primary, const VkCommandBufferInheritanceRenderingInfo& renderingInfo, const std::vector<Pass>& passes,
+		uint64_t stateHash = 0);
+
+	/** @brief CPU recording time of every pass of the last recordRenderingPasses call, in pass order, 0 when replayed */
+	const std::vector<PassRecordTiming>& getTimings() const { return timings; }
+
+private:
+	struct ThreadCommands {
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> buffers;
+		uint32_t used = 0;
+	};
+
+	// what the pools of a frame slot currently hold
+	struct FrameCache {
+		uint64_t stateHash = 0; // 0 when the buffers were recorded for one submission only
+		std::vector<VkCommandBuffer> secondaries;
+	};
+
+	/** @brief Next free secondary buffer of the calling thread's pool in the current frame */
+	VkCommandBuffer acquireCommandBuffer();
+	PassRecordTiming recordPass(const Pass& pass, const VkCommandBufferInheritanceInfo& inheritance, VkCommandBufferUsageFlags usage,
+		VkCommandBuffer& commandBuffer);
+	void resetFramePools();
+
+	VkDevice device;
+	ThreadPool& threadPool;
+	uint32_t frameCount;
+	uint32_t threadSlots; // pool workers plus the calling thread
+	uint32_t currentFrame = 0;
+
+	std::vector<ThreadCommands> commands; // frame * threadSlots + slot
+	std::vector<FrameCache> frameCaches;
+	std::vector<PassRecordTiming> timings;
+};
@@ -2,10 +2,17 @@
 //
 
 #include <iostream>
+#include <cstring>
 #include "Engine.h"
 
-int main()
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "--bake-textures") == 0)
+    {
+        Engine::bakeTerrainMaterials();
+        return 0;
+    }
+
     Engine* engine = new Engine();
     engine->run();
     delete(engine);
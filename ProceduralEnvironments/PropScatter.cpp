@@ -0,0 +1,827 @@
+#include "PropScatter.h"
+
+#include "VulkanTools.h"
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace
+{
+	/** Mirrors PropInstance in props_common.slang */
+	struct PropInstance {
+		glm::vec3 position;
+		float scale;
+		float rotation;
+		uint32_t type;
+		float _padding[2];
+	};
+	static_assert(sizeof(PropInstance) == 32, "PropInstance has to match props_common.slang");
+
+	/** Mirrors PropCullConstants in prop_cull.slang */
+	struct PropCullConstants {
+		glm::mat4 viewProj;
+		glm::vec4 frustumPlanes[6];
+		glm::vec4 cameraPosition;
+		glm::vec4 typeBounds[PropScatter::PROP_TYPE_COUNT];
+		glm::vec2 pyramidSize;
+		uint32_t pyramidLevels;
+		uint32_t occlusion;
+		uint32_t reverseZ;
+		uint32_t maxInstances;
+		float lodDistance;
+		float drawDistance;
+	};
+
+	const uint32_t SCATTER_GROUP_SIZE = 8;
+	const uint32_t CULL_GROUP_SIZE = 64;
+	const uint32_t PROP_TREE = 0;
+	const uint32_t PROP_ROCK = 1;
+	const float PI = 3.14159265358979f;
+
+	// linear colors, the scene target is a float format
+	const glm::vec4 BARK_COLOR{ 0.16f, 0.09f, 0.05f, 1.0f };
+	const glm::vec4 LEAF_COLOR{ 0.05f, 0.16f, 0.04f, 1.0f };
+	const glm::vec4 ROCK_COLOR{ 0.22f, 0.21f, 0.19f, 1.0f };
+
+	// flat shaded triangle soup, every face gets its own vertices
+	struct MeshBuilder {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+
+		// wound so that the face points away from inside, which is front facing with the terrain's flipped viewport
+		void triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, const glm::vec3& inside, const glm::vec4& color)
+		{
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			if (glm::dot(normal, (a + b + c) / 3.0f - inside) < 0.0f)
+			{
+				std::swap(b, c);
+				normal = -normal;
+			}
+			normal = glm::normalize(normal);
+			for (const glm::vec3& position : { a, b, c })
+			{
+				Vertex vertex{};
+				vertex.pos = position;
+				vertex.inNormal = normal;
+				vertex.texCoord = glm::vec2(0.0f);
+				vertex.color = color;
+				indices.push_back(static_cast<uint32_t>(vertices.size()));
+				vertices.push_back(vertex);
+			}
+		}
+
+		// a cone around +y, a prism or truncated cone when topRadius is above 0
+		void cone(float bottom, float top, float bottomRadius, float topRadius, uint32_t sides, const glm::vec4& color, bool bottomCap)
+		{
+			const glm::vec3 bottomCenter(0.0f, bottom, 0.0f);
+			for (uint32_t side = 0; side < sides; side++)
+			{
+				const float angle0 = 2.0f * PI * side / sides;
+				const float angle1 = 2.0f * PI * (side + 1) / sides;
+				const glm::vec3 p0(std::cos(angle0) * bottomRadius, bottom, std::sin(angle0) * bottomRadius);
+				const glm::vec3 p1(std::cos(angle1) * bottomRadius, bottom, std::sin(angle1) * bottomRadius);
+				const glm::vec3 q0(std::cos(angle0) * topRadius, top, std::sin(angle0) * topRadius);
+				const glm::vec3 q1(std::cos(angle1) * topRadius, top, std::sin(angle1) * topRadius);
+
+				// the axis at the height of the face lies inside of it
+				triangle(p0, p1, q1, glm::vec3(0.0f, (p0.y + p1.y + q1.y) / 3.0f, 0.0f), color);
+				if (topRadius > 0.0f)
+				{
+					triangle(p0, q1, q0, glm::vec3(0.0f, (p0.y + q1.y + q0.y) / 3.0f, 0.0f), color);
+				}
+				if (bottomCap)
+				{
+					triangle(bottomCenter, p1, p0, glm::vec3(0.0f, top, 0.0f), color);
+				}
+			}
+		}
+	};
+
+	// unit height, standing on the origin. The trunk reaches below it so it stays in the ground on slopes
+	void buildTree(MeshBuilder& mesh, uint32_t lod)
+	{
+		if (lod == 0)
+		{
+			mesh.cone(-0.1f, 0.3f, 0.05f, 0.04f, 6, BARK_COLOR, false);
+			mesh.cone(0.2f, 0.6f, 0.32f, 0.0f, 8, LEAF_COLOR, true);
+			mesh.cone(0.42f, 0.82f, 0.25f, 0.0f, 8, LEAF_COLOR, true);
+			mesh.cone(0.62f, 1.0f, 0.17f, 0.0f, 8, LEAF_COLOR, true);
+			return;
+		}
+		mesh.cone(0.15f, 1.0f, 0.3f, 0.0f, 5, LEAF_COLOR, false);
+	}
+
+	// a flattened and lumpy icosphere of about unit radius, half sunk into the ground. The coarse LOD displaces the
+	// corners of the plain icosahedron the same way, so both keep the same outline
+	void buildRock(MeshBuilder& mesh, uint32_t lod)
+	{
+		const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+		const glm::vec3 corners[12] = {
+			{ -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+			{ 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+			{ t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+		const uint32_t faces[20][3] = {
+			{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+			{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+			{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+			{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+
+		auto surface = [](const glm::vec3& direction) {
+			const glm::vec3 d = glm::normalize(direction);
+			const float lumps = 1.0f
+				+ 0.18f * std::sin(3.1f * d.x + 1.7f) * std::sin(2.3f * d.y + 0.4f) * std::sin(2.9f * d.z + 2.1f)
+				+ 0.07f * std::sin(7.3f * d.x + 0.3f) * std::sin(6.1f * d.z + 1.1f);
+			const glm::vec3 position = d * lumps;
+			return glm::vec3(position.x, position.y * 0.6f - 0.15f, position.z);
+		};
+		const glm::vec3 inside(0.0f, -0.15f, 0.0f);
+
+		for (const auto& face : faces)
+		{
+			const glm::vec3 a = corners[face[0]];
+			const glm::vec3 b = corners[face[1]];
+			const glm::vec3 c = corners[face[2]];
+			if (lod > 0)
+			{
+				mesh.triangle(surface(a), surface(b), surface(c), inside, ROCK_COLOR);
+				continue;
+			}
+			const glm::vec3 ab = glm::normalize(a + b);
+			const glm::vec3 bc = glm::normalize(b + c);
+			const glm::vec3 ca = glm::normalize(c + a);
+			mesh.triangle(surface(a), surface(ab), surface(ca), inside, ROCK_COLOR);
+			mesh.triangle(surface(ab), surface(b), surface(bc), inside, ROCK_COLOR);
+			mesh.triangle(surface(ca), surface(bc), surface(c), inside, ROCK_COLOR);
+			mesh.triangle(surface(ab), surface(bc), surface(ca), inside, ROCK_COLOR);
+		}
+	}
+}
+
+PropScatter::PropScatter(VulkanDevice& device, ShaderCache& shaderCache, FrameConstantAllocator& frameConstants, UploadManager& uploadManager,
+	const Terrain& terrain, const ImageBasedLighting& imageBasedLighting, VkFormat colorFormat, VkFormat depthFormat, uint32_t frameCount,
+	const Config& config, ThreadPool* threadPool) :
+	device(device),
+	shaderCache(shaderCache),
+	frameConstants(frameConstants),
+	terrain(terrain),
+	imageBasedLighting(imageBasedLighting),
+	colorFormat(colorFormat),
+	depthFormat(depthFormat),
+	frameCount(frameCount),
+	config(config),
+	threadPool(threadPool)
+{
+	createBuffers();
+	createMeshes(uploadManager);
+	createPasses();
+	createDrawResources();
+}
+
+PropScatter::~PropScatter()
+{
+	// builds still in flight reference the passes and the pipeline layout
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.wait();
+	}
+	pipelineBuilds.clear();
+	if (drawPipelineBuild.valid())
+	{
+		drawPipeline = drawPipelineBuild.get();
+	}
+
+	destroyTarget(target);
+	scatterPass.reset();
+	cullPass.reset();
+
+	if (drawPipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(device.logicalDevice, drawPipeline, nullptr);
+	}
+	vkDestroyPipelineLayout(device.logicalDevice, drawPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device.logicalDevice, drawSetLayout, nullptr);
+	vkDestroyDescriptorPool(device.logicalDevice, descriptorPool, nullptr);
+
+	instances.destroy();
+	counters.destroy();
+	draws.destroy();
+	drawTemplate.destroy();
+	visible.destroy();
+	readback.destroy();
+	meshVertices.destroy();
+	meshIndices.destroy();
+}
+
+void PropScatter::waitForPipelines()
+{
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.get();
+	}
+	pipelineBuilds.clear();
+
+	if (drawPipelineBuild.valid())
+	{
+		drawPipeline = drawPipelineBuild.get();
+		if (drawPipeline == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("Failed to create the prop graphics pipeline");
+		}
+	}
+}
+
+void PropScatter::createBuffers()
+{
+	instances.create(device, sizeof(PropInstance) * config.maxInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	counters.create(device, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	draws.create(device, sizeof(VkDrawIndexedIndirectCommand) * DRAW_COUNT,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	drawTemplate.create(device, sizeof(VkDrawIndexedIndirectCommand) * DRAW_COUNT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	visible.create(device, sizeof(uint32_t) * DRAW_COUNT * config.maxInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	readback.create(device, sizeof(PropStats) * frameCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VK_CHECK_RESULT(readback.map());
+	// slots that were never written read as nothing placed
+	memset(readback.mapped, 0, sizeof(PropStats) * frameCount);
+}
+
+void PropScatter::createMeshes(UploadManager& uploadManager)
+{
+	MeshBuilder mesh;
+	std::array<VkDrawIndexedIndirectCommand, DRAW_COUNT> templates{};
+	for (uint32_t type = 0; type < PROP_TYPE_COUNT; type++)
+	{
+		glm::vec3 boundsMin(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+		const size_t typeFirstVertex = mesh.vertices.size();
+
+		for (uint32_t lod = 0; lod < LOD_COUNT; lod++)
+		{
+			const uint32_t firstVertex = static_cast<uint32_t>(mesh.vertices.size());
+			const uint32_t firstIndex = static_cast<uint32_t>(mesh.indices.size());
+			MeshBuilder lodMesh;
+			if (type == PROP_TREE)
+			{
+				buildTree(lodMesh, lod);
+			}
+			else
+			{
+				buildRock(lodMesh, lod);
+			}
+			mesh.vertices.insert(mesh.vertices.end(), lodMesh.vertices.begin(), lodMesh.vertices.end());
+			mesh.indices.insert(mesh.indices.end(), lodMesh.indices.begin(), lodMesh.indices.end());
+
+			// the cull pass appends the instances of draw d from d * maxInstances on
+			const uint32_t draw = type * LOD_COUNT + lod;
+			templates[draw].indexCount = static_cast<uint32_t>(lodMesh.indices.size());
+			templates[draw].instanceCount = 0;
+			templates[draw].firstIndex = firstIndex;
+			templates[draw].vertexOffset = static_cast<int32_t>(firstVertex);
+			templates[draw].firstInstance = draw * config.maxInstances;
+		}
+
+		// one sphere over every LOD, so an instance is culled the same whichever LOD it would get
+		for (size_t i = typeFirstVertex; i < mesh.vertices.size(); i++)
+		{
+			boundsMin = glm::min(boundsMin, mesh.vertices[i].pos);
+			boundsMax = glm::max(boundsMax, mesh.vertices[i].pos);
+		}
+		const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radius = 0.0f;
+		for (size_t i = typeFirstVertex; i < mesh.vertices.size(); i++)
+		{
+			radius = std::max(radius, glm::length(mesh.vertices[i].pos - center));
+		}
+		typeBounds[type] = glm::vec4(center, radius);
+	}
+
+	const VkDeviceSize vertexBytes = sizeof(Vertex) * mesh.vertices.size();
+	const VkDeviceSize indexBytes = sizeof(uint32_t) * mesh.indices.size();
+	meshVertices.create(device, vertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	meshIndices.create(device, indexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// the owner waits for the uploads before the first frame
+	uploadManager.uploadBuffer(meshVertices.buffer, mesh.vertices.data(), vertexBytes, 0,
+		VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+	uploadManager.uploadBuffer(meshIndices.buffer, mesh.indices.data(), indexBytes, 0,
+		VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
+	uploadManager.uploadBuffer(drawTemplate.buffer, templates.data(), sizeof(templates), 0,
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+}
+
+void PropScatter::createPasses()
+{
+	auto binding = [](uint32_t index, VkDescriptorType type) {
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = index;
+		layoutBinding.descriptorType = type;
+		layoutBinding.descriptorCount = 1;
+		layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		return layoutBinding;
+	};
+
+	VulkanComputePass::Config computeConfig{};
+	computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+	computeConfig.slangGlobalSession = nullptr;
+	computeConfig.shaderCache = &shaderCache;
+
+	// heightmap, instances, counters
+	scatterPass = std::make_unique<VulkanComputePass>(device);
+	computeConfig.shaderPath = "shaders/prop_scatter.slang";
+	computeConfig.descriptorSetLayoutBindings = {
+		binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+		binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) };
+	computeConfig.pushConstantSize = sizeof(ScatterParams);
+	scatterPass->createLayouts(computeConfig);
+
+	// constants, instances, counters, draws, visible instances, pyramid
+	cullPass = std::make_unique<VulkanComputePass>(device);
+	computeConfig.shaderPath = "shaders/prop_cull.slang";
+	computeConfig.descriptorSetLayoutBindings = {
+		binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+		binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		binding(5, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE) };
+	computeConfig.pushConstantSize = 0;
+	cullPass->createLayouts(computeConfig);
+
+	for (VulkanComputePass* pass : { scatterPass.get(), cullPass.get() })
+	{
+		if (threadPool == nullptr)
+		{
+			pass->createPipeline();
+			continue;
+		}
+		pipelineBuilds.push_back(threadPool->submit([pass]() { pass->createPipeline(); }));
+	}
+}
+
+void PropScatter::createDrawResources()
+{
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+	// instances
+	bindings[0].binding = 0;
+	bindings[0].descriptorCount = 1;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	// irradiance of the sky
+	bindings[1].binding = 1;
+	bindings[1].descriptorCount = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo setLayoutCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	setLayoutCI.bindingCount = static_cast<uint32_t>(bindings.size());
+	setLayoutCI.pBindings = bindings.data();
+	VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device.logicalDevice, &setLayoutCI, nullptr, &drawSetLayout));
+
+	VkPushConstantRange pushConstantRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4) };
+	VkPipelineLayoutCreateInfo pipelineLayoutCI{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	pipelineLayoutCI.setLayoutCount = 1;
+	pipelineLayoutCI.pSetLayouts = &drawSetLayout;
+	pipelineLayoutCI.pushConstantRangeCount = 1;
+	pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+	VK_CHECK_RESULT(vkCreatePipelineLayout(device.logicalDevice, &pipelineLayoutCI, nullptr, &drawPipelineLayout));
+
+	// picked up in waitForPipelines()
+	if (threadPool != nullptr)
+	{
+		drawPipelineBuild = threadPool->submit([this]() { return buildDrawPipeline(); });
+	}
+	else
+	{
+		std::promise<VkPipeline> built;
+		built.set_value(buildDrawPipeline());
+		drawPipelineBuild = built.get_future();
+	}
+
+	// the scatter and draw sets reference buffers and images that live as long as this object
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 }
+	};
+	VkDescriptorPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCI.pPoolSizes = poolSizes.data();
+	poolCI.maxSets = 2;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device.logicalDevice, &poolCI, nullptr, &descriptorPool));
+
+	const VkDescriptorSetLayout setLayouts[2] = { scatterPass->getDescriptorSetLayout(), drawSetLayout };
+	VkDescriptorSet sets[2];
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = setLayouts;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, sets));
+	scatterSet = sets[0];
+	drawSet = sets[1];
+
+	const vks::Image& heightmap = terrain.getHeightmap();
+	VkDescriptorImageInfo heightmapInfo{ heightmap.sampler, heightmap.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo irradianceInfo{ imageBasedLighting.getSampler(), imageBasedLighting.getIrradiance().imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorBufferInfo instancesInfo{ instances.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo countersInfo{ counters.buffer, 0, VK_WHOLE_SIZE };
+
+	auto write = [](VkDescriptorSet set, uint32_t binding, VkDescriptorType type) {
+		VkWriteDescriptorSet descriptorWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = type;
+		return descriptorWrite;
+	};
+
+	std::vector<VkWriteDescriptorSet> writes = {
+		write(scatterSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+		write(scatterSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(scatterSet, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(drawSet, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(drawSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+	};
+	writes[0].pImageInfo = &heightmapInfo;
+	writes[1].pBufferInfo = &instancesInfo;
+	writes[2].pBufferInfo = &countersInfo;
+	writes[3].pBufferInfo = &instancesInfo;
+	writes[4].pImageInfo = &irradianceInfo;
+	vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+VkPipeline PropScatter::buildDrawPipeline()
+{
+	VkShaderModule vertShaderModule = shaderCache.loadShader(device.logicalDevice, "shaders/props.slang", "vertexMain");
+	VkShaderModule fragShaderModule = shaderCache.loadShader(device.logicalDevice, "shaders/props.slang", "fragmentMain");
+	if (vertShaderModule == VK_NULL_HANDLE || fragShaderModule == VK_NULL_HANDLE)
+	{
+		if (vertShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device.logicalDevice, vertShaderModule, nullptr);
+		if (fragShaderModule != VK_NULL_HANDLE) vkDestroyShaderModule(device.logicalDevice, fragShaderModule, nullptr);
+		return VK_NULL_HANDLE;
+	}
+
+	VkPipelineShaderStageCreateInfo shaderStages[2]{};
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	// the mesh vertices per vertex, the index the cull pass appended per instance
+	const VkVertexInputBindingDescription bindingDescriptions[2] = {
+		Vertex::getBindingDescription(),
+		{ 1, sizeof(uint32_t), VK_VERTEX_INPUT_RATE_INSTANCE } };
+	std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions{};
+	const auto vertexAttributes = Vertex::getAttributeDescriptions();
+	std::copy(vertexAttributes.begin(), vertexAttributes.end(), attributeDescriptions.begin());
+	attributeDescriptions[4] = { 4, 1, VK_FORMAT_R32_UINT, 0 };
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{ VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	vertexInputInfo.vertexBindingDescriptionCount = 2;
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyCI{ VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+	inputAssemblyCI.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportStateCI{ VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	viewportStateCI.viewportCount = 1;
+	viewportStateCI.scissorCount = 1;
+
+	// wound like the terrain, see MeshBuilder::triangle()
+	VkPipelineRasterizationStateCreateInfo rasterizerStateCI{ VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+	rasterizerStateCI.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerStateCI.lineWidth = 1.0f;
+	rasterizerStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizerStateCI.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisamplingStateCI{ VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+	multisamplingStateCI.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingStateCI{ VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	colorBlendingStateCI.attachmentCount = 1;
+	colorBlendingStateCI.pAttachments = &colorBlendAttachment;
+
+	// the compare op depends on reverse-Z
+	VkPipelineDepthStencilStateCreateInfo depthStencilStateCI{ VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	depthStencilStateCI.depthTestEnable = VK_TRUE;
+	depthStencilStateCI.depthWriteEnable = VK_TRUE;
+	depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS;
+
+	const VkDynamicState dynamicStates[3] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP };
+	VkPipelineDynamicStateCreateInfo dynamicState{ VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dynamicState.dynamicStateCount = 3;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkPipelineRenderingCreateInfoKHR pipelineRenderingCI{ VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
+	pipelineRenderingCI.colorAttachmentCount = 1;
+	pipelineRenderingCI.pColorAttachmentFormats = &colorFormat;
+	pipelineRenderingCI.depthAttachmentFormat = depthFormat;
+
+	VkGraphicsPipelineCreateInfo pipelineCI{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipelineCI.layout = drawPipelineLayout;
+	pipelineCI.stageCount = 2;
+	pipelineCI.pStages = shaderStages;
+	pipelineCI.pVertexInputState = &vertexInputInfo;
+	pipelineCI.pInputAssemblyState = &inputAssemblyCI;
+	pipelineCI.pViewportState = &viewportStateCI;
+	pipelineCI.pRasterizationState = &rasterizerStateCI;
+	pipelineCI.pMultisampleState = &multisamplingStateCI;
+	pipelineCI.pDepthStencilState = &depthStencilStateCI;
+	pipelineCI.pColorBlendState = &colorBlendingStateCI;
+	pipelineCI.pDynamicState = &dynamicState;
+	pipelineCI.pNext = &pipelineRenderingCI;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult result = vkCreateGraphicsPipelines(device.logicalDevice, device.pipelineCache, 1, &pipelineCI, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device.logicalDevice, vertShaderModule, nullptr);
+	vkDestroyShaderModule(device.logicalDevice, fragShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << "vkCreateGraphicsPipelines failed with \"" << vks::tools::errorString(result) << "\"" << "\n";
+		return VK_NULL_HANDLE;
+	}
+	return pipeline;
+}
+
+void PropScatter::setPyramid(const vks::Image& pyramid, uint64_t frameNumber)
+{
+	// frames in flight may still cull against the old pyramid
+	if (target.descriptorPool != VK_NULL_HANDLE)
+	{
+		Target retired = target;
+		device.deletionQueue->retire(frameNumber, [this, retired]() mutable { destroyTarget(retired); });
+		target = Target{};
+	}
+
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1 }
+	};
+	VkDescriptorPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCI.pPoolSizes = poolSizes.data();
+	poolCI.maxSets = 1;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device.logicalDevice, &poolCI, nullptr, &target.descriptorPool));
+
+	const VkDescriptorSetLayout setLayout = cullPass->getDescriptorSetLayout();
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = target.descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &target.cullSet));
+
+	VkDescriptorBufferInfo constantsInfo = frameConstants.getDescriptorInfo(sizeof(PropCullConstants));
+	VkDescriptorBufferInfo instancesInfo{ instances.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo countersInfo{ counters.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo drawsInfo{ draws.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorBufferInfo visibleInfo{ visible.buffer, 0, VK_WHOLE_SIZE };
+	VkDescriptorImageInfo pyramidInfo{ VK_NULL_HANDLE, pyramid.imageView, VK_IMAGE_LAYOUT_GENERAL };
+
+	auto write = [this](uint32_t binding, VkDescriptorType type) {
+		VkWriteDescriptorSet descriptorWrite{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		descriptorWrite.dstSet = target.cullSet;
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = type;
+		return descriptorWrite;
+	};
+
+	std::vector<VkWriteDescriptorSet> writes = {
+		write(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+		write(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		write(5, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE)
+	};
+	writes[0].pBufferInfo = &constantsInfo;
+	writes[1].pBufferInfo = &instancesInfo;
+	writes[2].pBufferInfo = &countersInfo;
+	writes[3].pBufferInfo = &drawsInfo;
+	writes[4].pBufferInfo = &visibleInfo;
+	writes[5].pImageInfo = &pyramidInfo;
+	vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	pyramidSize = glm::vec2(pyramid.imageInfo.extent.width, pyramid.imageInfo.extent.height);
+	pyramidLevels = pyramid.imageInfo.mipLevels;
+}
+
+void PropScatter::destroyTarget(Target& retired)
+{
+	if (retired.descriptorPool != VK_NULL_HANDLE)
+	{
+		// destroying the pool frees its set
+		vkDestroyDescriptorPool(device.logicalDevice, retired.descriptorPool, nullptr);
+		retired.descriptorPool = VK_NULL_HANDLE;
+	}
+}
+
+PropStats PropScatter::collectStats(uint32_t frame) const
+{
+	PropStats stats{};
+	memcpy(&stats, static_cast<const char*>(readback.mapped) + sizeof(PropStats) * frame, sizeof(PropStats));
+	return stats;
+}
+
+PropScatter::GraphResources PropScatter::importResources(RenderGraph& graph, uint32_t frame) const
+{
+	// like OcclusionCuller, the buffers are imported as if every stage that may have used them last frame had written them
+	const RenderGraph::Access previousFrame{
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT |
+			VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+		VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT };
+
+	GraphResources resources{};
+	resources.instances = graph.importBuffer("prop instances", instances.buffer, 0, instances.size, previousFrame);
+	resources.counters = graph.importBuffer("prop counters", counters.buffer, 0, counters.size, previousFrame);
+	resources.draws = graph.importBuffer("prop draws", draws.buffer, 0, draws.size, previousFrame);
+	resources.visible = graph.importBuffer("prop visible instances", visible.buffer, 0, visible.size, previousFrame);
+
+	// the host reads the slot after the frame fence
+	resources.readback = graph.importBuffer("prop readback", readback.buffer, sizeof(PropStats) * frame, sizeof(PropStats), {});
+	graph.setFinalState(resources.readback, { VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT });
+	return resources;
+}
+
+void PropScatter::addScatterPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap, const PropSettings& settings,
+	const TerrainParams& terrainParams, const TerrainMaterialParams& materialParams)
+{
+	if (!settings.enabled)
+	{
+		// placed once they are shown again
+		return;
+	}
+
+	ScatterParams params{};
+	params.cellsPerSide = config.cellsPerSide;
+	params.maxInstances = config.maxInstances;
+	params.seed = config.seed;
+	params.gridResolution = terrainParams.gridResolution;
+	params.terrainSideLength = terrainParams.terrainSideLength;
+	params.heightScale = terrainParams.heightScale;
+	params.treeDensity = settings.treeDensity;
+	params.rockDensity = settings.rockDensity;
+	params.treeSize = settings.treeSize;
+	params.rockSize = settings.rockSize;
+	params.sandHeight = materialParams.sandHeight;
+	params.snowHeight = materialParams.snowHeight;
+	params.rockSlope = materialParams.rockSlope;
+	params.transitionWidth = materialParams.transitionWidth;
+
+	const uint32_t generation = terrain.getGenerationCount();
+	if (scattered && generation == scatteredGeneration && memcmp(&params, &scatteredParams, sizeof(ScatterParams)) == 0)
+	{
+		return;
+	}
+	waitForPipelines();
+
+	// the instances are appended with an atomic counter
+	graph.addPass("prop scatter reset", [this](VkCommandBuffer cmd) {
+			vkCmdFillBuffer(cmd, counters.buffer, 0, VK_WHOLE_SIZE, 0);
+		})
+		.write(resources.counters, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+
+	const uint32_t groups = (config.cellsPerSide + SCATTER_GROUP_SIZE - 1) / SCATTER_GROUP_SIZE;
+	graph.addPass("prop scatter", [this, params, groups](VkCommandBuffer cmd) {
+			scatterPass->recordCommands(cmd, scatterSet, 0, nullptr, &params, groups, groups, 1);
+		})
+		.read(heightmap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL })
+		.read(resources.counters, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT })
+		.write(resources.counters, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT })
+		.write(resources.instances, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT });
+
+	scattered = true;
+	scatteredGeneration = generation;
+	scatteredParams = params;
+}
+
+void PropScatter::addCullPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource pyramid, const glm::mat4& viewProj,
+	const glm::vec3& cameraPosition, bool reverseZ, bool occlusion, const PropSettings& settings, uint32_t frame)
+{
+	if (!settings.enabled || !scattered)
+	{
+		return;
+	}
+	waitForPipelines();
+
+	PropCullConstants constants{};
+	constants.viewProj = viewProj;
+	OcclusionCuller::extractFrustumPlanes(viewProj, constants.frustumPlanes);
+	constants.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+	for (uint32_t type = 0; type < PROP_TYPE_COUNT; type++)
+	{
+		constants.typeBounds[type] = typeBounds[type];
+	}
+	constants.pyramidSize = pyramidSize;
+	constants.pyramidLevels = pyramidLevels;
+	constants.occlusion = occlusion ? 1 : 0;
+	constants.reverseZ = reverseZ ? 1 : 0;
+	constants.maxInstances = config.maxInstances;
+	constants.lodDistance = settings.lodDistance;
+	constants.drawDistance = settings.drawDistance;
+	const uint32_t constantsOffset = frameConstants.push(constants);
+
+	const RenderGraph::Access storageRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT };
+	const RenderGraph::Access storageWrite{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT };
+	const RenderGraph::Access transferRead{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT };
+
+	// every draw starts over with its mesh range and no instances
+	graph.addPass("prop draw reset", [this](VkCommandBuffer cmd) {
+			const VkBufferCopy region{ 0, 0, draws.size };
+			vkCmdCopyBuffer(cmd, drawTemplate.buffer, draws.buffer, 1, &region);
+		})
+		.write(resources.draws, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+
+	// one thread per instance slot, the ones past the placed count return right away
+	const uint32_t groups = (config.maxInstances + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+	graph.addPass("prop cull", [this, groups, constantsOffset](VkCommandBuffer cmd) {
+			cullPass->recordCommands(cmd, target.cullSet, 1, &constantsOffset, nullptr, groups, 1, 1);
+		})
+		.read(resources.instances, storageRead)
+		.read(resources.counters, storageRead)
+		// declared even without occlusion, the set binds it either way
+		.read(pyramid, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL })
+		.read(resources.draws, storageRead)
+		.write(resources.draws, storageWrite)
+		.write(resources.visible, storageWrite);
+
+	// the placed count, then the instance count of every draw, in the order of PropStats
+	const VkDeviceSize slot = sizeof(PropStats) * frame;
+	graph.addPass("prop readback", [this, slot](VkCommandBuffer cmd) {
+			const VkBufferCopy placedRegion{ 0, slot, sizeof(uint32_t) };
+			vkCmdCopyBuffer(cmd, counters.buffer, readback.buffer, 1, &placedRegion);
+			std::array<VkBufferCopy, DRAW_COUNT> drawRegions{};
+			for (uint32_t draw = 0; draw < DRAW_COUNT; draw++)
+			{
+				drawRegions[draw] = { sizeof(VkDrawIndexedIndirectCommand) * draw + offsetof(VkDrawIndexedIndirectCommand, instanceCount),
+					slot + sizeof(uint32_t) * (draw + 1), sizeof(uint32_t) };
+			}
+			vkCmdCopyBuffer(cmd, draws.buffer, readback.buffer, DRAW_COUNT, drawRegions.data());
+		})
+		.read(resources.counters, transferRead)
+		.read(resources.draws, transferRead)
+		.write(resources.readback, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+}
+
+void PropScatter::recordDraw(VkCommandBuffer cmd, const glm::mat4& viewProj, VkCompareOp depthCompareOp) const
+{
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipelineLayout, 0, 1, &drawSet, 0, nullptr);
+	vkCmdPushConstants(cmd, drawPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &viewProj);
+	vkCmdSetDepthCompareOp(cmd, depthCompareOp);
+
+	const VkBuffer vertexBuffers[2] = { meshVertices.buffer, visible.buffer };
+	const VkDeviceSize offsets[2] = { 0, 0 };
+	vkCmdBindVertexBuffers(cmd, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(cmd, meshIndices.buffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdDrawIndexedIndirect(cmd, draws.buffer, 0, DRAW_COUNT, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void PropScatter::registerShaderReloads(ShaderHotReloader& reloader)
+{
+	// the cull pass includes the Hi-Z test of OcclusionCuller, every pass the instance layout
+	reloader.registerPipeline(
+		scatterPass->getShaderPath(),
+		{ scatterPass->getShaderPath(), "shaders/props_common.slang" },
+		[pass = scatterPass.get()]() { return pass->buildPipeline(); },
+		// the instances placed by the old shader would stay until the next terrain change
+		[this](VkPipeline pipeline) { scattered = false; return scatterPass->swapPipeline(pipeline); }
+	);
+	reloader.registerPipeline(
+		cullPass->getShaderPath(),
+		{ cullPass->getShaderPath(), "shaders/props_common.slang", OcclusionCuller::HIZ_COMMON_SHADER },
+		[pass = cullPass.get()]() { return pass->buildPipeline(); },
+		[pass = cullPass.get()](VkPipeline pipeline) { return pass->swapPipeline(pipeline); }
+	);
+	reloader.registerPipeline(
+		"prop graphics",
+		{ "shaders/props.slang", "shaders/props_common.slang" },
+		[this]() { return buildDrawPipeline(); },
+		[this](VkPipeline pipeline) { return std::exchange(drawPipeline, pipeline); }
+	);
+}
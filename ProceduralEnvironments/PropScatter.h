@@ -0,0 +1,182 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanImage.h"
+#include "VulkanComputePass.h"
+#include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "UploadManager.h"
+#include "FrameConstants.h"
+#include "RenderGraph.h"
+#include "ImageBasedLighting.h"
+#include "Terrain.h"
+
+/**
+* Trees and rocks scattered over the terrain and drawn entirely from GPU written indirect commands:
+*  - scatter: one candidate per cell of a jittered grid, kept or dropped by density rules on the height and slope of
+*    the heightmap, accepted ones are appended to the instance buffer. Runs only when the terrain or the scatter settings changed
+*  - cull: every frame, each instance is tested against the frustum, the draw distance and the Hi-Z pyramid OcclusionCuller
+*    built in the same frame, then appended to the instance list of its kind and LOD
+*  - draw: one indexed indirect draw per kind and LOD, the instance lists feed a per instance vertex attribute
+* The draws are reset by copying a template that holds the mesh ranges with zero instances. The placed count and the
+* instances of every draw are copied to a host visible slot per frame in flight for the overlay.
+*/
+class PropScatter
+{
+public:
+	static const uint32_t PROP_TYPE_COUNT = 2; // trees, rocks. Matches props_common.slang
+	static const uint32_t LOD_COUNT = 2;
+	static const uint32_t DRAW_COUNT = PROP_TYPE_COUNT * LOD_COUNT;
+
+	struct Config {
+		uint32_t cellsPerSide = 1024;     // scatter candidates per side of the terrain, at most one prop per cell
+		uint32_t maxInstances = 1u << 18; // capacity of the instance buffer and of the instance list of every draw
+		uint32_t seed = 7;
+	};
+
+	struct GraphResources {
+		RenderGraph::Resource instances;
+		RenderGraph::Resource counters;
+		RenderGraph::Resource draws;
+		RenderGraph::Resource visible;
+		RenderGraph::Resource readback;
+	};
+
+	/**
+	* @param colorFormat, depthFormat Attachments the props are drawn into
+	* @param threadPool When set, the pipelines are built on it, see waitForPipelines()
+	*/
+	PropScatter(VulkanDevice& device, ShaderCache& shaderCache, FrameConstantAllocator& frameConstants, UploadManager& uploadManager,
+		const Terrain& terrain, const ImageBasedLighting& imageBasedLighting, VkFormat colorFormat, VkFormat depthFormat, uint32_t frameCount,
+		const Config& config, ThreadPool* threadPool = nullptr);
+	~PropScatter();
+
+	PropScatter(const PropScatter&) = delete;
+	PropScatter& operator=(const PropScatter&) = delete;
+
+	/** @brief Block until the pipelines exist. Rethrows build failures */
+	void waitForPipelines();
+
+	/** @brief Bind the Hi-Z pyramid of OcclusionCuller, again after each of its resizes. The previous set is retired through the deletion queue */
+	void setPyramid(const vks::Image& pyramid, uint64_t frameNumber);
+
+	/** @brief Counters of the last submission of frame's slot, call once its fence was waited on */
+	PropStats collectStats(uint32_t frame) const;
+
+	/** @brief Import the instance, counter and draw buffers and frame's readback slot */
+	GraphResources importResources(RenderGraph& graph, uint32_t frame) const;
+
+	/**
+	* @brief Add the scatter over heightmap when the terrain was generated again or the scatter settings changed since the last one,
+	* after the terrain generation passes of the frame
+	*/
+	void addScatterPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap, const PropSettings& settings,
+		const TerrainParams& terrainParams, const TerrainMaterialParams& materialParams);
+
+	/**
+	* @brief Add the draw reset, the cull and the readback. pyramid has to be written by OcclusionCuller::addLatePasses() first
+	* @param occlusion Test against the pyramid, only when it was built in this frame
+	*/
+	void addCullPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource pyramid, const glm::mat4& viewProj,
+		const glm::vec3& cameraPosition, bool reverseZ, bool occlusion, const PropSettings& settings, uint32_t frame);
+
+	/**
+	* @brief Record the indirect draws inside a rendering that has the formats given at construction. Viewport and
+	* scissor are the caller's, the graph pass has to read the draws, visible and instance buffers
+	*/
+	void recordDraw(VkCommandBuffer cmd, const glm::mat4& viewProj, VkCompareOp depthCompareOp) const;
+
+	/** @brief Register the scatter and cull passes and the draw pipeline with the hot reloader */
+	void registerShaderReloads(ShaderHotReloader& reloader);
+
+	uint32_t getCapacity() const { return config.maxInstances; }
+
+private:
+	// the cull set binds the pyramid, replaced as a whole when it changes
+	struct Target {
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSet cullSet = VK_NULL_HANDLE;
+	};
+
+	/** Mirrors ScatterParams in prop_scatter.slang, compared against the last scatter to notice changes */
+	struct ScatterParams {
+		uint32_t cellsPerSide;
+		uint32_t maxInstances;
+		uint32_t seed;
+		uint32_t gridResolution;
+		float terrainSideLength;
+		float heightScale;
+		float treeDensity;
+		float rockDensity;
+		float treeSize;
+		float rockSize;
+		float sandHeight;
+		float snowHeight;
+		float rockSlope;
+		float transitionWidth;
+		float _padding[2];
+	};
+
+	void createBuffers();
+	void createMeshes(UploadManager& uploadManager);
+	void createPasses();
+	void createDrawResources();
+	VkPipeline buildDrawPipeline();
+	void destroyTarget(Target& retired);
+
+	VulkanDevice& device;
+	ShaderCache& shaderCache;
+	FrameConstantAllocator& frameConstants;
+	const Terrain& terrain;
+	const ImageBasedLighting& imageBasedLighting;
+	VkFormat colorFormat;
+	VkFormat depthFormat;
+	uint32_t frameCount;
+	Config config;
+
+	ThreadPool* threadPool;
+	std::vector<std::future<void>> pipelineBuilds;
+	std::future<VkPipeline> drawPipelineBuild;
+
+	std::unique_ptr<VulkanComputePass> scatterPass;
+	std::unique_ptr<VulkanComputePass> cullPass;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE; // the scatter and draw sets, which never change
+	VkDescriptorSet scatterSet = VK_NULL_HANDLE;
+	Target target;
+	glm::vec2 pyramidSize{ 1.0f };
+	uint32_t pyramidLevels = 1;
+
+	VkDescriptorSetLayout drawSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout drawPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline drawPipeline = VK_NULL_HANDLE;
+	VkDescriptorSet drawSet = VK_NULL_HANDLE;
+
+	vks::Buffer instances;
+	vks::Buffer counters;
+	vks::Buffer draws;
+	vks::Buffer drawTemplate; // the mesh ranges of every draw with no instances, copied over draws every frame
+	vks::Buffer visible;      // maxInstances instance indices per draw
+	vks::Buffer readback;     // one PropStats per frame slot, persistently mapped
+
+	// every LOD of every kind in one vertex and index buffer
+	vks::Buffer meshVertices;
+	vks::Buffer meshIndices;
+	// bounding sphere of the unit mesh of every kind over all its LODs, xyz center and w radius
+	std::array<glm::vec4, PROP_TYPE_COUNT> typeBounds{};
+
+	// what the instance buffer holds
+	bool scattered = false;
+	uint32_t scatteredGeneration = 0;
+	ScatterParams scatteredParams{};
+};
@@ -0,0 +1,380 @@
+#include "RenderGraph.h"
+
+#include <iomanip>
+#include <stdexcept>
+
+namespace
+{
+	const VkAccessFlags2 WRITE_ACCESS =
+		VK_ACCESS_2_SHADER_WRITE_BIT |
+		VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+		VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_TRANSFER_WRITE_BIT |
+		VK_ACCESS_2_HOST_WRITE_BIT |
+		VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+	const char* layoutName(VkImageLayout layout)
+	{
+		switch (layout)
+		{
+		case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+		case VK_IMAGE_LAYOUT_GENERAL: return "GENERAL";
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "COLOR_ATTACHMENT";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL: return "DEPTH_STENCIL_ATTACHMENT";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL: return "DEPTH_STENCIL_READ_ONLY";
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY";
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC";
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "TRANSFER_DST";
+		case VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL: return "ATTACHMENT";
+		case VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL: return "READ_ONLY";
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC";
+		default: return "OTHER";
+		}
+	}
+
+	std::ostream& writeMasks(std::ostream& out, VkPipelineStageFlags2 stage, VkAccessFlags2 access)
+	{
+		return out << "stage 0x" << std::hex << stage << " access 0x" << access << std::dec;
+	}
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(Resource resource, const Access& access)
+{
+	graph.addUse(pass, resource, access, false);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(Resource resource, const Access& access)
+{
+	graph.addUse(pass, resource, access, true);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffect()
+{
+	graph.passes[pass].sideEffect = true;
+	return *this;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImage image, const VkImageSubresourceRange& range, const Access& current)
+{
+	ResourceInfo info{};
+	info.name = name;
+	info.isImage = true;
+	info.image = image;
+	info.range = range;
+	info.initial = current;
+	resources.push_back(info);
+	return static_cast<Resource>(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, const Access& current)
+{
+	ResourceInfo info{};
+	info.name = name;
+	info.isImage = false;
+	info.buffer = buffer;
+	info.offset = offset;
+	info.size = size;
+	info.initial = current;
+	resources.push_back(info);
+	return static_cast<Resource>(resources.size() - 1);
+}
+
+void RenderGraph::setFinalState(Resource resource, const Access& state)
+{
+	resources[resource].hasFinalState = true;
+	resources[resource].finalState = state;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string& name, std::function<void(VkCommandBuffer)> execute)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("Render graph pass \"" + name + "\" added after compile()");
+	}
+	PassInfo pass{};
+	pass.name = name;
+	pass.execute = std::move(execute);
+	passes.push_back(std::move(pass));
+	return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void RenderGraph::addUse(uint32_t pass, Resource resource, const Access& access, bool write)
+{
+	// all uses of a resource within a pass are merged, a single barrier has to cover them
+	for (ResourceUse& use : passes[pass].uses)
+	{
+		if (use.resource != resource)
+		{
+			continue;
+		}
+		if (resources[resource].isImage && use.access.layout != access.layout)
+		{
+			throw std::runtime_error("Render graph pass \"" + passes[pass].name + "\" uses \"" + resources[resource].name + "\" in two layouts");
+		}
+		use.access.stage |= access.stage;
+		use.access.access |= access.access;
+		use.read = use.read || !write;
+		use.write = use.write || write;
+		return;
+	}
+	passes[pass].uses.push_back({ resource, access, !write, write });
+}
+
+void RenderGraph::cullPasses()
+{
+	// walking backwards, a pass is needed when it has side effects or writes something a later needed pass reads or
+	// that leaves the graph. Earlier writers of a needed resource are kept, writes are not assumed to cover all of it
+	std::vector<bool> needed(resources.size(), false);
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		needed[i] = resources[i].hasFinalState;
+	}
+
+	for (size_t i = passes.size(); i-- > 0;)
+	{
+		PassInfo& pass = passes[i];
+		bool live = pass.sideEffect;
+		for (const ResourceUse& use : pass.uses)
+		{
+			live = live || (use.write && needed[use.resource]);
+		}
+		pass.culled = !live;
+		if (!live)
+		{
+			continue;
+		}
+		for (const ResourceUse& use : pass.uses)
+		{
+			if (use.read)
+			{
+				needed[use.resource] = true;
+			}
+		}
+	}
+}
+
+void RenderGraph::compile()
+{
+	if (compiled)
+	{
+		return;
+	}
+	cullPasses();
+
+	std::vector<Tracking> tracking(resources.size());
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		const Access& initial = resources[i].initial;
+		Tracking& state = tracking[i];
+		state = {};
+		state.layout = initial.layout;
+		if (initial.access & WRITE_ACCESS)
+		{
+			state.writeStage = initial.stage;
+			state.writeAccess = initial.access;
+		}
+		else
+		{
+			state.readStages = initial.stage;
+		}
+	}
+
+	for (PassInfo& pass : passes)
+	{
+		if (pass.culled)
+		{
+			continue;
+		}
+		for (const ResourceUse& use : pass.uses)
+		{
+			synchronize(use.resource, tracking[use.resource], use.access, use.write, pass.barriers);
+		}
+	}
+
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		if (resources[i].hasFinalState)
+		{
+			const Access& finalState = resources[i].finalState;
+			synchronize(static_cast<Resource>(i), tracking[i], finalState, (finalState.access & WRITE_ACCESS) != 0, finalBarriers);
+		}
+	}
+
+	compiled = true;
+}
+
+void RenderGraph::synchronize(Resource resource, Tracking& tracking, const Access& access, bool write, BarrierBatch& batch) const
+{
+	const ResourceInfo& info = resources[resource];
+	const VkImageLayout oldLayout = tracking.layout;
+	const bool transition = info.isImage && access.layout != oldLayout;
+
+	VkPipelineStageFlags2 srcStage = VK_PIPELINE_STAGE_2_NONE;
+	VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+	bool barrier = false;
+
+	if (transition || write)
+	{
+		// a write or layout change waits for the last write and every read since, reads only need an execution dependency
+		srcStage = tracking.writeStage | tracking.readStages;
+		srcAccess = tracking.writeAccess;
+		barrier = transition || srcStage != VK_PIPELINE_STAGE_2_NONE;
+
+		if (write)
+		{
+			tracking.writeStage = access.stage;
+			tracking.writeAccess = access.access & WRITE_ACCESS;
+			tracking.readStages = VK_PIPELINE_STAGE_2_NONE;
+			// the new write is visible to nobody yet, not even a read in the same stage
+			tracking.visibleStages = VK_PIPELINE_STAGE_2_NONE;
+			tracking.visibleAccess = VK_ACCESS_2_NONE;
+		}
+		else
+		{
+			// later reads in other stages still have to be ordered after the transition, the transition made
+			// everything before it visible to this stage and access
+			tracking.writeStage = access.stage;
+			tracking.writeAccess = VK_ACCESS_2_NONE;
+			tracking.readStages = access.stage;
+			tracking.visibleStages = access.stage;
+			tracking.visibleAccess = access.access;
+		}
+		tracking.layout = info.isImage ? access.layout : tracking.layout;
+	}
+	else
+	{
+		// read after read needs nothing, read after write only once per stage and access
+		const bool invisible = (access.stage & ~tracking.visibleStages) != 0 || (access.access & ~tracking.visibleAccess) != 0;
+		if (tracking.writeStage != VK_PIPELINE_STAGE_2_NONE && invisible)
+		{
+			srcStage = tracking.writeStage;
+			srcAccess = tracking.writeAccess;
+			barrier = true;
+			tracking.visibleStages |= access.stage;
+			tracking.visibleAccess |= access.access;
+		}
+		tracking.readStages |= access.stage;
+	}
+
+	if (!barrier)
+	{
+		return;
+	}
+
+	if (info.isImage)
+	{
+		VkImageMemoryBarrier2 imageBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+		imageBarrier.srcStageMask = srcStage;
+		imageBarrier.srcAccessMask = srcAccess;
+		imageBarrier.dstStageMask = access.stage;
+		imageBarrier.dstAccessMask = access.access;
+		imageBarrier.oldLayout = oldLayout;
+		imageBarrier.newLayout = access.layout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = info.image;
+		imageBarrier.subresourceRange = info.range;
+		batch.imageBarriers.push_back(imageBarrier);
+		batch.imageResources.push_back(resource);
+	}
+	else
+	{
+		VkBufferMemoryBarrier2 bufferBarrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+		bufferBarrier.srcStageMask = srcStage;
+		bufferBarrier.srcAccessMask = srcAccess;
+		bufferBarrier.dstStageMask = access.stage;
+		bufferBarrier.dstAccessMask = access.access;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.buffer = info.buffer;
+		bufferBarrier.offset = info.offset;
+		bufferBarrier.size = info.size;
+		batch.bufferBarriers.push_back(bufferBarrier);
+		batch.bufferResources.push_back(resource);
+	}
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+	compile();
+	for (const PassInfo& pass : passes)
+	{
+		if (pass.culled)
+		{
+			continue;
+		}
+		record(cmd, pass.barriers);
+		pass.execute(cmd);
+	}
+	record(cmd, finalBarriers);
+}
+
+void RenderGraph::record(VkCommandBuffer cmd, const BarrierBatch& batch) const
+{
+	if (batch.empty())
+	{
+		return;
+	}
+	VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(batch.imageBarriers.size());
+	dependencyInfo.pImageMemoryBarriers = batch.imageBarriers.data();
+	dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(batch.bufferBarriers.size());
+	dependencyInfo.pBufferMemoryBarriers = batch.bufferBarriers.data();
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+uint32_t RenderGraph::getBarrierBatchCount() const
+{
+	uint32_t count = finalBarriers.empty() ? 0 : 1;
+	for (const PassInfo& pass : passes)
+	{
+		count += !pass.culled && !pass.barriers.empty() ? 1 : 0;
+	}
+	return count;
+}
+
+void RenderGraph::dump(std::ostream& out) const
+{
+	auto dumpBatch = [&](const BarrierBatch& batch) {
+		for (size_t i = 0; i < batch.imageBarriers.size(); i++)
+		{
+			const VkImageMemoryBarrier2& barrier = batch.imageBarriers[i];
+			out << "    barrier \"" << resources[batch.imageResources[i]].name << "\" " << layoutName(barrier.oldLayout) << " -> " << layoutName(barrier.newLayout) << ", ";
+			writeMasks(out, barrier.srcStageMask, barrier.srcAccessMask) << " -> ";
+			writeMasks(out, barrier.dstStageMask, barrier.dstAccessMask) << "\n";
+		}
+		for (size_t i = 0; i < batch.bufferBarriers.size(); i++)
+		{
+			const VkBufferMemoryBarrier2& barrier = batch.bufferBarriers[i];
+			out << "    barrier \"" << resources[batch.bufferResources[i]].name << "\" ";
+			writeMasks(out, barrier.srcStageMask, barrier.srcAccessMask) << " -> ";
+			writeMasks(out, barrier.dstStageMask, barrier.dstAccessMask) << "\n";
+		}
+	};
+
+	out << "Render graph: " << passes.size() << " passes, " << resources.size() << " resources, " << getBarrierBatchCount() << " barrier batches" << "\n";
+	for (size_t i = 0; i < passes.size(); i++)
+	{
+		const PassInfo& pass = passes[i];
+		out << "  [" << i << "] " << pass.name << (pass.culled ? " (culled)" : "") << (pass.sideEffect ? " (side effect)" : "") << "\n";
+		dumpBatch(pass.barriers);
+		for (const ResourceUse& use : pass.uses)
+		{
+			const ResourceInfo& info = resources[use.resource];
+			out << "    " << (use.read && use.write ? "read/write" : use.write ? "write" : "read") << " \"" << info.name << "\" ";
+			if (info.isImage)
+			{
+				out << layoutName(use.access.layout) << ", ";
+			}
+			writeMasks(out, use.access.stage, use.access.access) << "\n";
+		}
+	}
+	if (!finalBarriers.empty())
+	{
+		out << "  final states" << "\n";
+		dumpBatch(finalBarriers);
+	}
+}
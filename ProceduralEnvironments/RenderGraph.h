@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+* Per frame list of passes with their declared resource accesses, executed in the order they were added.
+* compile() drops passes whose results nothing needs and derives the synchronization2 barriers in between: every
+* barrier a pass needs is issued in a single vkCmdPipelineBarrier2 before it, reads after reads don't synchronize and
+* a write after reads is only an execution dependency.
+* Resources are imported with the state their last use left them in, the graph doesn't own them. An imported resource
+* with a final state is an output of the graph and is transitioned to that state after its last use.
+* Built and compiled on the recording thread, cheap enough to rebuild every frame.
+*/
+class RenderGraph
+{
+public:
+	using Resource = uint32_t;
+
+	/** @brief How a resource was or will be accessed. The layout is ignored for buffers */
+	struct Access {
+		VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+		VkAccessFlags2 access = VK_ACCESS_2_NONE;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	class PassBuilder
+	{
+	public:
+		PassBuilder& read(Resource resource, const Access& access);
+		PassBuilder& write(Resource resource, const Access& access);
+		/** @brief Keep the pass even when nothing reads what it writes, e.g. for queries */
+		PassBuilder& sideEffect();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+		RenderGraph& graph;
+		uint32_t pass;
+	};
+
+	/** @brief current is the state the previous use left the image in, UNDEFINED discards its contents */
+	Resource importImage(const std::string& name, VkImage image, const VkImageSubresourceRange& range, const Access& current);
+	Resource importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, const Access& current);
+
+	/** @brief Transition resource to state after the graph ran and treat it as an output */
+	void setFinalState(Resource resource, const Access& state);
+
+	PassBuilder addPass(const std::string& name, std::function<void(VkCommandBuffer)> execute);
+
+	/** @brief Cull passes and derive barriers, the graph can't be changed afterwards */
+	void compile();
+
+	/** @brief Record the barriers and live passes into cmd, compiles first if needed */
+	void execute(VkCommandBuffer cmd);
+
+	/** @brief Passes, their accesses and the derived barrier batches in execution order */
+	void dump(std::ostream& out) const;
+
+	uint32_t getBarrierBatchCount() const;
+
+private:
+	struct ResourceInfo {
+		std::string name;
+		bool isImage;
+		VkImage image;
+		VkImageSubresourceRange range;
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		Access initial;
+		bool hasFinalState = false;
+		Access finalState;
+	};
+
+	struct ResourceUse {
+		Resource resource;
+		Access access;
+		bool read;
+		bool write;
+	};
+
+	// barriers recorded together before a pass, or after the last one for the final states
+	struct BarrierBatch {
+		std::vector<VkImageMemoryBarrier2> imageBarriers;
+		std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+		std::vector<Resource> imageResources; // parallel to the barriers, for dump()
+		std::vector<Resource> bufferResources;
+		bool empty() const { return imageBarriers.empty() && bufferBarriers.empty(); }
+	};
+
+	struct PassInfo {
+		std::string name;
+		std::function<void(VkCommandBuffer)> execute;
+		std::vector<ResourceUse> uses; // one per resource
+		bool sideEffect = false;
+		bool culled = false;
+		BarrierBatch barriers;
+	};
+
+	// what has to be waited on before the next access of a resource
+	struct Tracking {
+		VkImageLayout layout;
+		VkPipelineStageFlags2 writeStage;
+		VkAccessFlags2 writeAccess;
+		VkPipelineStageFlags2 readStages; // since the last write
+		VkPipelineStageFlags2 visibleStages; // the last write is already visible to these
+		VkAccessFlags2 visibleAccess;
+	};
+
+	void addUse(uint32_t pass, Resource resource, const Access& access, bool write);
+	void cullPasses();
+	void synchronize(Resource resource, Tracking& tracking, const Access& access, bool write, BarrierBatch& batch) const;
+	void record(VkCommandBuffer cmd, const BarrierBatch& batch) const;
+
+	std::vector<ResourceInfo> resources;
+	std::vector<PassInfo> passes;
+	BarrierBatch finalBarriers;
+	bool compiled = false;
+};
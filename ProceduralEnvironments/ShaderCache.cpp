@@ -0,0 +1,214 @@
+#include "ShaderCache.h"
+
+#include "VulkanTools.h"
+
+#include <filesystem>
+#include <regex>
+#include <sstream>
+#include <iomanip>
+
+ShaderCache::ShaderCache(slang::IGlobalSession* slangGlobalSession, std::string cacheDirectory)
+	: slangGlobalSession(slangGlobalSession)
+	, cacheDirectory(std::move(cacheDirectory))
+{
+	const char* buildTag = slangGlobalSession->getBuildTagString();
+	slangBuildTag = buildTag ? buildTag : "";
+
+	idleSessions.push_back(slangGlobalSession);
+
+	std::error_code ec;
+	std::filesystem::create_directories(this->cacheDirectory, ec);
+}
+
+ShaderCache::~ShaderCache()
+{
+	for (slang::IGlobalSession* session : ownedSessions)
+	{
+		session->release();
+	}
+}
+
+std::vector<uint32_t> ShaderCache::getSpirv(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile)
+{
+	uint64_t key = computeKey(shaderPath, entryPointName, profile);
+	std::string cachePath = cacheFilePath(shaderPath, entryPointName, profile, key);
+
+	std::vector<char> cached = vks::tools::readBinaryFile(cachePath.c_str());
+	if (!cached.empty() && cached.size() % sizeof(uint32_t) == 0)
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats.hits++;
+		std::vector<uint32_t> spirv(cached.size() / sizeof(uint32_t));
+		memcpy(spirv.data(), cached.data(), cached.size());
+		return spirv;
+	}
+
+	slang::IGlobalSession* session = acquireSession();
+	std::vector<uint32_t> spirv = vks::tools::compileSlangShader(session, shaderPath.c_str(), entryPointName.c_str(), profile.c_str());
+	releaseSession(session);
+
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		if (spirv.empty())
+		{
+			stats.failures++;
+			return spirv;
+		}
+		stats.misses++;
+	}
+
+	// write to a temporary first so a crash never leaves a truncated entry behind
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+		os.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+	}
+	std::error_code ec;
+	std::filesystem::rename(tempPath, cachePath, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tempPath, ec);
+		return spirv;
+	}
+
+	// drop entries for older versions of the same entry point and profile, other profiles of it stay cached
+	std::string stalePrefix = std::filesystem::path(shaderPath).stem().string() + "." + entryPointName + "." + profile + ".";
+	std::string currentName = std::filesystem::path(cachePath).filename().string();
+	for (const auto& entry : std::filesystem::directory_iterator(cacheDirectory, ec))
+	{
+		std::string name = entry.path().filename().string();
+		if (name != currentName && name.rfind(stalePrefix, 0) == 0 && entry.path().extension() == ".spv")
+		{
+			std::filesystem::remove(entry.path(), ec);
+		}
+	}
+
+	return spirv;
+}
+
+VkShaderModule ShaderCache::loadShader(VkDevice device, const std::string& shaderPath, const std::string& entryPointName, const std::string& profile)
+{
+	std::vector<uint32_t> spirv = getSpirv(shaderPath, entryPointName, profile);
+	if (spirv.empty())
+	{
+		std::cerr << "Error: Could not compile shader \"" << shaderPath << "\" entry \"" << entryPointName << "\"" << "\n";
+		return VK_NULL_HANDLE;
+	}
+	return vks::tools::createShaderModule(device, spirv);
+}
+
+std::vector<std::string> ShaderCache::getDependencies(const std::string& shaderPath) const
+{
+	uint64_t hash = 0;
+	std::unordered_set<std::string> visited;
+	hashFileRecursive(shaderPath, hash, visited);
+	return std::vector<std::string>(visited.begin(), visited.end());
+}
+
+ShaderCache::Stats ShaderCache::getStats() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return stats;
+}
+
+uint64_t ShaderCache::computeKey(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile) const
+{
+	uint64_t hash = vks::tools::fnv1a64(slangBuildTag.data(), slangBuildTag.size());
+	hash = vks::tools::fnv1a64(entryPointName.data(), entryPointName.size(), hash);
+	hash = vks::tools::fnv1a64(profile.data(), profile.size(), hash);
+
+	std::unordered_set<std::string> visited;
+	hashFileRecursive(shaderPath, hash, visited);
+	return hash;
+}
+
+void ShaderCache::hashFileRecursive(const std::string& path, uint64_t& hash, std::unordered_set<std::string>& visited) const
+{
+	std::string normalized = std::filesystem::path(path).lexically_normal().generic_string();
+	if (!visited.insert(normalized).second)
+	{
+		return;
+	}
+
+	std::vector<char> source = vks::tools::readBinaryFile(normalized.c_str());
+	hash = vks::tools::fnv1a64(normalized.data(), normalized.size(), hash);
+	hash = vks::tools::fnv1a64(source.data(), source.size(), hash);
+
+	for (const std::string& dependency : parseDependencies(normalized, std::string(source.begin(), source.end())))
+	{
+		hashFileRecursive(dependency, hash, visited);
+	}
+}
+
+std::vector<std::string> ShaderCache::parseDependencies(const std::string& path, const std::string& source)
+{
+	static const std::regex includeRegex(R"(^\s*#\s*include\s*"([^"]+)")");
+	static const std::regex importRegex(R"(^\s*(?:import|__include|implementing)\s+([A-Za-z0-9_.]+)\s*;)");
+	static const std::regex quotedImportRegex(R"(^\s*(?:import|__include|implementing)\s+"([^"]+)"\s*;)");
+
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	std::vector<std::string> dependencies;
+
+	std::istringstream stream(source);
+	std::string line;
+	std::smatch match;
+	while (std::getline(stream, line))
+	{
+		if (std::regex_search(line, match, includeRegex) || std::regex_search(line, match, quotedImportRegex))
+		{
+			dependencies.push_back((directory / match[1].str()).string());
+		}
+		else if (std::regex_search(line, match, importRegex))
+		{
+			// module "a.b_c" lives in "a/b_c.slang" or "a/b-c.slang"
+			std::string moduleName = match[1].str();
+			std::replace(moduleName.begin(), moduleName.end(), '.', '/');
+			std::filesystem::path candidate = directory / (moduleName + ".slang");
+			if (!std::filesystem::exists(candidate))
+			{
+				std::replace(moduleName.begin(), moduleName.end(), '_', '-');
+				candidate = directory / (moduleName + ".slang");
+			}
+			if (std::filesystem::exists(candidate))
+			{
+				dependencies.push_back(candidate.string());
+			}
+		}
+	}
+	return dependencies;
+}
+
+std::string ShaderCache::cacheFilePath(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile, uint64_t key) const
+{
+	std::ostringstream name;
+	name << std::filesystem::path(shaderPath).stem().string() << "." << entryPointName << "." << profile << "."
+		<< std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+	return (std::filesystem::path(cacheDirectory) / name.str()).string();
+}
+
+slang::IGlobalSession* ShaderCache::acquireSession()
+{
+	{
+		std::lock_guard<std::mutex> lock(sessionMutex);
+		if (!idleSessions.empty())
+		{
+			slang::IGlobalSession* session = idleSessions.back();
+			idleSessions.pop_back();
+			return session;
+		}
+	}
+
+	// every session is busy compiling on another thread
+	slang::IGlobalSession* session = nullptr;
+	slang::createGlobalSession(&session);
+
+	std::lock_guard<std::mutex> lock(sessionMutex);
+	ownedSessions.push_back(session);
+	return session;
+}
+
+void ShaderCache::releaseSession(slang::IGlobalSession* session)
+{
+	std::lock_guard<std::mutex> lock(sessionMutex);
+	idleSessions.push_back(session);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <slang/slang.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+* On-disk cache of Slang -> SPIR-V compilation results.
+* Entries are keyed by a hash of the shader source, every file it imports or includes,
+* the entry point, the target profile and the Slang build tag.
+*/
+class ShaderCache
+{
+public:
+	struct Stats {
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+		uint32_t failures = 0;
+	};
+
+	ShaderCache(slang::IGlobalSession* slangGlobalSession, std::string cacheDirectory = "shaders/cache/");
+	~ShaderCache();
+
+	ShaderCache(const ShaderCache&) = delete;
+	ShaderCache& operator=(const ShaderCache&) = delete;
+
+	/** @brief Returns SPIR-V for the entry point, compiling and storing it on a miss. Empty if compilation failed */
+	std::vector<uint32_t> getSpirv(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile = "spirv_1_5");
+
+	/** @brief Wraps getSpirv() in a shader module. VK_NULL_HANDLE if compilation failed */
+	VkShaderModule loadShader(VkDevice device, const std::string& shaderPath, const std::string& entryPointName, const std::string& profile = "spirv_1_5");
+
+	/** @brief Files the shader depends on, itself included */
+	std::vector<std::string> getDependencies(const std::string& shaderPath) const;
+
+	Stats getStats() const;
+
+private:
+	uint64_t computeKey(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile) const;
+	void hashFileRecursive(const std::string& path, uint64_t& hash, std::unordered_set<std::string>& visited) const;
+	static std::vector<std::string> parseDependencies(const std::string& path, const std::string& source);
+	std::string cacheFilePath(const std::string& shaderPath, const std::string& entryPointName, const std::string& profile, uint64_t key) const;
+	slang::IGlobalSession* acquireSession();
+	void releaseSession(slang::IGlobalSession* session);
+
+	slang::IGlobalSession* slangGlobalSession;
+	std::string cacheDirectory;
+	std::string slangBuildTag;
+
+	// a slang global session is not thread safe, concurrent compiles each take their own
+	std::mutex sessionMutex;
+	std::vector<slang::IGlobalSession*> idleSessions;
+	std::vector<slang::IGlobalSession*> ownedSessions;
+
+	mutable std::mutex statsMutex;
+	Stats stats;
+};
@@ -0,0 +1,295 @@
+#include "ShaderHotReloader.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ShaderHotReloader::ShaderHotReloader(VkDevice device, ShaderCache& shaderCache, DeletionQueue& deletionQueue)
+	: device(device)
+	, shaderCache(shaderCache)
+	, deletionQueue(deletionQueue)
+{
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0)
+	{
+		std::cerr << "Warning: inotify unavailable, shader hot reload disabled" << "\n";
+	}
+#endif
+}
+
+ShaderHotReloader::~ShaderHotReloader()
+{
+	stop();
+
+#ifdef __linux__
+	if (inotifyFd >= 0)
+	{
+		close(inotifyFd);
+	}
+#endif
+
+	// never installed, so never used by a frame
+	for (const ReadyPipeline& ready : readyPipelines)
+	{
+		vkDestroyPipeline(device, ready.pipeline, nullptr);
+	}
+}
+
+void ShaderHotReloader::registerPipeline(const std::string& name, const std::vector<std::string>& shaderPaths, BuildFn build, InstallFn install)
+{
+	if (running)
+	{
+		throw std::runtime_error("Shader hot reload targets must be registered before start()");
+	}
+
+	Target target;
+	target.name = name;
+	for (const std::string& path : shaderPaths)
+	{
+		target.shaderPaths.push_back(std::filesystem::path(path).lexically_normal().generic_string());
+	}
+	target.build = std::move(build);
+	target.install = std::move(install);
+	refreshDependencies(target);
+	targets.push_back(std::move(target));
+}
+
+void ShaderHotReloader::start()
+{
+	if (running)
+	{
+		return;
+	}
+	updateWatches();
+	running = true;
+	watcherThread = std::thread(&ShaderHotReloader::watchLoop, this);
+}
+
+void ShaderHotReloader::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		running = false;
+	}
+	wakeCondition.notify_all();
+	if (watcherThread.joinable())
+	{
+		watcherThread.join();
+	}
+}
+
+void ShaderHotReloader::applyPendingReloads(uint64_t frameNumber)
+{
+	std::vector<ReadyPipeline> ready;
+	{
+		std::lock_guard<std::mutex> lock(readyMutex);
+		ready.swap(readyPipelines);
+	}
+
+	for (const ReadyPipeline& pipeline : ready)
+	{
+		const Target& target = targets[pipeline.targetIndex];
+		VkPipeline previous = target.install(pipeline.pipeline);
+		if (previous != VK_NULL_HANDLE)
+		{
+			// replaced before recording frameNumber, so the previous frame was the last to use it
+			VkDevice pipelineDevice = device;
+			deletionQueue.retire(frameNumber == 0 ? 0 : frameNumber - 1, [pipelineDevice, previous]() { vkDestroyPipeline(pipelineDevice, previous, nullptr); });
+		}
+		std::cout << "Shader reload: \"" << target.name << "\" updated" << "\n";
+	}
+}
+
+void ShaderHotReloader::watchLoop()
+{
+	while (running)
+	{
+		std::vector<std::string> changedFiles = waitForChanges();
+		if (!changedFiles.empty())
+		{
+			rebuild(changedFiles);
+			updateWatches();
+		}
+	}
+}
+
+#ifdef __linux__
+
+std::vector<std::string> ShaderHotReloader::waitForChanges()
+{
+	if (inotifyFd < 0)
+	{
+		sleepFor(std::chrono::milliseconds(250));
+		return {};
+	}
+
+	std::unordered_set<std::string> changed;
+	pollfd pfd{ inotifyFd, POLLIN, 0 };
+	int timeoutMs = 250;
+	while (running)
+	{
+		int result = poll(&pfd, 1, timeoutMs);
+		if (result <= 0)
+		{
+			if (!changed.empty())
+			{
+				break;
+			}
+			continue;
+		}
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* ptr = buffer; ptr < buffer + length; )
+			{
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+				auto directory = watchedDirectories.find(event->wd);
+				if (event->len > 0 && directory != watchedDirectories.end())
+				{
+					changed.insert((std::filesystem::path(directory->second) / event->name).lexically_normal().generic_string());
+				}
+				ptr += sizeof(inotify_event) + event->len;
+			}
+		}
+
+		// editors often save in several steps, gather everything written in a short window
+		timeoutMs = 100;
+	}
+	return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+void ShaderHotReloader::updateWatches()
+{
+	if (inotifyFd < 0)
+	{
+		return;
+	}
+
+	for (const Target& target : targets)
+	{
+		for (const std::string& dependency : target.dependencies)
+		{
+			std::string directory = std::filesystem::path(dependency).parent_path().generic_string();
+			if (directory.empty())
+			{
+				directory = ".";
+			}
+
+			bool watched = std::any_of(watchedDirectories.begin(), watchedDirectories.end(),
+				[&](const auto& entry) { return entry.second == directory; });
+			if (watched)
+			{
+				continue;
+			}
+
+			int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+			if (wd >= 0)
+			{
+				watchedDirectories[wd] = directory;
+			}
+		}
+	}
+}
+
+#else
+
+std::vector<std::string> ShaderHotReloader::waitForChanges()
+{
+	sleepFor(std::chrono::milliseconds(250));
+
+	std::vector<std::string> changed;
+	for (auto& [path, lastWriteTime] : lastWriteTimes)
+	{
+		std::error_code ec;
+		auto writeTime = std::filesystem::last_write_time(path, ec);
+		if (!ec && writeTime != lastWriteTime)
+		{
+			lastWriteTime = writeTime;
+			changed.push_back(path);
+		}
+	}
+	return changed;
+}
+
+void ShaderHotReloader::updateWatches()
+{
+	for (const Target& target : targets)
+	{
+		for (const std::string& dependency : target.dependencies)
+		{
+			if (lastWriteTimes.count(dependency) == 0)
+			{
+				std::error_code ec;
+				lastWriteTimes[dependency] = std::filesystem::last_write_time(dependency, ec);
+			}
+		}
+	}
+}
+
+#endif
+
+void ShaderHotReloader::rebuild(const std::vector<std::string>& changedFiles)
+{
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		Target& target = targets[i];
+		bool affected = std::any_of(changedFiles.begin(), changedFiles.end(),
+			[&](const std::string& file) { return target.dependencies.count(file) > 0; });
+		if (!affected)
+		{
+			continue;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		try
+		{
+			pipeline = target.build();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Shader reload: \"" << target.name << "\" threw: " << e.what() << "\n";
+		}
+
+		// imports may have been added or removed by the edit
+		refreshDependencies(target);
+
+		if (pipeline == VK_NULL_HANDLE)
+		{
+			std::cerr << "Shader reload: \"" << target.name << "\" failed, keeping the current pipeline" << "\n";
+			continue;
+		}
+
+		float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Shader reload: \"" << target.name << "\" rebuilt in " << ms << " ms" << "\n";
+
+		std::lock_guard<std::mutex> lock(readyMutex);
+		readyPipelines.push_back({ i, pipeline });
+	}
+}
+
+void ShaderHotReloader::refreshDependencies(Target& target)
+{
+	target.dependencies.clear();
+	for (const std::string& path : target.shaderPaths)
+	{
+		for (const std::string& dependency : shaderCache.getDependencies(path))
+		{
+			target.dependencies.insert(dependency);
+		}
+	}
+}
+
+void ShaderHotReloader::sleepFor(std::chrono::milliseconds duration)
+{
+	std::unique_lock<std::mutex> lock(wakeMutex);
+	wakeCondition.wait_for(lock, duration, [this]() { return !running; });
+}
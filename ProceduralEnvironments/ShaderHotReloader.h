@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ShaderCache.h"
+#include "DeletionQueue.h"
+
+/**
+* Watches shader sources and rebuilds the pipelines that depend on them on a background thread.
+* Rebuilt pipelines are handed to their owners in applyPendingReloads(), which the render thread
+* calls once per frame. Replaced pipelines go to the deletion queue, so reloading never waits for
+* the device to go idle.
+* A failed compile keeps the current pipeline.
+*/
+class ShaderHotReloader
+{
+public:
+	/** Builds a replacement pipeline, VK_NULL_HANDLE on failure. Called on the watcher thread */
+	using BuildFn = std::function<VkPipeline()>;
+	/** Installs the new pipeline and returns the one it replaced. Called on the render thread */
+	using InstallFn = std::function<VkPipeline(VkPipeline)>;
+
+	ShaderHotReloader(VkDevice device, ShaderCache& shaderCache, DeletionQueue& deletionQueue);
+	~ShaderHotReloader();
+
+	ShaderHotReloader(const ShaderHotReloader&) = delete;
+	ShaderHotReloader& operator=(const ShaderHotReloader&) = delete;
+
+	/** @brief Register a pipeline built from the given shaders. Must be called before start() */
+	void registerPipeline(const std::string& name, const std::vector<std::string>& shaderPaths, BuildFn build, InstallFn install);
+
+	/** @brief Start watching the registered shaders */
+	void start();
+
+	/** @brief Stop the watcher thread. Pipelines not yet installed are destroyed on destruction */
+	void stop();
+
+	/**
+	* @brief Install rebuilt pipelines and retire the replaced ones
+	* @param frameNumber Monotonic frame counter of the frame about to be recorded
+	*/
+	void applyPendingReloads(uint64_t frameNumber);
+
+private:
+	struct Target {
+		std::string name;
+		std::vector<std::string> shaderPaths;
+		std::unordered_set<std::string> dependencies;
+		BuildFn build;
+		InstallFn install;
+	};
+
+	struct ReadyPipeline {
+		size_t targetIndex;
+		VkPipeline pipeline;
+	};
+
+	void watchLoop();
+	std::vector<std::string> waitForChanges();
+	void rebuild(const std::vector<std::string>& changedFiles);
+	void refreshDependencies(Target& target);
+	void updateWatches();
+	void sleepFor(std::chrono::milliseconds duration);
+
+	VkDevice device;
+	ShaderCache& shaderCache;
+	DeletionQueue& deletionQueue;
+
+	// only touched by the watcher thread once started, install callbacks excepted
+	std::vector<Target> targets;
+
+	std::thread watcherThread;
+	std::atomic<bool> running{ false };
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+
+#ifdef __linux__
+	int inotifyFd = -1;
+	std::unordered_map<int, std::string> watchedDirectories;
+#else
+	std::unordered_map<std::string, std::filesystem::file_time_type> lastWriteTimes;
+#endif
+
+	std::mutex readyMutex;
+	std::vector<ReadyPipeline> readyPipelines;
+};
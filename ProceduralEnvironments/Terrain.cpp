@@ -1,9 +1,14 @@
 #include "Terrain.h"
 
-Terrain::Terrain(VulkanDevice& device, const Config& config)
+#include <algorithm>
+
+Terrain::Terrain(VulkanDevice& device, ShaderCache& shaderCache, const Config& config)
 	: m_device(device)
+	, m_shaderCache(shaderCache)
 	, m_config(config)
-	, m_indexCount((config.gridResolution - 1)* (config.gridResolution - 1) * 6)
+	, m_patchesPerSide((config.gridResolution - 1 + config.patchSize - 1) / config.patchSize)
+	, m_patchCount(m_patchesPerSide * m_patchesPerSide)
+	, m_indexCount(m_patchCount * config.patchSize * config.patchSize * 6)
 {
 }
 
@@ -12,114 +17,126 @@ Terrain::~Terrain()
 	cleanup();
 }
 
-void Terrain::initialize(VkDescriptorPool descriptorPool)
+void Terrain::initialize(VkDescriptorPool descriptorPool, ThreadPool* threadPool)
 {
+	m_threadPool = threadPool;
 	createHeightmapResources();
 	createMeshBuffers();
 	createHeightmapComputePass(descriptorPool);
 	createTerrainGenComputePass(descriptorPool);
+	createHorizonResources(descriptorPool);
 }
 
-void Terrain::recordGeneration(VkCommandBuffer cmd, const HeightMapParams& heightMapParams, const TerrainParams& terrainParams)
+void Terrain::waitForPipelines()
 {
-    VkImageLayout oldLayout = m_initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
-    VkAccessFlags srcAccessMask = m_initialized ? VK_ACCESS_SHADER_READ_BIT : 0;
-    VkPipelineStageFlags srcStage = m_initialized ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-    // ============================================
-    // HEIGHTMAP GENERATION
-    // ============================================
-
-    vks::tools::insertImageMemoryBarrier(
-        cmd,
-        m_heightMap.image,
-        srcAccessMask,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        oldLayout,
-        VK_IMAGE_LAYOUT_GENERAL,
-        srcStage,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-    );
+	for (std::future<void>& build : m_pipelineBuilds)
+	{
+		build.get();
+	}
+	m_pipelineBuilds.clear();
+}
+
+Terrain::GraphResources Terrain::importResources(RenderGraph& graph) const
+{
+    // once generated, the heightmap was last sampled by mesh generation, the buffers were last read by the draw and
+    // the bounds by culling
+    const RenderGraph::Access sampled{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    const RenderGraph::Access vertexRead{ VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT };
+    const RenderGraph::Access indexRead{ VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT };
+    const RenderGraph::Access boundsRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT };
+    const RenderGraph::Access fragmentSampled{ VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    VkDeviceSize vertexBufferSize = sizeof(Vertex) * m_config.gridResolution * m_config.gridResolution;
+    VkDeviceSize indexBufferSize = sizeof(uint32_t) * m_indexCount;
+
+    GraphResources resources{};
+    resources.heightmap = graph.importImage("terrain heightmap", m_heightMap.image, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        m_initialized ? sampled : RenderGraph::Access{});
+    resources.vertices = graph.importBuffer("terrain vertices", m_vertexBuffer.buffer, 0, vertexBufferSize,
+        m_initialized ? vertexRead : RenderGraph::Access{});
+    resources.indices = graph.importBuffer("terrain indices", m_indexBuffer.buffer, 0, indexBufferSize,
+        m_initialized ? indexRead : RenderGraph::Access{});
+    resources.patchBounds = graph.importBuffer("terrain patch bounds", m_patchBounds.buffer, 0, m_patchBounds.size,
+        m_initialized ? boundsRead : RenderGraph::Access{});
+    resources.horizonMap = graph.importImage("terrain horizon map", m_horizonMap.image, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 2 },
+        m_initialized ? fragmentSampled : RenderGraph::Access{});
+
+    // the next frame imports the heightmap as sampled again, whether or not it regenerates
+    graph.setFinalState(resources.heightmap, sampled);
+    graph.setFinalState(resources.horizonMap, fragmentSampled);
+    return resources;
+}
+
+void Terrain::addGenerationPasses(RenderGraph& graph, const GraphResources& resources, const HeightMapParams& heightMapParams, const TerrainParams& terrainParams)
+{
+    waitForPipelines();
 
     uint32_t groupSize = 8;
     uint32_t gx = (m_config.heightmapSize + groupSize - 1) / groupSize;
     uint32_t gy = gx;
 
-    m_heightMapCompute->recordCommands(cmd, &heightMapParams, gx, gy, 1);
-
-    vks::tools::insertImageMemoryBarrier(
-        cmd,
-        m_heightMap.image,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        VK_ACCESS_SHADER_READ_BIT,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-    );
+    graph.addPass("terrain heightmap", [this, heightMapParams, gx, gy](VkCommandBuffer cmd) {
+            m_heightMapCompute->recordCommands(cmd, &heightMapParams, gx, gy, 1);
+        })
+        .write(resources.heightmap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
 
-    // ============================================
-    // MESH GENERATION
-    // ============================================
+    addMeshPasses(graph, resources, terrainParams);
+}
 
-    VkDeviceSize vertexBufferSize = sizeof(Vertex) * m_config.gridResolution * m_config.gridResolution;
-    VkDeviceSize indexBufferSize = sizeof(uint32_t) * m_indexCount;
+void Terrain::addMeshPasses(RenderGraph& graph, const GraphResources& resources, const TerrainParams& terrainParams)
+{
+    waitForPipelines();
 
-    VkAccessFlags vertexSrcAccess = m_initialized ? VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT : 0;
-    VkPipelineStageFlags vertexSrcStage = m_initialized ? VK_PIPELINE_STAGE_VERTEX_INPUT_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    VkAccessFlags indexSrcAccess = m_initialized ? VK_ACCESS_INDEX_READ_BIT : 0;
-    VkPipelineStageFlags indexSrcStage = m_initialized ? VK_PIPELINE_STAGE_VERTEX_INPUT_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-    vks::tools::insertBufferMemoryBarrier(
-        cmd,
-        vertexSrcAccess,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        m_vertexBuffer.buffer,
-        0,
-        vertexBufferSize,
-        vertexSrcStage,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
-    );
+    uint32_t groupSize = 8;
 
-    vks::tools::insertBufferMemoryBarrier(
-        cmd,
-        indexSrcAccess,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        m_indexBuffer.buffer,
-        0,
-        indexBufferSize,
-        indexSrcStage,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
-    );
+    // one thread per vertex and per quad slot of the patches, the slots past the last row and column of quads are
+    // filled with degenerate triangles
+    TerrainParams meshParams = terrainParams;
+    meshParams.patchSize = m_config.patchSize;
+    uint32_t meshThreads = std::max(m_config.gridResolution, m_patchesPerSide * m_config.patchSize);
+    uint32_t meshGroups = (meshThreads + groupSize - 1) / groupSize;
+
+    // the bounds are reduced with atomic min, every patch starts out empty
+    graph.addPass("terrain bounds reset", [this](VkCommandBuffer cmd) {
+            vkCmdFillBuffer(cmd, m_patchBounds.buffer, 0, VK_WHOLE_SIZE, 0xFFFFFFFF);
+        })
+        .write(resources.patchBounds, { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT });
+
+    graph.addPass("terrain mesh", [this, meshParams, meshGroups](VkCommandBuffer cmd) {
+            m_terrainGenCompute->recordCommands(cmd, &meshParams, meshGroups, meshGroups, 1);
+        })
+        .read(resources.heightmap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL })
+        .write(resources.vertices, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT })
+        .write(resources.indices, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT })
+        .read(resources.patchBounds, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT })
+        .write(resources.patchBounds, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT });
+
+    addHorizonPasses(graph, resources, terrainParams);
 
-    m_terrainGenCompute->recordCommands(cmd, &terrainParams, gx, gy, 1);
+    m_generationCount++;
+    m_initialized = true;
+}
 
-    vks::tools::insertBufferMemoryBarrier(
-        cmd,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-        m_vertexBuffer.buffer,
-        0,
-        vertexBufferSize,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
-    );
+void Terrain::addHorizonPasses(RenderGraph& graph, const GraphResources& resources, const TerrainParams& terrainParams)
+{
+    waitForPipelines();
 
-    vks::tools::insertBufferMemoryBarrier(
-        cmd,
-        VK_ACCESS_SHADER_WRITE_BIT,
-        VK_ACCESS_INDEX_READ_BIT,
-        m_indexBuffer.buffer,
-        0,
-        indexBufferSize,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
-    );
+    HorizonParams params{};
+    params.mapSize = m_config.horizonMapSize;
+    params.stepCount = m_config.horizonSteps;
+    params.terrainSideLength = terrainParams.terrainSideLength;
+    params.heightScale = terrainParams.heightScale;
+    params.searchDistance = m_config.horizonSearchDistance;
 
-    m_generationCount++;
-    m_initialized = true;
+    uint32_t groupSize = 8;
+    uint32_t groups = (params.mapSize + groupSize - 1) / groupSize;
+
+    // every texel is written, the previous contents are not needed
+    graph.addPass("terrain horizon map", [this, params, groups](VkCommandBuffer cmd) {
+            m_horizonCompute->recordCommands(cmd, &params, groups, groups, 1);
+        })
+        .read(resources.heightmap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL })
+        .write(resources.horizonMap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
 }
 
 void Terrain::recordDraw(VkCommandBuffer cmd)
@@ -130,6 +147,38 @@ void Terrain::recordDraw(VkCommandBuffer cmd)
     vkCmdDrawIndexed(cmd, m_indexCount, 1, 0, 0, 0);
 }
 
+void Terrain::recordDrawIndirect(VkCommandBuffer cmd, VkBuffer drawBuffer, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount)
+{
+    VkDeviceSize offsets[1]{ 0 };
+    vkCmdBindVertexBuffers(cmd, 0, 1, &m_vertexBuffer.buffer, offsets);
+    vkCmdBindIndexBuffer(cmd, m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexedIndirectCount(cmd, drawBuffer, 0, countBuffer, countOffset, maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void Terrain::registerShaderReloads(ShaderHotReloader& reloader)
+{
+    for (VulkanComputePass* pass : { m_heightMapCompute.get(), m_terrainGenCompute.get(), m_horizonCompute.get() })
+    {
+        reloader.registerPipeline(
+            pass->getShaderPath(),
+            { pass->getShaderPath() },
+            [pass]() { return pass->buildPipeline(); },
+            [this, pass](VkPipeline pipeline)
+            {
+                m_regenerateRequested = true;
+                return pass->swapPipeline(pipeline);
+            }
+        );
+    }
+}
+
+bool Terrain::consumeRegenerateRequest()
+{
+    bool requested = m_regenerateRequested;
+    m_regenerateRequested = false;
+    return requested;
+}
+
 void Terrain::createHeightmapResources()
 {
     VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
@@ -142,7 +191,8 @@ void Terrain::createHeightmapResources()
     imageInfo.format = m_config.heightmapFormat;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    // copied to the host for the drainage analysis
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
     VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
@@ -153,7 +203,7 @@ void Terrain::createHeightmapResources()
     m_heightMap.imageInfo = imageInfo;
     m_heightMap.viewInfo = viewInfo;
 
-    m_heightMap.createImage(m_device.logicalDevice, m_device.physicalDevice, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_heightMap.createImage(m_device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 }
 
 void Terrain::createMeshBuffers()
@@ -163,8 +213,7 @@ void Terrain::createMeshBuffers()
 
     // Create vertex buffer
     m_vertexBuffer.create(
-        m_device.logicalDevice,
-        m_device.physicalDevice,
+        m_device,
         vertexBufferSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
@@ -172,12 +221,18 @@ void Terrain::createMeshBuffers()
 
     // Create index buffer
     m_indexBuffer.create(
-        m_device.logicalDevice,
-        m_device.physicalDevice,
+        m_device,
         indexBufferSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
     );
+
+    m_patchBounds.create(
+        m_device,
+        PATCH_BOUNDS_STRIDE * m_patchCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    );
 }
 
 void Terrain::createHeightmapComputePass(VkDescriptorPool descriptorPool)
@@ -191,11 +246,14 @@ void Terrain::createHeightmapComputePass(VkDescriptorPool descriptorPool)
     m_heightMapCompute = std::make_unique<VulkanComputePass>(m_device);
     VulkanComputePass::Config computeConfig{};
     computeConfig.descriptorSetLayoutBindings = layoutBindings;
-    computeConfig.shaderPath = "shaders/heightmap.spirv";
-    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SPIRV;
+    computeConfig.shaderPath = "shaders/heightmap.slang";
+    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
     computeConfig.slangGlobalSession = nullptr;
+    computeConfig.shaderCache = &m_shaderCache;
     computeConfig.pushConstantSize = sizeof(HeightMapParams);
-    m_heightMapCompute->create(computeConfig, descriptorPool);
+    m_heightMapCompute->createLayouts(computeConfig);
+    createComputePipeline(*m_heightMapCompute);
+    m_heightMapCompute->allocateDescriptorSet(descriptorPool);
 
     // Update descriptors
     VkDescriptorImageInfo storageImageDescriptor{};
@@ -214,8 +272,8 @@ void Terrain::createHeightmapComputePass(VkDescriptorPool descriptorPool)
 
 void Terrain::createTerrainGenComputePass(VkDescriptorPool descriptorPool)
 {
-    // Descriptor layout: heightmap sampler, vertex buffer, index buffer
-    std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+    // Descriptor layout: heightmap sampler, vertex buffer, index buffer, patch bounds
+    std::vector<VkDescriptorSetLayoutBinding> bindings(4);
 
     // Heightmap sampler
     bindings[0].binding = 0;
@@ -235,14 +293,23 @@ void Terrain::createTerrainGenComputePass(VkDescriptorPool descriptorPool)
     bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+    // Patch bounds
+    bindings[3].binding = 3;
+    bindings[3].descriptorCount = 1;
+    bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
     m_terrainGenCompute = std::make_unique<VulkanComputePass>(m_device);
     VulkanComputePass::Config computeConfig{};
     computeConfig.descriptorSetLayoutBindings = bindings;
-    computeConfig.shaderPath = "shaders/GenerateTerrainMesh.spirv";
-    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SPIRV;
+    computeConfig.shaderPath = "shaders/GenerateTerrainMesh.slang";
+    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
     computeConfig.slangGlobalSession = nullptr;
+    computeConfig.shaderCache = &m_shaderCache;
     computeConfig.pushConstantSize = sizeof(TerrainParams);
-    m_terrainGenCompute->create(computeConfig, descriptorPool);
+    m_terrainGenCompute->createLayouts(computeConfig);
+    createComputePipeline(*m_terrainGenCompute);
+    m_terrainGenCompute->allocateDescriptorSet(descriptorPool);
 
     // Update descriptors
     VkDescriptorImageInfo heightMapInfo{};
@@ -263,7 +330,12 @@ void Terrain::createTerrainGenComputePass(VkDescriptorPool descriptorPool)
     indexBufferInfo.range = indexBufferSize;
     indexBufferInfo.offset = 0;
 
-    std::vector<VkWriteDescriptorSet> writeDescriptorSets(3);
+    VkDescriptorBufferInfo patchBoundsInfo{};
+    patchBoundsInfo.buffer = m_patchBounds.buffer;
+    patchBoundsInfo.range = m_patchBounds.size;
+    patchBoundsInfo.offset = 0;
+
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets(4);
 
     writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     writeDescriptorSets[0].dstBinding = 0;
@@ -283,9 +355,107 @@ void Terrain::createTerrainGenComputePass(VkDescriptorPool descriptorPool)
     writeDescriptorSets[2].descriptorCount = 1;
     writeDescriptorSets[2].pBufferInfo = &indexBufferInfo;
 
+    writeDescriptorSets[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSets[3].dstBinding = 3;
+    writeDescriptorSets[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSets[3].descriptorCount = 1;
+    writeDescriptorSets[3].pBufferInfo = &patchBoundsInfo;
+
     m_terrainGenCompute->updateDescriptors(writeDescriptorSets);
 }
 
+void Terrain::createHorizonResources(VkDescriptorPool descriptorPool)
+{
+    VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = { m_config.horizonMapSize, m_config.horizonMapSize, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = HORIZON_DIRECTIONS / 4;
+    imageInfo.format = HORIZON_MAP_FORMAT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = HORIZON_MAP_FORMAT;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, imageInfo.arrayLayers };
+
+    m_horizonMap.imageInfo = imageInfo;
+    m_horizonMap.viewInfo = viewInfo;
+    m_horizonMap.createImage(m_device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+
+    // the edges must not wrap around to the other side of the terrain
+    VkSamplerCreateInfo samplerCI{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerCI.magFilter = VK_FILTER_LINEAR;
+    samplerCI.minFilter = VK_FILTER_LINEAR;
+    samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCI.maxLod = 0.0f;
+    VK_CHECK_RESULT(vkCreateSampler(m_device.logicalDevice, &samplerCI, nullptr, &m_horizonMap.sampler));
+
+    // Descriptor layout: heightmap sampler, horizon map
+    std::vector<VkDescriptorSetLayoutBinding> bindings(2);
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    m_horizonCompute = std::make_unique<VulkanComputePass>(m_device);
+    VulkanComputePass::Config computeConfig{};
+    computeConfig.descriptorSetLayoutBindings = bindings;
+    computeConfig.shaderPath = "shaders/horizon_map.slang";
+    computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+    computeConfig.slangGlobalSession = nullptr;
+    computeConfig.shaderCache = &m_shaderCache;
+    computeConfig.pushConstantSize = sizeof(HorizonParams);
+    m_horizonCompute->createLayouts(computeConfig);
+    createComputePipeline(*m_horizonCompute);
+    m_horizonCompute->allocateDescriptorSet(descriptorPool);
+
+    VkDescriptorImageInfo heightMapInfo{};
+    heightMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    heightMapInfo.imageView = m_heightMap.imageView;
+    heightMapInfo.sampler = m_heightMap.sampler;
+
+    VkDescriptorImageInfo horizonMapInfo{};
+    horizonMapInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    horizonMapInfo.imageView = m_horizonMap.imageView;
+
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets(2);
+
+    writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSets[0].dstBinding = 0;
+    writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptorSets[0].descriptorCount = 1;
+    writeDescriptorSets[0].pImageInfo = &heightMapInfo;
+
+    writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSets[1].dstBinding = 1;
+    writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writeDescriptorSets[1].descriptorCount = 1;
+    writeDescriptorSets[1].pImageInfo = &horizonMapInfo;
+
+    m_horizonCompute->updateDescriptors(writeDescriptorSets);
+}
+
+void Terrain::createComputePipeline(VulkanComputePass& pass)
+{
+    if (m_threadPool == nullptr)
+    {
+        pass.createPipeline();
+        return;
+    }
+    m_pipelineBuilds.push_back(m_threadPool->submit([&pass]() { pass.createPipeline(); }));
+}
 
 void Terrain::debugPrintBuffers() const
 {
@@ -293,6 +463,7 @@ void Terrain::debugPrintBuffers() const
     std::cout << "Heightmap Size: " << m_config.heightmapSize << "x" << m_config.heightmapSize << std::endl;
     std::cout << "Grid Resolution: " << m_config.gridResolution << std::endl;
     std::cout << "Index Count: " << m_indexCount << std::endl;
+    std::cout << "Patch Count: " << m_patchCount << " of " << m_config.patchSize << "x" << m_config.patchSize << " quads" << std::endl;
     std::cout << "Generation Count: " << m_generationCount << std::endl;
     std::cout << "Initialized: " << (m_initialized ? "Yes" : "No") << std::endl;
     std::cout << "=========================\n" << std::endl;
@@ -300,10 +471,20 @@ void Terrain::debugPrintBuffers() const
 
 void Terrain::cleanup()
 {
+    // builds still in flight reference the passes
+    for (std::future<void>& build : m_pipelineBuilds)
+    {
+        build.wait();
+    }
+    m_pipelineBuilds.clear();
+
+    m_horizonCompute.reset();
     m_terrainGenCompute.reset();
     m_heightMapCompute.reset();
 
+    m_patchBounds.destroy();
     m_indexBuffer.destroy();
     m_vertexBuffer.destroy();
+    m_horizonMap.destroy();
     m_heightMap.destroy();
 }
\ No newline at end of file
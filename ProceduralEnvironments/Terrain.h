@@ -1,12 +1,18 @@
 #pragma once
 
+#include <future>
 #include <memory>
+#include <vector>
 #include <vulkan/vulkan.h>
 #include "VulkanDevice.h"
 #include "VulkanBuffer.h"
 #include "VulkanImage.h"
 #include "VulkanComputePass.h"
 #include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "RenderGraph.h"
 
 class Terrain
 {
@@ -18,9 +24,19 @@ public:
         float heightScale = 3.0f;
         float normalsStrength = 50.0f;
         VkFormat heightmapFormat = VK_FORMAT_R32_SFLOAT;
+        // quads per side of a patch, the unit the terrain is culled and drawn in
+        uint32_t patchSize = 32;
+        // horizon map for the terrain shadows, see addHorizonPasses()
+        uint32_t horizonMapSize = 512;
+        float horizonSearchDistance = 8.0f; // world units, farther terrain casts no shadow
+        uint32_t horizonSteps = 32;         // heightmap samples per direction
 	};
 
-    Terrain(VulkanDevice& device, const Config& config);
+    // azimuths of the horizon map, four per layer. Matches HORIZON_DIRECTIONS in horizon_map.slang and shader.slang
+    static const uint32_t HORIZON_DIRECTIONS = 8;
+    static const VkFormat HORIZON_MAP_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+    Terrain(VulkanDevice& device, ShaderCache& shaderCache, const Config& config);
     ~Terrain();
 
     Terrain(const Terrain&) = delete;
@@ -29,16 +45,43 @@ public:
     /**
      * @brief Initialize all Vulkan resources (buffers, images, compute pipelines)
      * @param descriptorPool Pool to allocate descriptor sets from
+     * @param threadPool When set, the compute pipelines are built on it and initialize() returns without waiting for them
      */
-    void initialize(VkDescriptorPool descriptorPool);
+    void initialize(VkDescriptorPool descriptorPool, ThreadPool* threadPool = nullptr);
 
     /**
-     * @brief Record terrain generation commands into command buffer
-     * @param cmd Command buffer to record into
+     * @brief Block until the compute pipelines started by initialize() exist. Rethrows build failures
+     */
+    void waitForPipelines();
+
+    struct GraphResources {
+        RenderGraph::Resource heightmap;
+        RenderGraph::Resource vertices;
+        RenderGraph::Resource indices;
+        RenderGraph::Resource patchBounds;
+        RenderGraph::Resource horizonMap;
+    };
+
+    /**
+     * @brief Import the heightmap, horizon map, mesh and patch bounds buffers in the state the previous frame left them in.
+     * The horizon map is left for the fragment shader
+     * @param graph Render graph of the current frame
+     */
+    GraphResources importResources(RenderGraph& graph) const;
+
+    /**
+     * @brief Add the heightmap and mesh generation passes, barriers are derived by the graph
+     * @param graph Render graph of the current frame, resources imported from it by importResources()
      * @param heightMapParams Parameters for heightmap generation
      * @param terrainParams Parameters for mesh generation
      */
-    void recordGeneration(VkCommandBuffer cmd, const HeightMapParams& heightMapParams, const TerrainParams& terrainParams);
+    void addGenerationPasses(RenderGraph& graph, const GraphResources& resources, const HeightMapParams& heightMapParams, const TerrainParams& terrainParams);
+
+    /**
+     * @brief Add the mesh generation from the current heightmap, with the horizon map and the patch bounds.
+     * addGenerationPasses() ends with it, on its own it picks up heightmap changes made by other passes such as erosion
+     */
+    void addMeshPasses(RenderGraph& graph, const GraphResources& resources, const TerrainParams& terrainParams);
 
     /**
      * @brief Record draw commands for the terrain
@@ -46,6 +89,12 @@ public:
      */
     void recordDraw(VkCommandBuffer cmd);
 
+    /**
+     * @brief Record an indexed indirect draw of the patches listed in drawBuffer
+     * @param countBuffer Holds the number of draws at countOffset, at most maxDrawCount are drawn
+     */
+    void recordDrawIndirect(VkCommandBuffer cmd, VkBuffer drawBuffer, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount);
+
     /**
      * @brief Get whether the terrain has been generated at least once
      */
@@ -56,25 +105,60 @@ public:
      */
     void markDirty() { m_initialized = false; }
 
+    /**
+     * @brief Register the generation passes with the hot reloader. A reloaded pass requests a regeneration
+     */
+    void registerShaderReloads(ShaderHotReloader& reloader);
+
+    /**
+     * @brief Returns true once after a generation shader was reloaded
+     */
+    bool consumeRegenerateRequest();
+
     // Getters
     const vks::Buffer& getVertexBuffer() const { return m_vertexBuffer; }
     const vks::Buffer& getIndexBuffer() const { return m_indexBuffer; }
     const vks::Image& getHeightmap() const { return m_heightMap; }
+    // sine of the horizon elevation in HORIZON_DIRECTIONS azimuths, clamp to edge sampler
+    const vks::Image& getHorizonMap() const { return m_horizonMap; }
     uint32_t getIndexCount() const { return m_indexCount; }
+    // bumped by every addMeshPasses(), consumers of the heightmap compare it to notice a new terrain
+    uint32_t getGenerationCount() const { return m_generationCount; }
+    // the indices are stored patch after patch, patch i starts at i * getPatchIndexCount()
+    uint32_t getPatchCount() const { return m_patchCount; }
+    uint32_t getPatchIndexCount() const { return m_config.patchSize * m_config.patchSize * 6; }
+    /** @brief World space AABB of every patch, see PATCH_BOUNDS_STRIDE */
+    const vks::Buffer& getPatchBounds() const { return m_patchBounds; }
+    // min xyz and the bitwise inverse of max xyz as order preserving uints, padded to 8 uints
+    static const uint32_t PATCH_BOUNDS_STRIDE = 8 * sizeof(uint32_t);
     const Config& getConfig() const { return m_config; }
 
     // Debug utilities
     void debugPrintBuffers() const;
 
 private:
+    /** Mirrors HorizonParams in horizon_map.slang */
+    struct HorizonParams {
+        uint32_t mapSize;
+        uint32_t stepCount;
+        float terrainSideLength;
+        float heightScale;
+        float searchDistance;
+    };
+
     void createHeightmapResources();
     void createMeshBuffers();
     void createHeightmapComputePass(VkDescriptorPool descriptorPool);
     void createTerrainGenComputePass(VkDescriptorPool descriptorPool);
+    void createHorizonResources(VkDescriptorPool descriptorPool);
+    /** @brief Add the horizon map build from the heightmap. Every texel is marched again, the heightmap changes as a whole */
+    void addHorizonPasses(RenderGraph& graph, const GraphResources& resources, const TerrainParams& terrainParams);
+    void createComputePipeline(VulkanComputePass& pass);
 
     void cleanup();
 
     VulkanDevice& m_device;
+    ShaderCache& m_shaderCache;
     Config m_config;
 
     // Heightmap resources
@@ -84,11 +168,23 @@ private:
     // Mesh resources
     vks::Buffer m_vertexBuffer;
     vks::Buffer m_indexBuffer;
+    uint32_t m_patchesPerSide;
+    uint32_t m_patchCount;
     uint32_t m_indexCount;
+    // reduced with atomics by mesh generation, reset right before
+    vks::Buffer m_patchBounds;
     std::unique_ptr<VulkanComputePass> m_terrainGenCompute;
 
+    // Horizon map resources
+    vks::Image m_horizonMap;
+    std::unique_ptr<VulkanComputePass> m_horizonCompute;
+
+    ThreadPool* m_threadPool = nullptr;
+    std::vector<std::future<void>> m_pipelineBuilds;
+
     // State
     bool m_initialized = false;
     uint32_t m_generationCount = 0;
+    bool m_regenerateRequested = false;
 };
 
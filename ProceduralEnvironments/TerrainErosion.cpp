@@ -0,0 +1,348 @@
+#include "TerrainErosion.h"
+
+#include "VulkanTools.h"
+
+#include <algorithm>
+
+namespace
+{
+	const uint32_t EROSION_GROUP_SIZE = 8;
+
+	// in the order of TerrainErosion::PassIndex, every pass includes COMMON_SHADER
+	const char* const PASS_SHADERS[] = {
+		"shaders/erosion_init.slang",
+		"shaders/erosion_flux.slang",
+		"shaders/erosion_water.slang",
+		"shaders/erosion_sediment.slang",
+		"shaders/erosion_thermal.slang",
+		"shaders/erosion_apply.slang"
+	};
+	const char* const COMMON_SHADER = "shaders/erosion_common.slang";
+
+	// bindings of every pass: state in, state out, flux, velocity, heightmap
+	const uint32_t BINDING_COUNT = 5;
+
+	// iterations of a frame until a GPU time was measured, and the weight of every new measurement
+	const uint32_t UNMEASURED_ITERATIONS = 4;
+	const float MS_SMOOTHING = 0.2f;
+}
+
+TerrainErosion::TerrainErosion(VulkanDevice& device, ShaderCache& shaderCache, const Terrain& terrain, uint32_t frameCount, ThreadPool* threadPool) :
+	device(device),
+	shaderCache(shaderCache),
+	terrain(terrain),
+	size(terrain.getConfig().heightmapSize),
+	frameCount(frameCount),
+	threadPool(threadPool),
+	slotIterations(frameCount, 0),
+	secondStart(std::chrono::steady_clock::now())
+{
+	static_assert(sizeof(PASS_SHADERS) / sizeof(PASS_SHADERS[0]) == PASS_COUNT, "every erosion pass needs its shader");
+
+	createImages();
+	createPasses();
+	createDescriptorSets();
+}
+
+TerrainErosion::~TerrainErosion()
+{
+	// builds still in flight reference the passes
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.wait();
+	}
+	pipelineBuilds.clear();
+
+	for (std::unique_ptr<VulkanComputePass>& pass : passes)
+	{
+		pass.reset();
+	}
+	// destroying the pool frees its sets
+	vkDestroyDescriptorPool(device.logicalDevice, descriptorPool, nullptr);
+	state[0].destroy();
+	state[1].destroy();
+	flux.destroy();
+	velocity.destroy();
+}
+
+void TerrainErosion::waitForPipelines()
+{
+	for (std::future<void>& build : pipelineBuilds)
+	{
+		build.get();
+	}
+	pipelineBuilds.clear();
+}
+
+void TerrainErosion::createImages()
+{
+	VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = STATE_FORMAT;
+	imageInfo.extent = { size, size, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = STATE_FORMAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	for (vks::Image* image : { &state[0], &state[1], &flux, &velocity })
+	{
+		image->imageInfo = imageInfo;
+		image->viewInfo = viewInfo;
+		image->createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	}
+}
+
+void TerrainErosion::createPasses()
+{
+	std::vector<VkDescriptorSetLayoutBinding> bindings(BINDING_COUNT);
+	for (uint32_t i = 0; i < BINDING_COUNT; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VulkanComputePass::Config computeConfig{};
+	computeConfig.shaderType = VulkanComputePass::ShaderType::Shader_Type_SLANG;
+	computeConfig.slangGlobalSession = nullptr;
+	computeConfig.shaderCache = &shaderCache;
+	computeConfig.descriptorSetLayoutBindings = bindings;
+	computeConfig.pushConstantSize = sizeof(ErosionParams);
+
+	for (uint32_t i = 0; i < PASS_COUNT; i++)
+	{
+		computeConfig.shaderPath = PASS_SHADERS[i];
+		passes[i] = std::make_unique<VulkanComputePass>(device);
+		passes[i]->createLayouts(computeConfig);
+
+		VulkanComputePass* pass = passes[i].get();
+		if (threadPool == nullptr)
+		{
+			pass->createPipeline();
+			continue;
+		}
+		pipelineBuilds.push_back(threadPool->submit([pass]() { pass->createPipeline(); }));
+	}
+}
+
+void TerrainErosion::createDescriptorSets()
+{
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 * BINDING_COUNT };
+	VkDescriptorPoolCreateInfo poolCI{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCI.poolSizeCount = 1;
+	poolCI.pPoolSizes = &poolSize;
+	poolCI.maxSets = 2;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device.logicalDevice, &poolCI, nullptr, &descriptorPool));
+
+	// the layouts of all passes are identical, sets of one of them bind with every pass
+	const VkDescriptorSetLayout setLayouts[2] = { passes[PASS_INIT]->getDescriptorSetLayout(), passes[PASS_INIT]->getDescriptorSetLayout() };
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = setLayouts;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, sets));
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		const VkDescriptorImageInfo imageInfos[BINDING_COUNT] = {
+			{ VK_NULL_HANDLE, state[i].imageView, VK_IMAGE_LAYOUT_GENERAL },
+			{ VK_NULL_HANDLE, state[1 - i].imageView, VK_IMAGE_LAYOUT_GENERAL },
+			{ VK_NULL_HANDLE, flux.imageView, VK_IMAGE_LAYOUT_GENERAL },
+			{ VK_NULL_HANDLE, velocity.imageView, VK_IMAGE_LAYOUT_GENERAL },
+			{ VK_NULL_HANDLE, terrain.getHeightmap().imageView, VK_IMAGE_LAYOUT_GENERAL }
+		};
+
+		// the bindings are consecutive and of one type, one write covers all of them
+		VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.dstSet = sets[i];
+		write.dstBinding = 0;
+		write.descriptorCount = BINDING_COUNT;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		write.pImageInfo = imageInfos;
+		vkUpdateDescriptorSets(device.logicalDevice, 1, &write, 0, nullptr);
+	}
+}
+
+void TerrainErosion::update(const ErosionSettings& settings, float erosionGpuMs, uint32_t frame)
+{
+	// 0 when timestamps are not supported, the iterations then stay at a fixed count
+	const uint32_t measured = slotIterations[frame];
+	if (measured > 0 && erosionGpuMs > 0.0f)
+	{
+		const float sample = erosionGpuMs / static_cast<float>(measured);
+		msPerIteration = msPerIteration > 0.0f ? msPerIteration + (sample - msPerIteration) * MS_SMOOTHING : sample;
+	}
+
+	const uint32_t maxIterations = std::max(settings.maxIterationsPerFrame, 1u);
+	if (msPerIteration > 0.0f && settings.budgetMs > 0.0f)
+	{
+		// at most doubled per frame, the first measurements include the pipeline warm up
+		const uint32_t fitting = static_cast<uint32_t>(settings.budgetMs / msPerIteration);
+		iterationsPerFrame = std::clamp(std::min(fitting, iterationsPerFrame * 2), 1u, maxIterations);
+	}
+	else
+	{
+		iterationsPerFrame = std::min(UNMEASURED_ITERATIONS, maxIterations);
+	}
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const float elapsed = std::chrono::duration<float>(now - secondStart).count();
+	if (elapsed >= 1.0f)
+	{
+		stats.iterationsPerSecond = static_cast<float>(iterationsThisSecond) / elapsed;
+		iterationsThisSecond = 0;
+		secondStart = now;
+	}
+	stats.iterationsPerFrame = settings.running ? iterationsPerFrame : 0;
+	stats.msPerIteration = msPerIteration;
+}
+
+TerrainErosion::GraphResources TerrainErosion::importResources(RenderGraph& graph) const
+{
+	// the erosion passes are their only users, left as storage images between them. Before the initialization the
+	// contents are discarded
+	const RenderGraph::Access storage{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_IMAGE_LAYOUT_GENERAL };
+	const RenderGraph::Access current = initialized ? storage : RenderGraph::Access{};
+	const VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	GraphResources resources{};
+	resources.state[0] = graph.importImage("erosion state 0", state[0].image, range, current);
+	resources.state[1] = graph.importImage("erosion state 1", state[1].image, range, current);
+	resources.flux = graph.importImage("erosion flux", flux.image, range, current);
+	resources.velocity = graph.importImage("erosion velocity", velocity.image, range, current);
+	return resources;
+}
+
+TerrainErosion::ErosionParams TerrainErosion::makeParams(const ErosionSettings& settings) const
+{
+	ErosionParams params{};
+	params.size = size;
+	params.timeStep = settings.timeStep;
+	params.heightToTexels = heightToTexels;
+	params.rainRate = settings.rainRate;
+	params.evaporation = settings.evaporation;
+	params.sedimentCapacity = settings.sedimentCapacity;
+	params.erosionRate = settings.erosionRate;
+	params.depositionRate = settings.depositionRate;
+	params.talusSlope = settings.talusSlope;
+	params.thermalRate = std::min(settings.thermalRate, 0.25f);
+	params.minTilt = settings.minTilt;
+	return params;
+}
+
+RenderGraph::PassBuilder TerrainErosion::addDispatch(RenderGraph& graph, const char* name, PassIndex pass, VkDescriptorSet set, const ErosionParams& params)
+{
+	const uint32_t groups = (size + EROSION_GROUP_SIZE - 1) / EROSION_GROUP_SIZE;
+	VulkanComputePass* computePass = passes[pass].get();
+	return graph.addPass(name, [computePass, set, params, groups](VkCommandBuffer cmd) {
+			computePass->recordCommands(cmd, set, 0, nullptr, &params, groups, groups, 1);
+		});
+}
+
+uint32_t TerrainErosion::addErosionPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap,
+	const ErosionSettings& settings, const TerrainParams& terrainParams, uint32_t frame)
+{
+	slotIterations[frame] = 0;
+	if (!settings.running)
+	{
+		return 0;
+	}
+	waitForPipelines();
+
+	const RenderGraph::Access storageRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+	const RenderGraph::Access storageWrite{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+
+	if (!initialized)
+	{
+		// the heights are kept in texel units until the apply, with the scale of the terrain they started from
+		heightToTexels = terrainParams.heightScale * static_cast<float>(size) / std::max(terrainParams.terrainSideLength, 1e-4f);
+		// sets[1] writes state[0]
+		addDispatch(graph, "erosion init", PASS_INIT, sets[1], makeParams(settings))
+			.read(heightmap, storageRead)
+			.write(resources.state[0], storageWrite)
+			.write(resources.flux, storageWrite)
+			.write(resources.velocity, storageWrite);
+		current = 0;
+		initialized = true;
+		stats.totalIterations = 0;
+	}
+
+	// every pass that writes the state moves it to the other image, sets[current] reads where it is
+	const ErosionParams params = makeParams(settings);
+	for (uint32_t i = 0; i < iterationsPerFrame; i++)
+	{
+		addDispatch(graph, "erosion flux", PASS_FLUX, sets[current], params)
+			.read(resources.state[current], storageRead)
+			.read(resources.flux, storageRead)
+			.write(resources.flux, storageWrite);
+
+		addDispatch(graph, "erosion water", PASS_WATER, sets[current], params)
+			.read(resources.state[current], storageRead)
+			.read(resources.flux, storageRead)
+			.write(resources.state[1 - current], storageWrite)
+			.write(resources.velocity, storageWrite);
+		current = 1 - current;
+
+		addDispatch(graph, "erosion sediment", PASS_SEDIMENT, sets[current], params)
+			.read(resources.state[current], storageRead)
+			.read(resources.velocity, storageRead)
+			.write(resources.state[1 - current], storageWrite);
+		current = 1 - current;
+
+		addDispatch(graph, "erosion thermal", PASS_THERMAL, sets[current], params)
+			.read(resources.state[current], storageRead)
+			.write(resources.state[1 - current], storageWrite);
+		current = 1 - current;
+	}
+
+	// outputs of the graph, so the iterations are kept although nothing reads them in this frame
+	const RenderGraph::Access storage{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_IMAGE_LAYOUT_GENERAL };
+	for (RenderGraph::Resource resource : { resources.state[0], resources.state[1], resources.flux, resources.velocity })
+	{
+		graph.setFinalState(resource, storage);
+	}
+
+	slotIterations[frame] = iterationsPerFrame;
+	iterationsThisSecond += iterationsPerFrame;
+	stats.totalIterations += iterationsPerFrame;
+	return iterationsPerFrame;
+}
+
+bool TerrainErosion::addApplyPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap)
+{
+	if (!initialized)
+	{
+		return false;
+	}
+	waitForPipelines();
+
+	// only the heights are applied, the parameters besides the size and scale don't matter
+	addDispatch(graph, "erosion apply", PASS_APPLY, sets[current], makeParams(ErosionSettings{}))
+		.read(resources.state[current], { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL })
+		.write(heightmap, { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
+	return true;
+}
+
+void TerrainErosion::registerShaderReloads(ShaderHotReloader& reloader)
+{
+	for (std::unique_ptr<VulkanComputePass>& pass : passes)
+	{
+		reloader.registerPipeline(
+			pass->getShaderPath(),
+			{ pass->getShaderPath(), COMMON_SHADER },
+			[pass = pass.get()]() { return pass->buildPipeline(); },
+			[pass = pass.get()](VkPipeline pipeline) { return pass->swapPipeline(pipeline); }
+		);
+	}
+}
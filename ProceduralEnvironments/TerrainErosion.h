@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanImage.h"
+#include "VulkanComputePass.h"
+#include "VulkanStructures.h"
+#include "ShaderCache.h"
+#include "ShaderHotReloader.h"
+#include "ThreadPool.h"
+#include "RenderGraph.h"
+#include "Terrain.h"
+
+/**
+* Hydraulic and thermal erosion of the terrain's heightmap on the GPU, a few iterations every frame:
+*  - flux: water flows between neighbouring cells through virtual pipes, driven by the water surface
+*  - water: rain and the flux change the water depth, the flux through a cell gives its velocity
+*  - sediment: sediment moves with the water, which dissolves or deposits terrain by its transport capacity
+*  - thermal: material slides down slopes steeper than the talus
+* The state of terrain height, water and sediment is ping-ponged between two images, flux and velocity are updated in
+* place. The number of iterations of a frame follows the GPU time the previous ones took, so erosion stays within
+* ErosionSettings::budgetMs. The heightmap is only written when addApplyPasses() is called, the mesh is generated
+* from it afterwards on request rather than after every iteration.
+*/
+class TerrainErosion
+{
+public:
+	static constexpr VkFormat STATE_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+	struct GraphResources {
+		RenderGraph::Resource state[2];
+		RenderGraph::Resource flux;
+		RenderGraph::Resource velocity;
+	};
+
+	/**
+	* @param frameCount Frames in flight, GPU times of a frame slot arrive when it comes around again
+	* @param threadPool When set, the compute pipelines are built on it, see waitForPipelines()
+	*/
+	TerrainErosion(VulkanDevice& device, ShaderCache& shaderCache, const Terrain& terrain, uint32_t frameCount, ThreadPool* threadPool = nullptr);
+	~TerrainErosion();
+
+	TerrainErosion(const TerrainErosion&) = delete;
+	TerrainErosion& operator=(const TerrainErosion&) = delete;
+
+	/** @brief Block until the compute pipelines exist. Rethrows build failures */
+	void waitForPipelines();
+
+	/** @brief Start again from the heightmap on the next addErosionPasses(), after the terrain was generated anew */
+	void reset() { initialized = false; }
+
+	/**
+	* @brief Pick the iterations of this frame from the GPU time the last erosion recorded on frame's slot took, 0 while
+	* there is none. Once per frame, after the profiler collected the slot's results
+	*/
+	void update(const ErosionSettings& settings, float erosionGpuMs, uint32_t frame);
+
+	/** @brief Import the state, flux and velocity images, they are only ever used by the erosion passes */
+	GraphResources importResources(RenderGraph& graph) const;
+
+	/**
+	* @brief Add the iterations of this frame after the terrain generation passes, with the initialization from heightmap
+	* first after a reset. Nothing is added while the settings are not running. Returns the number of iterations added
+	*/
+	uint32_t addErosionPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap, const ErosionSettings& settings,
+		const TerrainParams& terrainParams, uint32_t frame);
+
+	/** @brief Write the eroded terrain into heightmap. Returns false when there is nothing eroded since the last reset */
+	bool addApplyPasses(RenderGraph& graph, const GraphResources& resources, RenderGraph::Resource heightmap);
+
+	/** @brief Register the erosion passes with the hot reloader */
+	void registerShaderReloads(ShaderHotReloader& reloader);
+
+	const ErosionStats& getStats() const { return stats; }
+
+private:
+	enum PassIndex : uint32_t { PASS_INIT, PASS_FLUX, PASS_WATER, PASS_SEDIMENT, PASS_THERMAL, PASS_APPLY, PASS_COUNT };
+
+	/** Mirrors ErosionParams in erosion_common.slang */
+	struct ErosionParams {
+		uint32_t size;
+		float timeStep;
+		float heightToTexels;
+		float rainRate;
+		float evaporation;
+		float sedimentCapacity;
+		float erosionRate;
+		float depositionRate;
+		float talusSlope;
+		float thermalRate;
+		float minTilt;
+		float _padding;
+	};
+
+	void createImages();
+	void createPasses();
+	void createDescriptorSets();
+	ErosionParams makeParams(const ErosionSettings& settings) const;
+	/** @brief Add a dispatch of pass over the whole grid with set, the caller declares what it accesses */
+	RenderGraph::PassBuilder addDispatch(RenderGraph& graph, const char* name, PassIndex pass, VkDescriptorSet set, const ErosionParams& params);
+
+	VulkanDevice& device;
+	ShaderCache& shaderCache;
+	const Terrain& terrain;
+	uint32_t size;
+	uint32_t frameCount;
+
+	ThreadPool* threadPool;
+	std::vector<std::future<void>> pipelineBuilds;
+
+	std::array<std::unique_ptr<VulkanComputePass>, PASS_COUNT> passes;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	// sets[i] reads state[i] and writes the other one, every set binds the flux, velocity and heightmap as well
+	VkDescriptorSet sets[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+
+	vks::Image state[2];
+	vks::Image flux;
+	vks::Image velocity;
+
+	// which state image holds the terrain, valid once initialized
+	uint32_t current = 0;
+	bool initialized = false;
+	float heightToTexels = 1.0f; // of the terrain the state was initialized from
+
+	// iteration budget, the GPU time per iteration is smoothed over the frames
+	uint32_t iterationsPerFrame = 1;
+	float msPerIteration = 0.0f;
+	std::vector<uint32_t> slotIterations; // added in the last frame of every slot
+	uint32_t iterationsThisSecond = 0;
+	std::chrono::steady_clock::time_point secondStart;
+	ErosionStats stats{};
+};
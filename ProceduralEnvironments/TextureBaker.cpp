@@ -0,0 +1,530 @@
+#include "TextureBaker.h"
+#include "BlockCompression.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+	// bump whenever the bake output changes, so every cached file is baked again
+	const uint32_t BAKE_VERSION = 1;
+	const char* SOURCE_HASH_KEY = "ProceduralEnvironments.sourceHash";
+
+	struct FloatImage {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<float> texels; // RGBA, linear
+	};
+
+	float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	uint8_t toUnorm8(float value)
+	{
+		return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+	}
+
+	/**
+	* Positive float with a 5 bit exponent and mantissaBits of mantissa, rounded to nearest even.
+	* 10 bits is the magnitude of a half, 6 and 5 bits are the packed 11 and 10 bit floats.
+	* Negative values and NaN become 0, anything above the largest finite value is clamped to it.
+	*/
+	uint32_t toSmallFloat(float value, uint32_t mantissaBits)
+	{
+		if (!(value > 0.0f))
+		{
+			return 0;
+		}
+		const float largest = std::ldexp(2.0f - std::ldexp(1.0f, -static_cast<int>(mantissaBits)), 15);
+		value = std::min(value, largest);
+
+		if (value < std::ldexp(1.0f, -14))
+		{
+			// denormal, steps of 2^(-14 - mantissaBits)
+			return static_cast<uint32_t>(std::lround(std::ldexp(value, 14 + static_cast<int>(mantissaBits))));
+		}
+
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		const uint32_t shift = 23 - mantissaBits;
+		// rebias the exponent from 127 to 15, the rounding carry may move into the exponent which is still correct
+		const uint32_t rebiased = bits - (112u << 23);
+		return (rebiased + (1u << (shift - 1)) - 1 + ((rebiased >> shift) & 1)) >> shift;
+	}
+
+	uint16_t toHalf(float value)
+	{
+		const uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+		return static_cast<uint16_t>(sign | toSmallFloat(std::abs(value), 10));
+	}
+
+	/** Direction through texel (u, v) of a cube face, u and v in [-1, 1], in Vulkan face order and orientation */
+	void getCubeDirection(uint32_t face, float u, float v, float* direction)
+	{
+		const float faces[6][3] = {
+			{ 1.0f, -v, -u },  // +X
+			{ -1.0f, -v, u },  // -X
+			{ u, 1.0f, v },    // +Y
+			{ u, -1.0f, -v },  // -Y
+			{ u, -v, 1.0f },   // +Z
+			{ -u, -v, -1.0f }, // -Z
+		};
+		const float length = std::sqrt(faces[face][0] * faces[face][0] + faces[face][1] * faces[face][1] + faces[face][2] * faces[face][2]);
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			direction[c] = faces[face][c] / length;
+		}
+	}
+
+	/** Bilinear lookup of an RGBA float equirectangular image, wrapping horizontally */
+	void sampleEquirect(const float* pixels, int width, int height, const float* direction, float* result)
+	{
+		const float pi = 3.14159265359f;
+		const float u = std::atan2(direction[2], direction[0]) / (2.0f * pi) + 0.5f;
+		const float v = std::acos(std::clamp(direction[1], -1.0f, 1.0f)) / pi;
+
+		const float x = u * width - 0.5f;
+		const float y = std::clamp(v * height - 0.5f, 0.0f, static_cast<float>(height - 1));
+		const int x0 = static_cast<int>(std::floor(x));
+		const int y0 = static_cast<int>(y);
+		const float fx = x - x0;
+		const float fy = y - y0;
+		const int y1 = std::min(y0 + 1, height - 1);
+		const int xs[2] = { (x0 % width + width) % width, ((x0 + 1) % width + width) % width };
+
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			const float top = pixels[(static_cast<size_t>(y0) * width + xs[0]) * 4 + c] * (1.0f - fx) + pixels[(static_cast<size_t>(y0) * width + xs[1]) * 4 + c] * fx;
+			const float bottom = pixels[(static_cast<size_t>(y1) * width + xs[0]) * 4 + c] * (1.0f - fx) + pixels[(static_cast<size_t>(y1) * width + xs[1]) * 4 + c] * fx;
+			result[c] = top * (1.0f - fy) + bottom * fy;
+		}
+	}
+
+	unsigned char* loadPixels(const std::string& path, int channels, int& width, int& height)
+	{
+		int sourceChannels;
+		unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &sourceChannels, channels);
+		if (!pixels)
+		{
+			throw std::runtime_error("Failed to load image: " + path);
+		}
+		return pixels;
+	}
+
+	void normalizeXYZ(float* texel)
+	{
+		float length = std::sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+		if (length > 1e-6f)
+		{
+			texel[0] /= length;
+			texel[1] /= length;
+			texel[2] /= length;
+		}
+	}
+
+	/** 2x2 box filter, odd edges repeat their last texel */
+	FloatImage downsample(const FloatImage& source, bool renormalize)
+	{
+		FloatImage result;
+		result.width = std::max(source.width / 2, 1u);
+		result.height = std::max(source.height / 2, 1u);
+		result.texels.resize(static_cast<size_t>(result.width) * result.height * 4);
+
+		for (uint32_t y = 0; y < result.height; y++)
+		{
+			const uint32_t y0 = std::min(y * 2, source.height - 1);
+			const uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+			for (uint32_t x = 0; x < result.width; x++)
+			{
+				const uint32_t x0 = std::min(x * 2, source.width - 1);
+				const uint32_t x1 = std::min(x * 2 + 1, source.width - 1);
+				float* texel = &result.texels[(static_cast<size_t>(y) * result.width + x) * 4];
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					texel[c] = 0.25f * (
+						source.texels[(static_cast<size_t>(y0) * source.width + x0) * 4 + c] +
+						source.texels[(static_cast<size_t>(y0) * source.width + x1) * 4 + c] +
+						source.texels[(static_cast<size_t>(y1) * source.width + x0) * 4 + c] +
+						source.texels[(static_cast<size_t>(y1) * source.width + x1) * 4 + c]);
+				}
+				if (renormalize)
+				{
+					normalizeXYZ(texel);
+				}
+			}
+		}
+		return result;
+	}
+
+	std::string toHashText(uint64_t hash)
+	{
+		char hashText[17];
+		snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(hash));
+		return hashText;
+	}
+}
+
+TextureBaker::TextureBaker(bool blockCompression) :
+	blockCompression(blockCompression)
+{
+}
+
+bool TextureBaker::supportsBlockCompression(const VulkanDevice& device)
+{
+	return device.enabledFeatures.textureCompressionBC == VK_TRUE;
+}
+
+VkFormat TextureBaker::getFormat(Layout layout) const
+{
+	switch (layout)
+	{
+	case Layout::Color:
+		return blockCompression ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_R8G8B8A8_SRGB;
+	case Layout::Normal:
+		return blockCompression ? VK_FORMAT_BC5_UNORM_BLOCK : VK_FORMAT_R8G8B8A8_UNORM;
+	case Layout::Surface:
+	default:
+		return blockCompression ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+uint64_t TextureBaker::hashSources(const std::vector<uint32_t>& settings, const std::vector<std::string>& sources)
+{
+	uint64_t hash = vks::tools::fnv1a64(&BAKE_VERSION, sizeof(BAKE_VERSION));
+	hash = vks::tools::fnv1a64(settings.data(), settings.size() * sizeof(uint32_t), hash);
+
+	std::vector<char> bytes;
+	for (const std::string& source : sources)
+	{
+		std::ifstream file(source, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open texture source: " + source);
+		}
+		bytes.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(bytes.data(), bytes.size());
+		hash = vks::tools::fnv1a64(bytes.data(), bytes.size(), hash);
+	}
+	return hash;
+}
+
+Ktx2File TextureBaker::loadOrBake(const std::string& cachePath, Layout layout, const std::vector<std::string>& sources) const
+{
+	const VkFormat format = getFormat(layout);
+	const uint64_t hash = hashSources({ static_cast<uint32_t>(layout), static_cast<uint32_t>(format) }, sources);
+	return loadOrBakeCached(cachePath, format, hash, [&]() { return bake(layout, sources); });
+}
+
+Ktx2File TextureBaker::loadOrBakeCubemap(const std::string& cachePath, const std::string& source, uint32_t faceSize, VkFormat format)
+{
+	if (format != VK_FORMAT_R16G16B16A16_SFLOAT && format != VK_FORMAT_B10G11R11_UFLOAT_PACK32)
+	{
+		throw std::runtime_error("Unsupported cubemap format " + std::to_string(format));
+	}
+
+	// the layout slot is left out of range so a cubemap never shares a hash with a material texture
+	const uint64_t hash = hashSources({ UINT32_MAX, faceSize, static_cast<uint32_t>(format) }, { source });
+	return loadOrBakeCached(cachePath, format, hash, [&]() { return bakeCubemap(source, faceSize, format); });
+}
+
+Ktx2File TextureBaker::loadOrBakeCached(const std::string& cachePath, VkFormat format, uint64_t hash, const std::function<Ktx2File()>& bake)
+{
+	Ktx2File ktx;
+	if (readCached(cachePath, format, hash, ktx))
+	{
+		return ktx;
+	}
+
+	ktx = bake();
+	writeCached(cachePath, ktx, hash);
+	return ktx;
+}
+
+bool TextureBaker::readCached(const std::string& cachePath, VkFormat format, uint64_t hash, Ktx2File& file)
+{
+	if (!file.read(cachePath) || file.format != format)
+	{
+		return false;
+	}
+	auto storedHash = file.keyValues.find(SOURCE_HASH_KEY);
+	return storedHash != file.keyValues.end() && storedHash->second == toHashText(hash);
+}
+
+void TextureBaker::writeCached(const std::string& cachePath, Ktx2File& file, uint64_t hash)
+{
+	file.keyValues["KTXwriter"] = "ProceduralEnvironments TextureBaker";
+	file.keyValues[SOURCE_HASH_KEY] = toHashText(hash);
+
+	// written next to the target and renamed, an interrupted bake never leaves a valid looking file
+	std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path());
+	const std::string temporaryPath = cachePath + ".tmp";
+	file.write(temporaryPath);
+	std::filesystem::rename(temporaryPath, cachePath);
+}
+
+std::string TextureBaker::getSourceHash(const Ktx2File& file)
+{
+	auto storedHash = file.keyValues.find(SOURCE_HASH_KEY);
+	return storedHash != file.keyValues.end() ? storedHash->second : std::string();
+}
+
+uint64_t TextureBaker::hashDerived(const std::string& parentHash, const std::vector<uint32_t>& settings)
+{
+	uint64_t hash = vks::tools::fnv1a64(&BAKE_VERSION, sizeof(BAKE_VERSION));
+	hash = vks::tools::fnv1a64(settings.data(), settings.size() * sizeof(uint32_t), hash);
+	return vks::tools::fnv1a64(parentHash.data(), parentHash.size(), hash);
+}
+
+bool TextureBaker::readDerived(const std::string& path, VkFormat format, const std::string& parentHash, const std::vector<uint32_t>& settings, Ktx2File& file)
+{
+	// without a parent hash nothing ties the cache to its source
+	return !parentHash.empty() && readCached(path, format, hashDerived(parentHash, settings), file);
+}
+
+void TextureBaker::writeDerived(const std::string& path, Ktx2File file, const std::string& parentHash, const std::vector<uint32_t>& settings)
+{
+	writeCached(path, file, hashDerived(parentHash, settings));
+}
+
+Ktx2File TextureBaker::bake(Layout layout, const std::vector<std::string>& sources) const
+{
+	if (sources.size() != (layout == Layout::Surface ? 3u : 1u))
+	{
+		throw std::runtime_error("Wrong number of texture sources for " + sources.front());
+	}
+
+	FloatImage image;
+	if (layout == Layout::Surface)
+	{
+		// one grey source per channel, all of the same size
+		for (uint32_t channel = 0; channel < 3; channel++)
+		{
+			int width, height;
+			unsigned char* pixels = loadPixels(sources[channel], STBI_grey, width, height);
+			if (channel == 0)
+			{
+				image.width = static_cast<uint32_t>(width);
+				image.height = static_cast<uint32_t>(height);
+				image.texels.assign(static_cast<size_t>(width) * height * 4, 1.0f);
+			}
+			else if (image.width != static_cast<uint32_t>(width) || image.height != static_cast<uint32_t>(height))
+			{
+				stbi_image_free(pixels);
+				throw std::runtime_error("Texture sources differ in size: " + sources[channel]);
+			}
+			for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+			{
+				image.texels[i * 4 + channel] = pixels[i] / 255.0f;
+			}
+			stbi_image_free(pixels);
+		}
+	}
+	else
+	{
+		int width, height;
+		unsigned char* pixels = loadPixels(sources.front(), STBI_rgb_alpha, width, height);
+		image.width = static_cast<uint32_t>(width);
+		image.height = static_cast<uint32_t>(height);
+		image.texels.resize(static_cast<size_t>(width) * height * 4);
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+		{
+			float* texel = &image.texels[i * 4];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				texel[c] = pixels[i * 4 + c] / 255.0f;
+			}
+			if (layout == Layout::Color)
+			{
+				// filtered in linear space, stored as sRGB
+				for (uint32_t c = 0; c < 3; c++)
+				{
+					texel[c] = srgbToLinear(texel[c]);
+				}
+			}
+			else
+			{
+				for (uint32_t c = 0; c < 3; c++)
+				{
+					texel[c] = texel[c] * 2.0f - 1.0f;
+				}
+				normalizeXYZ(texel);
+			}
+		}
+		stbi_image_free(pixels);
+	}
+
+	Ktx2File ktx;
+	ktx.format = getFormat(layout);
+	ktx.width = image.width;
+	ktx.height = image.height;
+
+	while (true)
+	{
+		std::vector<uint8_t> texels(static_cast<size_t>(image.width) * image.height * 4);
+		for (size_t i = 0; i < static_cast<size_t>(image.width) * image.height; i++)
+		{
+			const float* texel = &image.texels[i * 4];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				float value = texel[c];
+				if (layout == Layout::Color && c < 3)
+				{
+					value = linearToSrgb(value);
+				}
+				else if (layout == Layout::Normal && c < 3)
+				{
+					value = value * 0.5f + 0.5f;
+				}
+				texels[i * 4 + c] = toUnorm8(value);
+			}
+		}
+
+		if (!blockCompression)
+		{
+			ktx.levels.push_back(std::move(texels));
+		}
+		else
+		{
+			const uint32_t blocksX = (image.width + 3) / 4;
+			const uint32_t blocksY = (image.height + 3) / 4;
+			const uint32_t blockBytes = Ktx2File::getBlockBytes(ktx.format);
+			std::vector<uint8_t> blocks(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+
+			uint8_t blockTexels[64];
+			for (uint32_t by = 0; by < blocksY; by++)
+			{
+				for (uint32_t bx = 0; bx < blocksX; bx++)
+				{
+					// levels smaller than a block repeat their edge texels
+					for (uint32_t t = 0; t < 16; t++)
+					{
+						const uint32_t x = std::min(bx * 4 + t % 4, image.width - 1);
+						const uint32_t y = std::min(by * 4 + t / 4, image.height - 1);
+						memcpy(&blockTexels[t * 4], &texels[(static_cast<size_t>(y) * image.width + x) * 4], 4);
+					}
+
+					uint8_t* block = &blocks[(static_cast<size_t>(by) * blocksX + bx) * blockBytes];
+					if (layout == Layout::Normal)
+					{
+						bc::encodeBC5Block(blockTexels, block);
+					}
+					else
+					{
+						bc::encodeBC7Block(blockTexels, block);
+					}
+				}
+			}
+			ktx.levels.push_back(std::move(blocks));
+		}
+
+		if (image.width == 1 && image.height == 1)
+		{
+			break;
+		}
+		image = downsample(image, layout == Layout::Normal);
+	}
+
+	return ktx;
+}
+
+Ktx2File TextureBaker::bakeCubemap(const std::string& source, uint32_t faceSize, VkFormat format)
+{
+	int width, height, channels;
+	float* pixels = stbi_loadf(source.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		throw std::runtime_error("Failed to load HDR image: " + source);
+	}
+
+	// 2x2 samples per texel, a face texel covers about two equirect texels at the usual source sizes
+	FloatImage faces[6];
+	for (uint32_t face = 0; face < 6; face++)
+	{
+		faces[face].width = faceSize;
+		faces[face].height = faceSize;
+		faces[face].texels.assign(static_cast<size_t>(faceSize) * faceSize * 4, 0.0f);
+		for (uint32_t y = 0; y < faceSize; y++)
+		{
+			for (uint32_t x = 0; x < faceSize; x++)
+			{
+				float* texel = &faces[face].texels[(static_cast<size_t>(y) * faceSize + x) * 4];
+				for (uint32_t s = 0; s < 4; s++)
+				{
+					const float u = (x + 0.25f + 0.5f * (s % 2)) / faceSize * 2.0f - 1.0f;
+					const float v = (y + 0.25f + 0.5f * (s / 2)) / faceSize * 2.0f - 1.0f;
+					float direction[3];
+					float sample[4];
+					getCubeDirection(face, u, v, direction);
+					sampleEquirect(pixels, width, height, direction, sample);
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						texel[c] += 0.25f * sample[c];
+					}
+				}
+			}
+		}
+	}
+	stbi_image_free(pixels);
+
+	Ktx2File ktx;
+	ktx.format = format;
+	ktx.width = faceSize;
+	ktx.height = faceSize;
+	ktx.faceCount = 6;
+
+	const uint32_t texelBytes = Ktx2File::getBlockBytes(format);
+	while (true)
+	{
+		const size_t faceTexels = static_cast<size_t>(faces[0].width) * faces[0].height;
+		std::vector<uint8_t> level(faceTexels * texelBytes * 6);
+		uint8_t* output = level.data();
+		for (const FloatImage& image : faces)
+		{
+			for (size_t i = 0; i < faceTexels; i++, output += texelBytes)
+			{
+				const float* texel = &image.texels[i * 4];
+				if (format == VK_FORMAT_R16G16B16A16_SFLOAT)
+				{
+					const uint16_t half[4] = { toHalf(texel[0]), toHalf(texel[1]), toHalf(texel[2]), toHalf(texel[3]) };
+					memcpy(output, half, sizeof(half));
+				}
+				else
+				{
+					const uint32_t packed = toSmallFloat(texel[0], 6) | (toSmallFloat(texel[1], 6) << 11) | (toSmallFloat(texel[2], 5) << 22);
+					memcpy(output, &packed, sizeof(packed));
+				}
+			}
+		}
+		ktx.levels.push_back(std::move(level));
+
+		if (faces[0].width == 1)
+		{
+			break;
+		}
+		// faces are filtered on their own, the seams of the small levels are only seen by very blurry lookups
+		for (FloatImage& image : faces)
+		{
+			image = downsample(image, false);
+		}
+	}
+
+	return ktx;
+}
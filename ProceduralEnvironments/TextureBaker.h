@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Ktx2File.h"
+
+class VulkanDevice;
+
+/**
+* Bakes PNG material sources into KTX2 files with a full mip chain, block compressed when the
+* device can sample BC formats and RGBA8 with the same packing otherwise.
+* Every bake records a hash of its source files and settings. A cached file is reused while the
+* hash matches and baked again when a source changes.
+*
+* Layouts:
+*  - Color:   albedo, BC7 sRGB
+*  - Normal:  tangent space XY, BC5, Z is reconstructed in the shader
+*  - Surface: R = ambient occlusion, G = roughness, B = displacement, BC7
+*
+* Equirectangular HDR images are baked into cubemaps the same way, see loadOrBakeCubemap.
+*/
+class TextureBaker
+{
+public:
+	enum class Layout { Color, Normal, Surface };
+
+	explicit TextureBaker(bool blockCompression);
+
+	/** @brief Whether device has BC sampling enabled */
+	static bool supportsBlockCompression(const VulkanDevice& device);
+
+	/**
+	* @brief Load cachePath, baking it from sources first when it is missing or stale.
+	* Color and Normal take one source, Surface takes ambient occlusion, roughness and displacement.
+	* Safe to call from several threads as long as they don't share a cachePath.
+	*/
+	Ktx2File loadOrBake(const std::string& cachePath, Layout layout, const std::vector<std::string>& sources) const;
+
+	VkFormat getFormat(Layout layout) const;
+
+	/**
+	* @brief Load a cubemap from cachePath, converting the equirectangular HDR image at source first when it is missing or stale.
+	* Faces are faceSize squared with a full mip chain, stored as R16G16B16A16_SFLOAT or B10G11R11_UFLOAT_PACK32.
+	*/
+	static Ktx2File loadOrBakeCubemap(const std::string& cachePath, const std::string& source, uint32_t faceSize, VkFormat format);
+
+	/** @brief Source hash recorded in a baked file, empty when there is none */
+	static std::string getSourceHash(const Ktx2File& file);
+
+	/**
+	* @brief Cache of data computed elsewhere from a baked file, keyed by that file's source hash and the settings used.
+	* readDerived returns false when path is missing, stale or not in format.
+	*/
+	static bool readDerived(const std::string& path, VkFormat format, const std::string& parentHash, const std::vector<uint32_t>& settings, Ktx2File& file);
+	static void writeDerived(const std::string& path, Ktx2File file, const std::string& parentHash, const std::vector<uint32_t>& settings);
+
+private:
+	Ktx2File bake(Layout layout, const std::vector<std::string>& sources) const;
+	static Ktx2File bakeCubemap(const std::string& source, uint32_t faceSize, VkFormat format);
+
+	/** @brief The cached file when its format and recorded hash still match, otherwise the result of bake, written to cachePath */
+	static Ktx2File loadOrBakeCached(const std::string& cachePath, VkFormat format, uint64_t hash, const std::function<Ktx2File()>& bake);
+	static bool readCached(const std::string& cachePath, VkFormat format, uint64_t hash, Ktx2File& file);
+	static void writeCached(const std::string& cachePath, Ktx2File& file, uint64_t hash);
+	static uint64_t hashSources(const std::vector<uint32_t>& settings, const std::vector<std::string>& sources);
+	static uint64_t hashDerived(const std::string& parentHash, const std::vector<uint32_t>& settings);
+
+	bool blockCompression;
+};
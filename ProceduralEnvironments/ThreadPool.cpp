@@ -0,0 +1,62 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+	thread_local uint32_t currentWorkerIndex = UINT32_MAX;
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = std::max(1u, hardwareThreads > 1 ? hardwareThreads - 1 : 1u);
+	}
+
+	workers.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueCondition.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t ThreadPool::getWorkerIndex()
+{
+	return currentWorkerIndex;
+}
+
+void ThreadPool::workerLoop(uint32_t workerIndex)
+{
+	currentWorkerIndex = workerIndex;
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			// drain the queue before exiting so no future is left without a value
+			if (tasks.empty())
+			{
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
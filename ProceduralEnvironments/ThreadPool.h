@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+* Fixed set of worker threads consuming a FIFO of tasks.
+* submit() returns a future, so dependent work waits on exactly the results it needs
+* and exceptions thrown by a task surface on the thread that calls get().
+*/
+class ThreadPool
+{
+public:
+	/** @param threadCount Number of workers, 0 picks hardware concurrency minus the calling thread */
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<typename F>
+	auto submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+	{
+		using Result = std::invoke_result_t<std::decay_t<F>>;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		std::future<Result> future = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.emplace([packaged]() { (*packaged)(); });
+		}
+		queueCondition.notify_one();
+		return future;
+	}
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+	/** @brief Index of the calling worker in [0, getThreadCount()), UINT32_MAX on threads that don't belong to a pool */
+	static uint32_t getWorkerIndex();
+
+private:
+	void workerLoop(uint32_t workerIndex);
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	bool stopping = false;
+};
@@ -1,5 +1,7 @@
 #include "UIOverlay.h"
 
+#include <algorithm>
+
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
@@ -13,7 +15,7 @@
 
 #include "VulkanTools.h"
 
-UIOverlay::UIOverlay(Window& window, VulkanDevice& device, VulkanSwapchain& swapchain) : m_device(device), m_swapchain(swapchain)
+UIOverlay::UIOverlay(Window& window, VulkanDevice& device, VulkanSwapchain& swapchain, uint32_t framesInFlight) : m_device(device), m_swapchain(swapchain)
 {
     VkDescriptorPoolSize pool_sizes[] =
     {
@@ -55,8 +57,10 @@ UIOverlay::UIOverlay(Window& window, VulkanDevice& device, VulkanSwapchain& swap
     initInfo.QueueFamily = device.familyIndices.graphicsFamily.value();
     initInfo.Queue = device.graphicsQueue;
     initInfo.DescriptorPool = descriptorPool;
-    initInfo.MinImageCount = swapchain.imageViews.size();
-    initInfo.ImageCount = swapchain.imageViews.size();
+    // ImageCount sizes the ring of vertex buffers, it has to cover the frames in flight. Tying it to the swapchain would
+    // mean a shutdown of the backend whenever a recreated swapchain comes back with a different image count
+    initInfo.MinImageCount = 2;
+    initInfo.ImageCount = std::max(framesInFlight, 2u);
     initInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     initInfo.Allocator = nullptr;
     initInfo.UseDynamicRendering = true;
@@ -95,7 +99,7 @@ void UIOverlay::buildUI(UIPacket& uiPacket)
 {
     ImGui::PushStyleColor(ImGuiCol_WindowBg, ImVec4(0.1f, 0.1f, 0.12f, 0.75f));
     ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - 320, 20), ImGuiCond_Always);
-    ImGui::SetNextWindowSize(ImVec2(300, 200), ImGuiCond_Always);
+    ImGui::SetNextWindowSize(ImVec2(300, 500), ImGuiCond_Always);
     if (ImGui::Begin("Debug", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav))
     {
         ImGui::Text("Performace");
@@ -106,6 +110,55 @@ void UIOverlay::buildUI(UIPacket& uiPacket)
         ImGui::PlotLines("##framerate", uiPacket.frameHistory.data(), static_cast<int>(uiPacket.frameHistory.size()), 0, overlay_text, 0.0f, 5000.0f, ImVec2(0, 50));
         ImGui::Text("Frame Time: %.7f s", uiPacket.deltaTime);
         ImGui::Text("Elapsed Time: %.1f s", uiPacket.elapsedTime);
+        ImGui::Text("Frame GPU: %.3f ms", uiPacket.frameGpuMs);
+        ImGui::Text("Terrain GPU: %.3f ms", uiPacket.terrainGpuMs);
+        ImGui::Text("Render: %ux%u (%.0f%%)", uiPacket.renderExtent.width, uiPacket.renderExtent.height, uiPacket.renderScale * 100.0f);
+        ImGui::Text("Present: %.2f ms, jitter %.3f ms", uiPacket.presentIntervalMs, uiPacket.presentJitterMs);
+        ImGui::Text("Pacing sleep: %.2f ms, %u frames in flight", uiPacket.pacingSleepMs, uiPacket.framesInFlight);
+        for (const PassRecordTiming& timing : uiPacket.passRecordTimings)
+        {
+            ImGui::Text("Record %s: %.3f ms", timing.name, timing.milliseconds);
+        }
+        ImGui::Text("Scene commands: %s", uiPacket.sceneCommandsReused ? "replayed" : "recorded");
+        ImGui::Text("Barrier batches: %u", uiPacket.renderGraphBarrierBatches);
+        ImGui::Text("Depth pre-pass: %.3f ms, skybox: %.3f ms", uiPacket.terrainDepthGpuMs, uiPacket.skyboxGpuMs);
+        if (uiPacket.pipelineStatistics)
+        {
+            ImGui::Text("Fragment invocations: terrain %llu, skybox %llu",
+                static_cast<unsigned long long>(uiPacket.terrainFragmentInvocations),
+                static_cast<unsigned long long>(uiPacket.skyboxFragmentInvocations));
+        }
+        else
+        {
+            ImGui::TextUnformatted("Fragment invocations: pipeline statistics not supported");
+        }
+        const OcclusionStats& occlusion = uiPacket.occlusionStats;
+        ImGui::Text("Patches: %u, outside the frustum %u", uiPacket.terrainPatchCount, occlusion.frustumCulled);
+        ImGui::Text("Drawn early %u, late %u, occluded %u", occlusion.earlyVisible, occlusion.lateVisible,
+            occlusion.lateCandidates - occlusion.lateVisible);
+        if (uiPacket.props.enabled)
+        {
+            const PropStats& props = uiPacket.propStats;
+            ImGui::Text("Props: %u of %u placed, %.3f ms", std::min(props.placed, uiPacket.propCapacity), uiPacket.propCapacity, uiPacket.propsGpuMs);
+            ImGui::Text("Drawn trees %u + %u, rocks %u + %u", props.treesNear, props.treesFar, props.rocksNear, props.rocksFar);
+        }
+        if (uiPacket.erosion.running)
+        {
+            const ErosionStats& erosion = uiPacket.erosionStats;
+            ImGui::Text("Erosion: %u iterations/frame, %.3f ms", erosion.iterationsPerFrame, uiPacket.erosionGpuMs);
+            ImGui::Text("%.0f iterations/s, %u in total", erosion.iterationsPerSecond, erosion.totalIterations);
+        }
+        const DrainageStats& drainage = uiPacket.drainageStats;
+        if (drainage.size > 0)
+        {
+            ImGui::Text("Drainage: %.1f ms%s, %u river cells", drainage.totalMs, uiPacket.drainageRunning ? " (updating)" : "", drainage.riverCells);
+            ImGui::Text("Fill %.1f, D8 %.1f, accumulation %.1f ms", drainage.fillMs, drainage.directionMs, drainage.accumulationMs);
+            ImGui::Text("%u cells filled, %u sinks", drainage.filledCells, drainage.sinkCells);
+        }
+        for (const DrainageStats& benchmark : uiPacket.drainageBenchmark)
+        {
+            ImGui::Text("Drainage %ux%u: %.1f ms", benchmark.size, benchmark.size, benchmark.totalMs);
+        }
         ImGui::Text("Camera Debug");
         ImGui::Separator();
 
@@ -118,7 +171,7 @@ void UIOverlay::buildUI(UIPacket& uiPacket)
     ImGui::End();
 
     ImGui::SetNextWindowPos(ImVec2(20, 20));
-    ImGui::SetNextWindowSize(ImVec2(300, 500));
+    ImGui::SetNextWindowSize(ImVec2(300, 1330));
     if (ImGui::Begin("Height Map Controls", nullptr, ImGuiWindowFlags_None))
     {
         ImGui::Text("Height Map Settings");
@@ -136,6 +189,135 @@ void UIOverlay::buildUI(UIPacket& uiPacket)
         changed |= ImGui::DragFloat("Height Scale", &uiPacket.terrainParams.heightScale, 0.01f, 0.001f, 100.0f);
         changed |= ImGui::DragFloat("Normals Strength", &uiPacket.terrainParams.normalsStrength, 0.01f, 0.0f, 100.0f);
         uiPacket.heightMapConfigChanged = changed;
+
+        ImGui::Text("Materials");
+        ImGui::Separator();
+
+        ImGui::SliderFloat("Tiling", &uiPacket.terrainMaterialParams.tiling, 1.0f, 64.0f);
+        ImGui::SliderFloat("Sand Height", &uiPacket.terrainMaterialParams.sandHeight, 0.0f, 1.0f);
+        ImGui::SliderFloat("Snow Height", &uiPacket.terrainMaterialParams.snowHeight, 0.0f, 1.0f);
+        ImGui::SliderFloat("Rock Slope", &uiPacket.terrainMaterialParams.rockSlope, 0.0f, 1.0f);
+        ImGui::SliderFloat("Transition", &uiPacket.terrainMaterialParams.transitionWidth, 0.001f, 0.25f);
+        ImGui::SliderFloat("Blend Depth", &uiPacket.terrainMaterialParams.blendDepth, 0.01f, 1.0f);
+        ImGui::SliderFloat("Horizon Shadows", &uiPacket.terrainMaterialParams.horizonShadowing, 0.0f, 1.0f);
+
+        ImGui::Text("Frame Pacing");
+        ImGui::Separator();
+
+        // applied by the engine before the next frame, mode and vsync rebuild the swapchain
+        ImGui::Combo("Mode", &uiPacket.frameMode, "Latency (1 frame)\0Balanced (2 frames)\0Throughput (3 frames)\0");
+        ImGui::Checkbox("VSync", &uiPacket.vsync);
+        ImGui::Checkbox("Pace input sampling", &uiPacket.framePacing);
+        // off re-records the scene passes every frame, to compare against replaying them
+        ImGui::Checkbox("Reuse scene commands", &uiPacket.reuseSceneCommands);
+
+        ImGui::Text("Resolution");
+        ImGui::Separator();
+
+        // the scale is per axis, the controller moves it between the limits to hold the target GPU time
+        DynamicResolutionSettings& resolution = uiPacket.dynamicResolution;
+        ImGui::Checkbox("Dynamic resolution", &resolution.enabled);
+        if (resolution.enabled)
+        {
+            ImGui::SliderFloat("Target GPU ms", &resolution.targetGpuMs, 2.0f, 50.0f, "%.1f");
+            ImGui::SliderFloat("Min scale", &resolution.minScale, DynamicResolutionSettings::MIN_SCALE, 1.0f);
+            ImGui::SliderFloat("Max scale", &resolution.maxScale, resolution.minScale, 1.0f);
+        }
+        else
+        {
+            ImGui::SliderFloat("Render scale", &resolution.fixedScale, DynamicResolutionSettings::MIN_SCALE, 1.0f);
+        }
+        ImGui::SliderFloat("Sharpness", &resolution.sharpness, 0.0f, 1.0f);
+
+        ImGui::Text("Depth");
+        ImGui::Separator();
+
+        // compare the fragment invocations in the Debug window with and without them
+        ImGui::Checkbox("Reverse-Z", &uiPacket.reverseZ);
+        ImGui::Checkbox("Terrain depth pre-pass", &uiPacket.terrainDepthPrePass);
+
+        ImGui::Text("Culling");
+        ImGui::Separator();
+
+        // without it the patches are only frustum culled
+        ImGui::Checkbox("Hi-Z occlusion culling", &uiPacket.occlusionCulling);
+
+        ImGui::Text("Props");
+        ImGui::Separator();
+
+        // the densities and sizes place the props again, the distances only change the cull
+        PropSettings& props = uiPacket.props;
+        ImGui::Checkbox("Trees and rocks", &props.enabled);
+        if (props.enabled)
+        {
+            ImGui::SliderFloat("Tree density", &props.treeDensity, 0.0f, 1.0f);
+            ImGui::SliderFloat("Rock density", &props.rockDensity, 0.0f, 1.0f);
+            ImGui::SliderFloat("Tree size", &props.treeSize, 0.05f, 1.0f);
+            ImGui::SliderFloat("Rock size", &props.rockSize, 0.02f, 0.5f);
+            ImGui::SliderFloat("LOD distance", &props.lodDistance, 1.0f, 40.0f);
+            ImGui::SliderFloat("Draw distance", &props.drawDistance, props.lodDistance, 100.0f);
+        }
+
+        ImGui::Text("Erosion");
+        ImGui::Separator();
+
+        // iterates within the budget every frame, the mesh shows the eroded heights once applied. Reset generates the heightmap again
+        ErosionSettings& erosion = uiPacket.erosion;
+        ImGui::Checkbox("Run erosion", &erosion.running);
+        if (erosion.running)
+        {
+            ImGui::SliderFloat("Budget (ms)", &erosion.budgetMs, 0.5f, 16.0f);
+            int maxIterations = static_cast<int>(erosion.maxIterationsPerFrame);
+            if (ImGui::SliderInt("Max iterations", &maxIterations, 1, 256))
+            {
+                erosion.maxIterationsPerFrame = static_cast<uint32_t>(maxIterations);
+            }
+            ImGui::SliderFloat("Rain", &erosion.rainRate, 0.0f, 0.1f);
+            ImGui::SliderFloat("Evaporation", &erosion.evaporation, 0.0f, 0.1f);
+            ImGui::SliderFloat("Capacity", &erosion.sedimentCapacity, 0.0f, 4.0f);
+            ImGui::SliderFloat("Erosion rate", &erosion.erosionRate, 0.0f, 0.5f);
+            ImGui::SliderFloat("Deposition rate", &erosion.depositionRate, 0.0f, 0.5f);
+            ImGui::SliderFloat("Talus slope", &erosion.talusSlope, 0.1f, 4.0f);
+            ImGui::SliderFloat("Thermal rate", &erosion.thermalRate, 0.0f, 0.25f);
+        }
+        if (ImGui::Button("Apply to mesh"))
+        {
+            uiPacket.erosionApplyRequested = true;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Reset terrain"))
+        {
+            uiPacket.heightMapConfigChanged = true;
+        }
+
+        ImGui::Text("Drainage");
+        ImGui::Separator();
+
+        // every new terrain and every change here is analyzed again in the background
+        DrainageSettings& drainage = uiPacket.drainage;
+        ImGui::Checkbox("Fill depressions", &drainage.fillDepressions);
+        ImGui::SliderFloat("River threshold", &drainage.riverThreshold, 0.0001f, 0.02f, "%.4f", ImGuiSliderFlags_Logarithmic);
+
+        ImGui::Text("Profiling");
+        ImGui::Separator();
+
+        ImGui::BeginDisabled(uiPacket.textureBenchmarkRunning);
+        if (ImGui::Button(uiPacket.textureBenchmarkRunning ? "Texture benchmark running..." : "Run texture benchmark"))
+        {
+            uiPacket.textureBenchmarkRequested = true;
+        }
+        ImGui::EndDisabled();
+        ImGui::BeginDisabled(uiPacket.drainageBenchmarkRunning);
+        if (ImGui::Button(uiPacket.drainageBenchmarkRunning ? "Drainage benchmark running..." : "Run drainage benchmark"))
+        {
+            uiPacket.drainageBenchmarkRequested = true;
+        }
+        ImGui::EndDisabled();
+        // prints the passes, their barriers and the culled ones of the next frame
+        if (ImGui::Button("Dump render graph"))
+        {
+            uiPacket.renderGraphDumpRequested = true;
+        }
     }
     ImGui::End();
     ImGui::PopStyleColor();
@@ -10,7 +10,8 @@ class VulkanSwapchain;
 class UIOverlay
 {
 public:
-	UIOverlay(Window& window, VulkanDevice& device, VulkanSwapchain& swapchain);
+	/** @brief Renders into the images of swapchain, which may be recreated underneath as long as its color format stays */
+	UIOverlay(Window& window, VulkanDevice& device, VulkanSwapchain& swapchain, uint32_t framesInFlight);
 	~UIOverlay();
 
 	UIOverlay(const UIOverlay&) = delete;
@@ -0,0 +1,522 @@
+#include "UploadManager.h"
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+UploadManager::UploadManager(VulkanDevice& device, VkDeviceSize ringSize) :
+	device(device),
+	ringSize(ringSize)
+{
+	transferFamily = device.familyIndices.transferFamily.value();
+	graphicsFamily = device.familyIndices.graphicsFamily.value();
+	ownershipTransfer = transferFamily != graphicsFamily;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+	// 16 covers the texel size of every format we upload and the 4 byte rule for copies
+	copyAlignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
+
+	VkSemaphoreTypeCreateInfo timelineCI{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	timelineCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineCI.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreCI{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreCI.pNext = &timelineCI;
+	VK_CHECK_RESULT(vkCreateSemaphore(device.logicalDevice, &semaphoreCI, nullptr, &timelineSemaphore));
+	if (ownershipTransfer)
+	{
+		VK_CHECK_RESULT(vkCreateSemaphore(device.logicalDevice, &semaphoreCI, nullptr, &releaseSemaphore));
+	}
+
+	ring.create(
+		device,
+		ringSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+	);
+	VK_CHECK_RESULT(ring.map());
+}
+
+UploadManager::~UploadManager()
+{
+	wait(submit());
+
+	for (VkCommandBuffer cmd : freeTransferCmds)
+	{
+		vkFreeCommandBuffers(device.logicalDevice, device.transferCommandPool, 1, &cmd);
+	}
+	for (VkCommandBuffer cmd : freeAcquireCmds)
+	{
+		vkFreeCommandBuffers(device.logicalDevice, device.graphicsCommandPool, 1, &cmd);
+	}
+
+	ring.destroy();
+	vkDestroySemaphore(device.logicalDevice, timelineSemaphore, nullptr);
+	if (releaseSemaphore != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(device.logicalDevice, releaseSemaphore, nullptr);
+	}
+}
+
+UploadManager::Token UploadManager::uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset,
+	VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+{
+	Staging staging = stage(data, size);
+
+	Batch& batch = openBatch();
+
+	VkBufferCopy copyRegion{ staging.offset, dstOffset, size };
+	vkCmdCopyBuffer(batch.transferCmd, staging.buffer, buffer, 1, &copyRegion);
+
+	VkBufferMemoryBarrier2 barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	barrier.dstStageMask = dstStage;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = dstOffset;
+	barrier.size = size;
+
+	if (ownershipTransfer)
+	{
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+
+		VkBufferMemoryBarrier2 acquire = barrier;
+		acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		acquire.srcAccessMask = VK_ACCESS_2_NONE;
+		VkDependencyInfo acquireDependency{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		acquireDependency.bufferMemoryBarrierCount = 1;
+		acquireDependency.pBufferMemoryBarriers = &acquire;
+		vkCmdPipelineBarrier2(batch.acquireCmd, &acquireDependency);
+
+		// the release half ignores the destination scope
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+		barrier.dstAccessMask = VK_ACCESS_2_NONE;
+	}
+
+	VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependencyInfo.bufferMemoryBarrierCount = 1;
+	dependencyInfo.pBufferMemoryBarriers = &barrier;
+	vkCmdPipelineBarrier2(batch.transferCmd, &dependencyInfo);
+
+	return batch.token;
+}
+
+UploadManager::Token UploadManager::uploadImage(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions,
+	const VkImageSubresourceRange& range, VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess, bool generateMips)
+{
+	return uploadImage(image, stage(data, size), regions, range, finalLayout, dstStage, dstAccess, generateMips);
+}
+
+UploadManager::Token UploadManager::uploadImage(VkImage image, const Staging& staging, const std::vector<VkBufferImageCopy>& regions,
+	const VkImageSubresourceRange& range, VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess, bool generateMips)
+{
+	Batch& batch = openBatch();
+
+	VkImageMemoryBarrier2 toTransfer{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	toTransfer.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+	toTransfer.srcAccessMask = VK_ACCESS_2_NONE;
+	toTransfer.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toTransfer.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = image;
+	toTransfer.subresourceRange = range;
+
+	VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependencyInfo.imageMemoryBarrierCount = 1;
+	dependencyInfo.pImageMemoryBarriers = &toTransfer;
+	vkCmdPipelineBarrier2(batch.transferCmd, &dependencyInfo);
+
+	std::vector<VkBufferImageCopy> stagedRegions = regions;
+	for (VkBufferImageCopy& region : stagedRegions)
+	{
+		region.bufferOffset += staging.offset;
+	}
+	vkCmdCopyBufferToImage(
+		batch.transferCmd,
+		staging.buffer,
+		image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(stagedRegions.size()),
+		stagedRegions.data()
+	);
+
+	if (generateMips && range.levelCount > 1)
+	{
+		VkCommandBuffer blitCmd = batch.transferCmd;
+		if (ownershipTransfer)
+		{
+			// blits need a graphics capable queue, hand the whole chain over still in TRANSFER_DST
+			VkImageMemoryBarrier2 release = toTransfer;
+			release.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+			release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+			release.dstAccessMask = VK_ACCESS_2_NONE;
+			release.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			release.srcQueueFamilyIndex = transferFamily;
+			release.dstQueueFamilyIndex = graphicsFamily;
+			dependencyInfo.pImageMemoryBarriers = &release;
+			vkCmdPipelineBarrier2(batch.transferCmd, &dependencyInfo);
+
+			VkImageMemoryBarrier2 acquire = release;
+			acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+			acquire.srcAccessMask = VK_ACCESS_2_NONE;
+			acquire.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+			acquire.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			dependencyInfo.pImageMemoryBarriers = &acquire;
+			vkCmdPipelineBarrier2(batch.acquireCmd, &dependencyInfo);
+
+			blitCmd = batch.acquireCmd;
+		}
+
+		recordMipChain(blitCmd, image, regions.front().imageExtent, range, finalLayout, dstStage, dstAccess);
+		return batch.token;
+	}
+
+	VkImageMemoryBarrier2 toFinal = toTransfer;
+	toFinal.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	toFinal.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	toFinal.dstStageMask = dstStage;
+	toFinal.dstAccessMask = dstAccess;
+	toFinal.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toFinal.newLayout = finalLayout;
+
+	if (ownershipTransfer)
+	{
+		// release and acquire must describe the same layout transition
+		toFinal.srcQueueFamilyIndex = transferFamily;
+		toFinal.dstQueueFamilyIndex = graphicsFamily;
+
+		VkImageMemoryBarrier2 acquire = toFinal;
+		acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		acquire.srcAccessMask = VK_ACCESS_2_NONE;
+		dependencyInfo.pImageMemoryBarriers = &acquire;
+		vkCmdPipelineBarrier2(batch.acquireCmd, &dependencyInfo);
+
+		toFinal.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+		toFinal.dstAccessMask = VK_ACCESS_2_NONE;
+	}
+
+	dependencyInfo.pImageMemoryBarriers = &toFinal;
+	vkCmdPipelineBarrier2(batch.transferCmd, &dependencyInfo);
+
+	return batch.token;
+}
+
+UploadManager::Token UploadManager::uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height,
+	VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+{
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+
+	return uploadImage(image, data, size, { region }, VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+		finalLayout, dstStage, dstAccess);
+}
+
+UploadManager::Token UploadManager::submit()
+{
+	if (!recording)
+	{
+		return lastSubmitted;
+	}
+
+	Batch batch = std::move(*recording);
+	recording.reset();
+
+	VK_CHECK_RESULT(vkEndCommandBuffer(batch.transferCmd));
+
+	VkCommandBufferSubmitInfo transferCmdInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+	transferCmdInfo.commandBuffer = batch.transferCmd;
+
+	VkSemaphoreSubmitInfo transferSignal{ VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+	transferSignal.semaphore = ownershipTransfer ? releaseSemaphore : timelineSemaphore;
+	transferSignal.value = batch.token;
+	transferSignal.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo2 transferSubmit{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+	transferSubmit.commandBufferInfoCount = 1;
+	transferSubmit.pCommandBufferInfos = &transferCmdInfo;
+	transferSubmit.signalSemaphoreInfoCount = 1;
+	transferSubmit.pSignalSemaphoreInfos = &transferSignal;
+	VK_CHECK_RESULT(vkQueueSubmit2(device.transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+	if (ownershipTransfer)
+	{
+		VK_CHECK_RESULT(vkEndCommandBuffer(batch.acquireCmd));
+
+		VkCommandBufferSubmitInfo acquireCmdInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+		acquireCmdInfo.commandBuffer = batch.acquireCmd;
+
+		VkSemaphoreSubmitInfo acquireWait = transferSignal;
+		VkSemaphoreSubmitInfo acquireSignal = transferSignal;
+		acquireSignal.semaphore = timelineSemaphore;
+
+		VkSubmitInfo2 acquireSubmit{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+		acquireSubmit.waitSemaphoreInfoCount = 1;
+		acquireSubmit.pWaitSemaphoreInfos = &acquireWait;
+		acquireSubmit.commandBufferInfoCount = 1;
+		acquireSubmit.pCommandBufferInfos = &acquireCmdInfo;
+		acquireSubmit.signalSemaphoreInfoCount = 1;
+		acquireSubmit.pSignalSemaphoreInfos = &acquireSignal;
+		VK_CHECK_RESULT(vkQueueSubmit2(device.graphicsQueue, 1, &acquireSubmit, VK_NULL_HANDLE));
+	}
+
+	lastSubmitted = batch.token;
+	inFlight.push_back(std::move(batch));
+
+	return lastSubmitted;
+}
+
+bool UploadManager::isComplete(Token token) const
+{
+	uint64_t value = 0;
+	VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device.logicalDevice, timelineSemaphore, &value));
+	return value >= token;
+}
+
+void UploadManager::wait(Token token)
+{
+	if (token > lastSubmitted)
+	{
+		submit();
+	}
+
+	VkSemaphoreWaitInfo waitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timelineSemaphore;
+	waitInfo.pValues = &token;
+	VK_CHECK_RESULT(vkWaitSemaphores(device.logicalDevice, &waitInfo, UINT64_MAX));
+
+	reclaim();
+}
+
+UploadManager::Batch& UploadManager::openBatch()
+{
+	if (!recording)
+	{
+		recording.emplace();
+		recording->token = nextToken++;
+		recording->transferCmd = getCommandBuffer(device.transferCommandPool, freeTransferCmds);
+		if (ownershipTransfer)
+		{
+			recording->acquireCmd = getCommandBuffer(device.graphicsCommandPool, freeAcquireCmds);
+		}
+
+		VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(recording->transferCmd, &beginInfo));
+		if (ownershipTransfer)
+		{
+			VK_CHECK_RESULT(vkBeginCommandBuffer(recording->acquireCmd, &beginInfo));
+		}
+	}
+	return *recording;
+}
+
+/**
+* The ring is a FIFO: bytes are released in the order their batches complete,
+* so the occupied span always runs from the oldest in-flight batch up to ringHead.
+* Reservations larger than half the ring get a temporary buffer instead of draining it.
+*/
+UploadManager::Staging UploadManager::reserve(VkDeviceSize size)
+{
+	Staging staging;
+	staging.size = size;
+
+	if (size > ringSize / 2)
+	{
+		vks::Buffer temporary;
+		temporary.create(
+			device,
+			size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		VK_CHECK_RESULT(temporary.map());
+
+		staging.buffer = temporary.buffer;
+		staging.offset = 0;
+		staging.mapped = temporary.mapped;
+		openBatch().temporaryBuffers.push_back(temporary);
+		return staging;
+	}
+
+	reclaim();
+
+	VkDeviceSize offset;
+	VkDeviceSize consumed;
+	while (true)
+	{
+		if (ringUsed == 0)
+		{
+			ringHead = 0;
+		}
+
+		offset = vks::tools::alignUp(ringHead, copyAlignment);
+		if (offset + size <= ringSize)
+		{
+			consumed = offset - ringHead + size;
+		}
+		else
+		{
+			// wrap, the tail end of the ring is wasted until this batch completes
+			offset = 0;
+			consumed = ringSize - ringHead + size;
+		}
+
+		if (consumed <= ringSize - ringUsed)
+		{
+			break;
+		}
+
+		if (inFlight.empty())
+		{
+			// the open batch holds the rest of the ring
+			submit();
+		}
+		wait(inFlight.front().token);
+	}
+
+	ringHead = (offset + size) % ringSize;
+	ringUsed += consumed;
+	openBatch().ringBytes += consumed;
+
+	staging.buffer = ring.buffer;
+	staging.offset = offset;
+	staging.mapped = static_cast<char*>(ring.mapped) + offset;
+	return staging;
+}
+
+UploadManager::Staging UploadManager::stage(const void* data, VkDeviceSize size)
+{
+	Staging staging = reserve(size);
+	memcpy(staging.mapped, data, size);
+	return staging;
+}
+
+/**
+* Downsample range level by level with linear blits. Level 0 of range holds the copied data,
+* every level starts in TRANSFER_DST and ends in finalLayout.
+*/
+void UploadManager::recordMipChain(VkCommandBuffer cmd, VkImage image, VkExtent3D extent, const VkImageSubresourceRange& range,
+	VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+{
+	VkImageMemoryBarrier2 barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	barrier.subresourceRange.levelCount = 1;
+
+	VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dependencyInfo.imageMemoryBarrierCount = 1;
+	dependencyInfo.pImageMemoryBarriers = &barrier;
+
+	int32_t width = static_cast<int32_t>(extent.width);
+	int32_t height = static_cast<int32_t>(extent.height);
+	const uint32_t lastLevel = range.baseMipLevel + range.levelCount - 1;
+	for (uint32_t level = range.baseMipLevel + 1; level <= lastLevel; level++)
+	{
+		// the previous level is complete, either copied or blitted
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+		VkImageBlit2 blit{ VK_STRUCTURE_TYPE_IMAGE_BLIT_2 };
+		blit.srcSubresource = { range.aspectMask, level - 1, range.baseArrayLayer, range.layerCount };
+		blit.srcOffsets[1] = { width, height, 1 };
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+		blit.dstSubresource = { range.aspectMask, level, range.baseArrayLayer, range.layerCount };
+		blit.dstOffsets[1] = { width, height, 1 };
+
+		VkBlitImageInfo2 blitInfo{ VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2 };
+		blitInfo.srcImage = image;
+		blitInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		blitInfo.dstImage = image;
+		blitInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		blitInfo.regionCount = 1;
+		blitInfo.pRegions = &blit;
+		blitInfo.filter = VK_FILTER_LINEAR;
+		vkCmdBlitImage2(cmd, &blitInfo);
+	}
+
+	// all levels but the last were blit sources
+	std::array<VkImageMemoryBarrier2, 2> toFinal{ barrier, barrier };
+	toFinal[0].subresourceRange.baseMipLevel = range.baseMipLevel;
+	toFinal[0].subresourceRange.levelCount = range.levelCount - 1;
+	toFinal[0].srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+	toFinal[0].srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+	toFinal[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	toFinal[1].subresourceRange.baseMipLevel = lastLevel;
+	toFinal[1].subresourceRange.levelCount = 1;
+	toFinal[1].srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+	toFinal[1].srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	toFinal[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+	for (VkImageMemoryBarrier2& finalBarrier : toFinal)
+	{
+		finalBarrier.dstStageMask = dstStage;
+		finalBarrier.dstAccessMask = dstAccess;
+		finalBarrier.newLayout = finalLayout;
+	}
+
+	dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(toFinal.size());
+	dependencyInfo.pImageMemoryBarriers = toFinal.data();
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+void UploadManager::reclaim()
+{
+	uint64_t completed = 0;
+	VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device.logicalDevice, timelineSemaphore, &completed));
+
+	while (!inFlight.empty() && inFlight.front().token <= completed)
+	{
+		Batch& batch = inFlight.front();
+		ringUsed -= batch.ringBytes;
+		for (vks::Buffer& temporary : batch.temporaryBuffers)
+		{
+			temporary.destroy();
+		}
+		freeTransferCmds.push_back(batch.transferCmd);
+		if (batch.acquireCmd != VK_NULL_HANDLE)
+		{
+			freeAcquireCmds.push_back(batch.acquireCmd);
+		}
+		inFlight.pop_front();
+	}
+}
+
+VkCommandBuffer UploadManager::getCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+{
+	if (freeList.empty())
+	{
+		return VulkanDevice::createCommandBuffers(device.logicalDevice, VK_COMMAND_BUFFER_LEVEL_PRIMARY, pool, 1)[0];
+	}
+	// pools are created with RESET_COMMAND_BUFFER, vkBeginCommandBuffer resets implicitly
+	VkCommandBuffer cmd = freeList.back();
+	freeList.pop_back();
+	return cmd;
+}
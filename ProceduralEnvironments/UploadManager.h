@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+
+/**
+* Batches staging copies into as few submissions on the transfer queue as possible.
+* Source data is copied into a persistently mapped staging ring right away, the copy commands go into
+* the open batch and submit() sends the whole batch at once. Completion is tracked on a timeline
+* semaphore, so callers get a token back instead of blocking on queue idle.
+*
+* When the transfer queue belongs to another queue family, every destination is released by the
+* transfer queue and acquired again by a short submission on the graphics queue, which also runs
+* mip generation blits.
+*
+* Not thread safe: record and submit from the thread that owns the queues.
+*/
+class UploadManager
+{
+public:
+	/** Timeline value that is signalled once an upload is usable on the graphics queue */
+	using Token = uint64_t;
+
+	UploadManager(VulkanDevice& device, VkDeviceSize ringSize = 32ull * 1024 * 1024);
+	~UploadManager();
+
+	UploadManager(const UploadManager&) = delete;
+	UploadManager& operator=(const UploadManager&) = delete;
+
+	/** Mapped staging memory, handed out before the data exists so producers can write it in place */
+	struct Staging {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr; // already offset
+	};
+
+	/**
+	* @brief Reserve staging memory in the open batch.
+	* The memory may be written from any thread, but every upload reading it must be recorded before
+	* anything else is staged, otherwise the batch owning it can be submitted and recycled first.
+	*/
+	Staging reserve(VkDeviceSize size);
+
+	/** @brief Copy data into a buffer. dstStage/dstAccess describe the first use on the graphics queue */
+	Token uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset,
+		VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
+
+	/**
+	* @brief Copy data into an image and transition it to finalLayout.
+	* Region buffer offsets are relative to data, the previous contents of range are discarded.
+	* With generateMips the regions fill the first level of range and the remaining levels are
+	* blitted from it. The format must support linear filtered blits, the blits run on a graphics queue.
+	*/
+	Token uploadImage(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions,
+		const VkImageSubresourceRange& range, VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess,
+		bool generateMips = false);
+
+	/** @brief Same as above with the data already in reserved staging memory, region offsets are relative to it */
+	Token uploadImage(VkImage image, const Staging& staging, const std::vector<VkBufferImageCopy>& regions,
+		const VkImageSubresourceRange& range, VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess,
+		bool generateMips = false);
+
+	/** @brief Single mip level, single layer color image */
+	Token uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height,
+		VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
+
+	/** @brief Submit the open batch, returns the token of the last upload */
+	Token submit();
+
+	bool isComplete(Token token) const;
+
+	/** @brief Block until token is signalled, submitting the open batch first if the token belongs to it */
+	void wait(Token token);
+
+	/** @brief Queue submissions that consume uploads wait on this semaphore with the token as value */
+	VkSemaphore getTimelineSemaphore() const { return timelineSemaphore; }
+
+private:
+	struct Batch {
+		Token token = 0;
+		VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCmd = VK_NULL_HANDLE;
+		VkDeviceSize ringBytes = 0;
+		std::vector<vks::Buffer> temporaryBuffers;
+	};
+
+	Batch& openBatch();
+	Staging stage(const void* data, VkDeviceSize size);
+	void recordMipChain(VkCommandBuffer cmd, VkImage image, VkExtent3D extent, const VkImageSubresourceRange& range,
+		VkImageLayout finalLayout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
+	void reclaim();
+	VkCommandBuffer getCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList);
+
+	VulkanDevice& device;
+	bool ownershipTransfer = false;
+	uint32_t transferFamily = 0;
+	uint32_t graphicsFamily = 0;
+
+	VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+	// signalled by the transfer queue and waited on by the acquire submission, both with the batch token.
+	// A separate timeline keeps values monotonic per signalling queue.
+	VkSemaphore releaseSemaphore = VK_NULL_HANDLE;
+	Token nextToken = 1;
+	Token lastSubmitted = 0;
+
+	vks::Buffer ring;
+	VkDeviceSize ringSize = 0;
+	VkDeviceSize ringHead = 0;
+	VkDeviceSize ringUsed = 0; // bytes between the oldest in-flight batch and ringHead, including wrap padding
+	VkDeviceSize copyAlignment = 16;
+
+	std::optional<Batch> recording;
+	std::deque<Batch> inFlight;
+	std::vector<VkCommandBuffer> freeTransferCmds;
+	std::vector<VkCommandBuffer> freeAcquireCmds;
+};
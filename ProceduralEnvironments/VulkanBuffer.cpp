@@ -18,9 +18,10 @@ namespace vks
 
 
 
-	void Buffer::create(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+	void Buffer::create(VulkanDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
 	{
-		this->device = device;
+		this->device = device.logicalDevice;
+		this->allocator = device.allocator.get();
 		this->size = size;
 		this->usageFlags = usage;
 		this->memoryPropertyFlags = properties;
@@ -29,23 +30,15 @@ namespace vks
 		bufferInfo.size = size;
 		bufferInfo.usage = usage;
 		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer));
+		VK_CHECK_RESULT(vkCreateBuffer(this->device, &bufferInfo, nullptr, &buffer));
 
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = vks::tools::findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
-
-		VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &memory));
-
-		bind();
+		// allocates and binds
+		allocation = allocator->allocateForBuffer(buffer, properties);
 	}
 
 	/**
 	* Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
+	* Host visible memory is persistently mapped by the allocator, so this only resolves the pointer.
 	*
 	* @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete buffer range.
 	* @param offset (Optional) Byte offset from beginning
@@ -54,33 +47,23 @@ namespace vks
 	*/
 	VkResult Buffer::map(VkDeviceSize size, VkDeviceSize offset)
 	{
-		return vkMapMemory(device, memory, offset, size, 0, &mapped);
-	}
-
-	/**
-	* Unmap a mapped memory range
-	*
-	* @note Does not return a result as vkUnmapMemory can't fail
-	*/
-	void Buffer::unmap()
-	{
-		if (mapped)
+		VulkanMemoryAllocator::AllocationInfo info = allocator->getInfo(allocation);
+		if (!info.mapped)
 		{
-			vkUnmapMemory(device, memory);
-			mapped = nullptr;
+			return VK_ERROR_MEMORY_MAP_FAILED;
 		}
+		mapped = static_cast<char*>(info.mapped) + offset;
+		return VK_SUCCESS;
 	}
 
 	/**
-	* Attach the allocated memory block to the buffer
-	*
-	* @param offset (Optional) Byte offset (from the beginning) for the memory region to bind
+	* Unmap a mapped memory range
 	*
-	* @return VkResult of the bindBufferMemory call
+	* @note The underlying block stays mapped for the allocator's lifetime
 	*/
-	VkResult Buffer::bind(VkDeviceSize offset)
+	void Buffer::unmap()
 	{
-		return vkBindBufferMemory(device, buffer, memory, offset);
+		mapped = nullptr;
 	}
 
 	/**
@@ -122,11 +105,13 @@ namespace vks
 	*/
 	VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
 	{
+		// VK_WHOLE_SIZE would reach past this sub-allocation to the end of the block
+		VulkanMemoryAllocator::AllocationInfo info = allocator->getInfo(allocation);
 		VkMappedMemoryRange mappedRange = {};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = info.memory;
+		mappedRange.offset = info.offset + offset;
+		mappedRange.size = size == VK_WHOLE_SIZE ? info.size - offset : size;
 		return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 	}
 
@@ -142,11 +127,13 @@ namespace vks
 	*/
 	VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset)
 	{
+		// VK_WHOLE_SIZE would reach past this sub-allocation to the end of the block
+		VulkanMemoryAllocator::AllocationInfo info = allocator->getInfo(allocation);
 		VkMappedMemoryRange mappedRange = {};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = info.memory;
+		mappedRange.offset = info.offset + offset;
+		mappedRange.size = size == VK_WHOLE_SIZE ? info.size - offset : size;
 		return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
 	}
 
@@ -158,11 +145,14 @@ namespace vks
 		if (buffer)
 		{
 			vkDestroyBuffer(device, buffer, nullptr);
+			buffer = VK_NULL_HANDLE;
 		}
-		if (memory)
+		if (allocation.isValid())
 		{
-			vkFreeMemory(device, memory, nullptr);
+			allocator->free(allocation);
+			allocation = {};
 		}
+		mapped = nullptr;
 	}
 
 };
\ No newline at end of file
@@ -16,6 +16,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanDevice.h"
 
 namespace vks
 {
@@ -27,7 +28,9 @@ namespace vks
 	{
 		VkDevice device;
 		VkBuffer buffer = VK_NULL_HANDLE;
-		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Sub-allocation backing the buffer, resolve through the allocator for memory and offset */
+		VulkanMemoryAllocator* allocator = nullptr;
+		VulkanMemoryAllocator::Allocation allocation;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
@@ -37,11 +40,10 @@ namespace vks
 		/** @brief Memory property flags to be filled by external source at buffer creation (to query at some later point) */
 		VkMemoryPropertyFlags memoryPropertyFlags;
 
-		void create(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);;
+		void create(VulkanDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
 
 		VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		void unmap();
-		VkResult bind(VkDeviceSize offset = 0);
 		void setupDescriptor(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		void copyTo(void* data, VkDeviceSize size);
 		VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
@@ -21,6 +21,13 @@ VulkanComputePass::~VulkanComputePass()
 }
 
 void VulkanComputePass::create(const Config& config, VkDescriptorPool descriptorPool)
+{
+    createLayouts(config);
+    createPipeline();
+    allocateDescriptorSet(descriptorPool);
+}
+
+void VulkanComputePass::createLayouts(const Config& config)
 {
     this->config = config;
 
@@ -40,19 +47,45 @@ void VulkanComputePass::create(const Config& config, VkDescriptorPool descriptor
     pipelineLayoutCI.pushConstantRangeCount = this->config.pushConstantSize == 0 ? 0 : 1;
     pipelineLayoutCI.pPushConstantRanges = this->config.pushConstantSize == 0 ? nullptr : &pushConstant;
     VK_CHECK_RESULT(vkCreatePipelineLayout(this->device.logicalDevice, &pipelineLayoutCI, nullptr, &this->pipelineLayout));
+}
+
+void VulkanComputePass::createPipeline()
+{
+    this->computePipeline = buildPipeline();
+    if (this->computePipeline == VK_NULL_HANDLE)
+    {
+        throw std::runtime_error("Failed to create compute pipeline: " + this->config.shaderPath);
+    }
+}
+
+void VulkanComputePass::allocateDescriptorSet(VkDescriptorPool descriptorPool)
+{
+    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &this->descriptorSetLayout;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device.logicalDevice, &allocInfo, &this->descriptorSet));
+}
 
-    VkShaderModule computeShader;
+VkPipeline VulkanComputePass::buildPipeline() const
+{
+    VkShaderModule computeShader = VK_NULL_HANDLE;
     if (this->config.shaderType == ShaderType::Shader_Type_SPIRV)
     {
         computeShader = vks::tools::loadShader(this->config.shaderPath.c_str(), this->device.logicalDevice);
     }
+    else if (this->config.shaderType == ShaderType::Shader_Type_SLANG && this->config.shaderCache != nullptr)
+    {
+        computeShader = this->config.shaderCache->loadShader(this->device.logicalDevice, this->config.shaderPath, "main");
+    }
     else if (this->config.shaderType == ShaderType::Shader_Type_SLANG)
     {
         computeShader = vks::tools::loadSlangShader(this->device.logicalDevice, this->config.slangGlobalSession, this->config.shaderPath.c_str(), "main");
     }
-    else
+    if (computeShader == VK_NULL_HANDLE)
     {
-        throw std::runtime_error("Invalid Shader Type");
+        std::cerr << "Failed to load compute shader: " << this->config.shaderPath << "\n";
+        return VK_NULL_HANDLE;
     }
 
     VkPipelineShaderStageCreateInfo shaderStage{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
@@ -63,15 +96,24 @@ void VulkanComputePass::create(const Config& config, VkDescriptorPool descriptor
     VkComputePipelineCreateInfo computeCI{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
     computeCI.stage = shaderStage;
     computeCI.layout = this->pipelineLayout;
-    VK_CHECK_RESULT(vkCreateComputePipelines(this->device.logicalDevice, VK_NULL_HANDLE, 1, &computeCI, nullptr, &this->computePipeline));
 
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateComputePipelines(this->device.logicalDevice, this->device.pipelineCache, 1, &computeCI, nullptr, &pipeline);
     vkDestroyShaderModule(this->device.logicalDevice, computeShader, nullptr);
 
-    VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = &this->descriptorSetLayout;
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device.logicalDevice, &allocInfo, &this->descriptorSet));
+    if (result != VK_SUCCESS)
+    {
+        std::cerr << "vkCreateComputePipelines failed with \"" << vks::tools::errorString(result) << "\" for " << this->config.shaderPath << "\n";
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
+}
+
+VkPipeline VulkanComputePass::swapPipeline(VkPipeline pipeline)
+{
+    VkPipeline previous = this->computePipeline;
+    this->computePipeline = pipeline;
+    return previous;
 }
 
 void VulkanComputePass::updateDescriptors(const std::vector<VkWriteDescriptorSet>& descriptorWrites)
@@ -84,9 +126,15 @@ void VulkanComputePass::updateDescriptors(const std::vector<VkWriteDescriptorSet
 }
 
 void VulkanComputePass::recordCommands(VkCommandBuffer cmd, const void* pushConstantData, uint32_t dispatchGroupX, uint32_t dispatchGroupY, uint32_t dispatchGroupZ)
+{
+    recordCommands(cmd, this->descriptorSet, 0, nullptr, pushConstantData, dispatchGroupX, dispatchGroupY, dispatchGroupZ);
+}
+
+void VulkanComputePass::recordCommands(VkCommandBuffer cmd, VkDescriptorSet set, uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets,
+    const void* pushConstantData, uint32_t dispatchGroupX, uint32_t dispatchGroupY, uint32_t dispatchGroupZ)
 {
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->computePipeline);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipelineLayout, 0, 1, &this->descriptorSet, 0, nullptr);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipelineLayout, 0, 1, &set, dynamicOffsetCount, dynamicOffsets);
     if (this->config.pushConstantSize > 0 && pushConstantData != nullptr)
     {
         vkCmdPushConstants(cmd, this->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, this->config.pushConstantSize, pushConstantData);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "VulkanDevice.h"
+#include "ShaderCache.h"
 #include <slang/slang.h>
 #include <string>
 #include <vector>
@@ -19,6 +20,7 @@ public:
 		std::string shaderPath;
 		ShaderType shaderType;
 		slang::IGlobalSession* slangGlobalSession;
+		ShaderCache* shaderCache = nullptr; // when set, slang shaders are loaded through the compile cache
 		std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindings;
 		uint32_t pushConstantSize = 0;
 	};
@@ -32,6 +34,15 @@ public:
 	/** @brief Create Compute Pass with all vulkan resources based on the config */
 	void create(const Config& config, VkDescriptorPool descriptorPool);
 
+	/*
+	* Split form of create() for building several passes concurrently:
+	* createLayouts() first, then createPipeline() from any thread, and allocateDescriptorSet()
+	* on the thread that owns the descriptor pool. The last two may run in either order.
+	*/
+	void createLayouts(const Config& config);
+	void createPipeline();
+	void allocateDescriptorSet(VkDescriptorPool descriptorPool);
+
 	/* 
 	* @brief Update the descriptor set with specific buffers / images. This must be called after create()
 	*/
@@ -46,9 +57,34 @@ public:
 		uint32_t dispatchGroupZ
 	);
 
+	/* @brief Record the dispatch with a set allocated from getDescriptorSetLayout() instead of the pass's own one */
+	void recordCommands(
+		VkCommandBuffer cmd,
+		VkDescriptorSet set,
+		uint32_t dynamicOffsetCount,
+		const uint32_t* dynamicOffsets,
+		const void* pushConstantData,
+		uint32_t dispatchGroupX,
+		uint32_t dispatchGroupY,
+		uint32_t dispatchGroupZ
+	);
+
+	/**
+	* @brief Compile the configured shader and build a pipeline against the existing layout.
+	* Returns VK_NULL_HANDLE on failure. Does not modify the pass, so it may run on another thread after create()
+	*/
+	VkPipeline buildPipeline() const;
+
+	/* @brief Replace the pipeline used by recordCommands(). Returns the previous one, which the caller now owns */
+	VkPipeline swapPipeline(VkPipeline pipeline);
+
+	const std::string& getShaderPath() const { return config.shaderPath; }
+
 	/* @brief Get descriptor set */
 	VkDescriptorSet getDescriptorSet() const { return descriptorSet; }
 
+	VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+
 private:
 	const VulkanDevice& device;
 	Config config;
@@ -1,6 +1,10 @@
 #include "VulkanDevice.h"
 #include "VulkanTools.h"
 #include "VulkanSwapchain.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 VulkanDevice::VulkanDevice(GLFWwindow* window)
 {
 	this->window = window;
@@ -8,19 +12,30 @@ VulkanDevice::VulkanDevice(GLFWwindow* window)
 	setupDebugging();
 	createSurface(window);
 	pickPhysicalDevice();
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 	createLogicalDevice();
+	allocator = std::make_unique<VulkanMemoryAllocator>(logicalDevice, physicalDevice);
+	deletionQueue = std::make_unique<DeletionQueue>(logicalDevice);
 	graphicsCommandPool = createCommandPool(logicalDevice, familyIndices.graphicsFamily.value()); // also use for present queue
 	computeCommandPool = createCommandPool(logicalDevice, familyIndices.computeFamily.value());
 	transferCommandPool = createCommandPool(logicalDevice, familyIndices.transferFamily.value());
+	createPipelineCache();
 
 
 }
 
 VulkanDevice::~VulkanDevice()
 {
+	// whatever is left may free allocations, so it goes before the allocator
+	vkDeviceWaitIdle(logicalDevice);
+	deletionQueue.reset();
+
+	savePipelineCache();
+	vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
 	vkDestroyCommandPool(logicalDevice, transferCommandPool, nullptr);
 	vkDestroyCommandPool(logicalDevice, computeCommandPool, nullptr);
 	vkDestroyCommandPool(logicalDevice, graphicsCommandPool, nullptr);
+	allocator.reset();
 	vkDestroyDevice(logicalDevice, nullptr);
 	vkDestroySurfaceKHR(instance, surface, nullptr);
 	freeDebugCallback();
@@ -221,11 +236,22 @@ void VulkanDevice::createLogicalDevice()
 		queueCreateInfos.push_back(queueCI);
 	}
 
-	VkPhysicalDeviceFeatures deviceFeatures{};
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	VkPhysicalDeviceFeatures& deviceFeatures = enabledFeatures;
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 	deviceFeatures.tessellationShader = VK_TRUE;
 	deviceFeatures.fillModeNonSolid = VK_TRUE;
 	deviceFeatures.wideLines = VK_TRUE;
+	// optional, baked textures fall back to uncompressed without it
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	// optional, only for the fragment invocation counts of the profiler
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+	// the terrain patches that survive occlusion culling are drawn with one indirect count draw per phase
+	deviceFeatures.multiDrawIndirect = VK_TRUE;
+	// the props start the instance list of every indirect draw at its own first instance
+	deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
 
 	/*VkDeviceDiagnosticsConfigCreateInfoNV aftermathInfo = {};
 	aftermathInfo.sType = VK_STRUCTURE_TYPE_DEVICE_DIAGNOSTICS_CONFIG_CREATE_INFO_NV;
@@ -234,9 +260,14 @@ void VulkanDevice::createLogicalDevice()
 		VK_DEVICE_DIAGNOSTICS_CONFIG_ENABLE_AUTOMATIC_CHECKPOINTS_BIT_NV | 
 		VK_DEVICE_DIAGNOSTICS_CONFIG_ENABLE_SHADER_ERROR_REPORTING_BIT_NV;*/
 
+	VkPhysicalDeviceVulkan12Features vk12Features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	vk12Features.timelineSemaphore = VK_TRUE;
+	vk12Features.drawIndirectCount = VK_TRUE;
+
 	VkPhysicalDeviceVulkan13Features vk13Features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES };
 	vk13Features.dynamicRendering = VK_TRUE;
 	vk13Features.synchronization2 = VK_TRUE;
+	vk13Features.pNext = &vk12Features;
 	//vk13Features.pNext = &aftermathInfo;
 
 
@@ -265,6 +296,51 @@ void VulkanDevice::createLogicalDevice()
 	//vkCmdSetCheckpointNV = (PFN_vkCmdSetCheckpointNV)vkGetDeviceProcAddr(logicalDevice, "vkCmdSetCheckpointNV");
 }
 
+void VulkanDevice::createPipelineCache()
+{
+	std::vector<char> initialData = vks::tools::readBinaryFile(pipelineCachePath.c_str());
+
+	// drivers are supposed to reject foreign data themselves, but not all of them do it gracefully
+	VkPipelineCacheHeaderVersionOne header{};
+	bool compatible = initialData.size() >= sizeof(header);
+	if (compatible)
+	{
+		memcpy(&header, initialData.data(), sizeof(header));
+		compatible = header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& header.vendorID == properties.vendorID
+			&& header.deviceID == properties.deviceID
+			&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCI{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	pipelineCacheCI.initialDataSize = compatible ? initialData.size() : 0;
+	pipelineCacheCI.pInitialData = compatible ? initialData.data() : nullptr;
+	VK_CHECK_RESULT(vkCreatePipelineCache(logicalDevice, &pipelineCacheCI, nullptr, &pipelineCache));
+}
+
+void VulkanDevice::savePipelineCache()
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+	{
+		return;
+	}
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(pipelineCachePath).parent_path(), ec);
+	std::string tempPath = pipelineCachePath + ".tmp";
+	{
+		std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+		os.write(data.data(), dataSize);
+	}
+	std::filesystem::rename(tempPath, pipelineCachePath, ec);
+}
+
 bool VulkanDevice::isDeviceSuitable(VkPhysicalDevice physicalDevice, VkSurfaceKHR vkSurface)
 {
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice, surface);
@@ -278,10 +354,13 @@ bool VulkanDevice::isDeviceSuitable(VkPhysicalDevice physicalDevice, VkSurfaceKH
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
 
-	VkPhysicalDeviceFeatures supportedFeatures;
-	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	VkPhysicalDeviceVulkan12Features supported12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	VkPhysicalDeviceFeatures2 supportedFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	supportedFeatures.pNext = &supported12;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
 
-	return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy && supportedFeatures.fillModeNonSolid;
+	return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.features.samplerAnisotropy && supportedFeatures.features.fillModeNonSolid
+		&& supportedFeatures.features.multiDrawIndirect && supportedFeatures.features.drawIndirectFirstInstance && supported12.drawIndirectCount;
 }
 
 bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice)
@@ -13,6 +13,9 @@
 
 #include <vulkan/vulkan.h>
 
+#include "VulkanMemoryAllocator.h"
+#include "DeletionQueue.h"
+
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -102,6 +105,8 @@ public:
 
 	VkDevice logicalDevice;
 	VkPhysicalDevice physicalDevice;
+	VkPhysicalDeviceProperties properties{};
+	VkPhysicalDeviceFeatures enabledFeatures{};
 	VkQueue graphicsQueue;
 	VkQueue computeQueue;
 	VkQueue transferQueue;
@@ -112,6 +117,15 @@ public:
 	VkCommandPool computeCommandPool;
 	VkCommandPool transferCommandPool;
 
+	// shared by every vkCreate*Pipelines call, internally synchronized so pipelines can be built from any thread
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+	// every buffer and image allocation is sub-allocated from here, internally synchronized
+	std::unique_ptr<VulkanMemoryAllocator> allocator;
+
+	// objects replaced while frames may still use them, collected by the frame loop once those frames completed
+	std::unique_ptr<DeletionQueue> deletionQueue;
+
 	// ----- Vulkan Command Pool / Buffer -----
 	static VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamilyIndex, VkCommandPoolCreateFlags createFlags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
@@ -137,6 +151,11 @@ private:
 		"VK_LAYER_KHRONOS_validation"
 	};
 
+	// ----- Vulkan Pipeline Cache -----
+	void createPipelineCache();
+	void savePipelineCache();
+	const std::string pipelineCachePath = "shaders/cache/pipeline_cache.bin";
+
 	// ----- Vulkan Surface -----
 	void createSurface(GLFWwindow* window);
 
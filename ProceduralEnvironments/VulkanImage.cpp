@@ -3,26 +3,22 @@
 
 #include "VulkanBuffer.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 /**
 * Creates Image, Imageview, and memory.
 * Must have a complete imageInfo and viewInfo (createInfo) before calling this function.
 */
-void vks::Image::createImage(VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryPropertyFlags properties, bool createSampler)
+void vks::Image::createImage(VulkanDevice& vulkanDevice, VkMemoryPropertyFlags properties, bool createSampler)
 {
-	this->device = device;
+	this->device = vulkanDevice.logicalDevice;
+	this->allocator = vulkanDevice.allocator.get();
 	VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &image));
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = vks::tools::findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
-
-	VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &memory));
-
-	vkBindImageMemory(device, image, memory, 0);
+	// allocates and binds
+	allocation = allocator->allocateForImage(image, properties, imageInfo.tiling);
 
 	viewInfo.image = image;
 	VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &imageView));
@@ -35,114 +31,118 @@ void vks::Image::createImage(VkDevice device, VkPhysicalDevice physicalDevice, V
 		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerCI.anisotropyEnable = VK_FALSE;
+		// anisotropy only pays off when there are smaller levels to pick from
+		samplerCI.anisotropyEnable = imageInfo.mipLevels > 1 ? VK_TRUE : VK_FALSE;
+		samplerCI.maxAnisotropy = imageInfo.mipLevels > 1 ? getMaxAnisotropy(vulkanDevice) : 1.0f;
 		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
 		samplerCI.unnormalizedCoordinates = VK_FALSE;
 		samplerCI.compareEnable = VK_FALSE;
 		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerCI.minLod = 0.0f;
-		samplerCI.maxLod = 0.0f;
+		samplerCI.maxLod = static_cast<float>(imageInfo.mipLevels);
 
 		VK_CHECK_RESULT(vkCreateSampler(device, &samplerCI, nullptr, &sampler));
 	}
 }
 
-void vks::Image::loadFromFile(VulkanDevice& device, std::string path, VkFormat format, bool createSampler)
+void vks::Image::createTexture2D(VulkanDevice& device, uint32_t width, uint32_t height, VkFormat format, bool createSampler, uint32_t mipLevels)
 {
-	int width, height, channels;
-	
-	unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
-
-	if (!data)
+	const bool blitMips = mipLevels == 0;
+	if (blitMips)
 	{
-		throw std::runtime_error("Failed to load image: " + path);
+		mipLevels = supportsMipBlits(device, format) ? getMipLevelCount(width, height) : 1;
 	}
 
-	this->device = device.logicalDevice;
-
 	imageInfo.format = format;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	imageInfo.extent.width = static_cast<uint32_t>(width);
-	imageInfo.extent.height = static_cast<uint32_t>(height);
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (blitMips && mipLevels > 1)
+	{
+		// each level is blitted from the one above it
+		imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 
 	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	viewInfo.format = format;
-	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+	this->createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, createSampler);
+}
+
+void vks::Image::createTexture2DArray(VulkanDevice& device, uint32_t width, uint32_t height, uint32_t layers, VkFormat format, uint32_t mipLevels, bool createSampler)
+{
+	imageInfo.format = format;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = layers;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, layers };
+
+	this->createImage(device, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, createSampler);
+}
+
+UploadManager::Token vks::Image::loadFromFile(VulkanDevice& device, UploadManager& uploads, std::string path, VkFormat format, bool createSampler)
+{
+	int width, height, channels;
+	
+	unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+	if (!data)
+	{
+		throw std::runtime_error("Failed to load image: " + path);
+	}
 
-	this->createImage(device.logicalDevice, device.physicalDevice, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, createSampler);
+	this->createTexture2D(device, static_cast<uint32_t>(width), static_cast<uint32_t>(height), format, createSampler, 0);
 
 	uint32_t bytesPerPixel = getBytesPerPixel(format);
 	VkDeviceSize imageSize = static_cast<uint32_t>(width) * static_cast<uint32_t>(height) * bytesPerPixel;
 
-	vks::Buffer stagingBuffer;
-	stagingBuffer.create(
-		device.logicalDevice,
-		device.physicalDevice,
-		imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
-	stagingBuffer.map();
-	stagingBuffer.copyTo(data, imageSize);
-	stagingBuffer.unmap();
-
+	// the pixels are copied into staging memory right away, the copy itself runs with the next batch
+	UploadManager::Staging staging = uploads.reserve(imageSize);
+	memcpy(staging.mapped, data, static_cast<size_t>(imageSize));
 	stbi_image_free(data);
 
-	VkCommandBuffer cmd = vks::tools::beginSingleTimeCommands(device.logicalDevice, device.graphicsCommandPool);
-
-	vks::tools::insertImageMemoryBarrier(
-		cmd,
-		this->image,
-		0,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-	);
+	return upload(uploads, staging, 0);
+}
 
+UploadManager::Token vks::Image::upload(UploadManager& uploads, const UploadManager::Staging& staging, VkDeviceSize stagingOffset)
+{
 	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
+	region.bufferOffset = stagingOffset;
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	region.imageSubresource.mipLevel = 0;
 	region.imageSubresource.baseArrayLayer = 0;
 	region.imageSubresource.layerCount = 1;
 	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+	region.imageExtent = imageInfo.extent;
 
-	vkCmdCopyBufferToImage(
-		cmd,
-		stagingBuffer.buffer,
+	return uploads.uploadImage(
 		this->image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
-	);
-
-	vks::tools::insertImageMemoryBarrier(
-		cmd,
-		this->image,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		staging,
+		{ region },
+		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, imageInfo.mipLevels, 0, 1 },
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, // Or whatever stage will read it
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+		true
 	);
-
-	vks::tools::endSingleTimeCommands(cmd, device.logicalDevice, device.graphicsQueue, device.graphicsCommandPool);
-	stagingBuffer.destroy();
 }
 
 uint32_t vks::Image::getBytesPerPixel(VkFormat format)
@@ -186,6 +186,25 @@ uint32_t vks::Image::getBytesPerPixel(VkFormat format)
 	}
 }
 
+uint32_t vks::Image::getMipLevelCount(uint32_t width, uint32_t height)
+{
+	return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+bool vks::Image::supportsMipBlits(VulkanDevice& device, VkFormat format)
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &formatProperties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (formatProperties.optimalTilingFeatures & required) == required;
+}
+
+float vks::Image::getMaxAnisotropy(VulkanDevice& device)
+{
+	return std::min(16.0f, device.properties.limits.maxSamplerAnisotropy);
+}
+
 void vks::Image::destroy()
 {
 	if (image != VK_NULL_HANDLE)
@@ -198,10 +217,10 @@ void vks::Image::destroy()
 		vkDestroyImageView(device, imageView, nullptr);
 		imageView = VK_NULL_HANDLE;
 	}
-	if (memory != VK_NULL_HANDLE)
+	if (allocation.isValid())
 	{
-		vkFreeMemory(device, memory, nullptr);
-		memory = VK_NULL_HANDLE;
+		allocator->free(allocation);
+		allocation = {};
 	}
 	if (sampler != VK_NULL_HANDLE)
 	{
@@ -210,70 +229,19 @@ void vks::Image::destroy()
 	}
 }
 
-void vks::Image::transferHdrDataToImage(VulkanDevice& device, float* pixelData, VkImage image, uint32_t width, uint32_t height, VkPipelineStageFlagBits imageDstStage)
+UploadManager::Token vks::Image::transferHdrDataToImage(UploadManager& uploads, float* pixelData, VkImage image, uint32_t width, uint32_t height, VkPipelineStageFlags2 imageDstStage)
 {
 	// VK_FORMAT_R32G32B32A32_SFLOAT 
-	VkDeviceSize imageSize = width * height * 4 * sizeof(float);
+	VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4 * sizeof(float);
 
-	vks::Buffer stagingBuffer;
-	stagingBuffer.create(
-		device.logicalDevice,
-		device.physicalDevice,
-		imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
-	stagingBuffer.map();
-	stagingBuffer.copyTo(pixelData, imageSize);
-	stagingBuffer.unmap();
-	
-	VkCommandBuffer cmd = vks::tools::beginSingleTimeCommands(device.logicalDevice, device.graphicsCommandPool);
-	
-	vks::tools::insertImageMemoryBarrier(
-		cmd,
-		image,
-		0,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-	);
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = { width, height, 1 };
-
-	vkCmdCopyBufferToImage(
-		cmd,
-		stagingBuffer.buffer,
-		image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
-	);
-
-	vks::tools::insertImageMemoryBarrier(
-		cmd,
+	return uploads.uploadImage(
 		image,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_ACCESS_SHADER_READ_BIT,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		pixelData,
+		imageSize,
+		width,
+		height,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
 		imageDstStage,
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+		VK_ACCESS_2_SHADER_SAMPLED_READ_BIT
 	);
-
-	vks::tools::endSingleTimeCommands(cmd, device.logicalDevice, device.graphicsQueue, device.graphicsCommandPool);
-
-	stagingBuffer.destroy();
 }
@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.h>
 
 #include "VulkanDevice.h"
+#include "UploadManager.h"
 #include <string>
 #include <stb_image.h>
 
@@ -14,21 +15,46 @@ namespace vks
 		VkDevice device;
 		VkImage image = VK_NULL_HANDLE;
 		VkImageView imageView = VK_NULL_HANDLE;
-		VkDeviceMemory memory = VK_NULL_HANDLE;
 		VkSampler sampler = VK_NULL_HANDLE;
 
 		VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
 
 		VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
 
-		void createImage(VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryPropertyFlags properties, bool createSampler = true);
+		VulkanMemoryAllocator* allocator = nullptr;
+		VulkanMemoryAllocator::Allocation allocation;
 
-		void loadFromFile(VulkanDevice& device, std::string path, VkFormat format, bool createSampler = true);
+		void createImage(VulkanDevice& device, VkMemoryPropertyFlags properties, bool createSampler = true);
+
+		/**
+		* @brief Sampled 2D image, ready to be the destination of an upload.
+		* mipLevels of 0 requests a full chain to be blitted by upload(), which falls back to a single level when the format
+		* can't be blitted with linear filtering. Any other count expects every level to be uploaded.
+		*/
+		void createTexture2D(VulkanDevice& device, uint32_t width, uint32_t height, VkFormat format, bool createSampler = true, uint32_t mipLevels = 1);
+
+		/** @brief Sampled 2D array image with an explicit level count, every level of every layer is expected to be uploaded */
+		void createTexture2DArray(VulkanDevice& device, uint32_t width, uint32_t height, uint32_t layers, VkFormat format, uint32_t mipLevels, bool createSampler = true);
+
+		/** @brief Create the image and queue its pixel upload with a full mip chain, the returned token signals when it is readable */
+		UploadManager::Token loadFromFile(VulkanDevice& device, UploadManager& uploads, std::string path, VkFormat format, bool createSampler = true);
+
+		/** @brief Upload level 0 from staging and blit the remaining levels of a texture created by createTexture2D */
+		UploadManager::Token upload(UploadManager& uploads, const UploadManager::Staging& staging, VkDeviceSize stagingOffset);
 
 		void destroy();
 
-		static void transferHdrDataToImage(VulkanDevice& device, float* pixelData, VkImage image, uint32_t width, uint32_t height, VkPipelineStageFlagBits imageDstStage);
+		static UploadManager::Token transferHdrDataToImage(UploadManager& uploads, float* pixelData, VkImage image, uint32_t width, uint32_t height, VkPipelineStageFlags2 imageDstStage);
 
 		static uint32_t getBytesPerPixel(VkFormat format);
+
+		/** @brief Levels of a full chain down to 1x1 */
+		static uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+		/** @brief Whether a full chain of format can be generated with linear blits */
+		static bool supportsMipBlits(VulkanDevice& device, VkFormat format);
+
+		/** @brief Device anisotropy limit, capped to 16x */
+		static float getMaxAnisotropy(VulkanDevice& device);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,578 @@
+#include "VulkanMemoryAllocator.h"
+
+#include "VulkanTools.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <iomanip>
+
+namespace
+{
+	constexpr uint32_t NONE = UINT32_MAX;
+}
+
+/**
+* TLSF bookkeeping for one block. Free ranges are binned by a first level (power of two)
+* and a second level (SL_COUNT linear steps inside it); two bitmaps find a suitable bin in O(1).
+* Neighbouring free ranges are merged on free, so free ranges are never physically adjacent.
+*/
+class VulkanMemoryAllocator::BlockMetadata
+{
+public:
+	explicit BlockMetadata(VkDeviceSize size)
+		: size(size)
+	{
+		for (auto& row : freeHeads) row.fill(NONE);
+		uint32_t chunk = newChunk();
+		chunks[chunk].offset = 0;
+		chunks[chunk].size = size;
+		insertFree(chunk);
+	}
+
+	bool allocate(VkDeviceSize allocationSize, VkDeviceSize alignment, VkDeviceSize& offset, uint32_t& chunkIndex)
+	{
+		// searching with the worst case padding guarantees the first candidate fits
+		uint32_t chunk = findFree(allocationSize + (alignment > 1 ? alignment - 1 : 0));
+		if (chunk == NONE)
+		{
+			return false;
+		}
+		removeFree(chunk);
+
+		VkDeviceSize alignedOffset = vks::tools::alignUp(chunks[chunk].offset, alignment);
+		VkDeviceSize padding = alignedOffset - chunks[chunk].offset;
+		if (padding > 0)
+		{
+			// the physical predecessor is in use (free neighbours are always merged), so the padding stays a separate free range
+			uint32_t front = newChunk();
+			chunks[front].offset = chunks[chunk].offset;
+			chunks[front].size = padding;
+			chunks[front].prevPhysical = chunks[chunk].prevPhysical;
+			chunks[front].nextPhysical = chunk;
+			if (chunks[front].prevPhysical != NONE) chunks[chunks[front].prevPhysical].nextPhysical = front;
+			chunks[chunk].prevPhysical = front;
+			chunks[chunk].offset = alignedOffset;
+			chunks[chunk].size -= padding;
+			insertFree(front);
+		}
+
+		VkDeviceSize remainder = chunks[chunk].size - allocationSize;
+		if (remainder >= MIN_SPLIT_SIZE)
+		{
+			uint32_t back = newChunk();
+			chunks[back].offset = chunks[chunk].offset + allocationSize;
+			chunks[back].size = remainder;
+			chunks[back].prevPhysical = chunk;
+			chunks[back].nextPhysical = chunks[chunk].nextPhysical;
+			if (chunks[back].nextPhysical != NONE) chunks[chunks[back].nextPhysical].prevPhysical = back;
+			chunks[chunk].nextPhysical = back;
+			chunks[chunk].size = allocationSize;
+			insertFree(back);
+		}
+
+		chunks[chunk].free = false;
+		used += chunks[chunk].size;
+		offset = chunks[chunk].offset;
+		chunkIndex = chunk;
+		return true;
+	}
+
+	void free(uint32_t chunk)
+	{
+		used -= chunks[chunk].size;
+		chunks[chunk].free = true;
+
+		uint32_t next = chunks[chunk].nextPhysical;
+		if (next != NONE && chunks[next].free)
+		{
+			removeFree(next);
+			chunks[chunk].size += chunks[next].size;
+			chunks[chunk].nextPhysical = chunks[next].nextPhysical;
+			if (chunks[chunk].nextPhysical != NONE) chunks[chunks[chunk].nextPhysical].prevPhysical = chunk;
+			releaseChunk(next);
+		}
+
+		uint32_t prev = chunks[chunk].prevPhysical;
+		if (prev != NONE && chunks[prev].free)
+		{
+			removeFree(prev);
+			chunks[prev].size += chunks[chunk].size;
+			chunks[prev].nextPhysical = chunks[chunk].nextPhysical;
+			if (chunks[prev].nextPhysical != NONE) chunks[chunks[prev].nextPhysical].prevPhysical = prev;
+			releaseChunk(chunk);
+			chunk = prev;
+		}
+
+		insertFree(chunk);
+	}
+
+	VkDeviceSize getUsed() const { return used; }
+	bool isEmpty() const { return used == 0; }
+
+private:
+	static constexpr uint32_t SL_LOG2 = 5;
+	static constexpr uint32_t SL_COUNT = 1u << SL_LOG2;
+	static constexpr uint32_t FL_COUNT = 48;
+	static constexpr VkDeviceSize MIN_SPLIT_SIZE = 64;
+
+	struct Chunk {
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint32_t prevPhysical = NONE;
+		uint32_t nextPhysical = NONE;
+		uint32_t prevFree = NONE;
+		uint32_t nextFree = NONE;
+		bool free = true;
+	};
+
+	static void mapping(VkDeviceSize value, uint32_t& fl, uint32_t& sl)
+	{
+		if (value < SL_COUNT)
+		{
+			fl = 0;
+			sl = static_cast<uint32_t>(value);
+			return;
+		}
+		uint32_t log2 = static_cast<uint32_t>(std::bit_width(value)) - 1;
+		fl = log2 - SL_LOG2 + 1;
+		sl = static_cast<uint32_t>(value >> (log2 - SL_LOG2)) - SL_COUNT;
+	}
+
+	uint32_t findFree(VkDeviceSize value) const
+	{
+		// round up to the next bin so every range in the found bin is large enough
+		if (value >= SL_COUNT)
+		{
+			uint32_t log2 = static_cast<uint32_t>(std::bit_width(value)) - 1;
+			value += (VkDeviceSize(1) << (log2 - SL_LOG2)) - 1;
+		}
+
+		uint32_t fl, sl;
+		mapping(value, fl, sl);
+		if (fl >= FL_COUNT)
+		{
+			return NONE;
+		}
+
+		uint32_t slMap = secondLevelBitmap[fl] & (~0u << sl);
+		if (slMap == 0)
+		{
+			uint64_t flMap = fl + 1 < 64 ? firstLevelBitmap & (~0ull << (fl + 1)) : 0;
+			if (flMap == 0)
+			{
+				return NONE;
+			}
+			fl = static_cast<uint32_t>(std::countr_zero(flMap));
+			slMap = secondLevelBitmap[fl];
+		}
+		sl = static_cast<uint32_t>(std::countr_zero(slMap));
+		return freeHeads[fl][sl];
+	}
+
+	void insertFree(uint32_t chunk)
+	{
+		uint32_t fl, sl;
+		mapping(chunks[chunk].size, fl, sl);
+		chunks[chunk].free = true;
+		chunks[chunk].prevFree = NONE;
+		chunks[chunk].nextFree = freeHeads[fl][sl];
+		if (freeHeads[fl][sl] != NONE) chunks[freeHeads[fl][sl]].prevFree = chunk;
+		freeHeads[fl][sl] = chunk;
+		firstLevelBitmap |= 1ull << fl;
+		secondLevelBitmap[fl] |= 1u << sl;
+	}
+
+	void removeFree(uint32_t chunk)
+	{
+		uint32_t fl, sl;
+		mapping(chunks[chunk].size, fl, sl);
+		if (chunks[chunk].prevFree != NONE) chunks[chunks[chunk].prevFree].nextFree = chunks[chunk].nextFree;
+		else freeHeads[fl][sl] = chunks[chunk].nextFree;
+		if (chunks[chunk].nextFree != NONE) chunks[chunks[chunk].nextFree].prevFree = chunks[chunk].prevFree;
+
+		if (freeHeads[fl][sl] == NONE)
+		{
+			secondLevelBitmap[fl] &= ~(1u << sl);
+			if (secondLevelBitmap[fl] == 0)
+			{
+				firstLevelBitmap &= ~(1ull << fl);
+			}
+		}
+		chunks[chunk].prevFree = NONE;
+		chunks[chunk].nextFree = NONE;
+	}
+
+	uint32_t newChunk()
+	{
+		if (!unusedChunks.empty())
+		{
+			uint32_t chunk = unusedChunks.back();
+			unusedChunks.pop_back();
+			chunks[chunk] = Chunk{};
+			return chunk;
+		}
+		chunks.emplace_back();
+		return static_cast<uint32_t>(chunks.size() - 1);
+	}
+
+	void releaseChunk(uint32_t chunk)
+	{
+		unusedChunks.push_back(chunk);
+	}
+
+	VkDeviceSize size;
+	VkDeviceSize used = 0;
+	std::vector<Chunk> chunks;
+	std::vector<uint32_t> unusedChunks;
+	uint64_t firstLevelBitmap = 0;
+	std::array<uint32_t, FL_COUNT> secondLevelBitmap{};
+	std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> freeHeads;
+};
+
+VulkanMemoryAllocator::VulkanMemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize preferredBlockSize)
+	: device(device)
+	, preferredBlockSize(preferredBlockSize)
+{
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+}
+
+VulkanMemoryAllocator::~VulkanMemoryAllocator()
+{
+	if (stats.allocationCount > 0)
+	{
+		std::cerr << "Warning: " << stats.allocationCount << " device memory allocations were never freed" << "\n";
+	}
+
+	for (AllocationRecord& record : records)
+	{
+		if (record.live && record.dedicatedMemory != VK_NULL_HANDLE)
+		{
+			freeDeviceMemory(record.dedicatedMemory, record.dedicatedMapped);
+		}
+	}
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool->blocks)
+		{
+			freeDeviceMemory(block->memory, block->mapped);
+		}
+	}
+}
+
+VulkanMemoryAllocator::Allocation VulkanMemoryAllocator::allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties)
+{
+	VkBufferMemoryRequirementsInfo2 requirementsInfo{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2 };
+	requirementsInfo.buffer = buffer;
+	VkMemoryDedicatedRequirements dedicatedRequirements{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+	VkMemoryRequirements2 requirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+	requirements.pNext = &dedicatedRequirements;
+	vkGetBufferMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+	VkMemoryDedicatedAllocateInfo dedicatedInfo{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
+	dedicatedInfo.buffer = buffer;
+
+	bool preferDedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	Allocation allocation = allocate(requirements.memoryRequirements, properties, false, preferDedicated, &dedicatedInfo);
+
+	AllocationInfo info = getInfo(allocation);
+	VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, info.memory, info.offset));
+	return allocation;
+}
+
+VulkanMemoryAllocator::Allocation VulkanMemoryAllocator::allocateForImage(VkImage image, VkMemoryPropertyFlags properties, VkImageTiling tiling)
+{
+	VkImageMemoryRequirementsInfo2 requirementsInfo{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2 };
+	requirementsInfo.image = image;
+	VkMemoryDedicatedRequirements dedicatedRequirements{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS };
+	VkMemoryRequirements2 requirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+	requirements.pNext = &dedicatedRequirements;
+	vkGetImageMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+	VkMemoryDedicatedAllocateInfo dedicatedInfo{ VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
+	dedicatedInfo.image = image;
+
+	bool preferDedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	Allocation allocation = allocate(requirements.memoryRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL, preferDedicated, &dedicatedInfo);
+
+	AllocationInfo info = getInfo(allocation);
+	VK_CHECK_RESULT(vkBindImageMemory(device, image, info.memory, info.offset));
+	return allocation;
+}
+
+void VulkanMemoryAllocator::free(Allocation allocation)
+{
+	if (!allocation.isValid())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	AllocationRecord& record = records[allocation.index];
+	if (!record.live || record.generation != allocation.generation)
+	{
+		std::cerr << "Warning: freeing a stale device memory allocation" << "\n";
+		return;
+	}
+
+	if (record.dedicatedMemory != VK_NULL_HANDLE)
+	{
+		freeDeviceMemory(record.dedicatedMemory, record.dedicatedMapped);
+		stats.dedicatedCount--;
+		stats.dedicatedBytes -= record.size;
+	}
+	else
+	{
+		record.block->metadata->free(record.chunk);
+
+		// keep one empty block per pool around so a free/allocate pattern does not hit the driver every time
+		if (record.block->metadata->isEmpty())
+		{
+			auto& blocks = record.pool->blocks;
+			auto emptyBlocks = std::count_if(blocks.begin(), blocks.end(), [](const auto& block) { return block->metadata->isEmpty(); });
+			if (emptyBlocks > 1)
+			{
+				freeDeviceMemory(record.block->memory, record.block->mapped);
+				stats.blockCount--;
+				stats.blockBytes -= record.block->size;
+				blocks.erase(std::find_if(blocks.begin(), blocks.end(), [&](const auto& block) { return block.get() == record.block; }));
+			}
+		}
+	}
+
+	stats.allocationCount--;
+	record.live = false;
+	record.generation++;
+	record.block = nullptr;
+	record.pool = nullptr;
+	record.dedicatedMemory = VK_NULL_HANDLE;
+	record.dedicatedMapped = nullptr;
+	freeRecords.push_back(allocation.index);
+}
+
+VulkanMemoryAllocator::AllocationInfo VulkanMemoryAllocator::getInfo(Allocation allocation) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const AllocationRecord& record = resolve(allocation);
+
+	AllocationInfo info;
+	info.offset = record.offset;
+	info.size = record.size;
+	info.memoryTypeIndex = record.memoryTypeIndex;
+	info.dedicated = record.dedicatedMemory != VK_NULL_HANDLE;
+	info.memory = info.dedicated ? record.dedicatedMemory : record.block->memory;
+	void* base = info.dedicated ? record.dedicatedMapped : record.block->mapped;
+	info.mapped = base ? static_cast<char*>(base) + (info.dedicated ? 0 : record.offset) : nullptr;
+	return info;
+}
+
+VulkanMemoryAllocator::Stats VulkanMemoryAllocator::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Stats result = stats;
+	result.blockUsedBytes = 0;
+	for (const auto& pool : pools)
+	{
+		for (const auto& block : pool->blocks)
+		{
+			result.blockUsedBytes += block->metadata->getUsed();
+		}
+	}
+	return result;
+}
+
+void VulkanMemoryAllocator::printStats(std::ostream& os) const
+{
+	Stats current = getStats();
+	const double mib = 1.0 / (1024.0 * 1024.0);
+	os << std::fixed << std::setprecision(1)
+		<< "Device memory: " << current.allocationCount << " allocations in " << current.deviceMemoryCount << " VkDeviceMemory objects ("
+		<< current.blockCount << " blocks, " << current.dedicatedCount << " dedicated), "
+		<< "blocks " << current.blockUsedBytes * mib << "/" << current.blockBytes * mib << " MiB used, "
+		<< "dedicated " << current.dedicatedBytes * mib << " MiB, "
+		<< current.totalDriverAllocations << " vkAllocateMemory calls so far" << "\n";
+	os << std::defaultfloat;
+}
+
+VulkanMemoryAllocator::Allocation VulkanMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+	bool optimalTiling, bool preferDedicated, const VkMemoryDedicatedAllocateInfo* dedicatedInfo)
+{
+	uint32_t memoryTypeIndex = NONE;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((requirements.memoryTypeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			memoryTypeIndex = i;
+			break;
+		}
+	}
+	if (memoryTypeIndex == NONE)
+	{
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	// only sub-allocations are rounded, dedicated memory is allocated with exactly requirements.size as VkMemoryDedicatedAllocateInfo requires
+	VkDeviceSize blockAllocationSize = requirements.size;
+	VkDeviceSize alignment = requirements.alignment;
+	VkMemoryPropertyFlags typeFlags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+	if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		// flush/invalidate ranges in a block must not spill into a neighbouring allocation
+		alignment = std::max(alignment, nonCoherentAtomSize);
+		blockAllocationSize = vks::tools::alignUp(blockAllocationSize, nonCoherentAtomSize);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t recordIndex = newRecord();
+	AllocationRecord& record = records[recordIndex];
+	record.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+	bool dedicated = preferDedicated || blockAllocationSize > blockSize / 2;
+
+	if (!dedicated)
+	{
+		Pool& pool = getPool(memoryTypeIndex, optimalTiling);
+		bool placed = false;
+		for (auto& block : pool.blocks)
+		{
+			if (block->metadata->allocate(blockAllocationSize, alignment, record.offset, record.chunk))
+			{
+				record.block = block.get();
+				placed = true;
+				break;
+			}
+		}
+
+		if (!placed)
+		{
+			auto block = std::make_unique<Block>();
+			block->size = blockSize;
+			if (allocateDeviceMemory(blockSize, memoryTypeIndex, nullptr, block->memory, block->mapped))
+			{
+				block->metadata = std::make_unique<BlockMetadata>(blockSize);
+				block->metadata->allocate(blockAllocationSize, alignment, record.offset, record.chunk);
+				record.block = block.get();
+				pool.blocks.push_back(std::move(block));
+				stats.blockCount++;
+				stats.blockBytes += blockSize;
+				placed = true;
+			}
+		}
+
+		if (placed)
+		{
+			record.pool = &pool;
+			record.size = blockAllocationSize;
+		}
+		else
+		{
+			// no room for another block, a dedicated allocation of just this size may still fit
+			dedicated = true;
+		}
+	}
+
+	if (dedicated)
+	{
+		if (!allocateDeviceMemory(requirements.size, memoryTypeIndex, dedicatedInfo, record.dedicatedMemory, record.dedicatedMapped))
+		{
+			freeRecords.push_back(recordIndex);
+			throw std::runtime_error("Out of device memory");
+		}
+		record.offset = 0;
+		record.size = requirements.size;
+		stats.dedicatedCount++;
+		stats.dedicatedBytes += requirements.size;
+	}
+
+	record.live = true;
+	stats.allocationCount++;
+	return Allocation{ recordIndex, record.generation };
+}
+
+bool VulkanMemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const void* pNext, VkDeviceMemory& memory, void*& mapped)
+{
+	VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.pNext = pNext;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		memory = VK_NULL_HANDLE;
+		return false;
+	}
+	stats.deviceMemoryCount++;
+	stats.totalDriverAllocations++;
+
+	mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		// persistently mapped, Buffer::map() just hands out an offset into it
+		VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+	}
+	return true;
+}
+
+void VulkanMemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, void* mapped)
+{
+	if (mapped)
+	{
+		vkUnmapMemory(device, memory);
+	}
+	vkFreeMemory(device, memory, nullptr);
+	stats.deviceMemoryCount--;
+}
+
+VulkanMemoryAllocator::Pool& VulkanMemoryAllocator::getPool(uint32_t memoryTypeIndex, bool optimalTiling)
+{
+	for (auto& pool : pools)
+	{
+		if (pool->memoryTypeIndex == memoryTypeIndex && pool->optimalTiling == optimalTiling)
+		{
+			return *pool;
+		}
+	}
+	auto pool = std::make_unique<Pool>();
+	pool->memoryTypeIndex = memoryTypeIndex;
+	pool->optimalTiling = optimalTiling;
+	pools.push_back(std::move(pool));
+	return *pools.back();
+}
+
+VkDeviceSize VulkanMemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) const
+{
+	// small heaps (e.g. 256 MiB BAR) get proportionally smaller blocks
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	return std::min(preferredBlockSize, vks::tools::alignUp(heapSize / 8, 1024 * 1024));
+}
+
+uint32_t VulkanMemoryAllocator::newRecord()
+{
+	if (!freeRecords.empty())
+	{
+		uint32_t index = freeRecords.back();
+		freeRecords.pop_back();
+		return index;
+	}
+	records.emplace_back();
+	return static_cast<uint32_t>(records.size() - 1);
+}
+
+const VulkanMemoryAllocator::AllocationRecord& VulkanMemoryAllocator::resolve(Allocation allocation) const
+{
+	if (!allocation.isValid() || allocation.index >= records.size())
+	{
+		throw std::runtime_error("Invalid device memory allocation handle");
+	}
+	const AllocationRecord& record = records[allocation.index];
+	if (!record.live || record.generation != allocation.generation)
+	{
+		throw std::runtime_error("Stale device memory allocation handle");
+	}
+	return record;
+}
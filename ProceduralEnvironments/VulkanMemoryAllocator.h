@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+* Sub-allocating device memory allocator.
+* Memory is taken from the driver in large blocks per memory type and split with a TLSF
+* (two-level segregated fit) allocator, giving O(1) allocation and free with low fragmentation.
+* Resources that are large, or that the driver prefers to be dedicated, get their own VkDeviceMemory.
+* Host visible blocks are mapped once for their whole lifetime.
+*
+* Callers hold an Allocation handle rather than memory/offset pairs; the handle resolves through the
+* allocator, so allocations can be relocated later (defragmentation) without invalidating it.
+*/
+class VulkanMemoryAllocator
+{
+public:
+	/** Handle to an allocation. Generation guards against use after free */
+	struct Allocation {
+		uint32_t index = UINT32_MAX;
+		uint32_t generation = 0;
+
+		bool isValid() const { return index != UINT32_MAX; }
+	};
+
+	struct AllocationInfo {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr; // already offset, nullptr if the memory is not host visible
+		uint32_t memoryTypeIndex = 0;
+		bool dedicated = false;
+	};
+
+	struct Stats {
+		uint32_t deviceMemoryCount = 0; // live VkDeviceMemory objects, blocks and dedicated
+		uint32_t blockCount = 0;
+		uint32_t dedicatedCount = 0;
+		uint32_t allocationCount = 0;
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize blockUsedBytes = 0;
+		VkDeviceSize dedicatedBytes = 0;
+		uint64_t totalDriverAllocations = 0; // vkAllocateMemory calls over the allocator's lifetime
+	};
+
+	VulkanMemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize preferredBlockSize = 64ull * 1024 * 1024);
+	~VulkanMemoryAllocator();
+
+	VulkanMemoryAllocator(const VulkanMemoryAllocator&) = delete;
+	VulkanMemoryAllocator& operator=(const VulkanMemoryAllocator&) = delete;
+
+	/** @brief Allocate and bind memory for a buffer */
+	Allocation allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+
+	/** @brief Allocate and bind memory for an image */
+	Allocation allocateForImage(VkImage image, VkMemoryPropertyFlags properties, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL);
+
+	/** @brief Return an allocation. The bound resource must already be destroyed or no longer in use */
+	void free(Allocation allocation);
+
+	AllocationInfo getInfo(Allocation allocation) const;
+
+	Stats getStats() const;
+	void printStats(std::ostream& os) const;
+
+private:
+	class BlockMetadata;
+
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		std::unique_ptr<BlockMetadata> metadata;
+	};
+
+	// linear (buffers, linear images) and optimal images never share a block,
+	// which sidesteps bufferImageGranularity entirely
+	struct Pool {
+		uint32_t memoryTypeIndex = 0;
+		bool optimalTiling = false;
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	struct AllocationRecord {
+		uint32_t generation = 0;
+		bool live = false;
+		Pool* pool = nullptr;
+		Block* block = nullptr;
+		uint32_t chunk = 0;
+		VkDeviceMemory dedicatedMemory = VK_NULL_HANDLE;
+		void* dedicatedMapped = nullptr;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeIndex = 0;
+	};
+
+	Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalTiling,
+		bool preferDedicated, const VkMemoryDedicatedAllocateInfo* dedicatedInfo);
+	bool allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const void* pNext, VkDeviceMemory& memory, void*& mapped);
+	void freeDeviceMemory(VkDeviceMemory memory, void* mapped);
+	Pool& getPool(uint32_t memoryTypeIndex, bool optimalTiling);
+	VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+	uint32_t newRecord();
+	const AllocationRecord& resolve(Allocation allocation) const;
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize nonCoherentAtomSize;
+	VkDeviceSize preferredBlockSize;
+
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<Pool>> pools;
+	std::vector<AllocationRecord> records;
+	std::vector<uint32_t> freeRecords;
+	Stats stats;
+};
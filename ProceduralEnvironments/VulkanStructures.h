@@ -115,6 +115,117 @@ struct TerrainParams
 	alignas(4) float heightScale;
 	alignas(4) uint32_t gridResolution;
 	alignas(4) float normalsStrength;
+	alignas(4) uint32_t patchSize; // quads per side of a culling patch, set by Terrain
+};
+
+/** Fragment push constant of the terrain, mirrors TerrainMaterialParams in shader.slang */
+struct TerrainMaterialParams
+{
+	alignas(4) float heightScale;
+	alignas(4) float tiling;
+	alignas(4) float sandHeight;
+	alignas(4) float snowHeight;
+	alignas(4) float rockSlope;
+	alignas(4) float transitionWidth;
+	alignas(4) float blendDepth;
+	alignas(4) float horizonShadowing; // 0 to 1, how much of the horizon map shadows and occlusion is applied
+};
+
+/** Counters of the two culling phases, mirrors the counter layout in occlusion_cull.slang */
+struct OcclusionStats
+{
+	uint32_t earlyVisible;   // drawn first, visible in the previous frame's pyramid
+	uint32_t lateCandidates; // occluded in the previous frame's pyramid, tested again after the first phase
+	uint32_t lateVisible;    // candidates drawn in the second phase
+	uint32_t frustumCulled;
+};
+
+/** Controls of DynamicResolution, edited by the UI */
+struct DynamicResolutionSettings
+{
+	static constexpr float MIN_SCALE = 0.25f; // lowest scale per axis the controller and the UI may pick
+
+	bool enabled = true;
+	float targetGpuMs = 12.0f; // the controller holds the frame's GPU time at or just below this
+	float minScale = 0.5f;     // per axis, of the swapchain extent
+	float maxScale = 1.0f;
+	float fixedScale = 1.0f;   // used while the controller is off
+	float sharpness = 0.25f;   // of the upscale, 0 is plain bilinear
+};
+
+/** Controls of PropScatter, edited by the UI. Changing a scatter field places the props again */
+struct PropSettings
+{
+	bool enabled = true;
+	float treeDensity = 0.08f;  // chance of a tree per scatter cell where the ground suits it
+	float rockDensity = 0.03f;  // chance of a rock per scatter cell on steep slopes, a fraction of it elsewhere
+	float treeSize = 0.35f;     // world height of an average tree
+	float rockSize = 0.1f;      // world radius of an average rock
+	float lodDistance = 8.0f;   // the coarse meshes are drawn beyond it
+	float drawDistance = 40.0f; // nothing is drawn beyond it
+};
+
+/** What PropScatter placed and drew, in the order of its indirect draws after the placed count */
+struct PropStats
+{
+	uint32_t placed;    // appended by the scatter pass, may exceed the instance buffer
+	uint32_t treesNear;
+	uint32_t treesFar;
+	uint32_t rocksNear;
+	uint32_t rocksFar;
+};
+
+/** Controls of TerrainErosion, edited by the UI. Changes apply to the next iteration */
+struct ErosionSettings
+{
+	bool running = false;
+	float budgetMs = 4.0f;                // GPU time per frame the iterations may take
+	uint32_t maxIterationsPerFrame = 64;
+	float timeStep = 0.02f;
+	float rainRate = 0.02f;               // texels of water per unit of time
+	float evaporation = 0.015f;           // fraction of the water per unit of time
+	float sedimentCapacity = 0.5f;
+	float erosionRate = 0.05f;            // fraction of the missing capacity dissolved per iteration
+	float depositionRate = 0.05f;         // fraction of the excess sediment deposited per iteration
+	float talusSlope = 0.8f;              // height difference per texel above which material slides
+	float thermalRate = 0.1f;             // fraction of the excess slid per iteration
+	float minTilt = 0.05f;
+};
+
+/** What TerrainErosion did recently */
+struct ErosionStats
+{
+	uint32_t iterationsPerFrame;
+	float iterationsPerSecond; // recorded iterations over the last full second of wall time
+	float msPerIteration;      // smoothed GPU time
+	uint32_t totalIterations;  // since the last reset
+};
+
+/** Controls of DrainageAnalysis, edited by the UI. Changes analyze the current heightmap again */
+struct DrainageSettings
+{
+	bool fillDepressions = true;
+	float riverThreshold = 0.002f; // upstream area, as a fraction of the terrain, above which a cell is a river
+};
+
+/** What one DrainageAnalysis run found and how long its phases took on the CPU */
+struct DrainageStats
+{
+	uint32_t size;            // cells per side
+	uint32_t filledCells;     // raised by depression filling
+	uint32_t sinkCells;       // inner cells without a downhill neighbour, none once filled
+	uint32_t riverCells;
+	uint32_t maxAccumulation; // cells draining through the largest outlet
+	float fillMs;
+	float directionMs;
+	float accumulationMs;     // includes the donor counts
+	float totalMs;            // includes the river mask
+};
+
+struct PassRecordTiming
+{
+	const char* name = nullptr;
+	float milliseconds = 0.0f; // CPU time spent recording the pass
 };
 
 struct UIPacket
@@ -126,6 +237,50 @@ struct UIPacket
 	HeightMapParams& heightMapConfig;
 	bool& heightMapConfigChanged;
 	TerrainParams& terrainParams;
+	TerrainMaterialParams& terrainMaterialParams;
+	float& terrainGpuMs;
+	bool& textureBenchmarkRequested;
+	bool textureBenchmarkRunning;
+	int& frameMode; // Engine::FrameMode
+	bool& vsync;
+	bool& framePacing;
+	uint32_t framesInFlight;
+	float frameGpuMs;
+	float presentIntervalMs;
+	float presentJitterMs;
+	float pacingSleepMs;
+	const std::vector<PassRecordTiming>& passRecordTimings;
+	bool& reuseSceneCommands;
+	bool sceneCommandsReused;
+	bool& renderGraphDumpRequested;
+	uint32_t renderGraphBarrierBatches;
+	bool& reverseZ;
+	bool& terrainDepthPrePass;
+	float terrainDepthGpuMs;
+	float skyboxGpuMs;
+	bool pipelineStatistics; // whether the invocation counts below are measured
+	uint64_t terrainFragmentInvocations;
+	uint64_t skyboxFragmentInvocations;
+	bool& occlusionCulling;
+	uint32_t terrainPatchCount;
+	OcclusionStats occlusionStats;
+	DynamicResolutionSettings& dynamicResolution;
+	float renderScale;
+	VkExtent2D renderExtent;
+	PropSettings& props;
+	PropStats propStats;
+	uint32_t propCapacity;
+	float propsGpuMs;
+	ErosionSettings& erosion;
+	bool& erosionApplyRequested;
+	ErosionStats erosionStats;
+	float erosionGpuMs;
+	DrainageSettings& drainage;
+	DrainageStats drainageStats; // of the latest analysis, size 0 before the first
+	bool drainageRunning;
+	bool& drainageBenchmarkRequested;
+	bool drainageBenchmarkRunning;
+	const std::vector<DrainageStats>& drainageBenchmark;
 	//NormalMapParams& normalMapConfig;
 	//VertexShaderPushConstant& vertShaderPushConstant;
 };
@@ -15,7 +15,7 @@ VulkanSwapchain::~VulkanSwapchain()
 	cleanup();
 }
 
-void VulkanSwapchain::create(uint32_t& width, uint32_t& height, bool vsync, bool fullscreen)
+void VulkanSwapchain::create(uint32_t& width, uint32_t& height, uint32_t desiredImageCount, bool vsync, bool fullscreen, Retired* retired)
 {
 	assert(physicalDevice);
 	assert(device);
@@ -100,7 +100,7 @@ void VulkanSwapchain::create(uint32_t& width, uint32_t& height, bool vsync, bool
 	}
 
 	// Determine the number of images
-	uint32_t desiredNumberOfSwapchainImages = surfCaps.minImageCount + 1;
+	uint32_t desiredNumberOfSwapchainImages = desiredImageCount == 0 ? surfCaps.minImageCount + 1 : std::max(desiredImageCount, surfCaps.minImageCount);
 	if ((surfCaps.maxImageCount > 0) && (desiredNumberOfSwapchainImages > surfCaps.maxImageCount))
 	{
 		desiredNumberOfSwapchainImages = surfCaps.maxImageCount;
@@ -172,11 +172,15 @@ void VulkanSwapchain::create(uint32_t& width, uint32_t& height, bool vsync, bool
 	// If an existing swap chain is re-created, destroy the old swap chain and the resources owned by the application (image views, images are owned by the swap chain)
 	if (oldSwapchain != VK_NULL_HANDLE)
 	{
-		for (auto i = 0; i < images.size(); i++)
+		Retired old{ oldSwapchain, imageViews };
+		if (retired != nullptr)
 		{
-			vkDestroyImageView(device, imageViews[i], nullptr);
+			*retired = std::move(old);
+		}
+		else
+		{
+			destroyRetired(old);
 		}
-		vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
 	}
 
 	VK_CHECK_RESULT(vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr));
@@ -211,6 +215,19 @@ void VulkanSwapchain::create(uint32_t& width, uint32_t& height, bool vsync, bool
 	}
 }
 
+void VulkanSwapchain::destroyRetired(Retired& retired)
+{
+	for (VkImageView imageView : retired.imageViews)
+	{
+		vkDestroyImageView(device, imageView, nullptr);
+	}
+	if (retired.swapChain != VK_NULL_HANDLE)
+	{
+		vkDestroySwapchainKHR(device, retired.swapChain, nullptr);
+	}
+	retired = {};
+}
+
 VkResult VulkanSwapchain::acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t& imageIndex)
 {
 	// By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
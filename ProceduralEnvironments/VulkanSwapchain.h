@@ -41,10 +41,23 @@ public:
 	uint32_t queueNodeIndex{ UINT32_MAX };
 	uint32_t imageCount{ 0 };
 
+	/** @brief Objects of a swapchain replaced by create(), frames in flight may still reference them */
+	struct Retired
+	{
+		VkSwapchainKHR swapChain{ VK_NULL_HANDLE };
+		std::vector<VkImageView> imageViews{};
+	};
+
 	VulkanSwapchain(VkInstance instance, VkSurfaceKHR surface, VkDevice device, VkPhysicalDevice physicalDevice, GLFWwindow* window);
 	~VulkanSwapchain();
 
-	void create(uint32_t& width, uint32_t& height, bool vsync = false, bool fullscreen = false);
+	/**
+	* @brief desiredImageCount of 0 picks one more than the surface minimum, any other count is clamped to the surface limits.
+	* A previous swapchain is passed as oldSwapchain. Without retired it is destroyed right away, which requires the
+	* device to be idle, otherwise its objects are handed over to be destroyed by destroyRetired() once they are unused.
+	*/
+	void create(uint32_t& width, uint32_t& height, uint32_t desiredImageCount = 0, bool vsync = false, bool fullscreen = false, Retired* retired = nullptr);
+	void destroyRetired(Retired& retired);
 	VkResult acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t& imageIndex);
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE);
 	void cleanup();
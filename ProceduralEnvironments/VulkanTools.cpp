@@ -477,7 +477,32 @@ namespace vks
 			return buffer;
 		}
 
-		VkShaderModule loadSlangShader(VkDevice device, slang::IGlobalSession* slangGlobalSession, const char* shaderPath, const char* entryPointName)
+		std::vector<char> readBinaryFile(const char* filePath)
+		{
+			std::ifstream is(filePath, std::ios::binary | std::ios::in | std::ios::ate);
+			if (!is.is_open())
+			{
+				return {};
+			}
+			std::vector<char> data(static_cast<size_t>(is.tellg()));
+			is.seekg(0, std::ios::beg);
+			is.read(data.data(), data.size());
+			return data;
+		}
+
+		uint64_t fnv1a64(const void* data, size_t size, uint64_t seed)
+		{
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			uint64_t hash = seed;
+			for (size_t i = 0; i < size; i++)
+			{
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+
+		std::vector<uint32_t> compileSlangShader(slang::IGlobalSession* slangGlobalSession, const char* shaderPath, const char* entryPointName, const char* profile)
 		{
 
 			//std::string shaderString = readFile(shaderPath);
@@ -486,7 +511,7 @@ namespace vks
 
 			slang::TargetDesc targetDesc = {};
 			targetDesc.format = SLANG_SPIRV;
-			targetDesc.profile = slangGlobalSession->findProfile("spirv_1_5");
+			targetDesc.profile = slangGlobalSession->findProfile(profile);
 
 			sessionDesc.targets = &targetDesc;
 			sessionDesc.targetCount = 1;
@@ -527,7 +552,7 @@ namespace vks
 				diagnoseIfNeeded(diagnosticsBlob);
 				if (!slangModule)
 				{
-					return VK_NULL_HANDLE;
+					return {};
 				}
 			}
 
@@ -539,7 +564,7 @@ namespace vks
 				if (!entryPoint)
 				{
 					std::cout << "Error getting entry point" << std::endl;
-					return VK_NULL_HANDLE;
+					return {};
 				}
 			}
 
@@ -561,7 +586,7 @@ namespace vks
 				diagnoseIfNeeded(diagnosticsBlob);
 				if (SLANG_FAILED(result))
 				{
-					return VK_NULL_HANDLE;
+					return {};
 				}
 			}
 
@@ -576,7 +601,7 @@ namespace vks
 				diagnoseIfNeeded(diagnosticsBlob);
 				if (SLANG_FAILED(result))
 				{
-					return VK_NULL_HANDLE;
+					return {};
 				}
 			}
 
@@ -593,16 +618,31 @@ namespace vks
 				diagnoseIfNeeded(diagnosticsBlob);
 				if (SLANG_FAILED(result))
 				{
-					return VK_NULL_HANDLE;
+					return {};
 				}
 			}
 
+			const uint32_t* code = static_cast<const uint32_t*>(spirvCode->getBufferPointer());
+			return std::vector<uint32_t>(code, code + spirvCode->getBufferSize() / sizeof(uint32_t));
+		}
+
+		VkShaderModule loadSlangShader(VkDevice device, slang::IGlobalSession* slangGlobalSession, const char* shaderPath, const char* entryPointName)
+		{
+			std::vector<uint32_t> spirvCode = compileSlangShader(slangGlobalSession, shaderPath, entryPointName);
+			if (spirvCode.empty())
+			{
+				return VK_NULL_HANDLE;
+			}
+			return createShaderModule(device, spirvCode);
+		}
+
+		VkShaderModule createShaderModule(VkDevice device, const std::vector<uint32_t>& spirvCode)
+		{
 			VkShaderModule shaderModule;
 			VkShaderModuleCreateInfo moduleCreateInfo{};
 			moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-			moduleCreateInfo.codeSize = spirvCode->getBufferSize();
-			moduleCreateInfo.pCode = static_cast<const uint32_t*>(spirvCode->getBufferPointer());
-
+			moduleCreateInfo.codeSize = spirvCode.size() * sizeof(uint32_t);
+			moduleCreateInfo.pCode = spirvCode.data();
 
 			VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &shaderModule));
 
@@ -667,14 +707,9 @@ namespace vks
 			return !f.fail();
 		}
 
-		uint32_t alignedSize(uint32_t value, uint32_t alignment)
-		{
-			return (value + alignment - 1) & ~(alignment - 1);
-		}
-
-		VkDeviceSize alignedVkSize(VkDeviceSize value, VkDeviceSize alignment)
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
 		{
-			return (value + alignment - 1) & ~(alignment - 1);
+			return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
 		}
 	}
 }
\ No newline at end of file
@@ -140,8 +140,18 @@ namespace vks
 		// reads file into string
 		std::string readFile(const char* filePath);
 
+		// reads file into a byte vector, empty if the file can't be opened
+		std::vector<char> readBinaryFile(const char* filePath);
+
+		// 64 bit FNV-1a hash, pass a previous result as seed to chain several inputs
+		uint64_t fnv1a64(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+		// Compile a slang entry point to SPIR-V, returns empty code on failure
+		std::vector<uint32_t> compileSlangShader(slang::IGlobalSession* slangGlobalSession, const char* shaderPath, const char* entryPointName, const char* profile = "spirv_1_5");
+
 		// Load slang shader
 		VkShaderModule loadSlangShader(VkDevice device, slang::IGlobalSession* slangGlobalSession, const char* shaderPath, const char* entryPointName);
+		VkShaderModule createShaderModule(VkDevice device, const std::vector<uint32_t>& spirvCode);
 		void diagnoseIfNeeded(slang::IBlob* diagnosticsBlob);
 
 
@@ -151,7 +161,7 @@ namespace vks
 		/** @brief Checks if a file exists */
 		bool fileExists(const std::string& filename);
 
-		uint32_t alignedSize(uint32_t value, uint32_t alignment);
-		VkDeviceSize alignedVkSize(VkDeviceSize value, VkDeviceSize alignment);
+		// rounds value up to a multiple of alignment, which need not be a power of two. 0 and 1 leave it unchanged
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment);
 	}
 }
\ No newline at end of file
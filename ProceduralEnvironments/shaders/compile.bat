@@ -1,9 +1,4 @@
-slangc shader.slang -target spirv -entry vertexMain -o vert.spirv
-slangc shader.slang -target spirv -entry fragmentMain -o frag.spirv
-slangc heightmap.slang -target spirv -entry main -o heightmap.spirv
-slangc height_normals.slang -target spirv -entry main -o heightmap_normals.spirv
-slangc GenerateTerrainMesh.slang -target spirv -entry main -o GenerateTerrainMesh.spirv
-slangc hdrToCube.slang -target spirv -entry main -o hdrToCube.spirv
-slangc skybox.slang -target spirv -entry vertexMain -o skybox_vert.spirv
-slangc skybox.slang -target spirv -entry fragmentMain -o skybox_frag.spirv
+REM Slang shaders are compiled at runtime through ShaderCache (shaders/cache/).
+REM Only the glsl skybox vertex shader still needs an offline build.
+glslangValidator -V skybox_glsl.vert -o skybox_glsl_vert.spirv
 pause
\ No newline at end of file